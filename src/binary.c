@@ -0,0 +1,277 @@
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+
+#include "binary.h"
+
+/* name of each command by its code (BINARY_) and the
+ * header that holds its topic, null if it has none */
+static const struct {
+    char *name;
+    char *topic;
+} commands[] = {
+    { NULL,         NULL },
+    { "SEND",       "topic" },
+    { "SUBSCRIBE",  "destination" },
+    { "DISCONNECT", NULL },
+    { "MESSAGE",    "destination" },
+    { "RECEIPT",    NULL },
+    { "ERROR",      NULL },
+    { "TOPIC",      "destination" }
+};
+
+#define NCOMMANDS (sizeof(commands) / sizeof(commands[0]))
+
+/* number of bytes of the value as a varint */
+static size_t varint_length(size_t val) {
+    size_t n = 1;
+
+    for (; val >= 0x80; val >>= 7) n++;
+    return n;
+}
+
+/* writes the value as a varint to dst and
+ * returns the position after it */
+static char *put_varint(char *dst, size_t val) {
+    for (; val >= 0x80; val >>= 7)
+        *dst++ = (char) (val & 0x7f) | 0x80;
+    *dst++ = (char) val;
+
+    return dst;
+}
+
+/* reads a varint at pos, which is moved past it. returns
+ * 0 on success and -1 if it does not end before end or
+ * does not fit into a size_t */
+static int get_varint(char **pos, const char *end, size_t *val) {
+    unsigned char c;
+    int shift;
+
+    *val = 0;
+    for (shift = 0; *pos < end; shift += 7) {
+        c = (unsigned char) *(*pos)++;
+
+        if (shift >= 64 || (shift == 63 && (c & 0x7f) > 1)) return -1;
+        *val |= (size_t) (c & 0x7f) << shift;
+
+        if ((c & 0x80) == 0) return 0;
+    }
+
+    return -1;
+}
+
+/* reads a varint at pos like get_varint, but first
+ * terminates the string before it, if term is set.
+ * the null byte takes the place of the first byte of
+ * the varint, which is why it is read first */
+static int get_field(char **pos, const char *end, size_t *val,
+        char **term) {
+    if (get_varint(pos, end, val) != 0) return -1;
+
+    if (*term != NULL) {
+        **term = '\0';
+        *term = NULL;
+    }
+
+    return 0;
+}
+
+/* reads a string at pos, which is moved past it. it is
+ * terminated by the next call to get_field, as the byte
+ * after it belongs to the next field. returns 0 on success
+ * and -1 if it does not end before end or contains a
+ * null byte */
+static int get_string(char **pos, const char *end, char **str,
+        char **term) {
+    size_t len;
+
+    if (get_field(pos, end, &len, term) != 0) return -1;
+    if (len > (size_t) (end - *pos)) return -1;
+    if (memchr(*pos, '\0', len) != NULL) return -1;
+
+    *str = *pos;
+    *pos += len;
+    *term = *pos;
+    return 0;
+}
+
+/* see header for doc */
+size_t binary_frame_length(const char *raw, size_t len) {
+    char *pos = (char *) raw;
+    size_t n;
+
+    if (get_varint(&pos, raw + len, &n) != 0) {
+        // the length may still be arriving
+        if (len < BINARY_MAX_VARINT && (len == 0 ||
+                (raw[len - 1] & 0x80) != 0))
+            return 0;
+        return SIZE_MAX;
+    }
+
+    if (n > SIZE_MAX - (pos - raw)) return SIZE_MAX;
+    return n + (pos - raw);
+}
+
+/* see header for doc */
+int binary_parse(char *raw, size_t len, struct stomp_command *cmd) {
+    char *pos = raw, *end, *term = NULL;
+    struct stomp_header *header;
+    size_t n, nheaders, i;
+    int code, hdr, parsed, required = -1, expect_content = 0;
+
+    cmd->headers = cmd->parsed;
+    cmd->nheaders = 0;
+    cmd->content = NULL;
+    cmd->contentlen = 0;
+    cmd->topicid = 0;
+    memset(cmd->known, 0, sizeof(cmd->known));
+
+    // the frame ends with the null byte
+    if (len == 0 || raw[len - 1] != '\0') return STOMP_INVALID_CONTENT;
+    end = raw + len - 1;
+
+    if (get_varint(&pos, end, &n) != 0 || n != (size_t) (end - pos) + 1)
+        return STOMP_INVALID_CONTENT;
+    if (pos == end) return STOMP_UNKNOWN_COMMAND;
+
+    // only what clients send
+    code = (unsigned char) *pos++;
+    switch (code) {
+        case BINARY_SEND:
+            required = STOMP_HDR_TOPIC;
+            expect_content = 1;
+            break;
+        case BINARY_SUBSCRIBE:
+            required = STOMP_HDR_DESTINATION;
+            break;
+        case BINARY_DISCONNECT:
+            break;
+        default:
+            return STOMP_UNKNOWN_COMMAND;
+    }
+
+    if (get_varint(&pos, end, &n) != 0) return STOMP_INVALID_HEADER;
+    if (commands[code].topic == NULL && n != 0)
+        return STOMP_UNEXPECTED_HEADER;
+    cmd->topicid = n;
+
+    // a topic by name is the first header
+    if (commands[code].topic != NULL && cmd->topicid == 0) {
+        header = &cmd->parsed[cmd->nheaders++];
+        if (get_string(&pos, end, &header->val, &term) != 0 ||
+                term == header->val)
+            return STOMP_INVALID_HEADER;
+        header->key = commands[code].topic;
+        cmd->known[required] = cmd->nheaders;
+    }
+
+    if (get_field(&pos, end, &nheaders, &term) != 0)
+        return STOMP_INVALID_HEADER;
+    if (nheaders > STOMP_MAX_HEADERS - cmd->nheaders)
+        return STOMP_TOO_MANY_HEADERS;
+
+    for (i = 0; i < nheaders; i++) {
+        header = &cmd->parsed[cmd->nheaders++];
+        if (get_string(&pos, end, &header->key, &term) != 0 ||
+                term == header->key ||
+                get_string(&pos, end, &header->val, &term) != 0)
+            return STOMP_INVALID_HEADER;
+
+        // the first one counts, as with the text framing
+        hdr = stomp_header_known(header->key);
+        if (hdr != -1 && cmd->known[hdr] == 0)
+            cmd->known[hdr] = cmd->nheaders;
+    }
+
+    if (get_field(&pos, end, &cmd->contentlen, &term) != 0)
+        return STOMP_INVALID_CONTENT;
+    if (cmd->contentlen != (size_t) (end - pos))
+        return STOMP_INVALID_CONTENT;
+    if (cmd->contentlen > 0) cmd->content = pos;
+
+    parsed = stomp_check_command(cmd, required, expect_content);
+    if (parsed != 0) return parsed;
+
+    cmd->name = commands[code].name;
+    return 0;
+}
+
+/* see header for doc */
+int binary_create(const struct stomp_command *cmd, char **str, size_t *len) {
+    size_t i, n, nheaders = 0, namelen = 0, body, contentlen;
+    unsigned long topicid = 0;
+    char *dst, *name = NULL;
+    const char *topic;
+    int code;
+
+    for (code = 1; code < (int) NCOMMANDS; code++)
+        if (strcmp(commands[code].name, cmd->name) == 0) break;
+    if (code == (int) NCOMMANDS) return STOMP_UNKNOWN_COMMAND;
+
+    topic = commands[code].topic;
+    if (topic != NULL) {
+        topicid = cmd->topicid;
+
+        for (i = 0; i < cmd->nheaders && name == NULL; i++)
+            if (strcmp(cmd->headers[i].key, topic) == 0)
+                name = cmd->headers[i].val;
+
+        // the name is left out once there is an id
+        if (topicid != 0 && code != BINARY_TOPIC) name = NULL;
+        else if (name == NULL) return STOMP_MISSING_HEADER;
+        else namelen = strlen(name);
+    }
+
+    // length calc, the topic is not repeated as a header
+    body = 1 + varint_length(topicid);
+    if (name != NULL) body += varint_length(namelen) + namelen;
+    for (i = 0; i < cmd->nheaders; i++) {
+        if (topic != NULL && strcmp(cmd->headers[i].key, topic) == 0)
+            continue;
+        n = strlen(cmd->headers[i].key);
+        body += varint_length(n) + n;
+        n = strlen(cmd->headers[i].val);
+        body += varint_length(n) + n;
+        nheaders++;
+    }
+    contentlen = cmd->content != NULL ? cmd->contentlen : 0;
+    body += varint_length(nheaders);
+    body += varint_length(contentlen) + contentlen;
+    body += 1; // \0
+
+    n = varint_length(body) + body;
+    *str = malloc(n);
+    assert(*str != NULL);
+
+    // frame construction, dst always points to
+    // the beginning of the next field
+    dst = put_varint(*str, body);
+    *dst++ = (char) code;
+    dst = put_varint(dst, topicid);
+    if (name != NULL) {
+        dst = put_varint(dst, namelen);
+        memcpy(dst, name, namelen);
+        dst += namelen;
+    }
+    dst = put_varint(dst, nheaders);
+    for (i = 0; i < cmd->nheaders; i++) {
+        const char *key = cmd->headers[i].key, *val = cmd->headers[i].val;
+        if (topic != NULL && strcmp(key, topic) == 0) continue;
+        dst = put_varint(dst, strlen(key));
+        memcpy(dst, key, strlen(key));
+        dst += strlen(key);
+        dst = put_varint(dst, strlen(val));
+        memcpy(dst, val, strlen(val));
+        dst += strlen(val);
+    }
+    dst = put_varint(dst, contentlen);
+    if (contentlen > 0) {
+        memcpy(dst, cmd->content, contentlen);
+        dst += contentlen;
+    }
+    *dst++ = '\0';
+
+    assert((size_t) (dst - *str) == n);
+    *len = n;
+    return 0;
+}
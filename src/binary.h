@@ -0,0 +1,80 @@
+#ifndef BINARY_HEADER
+#define BINARY_HEADER
+
+/* binary.h
+ *
+ * compact binary framing for clients that ask for it in
+ * CONNECT (see accept-framing in stomp.h). the commands
+ * and their headers are the same as with the text framing,
+ * only the encoding differs. a frame consists of:
+ *
+ *   varint  number of bytes that follow, including
+ *           the null byte at the end
+ *   byte    command (BINARY_)
+ *   varint  id of the topic, 0 if the command names
+ *           it instead or has no topic
+ *   string  name of the topic, only if the command has
+ *           a topic and its id is 0, and always for TOPIC
+ *   varint  number of headers
+ *   string  key and string value of each header
+ *   varint  number of bytes of content
+ *   bytes   content
+ *   byte    null byte
+ *
+ * a varint is an unsigned number in groups of 7 bits, the
+ * least significant first, with the high bit set in all
+ * bytes but the last. a string is a varint for its length
+ * followed by that many bytes. as everything has a length,
+ * nothing is escaped.
+ *
+ * the topic is what the topic header of a SEND and the
+ * destination header of the other commands would be. the
+ * broker assigns each topic an id and answers a client
+ * that has named a topic with TOPIC, which has both. from
+ * then on, the client may use the id instead of the name.
+ * a subscriber gets TOPIC before the first MESSAGE, which
+ * only has the id.
+ *
+ * a frame of length 0, i.e. a single null byte, is a
+ * heart-beat (see stomp.h) and has no command.
+ */
+
+#include <stdlib.h>
+
+#include "stomp.h"
+
+/* commands sent by the client */
+#define BINARY_SEND       1
+#define BINARY_SUBSCRIBE  2
+#define BINARY_DISCONNECT 3
+
+/* commands sent by the broker */
+#define BINARY_MESSAGE    4
+#define BINARY_RECEIPT    5
+#define BINARY_ERROR      6
+#define BINARY_TOPIC      7
+
+/* maximum number of bytes of a varint */
+#define BINARY_MAX_VARINT 10
+
+/* returns the number of bytes of the frame that starts
+ * with the len bytes at raw, including the length in
+ * front of it, or 0 if not all of the length is there
+ * yet. a length that is out of range returns SIZE_MAX */
+size_t binary_frame_length(const char *raw, size_t len);
+
+/* parses a frame of len bytes sent to the broker (SEND,
+ * SUBSCRIBE or DISCONNECT) into the stomp_command struct,
+ * just like parse_frame. the strings are terminated in
+ * place, the command points into the frame. a topic that
+ * is named is the first header, one that is referred to
+ * by its id is stored in topicid. returns 0 on success
+ * or any of the STOMP_ error codes */
+int binary_parse(char *raw, size_t len, struct stomp_command *cmd);
+
+/* encodes the command like create_command. commands with
+ * a topic use topicid unless it is 0, in which case the
+ * topic is taken from its header. TOPIC needs both */
+int binary_create(const struct stomp_command *cmd, char **str, size_t *len);
+
+#endif
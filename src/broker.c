@@ -8,6 +8,7 @@
 
 #include "topic.h"
 #include "broker.h"
+#include "compress.h"
 
 void * handle_client(void *handler_thread_params) {
     struct handler_params *params = handler_thread_params;
@@ -21,20 +22,86 @@ void * handle_client(void *handler_thread_params) {
 
     client_init(client);
     client->sockfd = sockfd;
+    client->attached = 1;
 
     do {
         ret = main_loop(ctx, client, &connected, sub);
     } while (ret == WORKER_CONTINUE);
 
-    socket_terminate_client(client);
+    release_client(client, sub, connected);
 
     return 0;
 }
 
+void release_client(struct client *client, struct subscriber *sub,
+                    int connected) {
+
+    // the gc may free a subscriber as soon as its
+    // client is terminated, so ask before that
+    int subscribed = connected && sub->subscribed;
+
+    socket_terminate_client(client);
+
+    // found and freed by the gc once
+    // nothing is delivered to it anymore
+    if (subscribed) return;
+
+    client_destroy(client);
+    free(client);
+
+    // the name is only set with CONNECT
+    if (connected) free(sub->name);
+    free(sub);
+}
+
+/* whether a receipt has been held back by confirm_send */
+static int receipt_pending(struct client *client) {
+    return client->receipt != NULL && client->receipt[0] != '\0';
+}
+
+/* sends the receipt that has been held back, if any */
+static int flush_receipt(struct client *client) {
+    if (!receipt_pending(client)) return 0;
+    return send_receipt(client, client->receipt);
+}
+
+/* confirms a SEND. if the client has already sent more
+ * commands, the receipt is held back: a later one confirms
+ * this one as well, so a publisher that pipelines gets a
+ * single receipt for everything it has sent in one go. the
+ * last one is sent once no more commands are buffered. a
+ * receipt that cannot be sent is held back as well, it is
+ * tried again after the next command */
+static int confirm_send(struct client *client, char *receipt) {
+    int ret = 0;
+    size_t len = strlen(receipt) + 1;
+
+    if (!socket_command_buffered(client)) {
+        ret = send_receipt(client, receipt);
+        if (ret == 0) return 0;
+    }
+
+    if (len > client->receiptcap) {
+        free(client->receipt);
+        client->receipt = malloc(len);
+        assert(client->receipt != NULL);
+        client->receiptcap = len;
+    }
+    memcpy(client->receipt, receipt, len);
+
+    return ret;
+}
+
 int send_error(struct client *client, char *reason) {
     struct stomp_command respc;
     struct stomp_header header;
 
+    memset(&respc, 0, sizeof(respc));
+
+    // what has succeeded before comes first
+    if (flush_receipt(client) != 0)
+        fprintf(stderr, "Failed to send receipt\n");
+
     respc.name = "ERROR";
     header.key = "message";
     header.val = reason;
@@ -42,77 +109,251 @@ int send_error(struct client *client, char *reason) {
     respc.nheaders = 1;
     respc.content = NULL;
 
-    return socket_send_command(client, respc);
+    return socket_send_command(client, &respc);
 }
 
-int send_receipt(struct client *client) {
+int send_receipt(struct client *client, char *id) {
+    int ret;
     struct stomp_command respc;
+    struct stomp_header header;
 
+    memset(&respc, 0, sizeof(respc));
     respc.name = "RECEIPT";
-    respc.headers = NULL;
-    respc.nheaders = 0;
+    header.key = "receipt-id";
+    header.val = id;
+    respc.headers = &header;
+    respc.nheaders = id != NULL;
     respc.content = NULL;
 
-    return socket_send_command(client, respc);
+    ret = socket_send_command(client, &respc);
+
+    // any receipt confirms those before it as well, the
+    // one held back is kept until one has been sent
+    if (ret == 0 && client->receipt != NULL) client->receipt[0] = '\0';
+
+    return ret;
 }
 
-int send_connected(struct client *client) {
+int send_connected(struct client *client, int features) {
     struct stomp_command respc;
+    struct stomp_header headers[3];
+    char heartbeat[48];
 
+    memset(&respc, 0, sizeof(respc));
     respc.name = "CONNECTED";
-    respc.headers = NULL;
+    respc.headers = headers;
     respc.nheaders = 0;
     respc.content = NULL;
 
-    return socket_send_command(client, respc);
+    if (features & BROKER_BINARY) {
+        headers[respc.nheaders].key = "framing";
+        headers[respc.nheaders++].val = "binary";
+    }
+    if (features & BROKER_DEFLATE) {
+        headers[respc.nheaders].key = "encoding";
+        headers[respc.nheaders++].val = COMPRESS_DEFLATE;
+    }
+    if (features & BROKER_HEARTBEAT) {
+        // the broker can send them just as often as check for them
+        sprintf(heartbeat, "%ld,%ld", client->heartbeat, client->heartbeat);
+        headers[respc.nheaders].key = "heart-beat";
+        headers[respc.nheaders++].val = heartbeat;
+    }
+
+    return socket_send_command(client, &respc);
+}
+
+/* parses a number of milliseconds of the heart-beat header
+ * up to the delimiter. returns -1 if it is not one */
+static long heartbeat_millis(const char *val, char delim, char **end) {
+    long ms;
+
+    if (*val < '0' || *val > '9') return -1;
+
+    errno = 0;
+    ms = strtol(val, end, 10);
+    if (errno != 0 || **end != delim) return -1;
+
+    return ms;
+}
+
+/* agrees with the client on the heart-beats (see stomp.h)
+ * from the value of its heart-beat header, which may be null.
+ * a header that cannot be parsed is taken for none. returns
+ * whether heart-beats are to be offered in CONNECTED */
+static int negotiate_heartbeat(struct client *client, const char *val) {
+    long cx, cy;
+    char *end;
+
+    client->hbsend = 0;
+    client->hbrecv = 0;
+    if (val == NULL || client->heartbeat <= 0) return 0;
+
+    cx = heartbeat_millis(val, ',', &end);
+    if (cx < 0) return 0;
+    cy = heartbeat_millis(end + 1, '\0', &end);
+    if (cy < 0) return 0;
+
+    // neither side is asked for more than it can do
+    if (cy > 0) client->hbsend = cy > client->heartbeat ? cy
+                                                        : client->heartbeat;
+    if (cx > 0) client->hbrecv = cx > client->heartbeat ? cx
+                                                        : client->heartbeat;
+
+    return cx > 0 || cy > 0;
+}
+
+/* whether the value is one of those in the
+ * comma-separated list, which may be null */
+static int header_lists(const char *list, const char *val) {
+    size_t len, vallen = strlen(val);
+
+    while (list != NULL && *list != '\0') {
+        len = strcspn(list, ",");
+        if (len == vallen && strncmp(list, val, len) == 0) return 1;
+        list += len + (list[len] == ',');
+    }
+
+    return 0;
+}
+
+/* tells a client with the binary framing which id the
+ * topic it has named has, so it may use that from now on */
+static int announce_topic(struct client *client, char *name,
+        unsigned long id) {
+    struct stomp_command respc;
+    struct stomp_header header;
+
+    memset(&respc, 0, sizeof(respc));
+    respc.name = "TOPIC";
+    header.key = "destination";
+    header.val = name;
+    respc.headers = &header;
+    respc.nheaders = 1;
+    respc.content = NULL;
+    respc.topicid = id;
+
+    return socket_send_command(client, &respc);
+}
+
+/* returns the topic of a command, which a client with
+ * the binary framing may refer to by its id. null if
+ * there is no topic with that id */
+static char *command_topic(struct broker_context *ctx,
+        struct stomp_command *cmd, int hdr) {
+    if (cmd->topicid != 0) return topic_name(ctx->topics, cmd->topicid);
+    return stomp_header_get(cmd, hdr);
+}
+
+/* whether the header of a SEND is passed on to the
+ * subscribers. those the broker sets itself or that
+ * are meant for it are not */
+static int forwarded_header(const char *key) {
+    switch (stomp_header_known(key)) {
+        case STOMP_HDR_TOPIC:
+        case STOMP_HDR_DESTINATION:
+        case STOMP_HDR_CONTENT_LENGTH:
+        case STOMP_HDR_RECEIPT:
+        case STOMP_HDR_MESSAGE_ID:
+        case STOMP_HDR_BATCH:
+            return 0;
+        default:
+            return 1;
+    }
 }
 
 int process_send(struct broker_context *ctx,
                  struct client *client,
-                 struct stomp_command cmd) {
+                 struct stomp_command *cmd) {
     int ret;
+    size_t i, nheaders = 0, nbodies;
+    struct stomp_header headers[STOMP_MAX_HEADERS];
+    struct iovec bodies[STOMP_MAX_BATCH];
 
-    struct list *topics = ctx->topics;
-    struct list *messages = ctx->messages;
+    struct topic_table *topics = ctx->topics;
 
-    char *topic = cmd.headers[0].val; // has only one header
-    char *content = cmd.content;
+    char *topic = command_topic(ctx, cmd, STOMP_HDR_TOPIC);
+    char *receipt = stomp_header_get(cmd, STOMP_HDR_RECEIPT);
 
-    ret = topic_add_message(topics, messages, topic, content);
+    if (topic == NULL) {
+        if (send_error(client, "Unknown topic id") != 0)
+            fprintf(stderr, "Failed to send error\n");
+        return -1;
+    }
+
+    // only the pointers, topic_add_message copies them
+    for (i = 0; i < cmd->nheaders; i++) {
+        if (forwarded_header(cmd->headers[i].key))
+            headers[nheaders++] = cmd->headers[i];
+    }
+
+    // all messages of a batch are added at once
+    nbodies = stomp_batch_split(cmd, bodies);
+    ret = topic_add_messages(topics, topic, headers, nheaders,
+        bodies, nbodies);
     if (ret != 0) {
         char errmsg[32];
         topic_strerror(ret, errmsg);
         fprintf(stderr,
-            "Error from topic_add_message: %s (%d)\n", errmsg, ret);
+            "Error from topic_add_messages: %s (%d)\n", errmsg, ret);
         ret = send_error(client, "Failed to add message");
 
         if (ret != 0) fprintf(stderr, "Failed to send error\n");
 
         return -1;
     } else {
-        fprintf(stderr, "Broker: Added message '%s' to topic '%s'\n",
-            content, topic);
+        fprintf(stderr, "Broker: Added %zu message(s) of %zu bytes "
+            "to topic '%s'\n", nbodies, cmd->contentlen, topic);
+
+        // the id saves sending the name next time. the
+        // topic exists, topic_ensure only looks it up
+        if (client->binary && cmd->topicid == 0 &&
+                announce_topic(client, topic,
+                    topic_ensure(topics, topic)) != 0)
+            fprintf(stderr, "Failed to announce topic\n");
+
+        if (receipt != NULL && confirm_send(client, receipt) != 0)
+            fprintf(stderr, "Failed to send receipt\n");
         return 0;
     }
 }
 
 int process_subscribe(struct broker_context *ctx,
-                      struct stomp_command cmd,
+                      struct stomp_command *cmd,
                       struct subscriber *sub) {
     int ret;
 
-    struct list *topics = ctx->topics;
-    char *topic = cmd.headers[0].val; // has only one header
+    struct topic_table *topics = ctx->topics;
+    char *topic = command_topic(ctx, cmd, STOMP_HDR_DESTINATION);
+    char *receipt = stomp_header_get(cmd, STOMP_HDR_RECEIPT);
+
+    if (topic == NULL) {
+        if (send_error(sub->client, "Unknown topic id") != 0)
+            fprintf(stderr, "Failed to send error\n");
+        return -1;
+    }
+
+    // messages only carry the id, so the subscriber
+    // must learn it before the first one arrives
+    if (sub->client->binary && cmd->topicid == 0 &&
+            announce_topic(sub->client, topic,
+                topic_ensure(topics, topic)) != 0)
+        fprintf(stderr, "Failed to announce topic\n");
 
     ret = topic_add_subscriber(topics, topic, sub);
     assert(ret == 0);
+    sub->subscribed = 1;
+
+    if (receipt != NULL && send_receipt(sub->client, receipt) != 0)
+        fprintf(stderr, "Failed to send receipt\n");
 
     return 0;
 }
 
 int process_disconnect(struct broker_context *ctx,
                        struct client *client,
-                       struct subscriber *sub) {
+                       struct subscriber *sub,
+                       char *receipt) {
     int ret;
 
     // acquire both locks for dead flag
@@ -124,7 +365,7 @@ int process_disconnect(struct broker_context *ctx,
     // send receipt with lock held in order to
     // prevent other threads sending data
     // after the receipt has been sent
-    ret = send_receipt(client);
+    ret = send_receipt(client, receipt);
     if (ret != 0) {
         ret = send_error(client, "Failed to send receipt");
 
@@ -158,9 +399,12 @@ int main_loop(struct broker_context *ctx,
     cmd.content = NULL;
     cmd.name = NULL;
     cmd.nheaders = 0;
+    cmd.contentlen = 0;
 
     ret = socket_read_command(client, &cmd);
-    if (ret == SOCKET_CLIENT_GONE || ret == SOCKET_NECROMANCE) {
+    if (ret == SOCKET_AGAIN) {
+        val = WORKER_WAIT;
+    } else if (ret == SOCKET_CLIENT_GONE || ret == SOCKET_NECROMANCE) {
         if (*connected)
             fprintf(stderr, "Broker: Client '%s' has gone\n", sub->name);
         else
@@ -179,20 +423,37 @@ int main_loop(struct broker_context *ctx,
         } else {
             *connected = 1;
             sub->client = client;
-            sub->name = strdup(cmd.headers[0].val); // only one header
-            ret = send_connected(client);
+            sub->name = strdup(stomp_header_get(&cmd, STOMP_HDR_LOGIN));
+            sub->subscribed = 0;
+
+            int features = 0;
+            if (header_lists(stomp_header_get(&cmd,
+                    STOMP_HDR_ACCEPT_FRAMING), "binary"))
+                features |= BROKER_BINARY;
+            if (header_lists(stomp_header_get(&cmd,
+                    STOMP_HDR_ACCEPT_ENCODING), COMPRESS_DEFLATE))
+                features |= BROKER_DEFLATE;
+            if (negotiate_heartbeat(client, stomp_header_get(&cmd,
+                    STOMP_HDR_HEART_BEAT)))
+                features |= BROKER_HEARTBEAT;
+
+            // CONNECTED is the last text frame either way
+            ret = send_connected(client, features);
+            client->binary = (features & BROKER_BINARY) != 0;
+            client->deflate = (features & BROKER_DEFLATE) != 0;
             fprintf(stderr, "Broker: New Client '%s'\n", sub->name);
             val = WORKER_CONTINUE;
         }
     } else {
         if (strcmp("SEND", cmd.name) == 0) {
-            ret = process_send(ctx, client, cmd);
+            ret = process_send(ctx, client, &cmd);
             val = WORKER_CONTINUE;
         } else if (strcmp("SUBSCRIBE", cmd.name) == 0) {
-            ret = process_subscribe(ctx, cmd, sub);
+            ret = process_subscribe(ctx, &cmd, sub);
             val = WORKER_CONTINUE;
         } else if (strcmp("DISCONNECT", cmd.name) == 0) {
-            ret = process_disconnect(ctx, client, sub);
+            ret = process_disconnect(ctx, client, sub,
+                stomp_header_get(&cmd, STOMP_HDR_RECEIPT));
             val = WORKER_STOP;
         } else {
             // impossible, socket read would have failed
@@ -201,6 +462,13 @@ int main_loop(struct broker_context *ctx,
         }
     }
 
+    // the client waits for the receipts held back
+    // once it has not sent anything else
+    if (val == WORKER_CONTINUE && receipt_pending(client) &&
+            !socket_command_buffered(client) &&
+            flush_receipt(client) != 0)
+        fprintf(stderr, "Failed to send receipt\n");
+
     stomp_command_fields_destroy(&cmd);
     return val;
 }
@@ -208,14 +476,9 @@ int main_loop(struct broker_context *ctx,
 int broker_context_init(struct broker_context *ctx) {
     int ret;
 
-    ctx->messages = malloc(sizeof(struct list));
-    assert(ctx->messages != NULL);
-    ret = list_init(ctx->messages);
-    assert(ret == 0);
-
-    ctx->topics = malloc(sizeof(struct list));
+    ctx->topics = malloc(sizeof(struct topic_table));
     assert(ctx->topics != NULL);
-    ret = list_init(ctx->topics);
+    ret = topic_table_init(ctx->topics);
     assert(ret == 0);
 
     return 0;
@@ -224,12 +487,7 @@ int broker_context_init(struct broker_context *ctx) {
 int broker_context_destroy(struct broker_context *ctx) {
     int ret;
 
-    ret = list_destroy(ctx->messages);
-    assert(ret == 0);
-    free(ctx->messages);
-    ctx->messages = NULL;
-
-    ret = list_destroy(ctx->topics);
+    ret = topic_table_destroy(ctx->topics);
     assert(ret == 0);
     free(ctx->topics);
     ctx->topics = NULL;
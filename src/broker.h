@@ -2,15 +2,14 @@
 #define BROKER_HEADER
 
 #include "stomp.h"
+#include "topic.h"
 
 /* global list of everything */
 struct broker_context {
 
-    /* global list of topics */
-    struct list *topics;
-
-    /* global list of messages */
-    struct list *messages;
+    /* global table of topics, each with
+     * the queue of its messages */
+    struct topic_table *topics;
 };
 
 /* params passed to handler thread */
@@ -30,41 +29,65 @@ int broker_context_destroy(struct broker_context *ctx);
 #define WORKER_CONTINUE 2
 #define WORKER_STOP     3
 #define WORKER_ERROR    4
+#define WORKER_WAIT     5
+
+/* features a client may ask for in CONNECT */
+#define BROKER_BINARY    1 /* binary framing, see binary.h */
+#define BROKER_DEFLATE   2 /* compressed content, see compress.h */
+#define BROKER_HEARTBEAT 4 /* heart-beats, see stomp.h */
 
 /* send an error message to the client with the specified reason */
 int send_error(struct client *client, char *reason);
 
-/* send receipt to client */
-int send_receipt(struct client *client);
+/* send receipt to client, with the receipt-id
+ * header if id is not null */
+int send_receipt(struct client *client, char *id);
 
-/* send connected message to client */
-int send_connected(struct client *client);
+/* send connected message to client, with a header for
+ * each of the features (BROKER_ flags) it has asked for.
+ * the heart-beats offered are those of the client struct */
+int send_connected(struct client *client, int features);
 
-/* add message sent by client to according topic */
+/* add message sent by client to according topic, or
+ * all messages of a batch at once */
 int process_send(struct broker_context *ctx,
                  struct client *client,
-                 struct stomp_command cmd);
+                 struct stomp_command *cmd);
 
 /* adds client to topic */
 int process_subscribe(struct broker_context *ctx,
-                      struct stomp_command cmd,
+                      struct stomp_command *cmd,
                       struct subscriber *sub);
 
-/* removes client from messages and topics */
+/* removes client from messages and topics. the
+ * receipt confirms it, with the receipt-id header
+ * if receipt is not null */
 int process_disconnect(struct broker_context *ctx,
                        struct client *client,
-                       struct subscriber *sub);
+                       struct subscriber *sub,
+                       char *receipt);
 
 /* main loops that is continuously invoked
  * while a client is connected. it returns
  * one of the WORKER_* constants and depending
- * on that value should be invoked again
+ * on that value should be invoked again.
+ * WORKER_WAIT means the client's socket is
+ * non-blocking and no complete command has
+ * arrived yet, it should be invoked again
+ * once the socket has become readable.
  */
 int main_loop(struct broker_context *ctx,
               struct client *client,
               int *connected,
               struct subscriber *sub);
 
+/* terminates the client of a connection that is no longer
+ * served and frees it along with the subscriber. one that has
+ * subscribed to a topic is left to the gc instead, which finds
+ * it through its subscriptions. connected is set by main_loop */
+void release_client(struct client *client, struct subscriber *sub,
+                    int connected);
+
 /* main loop for client. reads commands, accepts
  * parameter of type 'struct handler_params' */
 void * handle_client(void *handler_thread_params);
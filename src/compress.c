@@ -0,0 +1,81 @@
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <zlib.h>
+
+#include "compress.h"
+
+/* see header for doc */
+int compress_deflate(const char *src, size_t len, char **dst,
+        size_t *dstlen) {
+    int ret;
+    uLongf n;
+
+    if (len < COMPRESS_MIN) return -1;
+
+    // anything that would not be smaller is useless, so the
+    // buffer does not need the room for the worst case
+    n = len - 1;
+    *dst = malloc(n);
+    assert(*dst != NULL);
+
+    // market data is compressed on the hot path,
+    // speed matters more than the last few bytes
+    ret = compress2((Bytef *) *dst, &n, (const Bytef *) src, len,
+        Z_BEST_SPEED);
+    if (ret != Z_OK) {
+        free(*dst);
+        *dst = NULL;
+        return -1;
+    }
+
+    *dstlen = n;
+    return 0;
+}
+
+/* see header for doc */
+int compress_inflate(const char *src, size_t len, char **dst,
+        size_t *dstlen) {
+    int ret;
+    z_stream zs;
+    size_t cap = len * 4 + 64;
+    char *buf;
+
+    memset(&zs, 0, sizeof(zs));
+    ret = inflateInit(&zs);
+    assert(ret == Z_OK);
+
+    zs.next_in = (Bytef *) src;
+    zs.avail_in = len;
+
+    *dst = malloc(cap);
+    assert(*dst != NULL);
+    *dstlen = 0;
+
+    do {
+        // room for the null byte as well
+        if (cap - *dstlen < 2) {
+            cap *= 2;
+            buf = realloc(*dst, cap);
+            assert(buf != NULL);
+            *dst = buf;
+        }
+
+        zs.next_out = (Bytef *) *dst + *dstlen;
+        zs.avail_out = cap - *dstlen - 1;
+        ret = inflate(&zs, Z_NO_FLUSH);
+        *dstlen = (char *) zs.next_out - *dst;
+    } while (ret == Z_OK);
+
+    inflateEnd(&zs);
+
+    // the stream must end with the content
+    if (ret != Z_STREAM_END || zs.avail_in != 0) {
+        free(*dst);
+        *dst = NULL;
+        return -1;
+    }
+
+    (*dst)[*dstlen] = '\0';
+    return 0;
+}
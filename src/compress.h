@@ -0,0 +1,36 @@
+#ifndef COMPRESS_HEADER
+#define COMPRESS_HEADER
+
+/* compress.h
+ *
+ * compresses the content of messages for clients that
+ * accept it (see accept-encoding in stomp.h). the content
+ * is compressed with zlib (RFC 1950) and sent along with
+ * the content-encoding header set to deflate. content that
+ * does not get smaller is sent as it is, without the header.
+ */
+
+#include <stdlib.h>
+
+/* name of the encoding in the headers */
+#define COMPRESS_DEFLATE "deflate"
+
+/* content shorter than this is never compressed,
+ * as there is not enough to gain */
+#define COMPRESS_MIN 128
+
+/* compresses the len bytes at src into a new buffer, which
+ * is stored in dst along with its length. returns 0 on
+ * success and -1 if the content is shorter than COMPRESS_MIN
+ * or would not get smaller, in which case nothing is stored */
+int compress_deflate(const char *src, size_t len, char **dst,
+        size_t *dstlen);
+
+/* decompresses the len bytes at src, which must have been
+ * compressed with compress_deflate, into a new buffer that
+ * is null-terminated like the content of a command. returns
+ * 0 on success and -1 if the content is invalid */
+int compress_inflate(const char *src, size_t len, char **dst,
+        size_t *dstlen);
+
+#endif
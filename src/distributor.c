@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <string.h>
 #include <pthread.h>
 #include <sys/time.h>
 #include <assert.h>
@@ -7,6 +8,7 @@
 #include "socket.h"
 #include "stomp.h"
 #include "broker.h"
+#include "compress.h"
 
 /* returns timestamp */
 static long now() {
@@ -21,7 +23,7 @@ void *distributor_main_loop(void *arg) {
     struct broker_context *ctx = arg;
 
     while (1) {
-        ret = deliver_messages(ctx->messages);
+        ret = deliver_topics(ctx->topics);
         assert(ret >= 0);
 
         if (ret == 0) {
@@ -32,137 +34,255 @@ void *distributor_main_loop(void *arg) {
     }
 }
 
-/* at least read lock must be held by calling function */
-int is_eligible(struct msg_statistics *stat) {
-    
+/* at least read lock of the subscription
+ * must be held by calling function */
+int is_eligible(struct retry *retry) {
+    return (now() - retry->last_fail) > REDELIVERY_TIMEOUT &&
+        retry->nattempts < MAX_ATTEMPTS;
+}
+
+/* compresses the content of the message, unless that has
+ * been tried before. this happens only once, no matter how
+ * many subscribers accept it. content the publisher has
+ * encoded itself is left alone. returns whether there is
+ * compressed content */
+static int deflate_message(struct message *msg) {
+    size_t i;
+
+    if (msg->deflated != 0) return msg->deflated == 1;
+
+    msg->deflated = -1;
+    for (i = 0; i < msg->nheaders; i++)
+        if (stomp_header_known(msg->headers[i].key) ==
+                STOMP_HDR_CONTENT_ENCODING)
+            return 0;
+
+    if (compress_deflate(msg->content, msg->contentlen, &msg->zcontent,
+            &msg->zcontentlen) == 0)
+        msg->deflated = 1;
+
+    return msg->deflated == 1;
+}
+
+/* encodes the MESSAGE frame of a message with the framing
+ * and encoding (MESSAGE_ flags) of a subscriber. this
+ * happens only once per frame, all subscribers that want
+ * the same share it */
+static int encode_message(struct message *msg, int which,
+        struct frame **frame) {
+
     int ret;
-    long ts = now();
+    int binary = (which & MESSAGE_BINARY) != 0;
+    int deflate = (which & MESSAGE_DEFLATE) != 0;
 
-    // already successfully delivered
-    if (stat->last_fail == 0 && stat->nattempts > 0) {
-        return 0;
-    } else if ( ((ts - stat->last_fail) <= REDELIVERY_TIMEOUT) ||
-         (stat->nattempts >= MAX_ATTEMPTS)) {
-        return 0;
-    } else {
+    *frame = msg->frames[which];
+    if (*frame != NULL) return 0;
 
-        int val;
-        struct client *client = stat->subscriber->client; 
+    // those that don't compress well are the same either way
+    if (deflate && !deflate_message(msg)) {
+        ret = encode_message(msg, which & ~MESSAGE_DEFLATE, frame);
+        if (ret != 0) return ret;
 
-        // lock dead flag to check if
-        ret = pthread_mutex_lock(client->deadmutex);
-        assert(ret == 0);
-        
-        if (client->dead) {
-            val = 0;
-        } else {
-            val = 1;
-        }
+        frame_ref(*frame);
+        msg->frames[which] = *frame;
+        return 0;
+    }
 
-        // lock dead flag to check if
-        ret = pthread_mutex_unlock(client->deadmutex);
-        assert(ret == 0);
+    // the headers of the message follow those set by the broker
+    struct stomp_header headers[STOMP_MAX_HEADERS + 3];
+    size_t nheaders = 0;
+    char id[24];
+    sprintf(id, "%lu", msg->id);
+    headers[nheaders].key = "destination";
+    headers[nheaders++].val = msg->topicname;
+    headers[nheaders].key = "message-id";
+    headers[nheaders++].val = id;
+    if (deflate) {
+        headers[nheaders].key = "content-encoding";
+        headers[nheaders++].val = COMPRESS_DEFLATE;
+    }
+    // a message without headers has none to copy from
+    if (msg->nheaders > 0)
+        memcpy(headers + nheaders, msg->headers,
+            msg->nheaders * sizeof(struct stomp_header));
 
-        return val;
+    struct stomp_command cmd;
+    cmd.name = "MESSAGE";
+    cmd.headers = headers;
+    cmd.nheaders = msg->nheaders + nheaders;
+    cmd.content = deflate ? msg->zcontent : msg->content;
+    cmd.contentlen = deflate ? msg->zcontentlen : msg->contentlen;
+    cmd.topicid = msg->topicid;
+
+    if (binary) {
+        ret = frame_create_binary(&cmd, &msg->frames[which]);
+    } else if (msg->prefix != NULL) {
+        // the topic has encoded the destination already
+        cmd.headers++;
+        cmd.nheaders--;
+        ret = frame_create_prefixed(&cmd, msg->prefix, msg->prefixlen,
+            &msg->frames[which]);
+    } else {
+        ret = frame_create(&cmd, &msg->frames[which]);
     }
+    *frame = msg->frames[which];
 
+    return ret;
 }
 
-/* write lock must be held by calling function */
-static void deliver_message(struct message *msg,
-        struct msg_statistics *stat) {
+/* queues the message for the client, returns 0 if it has been */
+static int deliver_message(struct message *msg, struct client *client) {
 
     int ret;
+    struct frame *frame;
 
-    struct stomp_header header;
-    header.key = "destination";
-    header.val = msg->topicname;
-    struct stomp_command cmd;
-    cmd.name = "MESSAGE";
-    cmd.headers = &header;
-    cmd.nheaders = 1;
-    cmd.content = msg->content;
+    ret = encode_message(msg,
+        (client->binary ? MESSAGE_BINARY : 0) |
+        (client->deflate ? MESSAGE_DEFLATE : 0), &frame);
 
-    ret = socket_send_command(stat->subscriber->client, cmd);
+    // only queues the message, the subscriber's
+    // i/o thread writes it to the socket
+    if (ret == 0)
+        ret = socket_send_frame(client, frame);
 
+    // this includes a full outbound queue (subscriber does
+    // not keep up), which is retried like any other failure
     if (ret != 0) {
         fprintf(stderr,
                 "Failed to send message to subscriber: %d\n",
                 ret);
+    }
 
-        stat->last_fail = now();
-        stat->nattempts++;
-    } else {
-        stat->last_fail = 0;
-        stat->nattempts++;
+    return ret;
+}
+
+/* retries the failed delivery of the subscription, if it
+ * has one and it is eligible. returns the number of messages
+ * delivered. write lock of the subscription and read lock
+ * of the log must be held */
+static int deliver_retry(struct list *messages,
+        struct subscription *sub) {
+
+    struct retry *retry = &sub->retry;
+    struct node *cur = messages->root;
+
+    if (!sub->retrying || !is_eligible(retry)) return 0;
+
+    // the log is ordered by offset, the oldest first
+    while (cur != NULL &&
+            ((struct message *) cur->entry)->offset < retry->offset)
+        cur = cur->next;
+
+    if (cur == NULL ||
+            ((struct message *) cur->entry)->offset != retry->offset) {
+        // no longer in the log, nothing to retry
+        subscription_clear_retry(sub);
+        return 0;
+    }
+
+    if (deliver_message(cur->entry, sub->subscriber->client) == 0) {
+        subscription_clear_retry(sub);
+        return 1;
     }
+
+    retry->last_fail = now();
+    retry->nattempts++;
+
+    // given up, like the ones that never made it
+    if (retry->nattempts >= MAX_ATTEMPTS)
+        subscription_clear_retry(sub);
+
+    return 0;
 }
 
-int deliver_messages(struct list *messages) {
+/* delivers the messages from the cursor of the subscription on
+ * and moves it past them. a failed one is to be retried and the
+ * rest waits until it has been delivered or given up, so the
+ * subscriber gets them in order. write lock of the subscription
+ * and read lock of the log must be held */
+static int deliver_new(struct list *messages, struct subscription *sub) {
+
+    int nmsgs = 0;
+    struct node *cur = messages->tail;
+
+    // nothing overtakes a retry
+    if (sub->retrying) return 0;
+
+    // the new ones are at the end of the log
+    while (cur != NULL && cur->prev != NULL &&
+            ((struct message *) cur->prev->entry)->offset >= sub->cursor)
+        cur = cur->prev;
+
+    for (; cur != NULL; cur = cur->next) {
+        struct message *msg = cur->entry;
+
+        if (msg->offset < sub->cursor) continue;
+
+        sub->cursor = msg->offset + 1;
+        if (deliver_message(msg, sub->subscriber->client) != 0) {
+            subscription_set_retry(sub, msg->offset, now());
+            break;
+        }
+        nmsgs++;
+    }
+
+    return nmsgs;
+}
+
+int deliver_messages(struct topic *topic) {
 
     int nmsgs = 0; // number of delivered messages
     int ret;
 
-    // acquire read lock for list of messages
-    ret = pthread_rwlock_rdlock(messages->listrwlock);
+    // acquire read lock for subscriptions
+    ret = pthread_rwlock_rdlock(topic->subscribers->listrwlock);
     assert(ret == 0);
 
-    struct node *curMsg = messages->root;
-    while (curMsg != NULL) {
-        struct message *msg = curMsg->entry;
-
-        // acquire lock for message stat list
-        ret = pthread_rwlock_rdlock(msg->stats->listrwlock);
-        assert(ret == 0);
+    struct node *curSub = topic->subscribers->root;
+    while (curSub != NULL) {
+        struct subscription *sub = curSub->entry;
 
+        if (!subscriber_is_dead(sub->subscriber)) {
 
-        // walk through statistics of a message and check
-        // with read lock whether it is eligible. If yes,
-        // check again with write lock and deliver.
-        struct node *curStat = msg->stats->root;
-        while (curStat != NULL) {
-            struct msg_statistics *stat = curStat->entry;
-
-            // acquire read lock for statistic
-            ret = pthread_rwlock_rdlock(stat->statrwlock);
+            // acquire write lock for subscription
+            ret = pthread_rwlock_wrlock(sub->rwlock);
             assert(ret == 0);
 
-            int eligible = is_eligible(stat);
-            
-            // release read lock for statistic
-            ret = pthread_rwlock_unlock(stat->statrwlock);
+            // acquire read lock for log of the topic
+            ret = pthread_rwlock_rdlock(topic->messages->listrwlock);
             assert(ret == 0);
 
-            if (eligible) {
-                // acquire write lock for statistic
-                ret = pthread_rwlock_wrlock(stat->statrwlock);
-                assert(ret == 0);
-
-                // check again to make sure
-                if (is_eligible(stat)) {
-                    deliver_message(msg, stat); // requires write lock
-                    nmsgs++;
-                }
-                
-                // release read lock for statistic
-                ret = pthread_rwlock_unlock(stat->statrwlock);
-                assert(ret == 0);
-            }
-
-            curStat = curStat->next;
-        }
+            nmsgs += deliver_retry(topic->messages, sub);
+            nmsgs += deliver_new(topic->messages, sub);
 
-        // release lock for message stat list
-        ret = pthread_rwlock_unlock(msg->stats->listrwlock);
-        assert(ret == 0);
+            // release read lock for log of the topic
+            ret = pthread_rwlock_unlock(topic->messages->listrwlock);
+            assert(ret == 0);
 
+            // release write lock for subscription
+            ret = pthread_rwlock_unlock(sub->rwlock);
+            assert(ret == 0);
+        }
 
-        curMsg = curMsg->next;
+        curSub = curSub->next;
     }
 
-    // release read lock for list of messages
-    ret = pthread_rwlock_unlock(messages->listrwlock);
+    // release read lock for subscriptions
+    ret = pthread_rwlock_unlock(topic->subscribers->listrwlock);
     assert(ret == 0);
 
     return nmsgs;
 }
+
+/* delivers the log of the topic, adding
+ * to the number of messages delivered */
+static void deliver_topic(struct topic *topic, void *arg) {
+    int *nmsgs = arg;
+    *nmsgs += deliver_messages(topic);
+}
+
+int deliver_topics(struct topic_table *topics) {
+    int nmsgs = 0;
+    topic_foreach(topics, deliver_topic, &nmsgs);
+    return nmsgs;
+}
@@ -8,8 +8,8 @@
 
 #include "topic.h"
 
-/* maximum number of attempts made to deliver
- * a message before the message may be removed
+/* maximum number of attempts made to deliver a
+ * message to a subscriber before it is given up
  */
 #define MAX_ATTEMPTS 10 
 
@@ -24,16 +24,24 @@
  * the subscribers is made */
 #define DISTRIBUTOR_SEND_TIMEOUT 1
 
-/* searches the list of messages for messages 
- * to be sent to a subscriber. this may be for the first
- * time or because it is eligible to be resent.
- * returns the number of messages delivered.
+/* delivers the messages of the topic to each alive
+ * subscriber: first the one whose delivery has failed
+ * before, if it is eligible to be resent, then those after
+ * its cursor once it is no longer to be retried. returns
+ * the number of messages delivered.
  */
-int deliver_messages(struct list *messages);
-
-/* tests whether the message is is eligible
- * for redelivery to this client */
-int is_eligible(struct msg_statistics *stat);
+int deliver_messages(struct topic *topic);
+
+/* delivers the messages of all topics, one log
+ * after the other (see deliver_messages). returns
+ * the number of messages delivered */
+int deliver_topics(struct topic_table *topics);
+
+/* tests whether the failed delivery is eligible
+ * to be retried: it has been long enough since
+ * the last attempt and there have not been too
+ * many of them */
+int is_eligible(struct retry *retry);
 
 /* main loop that runs distributor functions. accepts
  * param of type 'struct broker_context' */
@@ -0,0 +1,83 @@
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "frame.h"
+#include "binary.h"
+
+/* wraps the encoded command into a new frame */
+static struct frame *frame_wrap(char *data, size_t len) {
+    struct frame *frame = malloc(sizeof(struct frame));
+    assert(frame != NULL);
+
+    frame->data = data;
+    frame->len = len;
+    frame->refs = 1;
+
+    return frame;
+}
+
+int frame_create(const struct stomp_command *cmd, struct frame **frame) {
+    int ret;
+    char *data;
+    size_t len;
+
+    ret = create_command(cmd, &data, &len);
+    if (ret != 0) return ret;
+
+    *frame = frame_wrap(data, len);
+    return 0;
+}
+
+int frame_create_prefixed(const struct stomp_command *cmd,
+        const char *prefix, size_t prefixlen, struct frame **frame) {
+    int ret;
+    char *data;
+    size_t len;
+
+    ret = create_command_prefixed(cmd, prefix, prefixlen, &data, &len);
+    if (ret != 0) return ret;
+
+    *frame = frame_wrap(data, len);
+    return 0;
+}
+
+int frame_create_binary(const struct stomp_command *cmd,
+        struct frame **frame) {
+    int ret;
+    char *data;
+    size_t len;
+
+    ret = binary_create(cmd, &data, &len);
+    if (ret != 0) return ret;
+
+    *frame = frame_wrap(data, len);
+    return 0;
+}
+
+int frame_create_heartbeat(int binary, struct frame **frame) {
+    char *data = malloc(1);
+    assert(data != NULL);
+
+    // the varint of the length 0
+    data[0] = binary ? '\0' : '\n';
+
+    *frame = frame_wrap(data, 1);
+    return 0;
+}
+
+void frame_ref(struct frame *frame) {
+    int refs = __sync_add_and_fetch(&frame->refs, 1);
+    assert(refs > 1);
+}
+
+void frame_unref(struct frame *frame) {
+    int refs = __sync_sub_and_fetch(&frame->refs, 1);
+    assert(refs >= 0);
+
+    if (refs == 0) {
+        free(frame->data);
+        frame->data = NULL;
+        free(frame);
+    }
+}
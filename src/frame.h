@@ -0,0 +1,53 @@
+#ifndef FRAME_HEADER
+#define FRAME_HEADER
+
+/* a frame is a command that has been encoded for
+ * the wire. it is immutable once it has been created
+ * and may therefore be queued for any number of clients
+ * at the same time, e.g. a message that is delivered
+ * to all subscribers of a topic is encoded only once.
+ * the frame is freed when the last reference is gone.
+ */
+
+#include <stdlib.h>
+
+#include "stomp.h"
+
+struct frame {
+    /* encoded command, including the null byte */
+    char *data;
+
+    /* number of bytes in data */
+    size_t len;
+
+    /* number of references, modified atomically */
+    int refs;
+};
+
+/* encodes the command into a new frame with
+ * one reference held by the caller. returns 0
+ * on success or any of the STOMP_ error codes */
+int frame_create(const struct stomp_command *cmd, struct frame **frame);
+
+/* like frame_create, but the frame starts with the
+ * prefix (see create_command_prefixed) */
+int frame_create_prefixed(const struct stomp_command *cmd,
+        const char *prefix, size_t prefixlen, struct frame **frame);
+
+/* like frame_create, but with the binary framing
+ * (see binary.h) */
+int frame_create_binary(const struct stomp_command *cmd,
+        struct frame **frame);
+
+/* creates a heart-beat (see stomp.h), a newline or
+ * with the binary framing a frame of length 0 */
+int frame_create_heartbeat(int binary, struct frame **frame);
+
+/* acquires another reference to the frame */
+void frame_ref(struct frame *frame);
+
+/* releases a reference to the frame and
+ * frees it if it was the last one */
+void frame_unref(struct frame *frame);
+
+#endif
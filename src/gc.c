@@ -1,6 +1,7 @@
 #include <assert.h>
 #include <pthread.h>
 #include <stdio.h>
+#include <stdlib.h>
 
 #include "gc.h"
 #include "broker.h"
@@ -21,77 +22,59 @@ void *gc_main_loop(void *arg) {
     return 0;
 }
 
+/* removes the messages of the log of the topic that are
+ * eligible, adding to the number removed (arg) */
+static void collect_topic(struct topic *topic, void *arg) {
+    int ret;
+    int *nmsgs = arg;
+
+    ret = gc_remove_eligible_msgs(topic->messages,
+        gc_eligible_offset(topic));
+    assert(ret >= 0);
+    *nmsgs += ret;
+}
+
 int gc_run_gc(struct broker_context *ctx) {
-    /* the messages, statistics and subscribers are
-     * cleaned up in two steps: collect a list of
-     * eligible entries and then remove those
-     * that have been collected.
+    /* the messages and subscribers are cleaned up
+     * in two steps: find what is eligible and then
+     * remove it.
      *
      * note that there is no synchronization between the
-     * two and thus one could think that the list might
+     * two and thus one could think that something might
      * change between collecting and removing (e.g.
      * a message was considered eligible and in the second
      * step it is no longer eligible). However, this case is not
-     * possible by design! The eligibility of any of the
-     * three types moves only from 'no' to 'yes', which means
+     * possible by design! The eligibility of either of the
+     * two types moves only from 'no' to 'yes', which means
      * once something is considered eligible, there is
      * no way back. reasoning:
-     * 1. message: a message's list of subscribers is copied
-     *             at creation time not additional subsribers
-     *             are added along the way. therefore, once
-     *             is is empty, it doesn't grow anymore.
-     * 2. msg_statistics:
-     *      I.   MAX_ATTEMPTS reached: the number of attempts
-     *              can only grow.
-     *      II.  client dead: there is no way back once the
-     *              client is dead
-     *      III. successfyl delivery: the message can only
-     *              be delivered once.
-     * 3. subscriber: a subscriber is eligible when it is
-     *                dead and no statistics point to it.
-     *                --> once a subscriber is considered dead,
-     *                it is not copied from the topic to the
-     *                message anymore.
+     * 1. message: a message is eligible once it is before
+     *             the oldest message any alive subscriber
+     *             still needs. cursors only move forward,
+     *             a retry is only added for the message at
+     *             the cursor as it moves past it and a new
+     *             subscriber starts at the end of the log.
+     *             a dead subscriber does not come back.
+     * 2. subscriber: a subscriber is eligible when it is
+     *                dead and no longer attached to its
+     *                connection. there is no way back from
+     *                either.
      * */
     int ret;
 
 
-    // collect and remove statistic
-    struct list stats;
-    ret = list_init(&stats);
-    assert(ret == 0);
-    ret = gc_collect_eligible_stats(ctx->messages, &stats);
-    assert(ret == 0);
-    ret = gc_remove_eligible_stats(ctx->messages, &stats);
-    assert(ret >= 0);
-    if (ret != 0) fprintf(stderr, "GC: Removed %d Statistics\n", ret);
-    ret = list_clean(&stats);
-    assert(ret == 0);
-    ret = list_destroy(&stats);
-    assert(ret == 0);
-
-
-    // collect and remove messages
-    struct list messages;
-    ret = list_init(&messages);
-    assert(ret == 0);
-    ret = gc_collect_eligible_msgs(ctx->messages, &messages);
-    assert(ret == 0);
-    ret = gc_remove_eligible_msgs(ctx->messages, &messages);
-    assert(ret >= 0);
-    if (ret != 0) fprintf(stderr, "GC: Removed %d Messages\n", ret);
-    ret = list_clean(&messages);
-    assert(ret == 0);
-    ret = list_destroy(&messages);
-    assert(ret == 0);
+    // remove delivered messages, one log after the other
+    int nmsgs = 0;
+    topic_foreach(ctx->topics, collect_topic, &nmsgs);
+    if (nmsgs != 0)
+        fprintf(stderr, "GC: Removed %d Messages\n", nmsgs);
 
 
     // collect and remove subscribers
     struct list subscribers;
     ret = list_init(&subscribers);
     assert(ret == 0);
-    ret = gc_collect_eligible_subscribers(ctx->topics, ctx->messages,
-        &subscribers);
+    ret = gc_collect_eligible_subscribers(ctx->topics, &subscribers);
     assert(ret == 0);
     if (!list_empty(&subscribers)) {
         ret = gc_remove_eligible_subscribers(ctx->topics, &subscribers);
@@ -108,394 +91,219 @@ int gc_run_gc(struct broker_context *ctx) {
     return 0;
 }
 
+unsigned long gc_eligible_offset(struct topic *topic) {
 
-int gc_eligible_stat(struct msg_statistics *stat) {
-
-    int ret; // return value from other functions
-    int val = 0;
-
-    if (stat->last_fail == 0 && stat->nattempts > 0) {
-        // sent successfully
-        val = 1;
-    } else if (stat->nattempts >= MAX_ATTEMPTS) {
-        // too many attempts already
-        val = 1;
-    } else {
-
-        pthread_mutex_t *deadmutex;
-        deadmutex = stat->subscriber->client->deadmutex; 
-
-        // acquire read lock for dead flag
-        ret = pthread_mutex_lock(deadmutex);
-        assert(ret == 0);
-
-        if (stat->subscriber->client->dead) {
-            val = 1;
-        }
-
-        // release read lock for dead flag
-        ret = pthread_mutex_unlock(deadmutex);
-        assert(ret == 0);
-    }
-
-    return val;
-}
-
-int gc_eligible_msg(struct message *msg) {
-
-    int ret; // return value from other functions
-    int val;
+    int ret;
+    unsigned long offset;
 
-    // acquire read lock for statstics list
-    ret = pthread_rwlock_rdlock(msg->stats->listrwlock);
+    // acquire read lock on subscriptions
+    ret = pthread_rwlock_rdlock(topic->subscribers->listrwlock);
     assert(ret == 0);
 
-    val = (msg->stats->root == NULL);
-
-    // release read lock for statstics list
-    ret = pthread_rwlock_unlock(msg->stats->listrwlock);
+    // acquire read lock on log
+    ret = pthread_rwlock_rdlock(topic->messages->listrwlock);
     assert(ret == 0);
 
-    return val;
-}
-
-int gc_collect_eligible_stats(struct list *messages,
-                              struct list *eligible) {
-
-    int ret;
+    // without subscribers, no message is needed anymore
+    offset = topic->nextoffset;
 
-    // acquire read lock for messages list
-    ret = pthread_rwlock_rdlock(messages->listrwlock);
+    // release read lock on log
+    ret = pthread_rwlock_unlock(topic->messages->listrwlock);
     assert(ret == 0);
 
-    struct node *curMsg = messages->root;
-    while (curMsg != NULL) {
-
-        struct message *msg = curMsg->entry;
-
-        // acquire read lock for stats list
-        ret = pthread_rwlock_rdlock(msg->stats->listrwlock);
-        assert(ret == 0);
+    struct node *curSub = topic->subscribers->root;
+    while (curSub != NULL) {
+        struct subscription *sub = curSub->entry;
 
-        struct node *curStat = msg->stats->root;
-        while (curStat != NULL) {
-            struct msg_statistics *stat = curStat->entry;
+        // nothing is delivered to a dead one anymore
+        if (!subscriber_is_dead(sub->subscriber)) {
 
-            // acquire read lock for statistics
-            ret = pthread_rwlock_rdlock(stat->statrwlock);
+            // acquire read lock on subscription
+            ret = pthread_rwlock_rdlock(sub->rwlock);
             assert(ret == 0);
 
-            if (gc_eligible_stat(stat)) {
-                  ret = list_add(eligible, stat);  
-                  assert(ret == 0);
-            }
+            if (subscription_oldest(sub) < offset)
+                offset = subscription_oldest(sub);
 
-            // release read lock for statistics
-            ret = pthread_rwlock_unlock(stat->statrwlock);
+            // release read lock on subscription
+            ret = pthread_rwlock_unlock(sub->rwlock);
             assert(ret == 0);
-
-            curStat = curStat->next;
         }
 
-        // release read lock for stats list
-        ret = pthread_rwlock_unlock(msg->stats->listrwlock);
-        assert(ret == 0);
-
-        curMsg = curMsg->next;
-    }
-
-    // release read lock for messages list
-    ret = pthread_rwlock_unlock(messages->listrwlock);
-    assert(ret == 0);
-
-    return 0;
-}
-
-int gc_collect_eligible_msgs(struct list *messages,
-                             struct list *eligible) {
-
-    int ret;
-
-    // acquire read lock for messages list
-    ret = pthread_rwlock_rdlock(messages->listrwlock);
-    assert(ret == 0);
-
-    struct node *curMsg = messages->root;
-    while (curMsg != NULL) {
-
-        struct message *msg = curMsg->entry;
-
-        // gc_eligible_msg does the locking
-        if (gc_eligible_msg(msg)) {
-            ret = list_add(eligible, msg);   
-            assert(ret == 0);
-        }
-
-        curMsg = curMsg->next;
+        curSub = curSub->next;
     }
 
-    // release read lock for messages list
-    ret = pthread_rwlock_unlock(messages->listrwlock);
+    // release read lock on subscriptions
+    ret = pthread_rwlock_unlock(topic->subscribers->listrwlock);
     assert(ret == 0);
 
-    return 0;
+    return offset;
 }
 
-int gc_collect_eligible_subscribers(struct list *topics,
-                                    struct list *messages,
+int gc_collect_eligible_subscribers(struct topic_table *topics,
                                     struct list *eligible) {
-    /* find dead subscribers via topics and then
-     * make sure each of those has no statistics */
+    /* find dead subscribers via topics. a dead
+     * subscriber holds back no message, so
+     * nothing else keeps it */
 
     int ret;
 
-    // acquire read lock on topic list
-    ret = pthread_rwlock_rdlock(topics->listrwlock);
-    assert(ret == 0);
+    size_t i, j;
+    for (i = 0; i < TOPIC_TABLE_SHARDS; i++) {
+        struct topic_shard *shard = &topics->shards[i];
 
-    struct node *curTopic = topics->root;
-    while (curTopic != NULL) {
-        struct topic *topic = curTopic->entry;
-        
-        // acquire read lock on subscribers list
-        ret = pthread_rwlock_rdlock(topic->subscribers->listrwlock);
+        // acquire read lock on shard
+        ret = pthread_rwlock_rdlock(shard->rwlock);
         assert(ret == 0);
 
-        struct node *curSub = topic->subscribers->root;
-        while (curSub != NULL) {
-            struct subscriber *sub = curSub->entry;
-            int dead;
-
-            // acquire dead flag lock
-            ret = pthread_mutex_lock(sub->client->deadmutex);
+        for (j = 0; j < shard->ntopics; j++) {
+            struct topic *topic = shard->byid[j];
+        
+            // acquire read lock on subscribers list
+            ret = pthread_rwlock_rdlock(topic->subscribers->listrwlock);
             assert(ret == 0);
 
-            dead = sub->client->dead;           
-            
-            // release dead flag lock
-            ret = pthread_mutex_unlock(sub->client->deadmutex);
-            assert(ret == 0);
+            struct node *curSub = topic->subscribers->root;
+            while (curSub != NULL) {
+                struct subscription *subscription = curSub->entry;
+                struct subscriber *sub = subscription->subscriber;
+                int dead;
 
-            // list_contains: subscriber could be subscribed
-            // to other topic as well
-            if (dead && !list_contains(eligible, sub)) {
-                ret = list_add(eligible, sub);
+                // acquire dead flag lock
+                ret = pthread_mutex_lock(sub->client->deadmutex);
                 assert(ret == 0);
-            }
 
-            curSub = curSub->next;
-        }
-
-        // release read lock on subscribers list
-        ret = pthread_rwlock_unlock(topic->subscribers->listrwlock);
-        assert(ret == 0);
-
-        curTopic = curTopic->next;
-    }
-
-    // release read lock on topic list
-    ret = pthread_rwlock_unlock(topics->listrwlock);
-    assert(ret == 0);
-
-    // early exit, if none are dead, there's
-    // nothing to verify
-    if (list_empty(eligible)) {
-        return 0;
-    }
-
-    // acquire read lock on messages
-    ret = pthread_rwlock_rdlock(messages->listrwlock);
-    assert(ret == 0);
-
-    struct node *curMsg = messages->root;
-    while (curMsg != NULL) {
-        struct message *msg = curMsg->entry;
-
-        // acquire read lock on statistics list
-        ret = pthread_rwlock_rdlock(msg->stats->listrwlock);
-        assert(ret == 0);
-
-        struct node *curStat = msg->stats->root;
-        while (curStat != NULL) {
-            struct msg_statistics *stat = curStat->entry;
-
-            struct node *curSub = eligible->root;
-            while (curSub != NULL) {
-                struct subscriber *sub = curSub->entry;
+                // an attached client is still used by the
+                // connection, e.g. to drain its outbound queue
+                dead = sub->client->dead && !sub->client->attached;
+            
+                // release dead flag lock
+                ret = pthread_mutex_unlock(sub->client->deadmutex);
+                assert(ret == 0);
 
-                // there still is some statistic for
-                // this subscriber. gc will clean
-                // this up in the next pass
-                if (sub == stat->subscriber) {
-                    ret = list_remove(eligible, sub);   
+                // list_contains: subscriber could be subscribed
+                // to other topic as well
+                if (dead && !list_contains(eligible, sub)) {
+                    ret = list_add(eligible, sub);
                     assert(ret == 0);
                 }
-                
+
                 curSub = curSub->next;
             }
 
-            curStat = curStat->next;
+            // release read lock on subscribers list
+            ret = pthread_rwlock_unlock(topic->subscribers->listrwlock);
+            assert(ret == 0);
         }
 
-        // release read lock on statistics list
-        ret = pthread_rwlock_unlock(msg->stats->listrwlock);
+        // release read lock on shard
+        ret = pthread_rwlock_unlock(shard->rwlock);
         assert(ret == 0);
-        
-        curMsg = curMsg->next;
     }
 
-    // release read lock on messages
-    ret = pthread_rwlock_unlock(messages->listrwlock);
-    assert(ret == 0);
-
     return 0;
 }
 
-int gc_remove_eligible_stats(struct list *messages,
-                             struct list *eligible) {
-    int ret;
-
-    int nstats = 0;
-
-    // acquire read lock on message list
-    ret = pthread_rwlock_rdlock(messages->listrwlock);
-    assert(ret == 0);
-
-    struct node *curStat = eligible->root;
-    while (curStat != NULL) {
-
-        struct node *curMsg = messages->root;
-        while (curMsg != NULL) {
-            struct message *msg = curMsg->entry;
-
-            // acquire write lock on statistic
-            ret = pthread_rwlock_wrlock(msg->stats->listrwlock);
-            assert(ret == 0);
-
-            ret = list_remove(msg->stats, curStat->entry);
-            if (ret == 0) {
-                msg_statistics_destroy(curStat->entry);
-                nstats++;
-            } else {
-                assert(ret == LIST_NOT_FOUND);
-            }
-
-            // release write lock on statistic
-            ret = pthread_rwlock_unlock(msg->stats->listrwlock);
-            assert(ret == 0);
-
-
-            curMsg = curMsg->next;
-        }
-
-        curStat = curStat->next;
-    }
-
-    // release write lock on message list
-    ret = pthread_rwlock_unlock(messages->listrwlock);
-    assert(ret == 0);
-
-    return nstats;
-}
-
 int gc_remove_eligible_msgs(struct list *messages,
-                            struct list *eligible) {
+                            unsigned long offset) {
     int ret;
 
     int nmsgs = 0;
 
-    // acquire write lock on message list
+    // acquire write lock on log
     ret = pthread_rwlock_wrlock(messages->listrwlock);
     assert(ret == 0);
 
-    struct node *cur = eligible->root;
-    while (cur != NULL) {
-
-        ret = list_remove(messages, cur->entry);
-        if (ret == 0) {
-            message_destroy(cur->entry);
-            nmsgs++;
-        } else {
-            assert(ret == LIST_NOT_FOUND);
-        }
+    // the log is ordered by offset
+    while (messages->root != NULL) {
+        struct message *msg = messages->root->entry;
+        if (msg->offset >= offset) break;
 
-        cur = cur->next;
+        ret = list_remove(messages, msg);
+        assert(ret == 0);
+        message_destroy(msg);
+        free(msg);
+        nmsgs++;
     }
 
-    // release write lock on message list
+    // release write lock on log
     ret = pthread_rwlock_unlock(messages->listrwlock);
     assert(ret == 0);
 
     return nmsgs;
 }
 
-int gc_remove_eligible_subscribers(struct list *topics,
+int gc_remove_eligible_subscribers(struct topic_table *topics,
                                    struct list *eligible) {
     
     int ret;
 
-    // acquire read lock on topics
-    ret = pthread_rwlock_rdlock(topics->listrwlock);
-    assert(ret == 0);
+    size_t i, j;
+    for (i = 0; i < TOPIC_TABLE_SHARDS; i++) {
+        struct topic_shard *shard = &topics->shards[i];
 
-    struct node *curTopic = topics->root;
-    while (curTopic != NULL) {
-        struct topic *topic = curTopic->entry;
-
-        // this topic contains subscribers to remove
-        int has_subs;
-
-        // acquire read lock on subscribers to check
-        ret = pthread_rwlock_rdlock(topic->subscribers->listrwlock);
+        // acquire read lock on shard
+        ret = pthread_rwlock_rdlock(shard->rwlock);
         assert(ret == 0);
 
-        struct node *curSub = topic->subscribers->root;
-        while (curSub != NULL) {
-            struct subscriber *sub = curSub->entry;
+        for (j = 0; j < shard->ntopics; j++) {
+            struct topic *topic = shard->byid[j];
 
-            if (list_contains(eligible, sub)) {
-                has_subs = 1;
-                break;
-            } else {
-                has_subs = 0;
-            }
+            // this topic contains subscribers to remove
+            int has_subs = 0;
 
-            curSub = curSub->next;
-        }
-
-        // release read lock on subscribers
-        ret = pthread_rwlock_unlock(topic->subscribers->listrwlock);
-        assert(ret == 0);
-
-        // now we need the write lock to actually remove them
-        if (has_subs) {
-
-            // acquire write lock to remove subscribers
-            ret = pthread_rwlock_wrlock(topic->subscribers->listrwlock);
+            // acquire read lock on subscribers to check
+            ret = pthread_rwlock_rdlock(topic->subscribers->listrwlock);
             assert(ret == 0);
 
-            struct node *curSub = eligible->root;
+            struct node *curSub = topic->subscribers->root;
             while (curSub != NULL) {
-                struct subscriber *sub = curSub->entry;
+                struct subscription *sub = curSub->entry;
 
-                ret = list_remove(topic->subscribers, sub);
-                // not found is ok, as we are trying all
-                assert(ret == 0 || ret == LIST_NOT_FOUND);
+                if (list_contains(eligible, sub->subscriber)) {
+                    has_subs = 1;
+                    break;
+                } else {
+                    has_subs = 0;
+                }
 
                 curSub = curSub->next;
             }
 
-            // release write lock on subscribers
+            // release read lock on subscribers
             ret = pthread_rwlock_unlock(topic->subscribers->listrwlock);
             assert(ret == 0);
+
+            // now we need the write lock to actually remove them
+            if (has_subs) {
+
+                // acquire write lock to remove subscribers
+                ret = pthread_rwlock_wrlock(topic->subscribers->listrwlock);
+                assert(ret == 0);
+
+                struct node *curSub = topic->subscribers->root;
+                while (curSub != NULL) {
+                    struct subscription *sub = curSub->entry;
+                    curSub = curSub->next;
+
+                    if (list_contains(eligible, sub->subscriber)) {
+                        ret = list_remove(topic->subscribers, sub);
+                        assert(ret == 0);
+                        subscription_destroy(sub);
+                        free(sub);
+                    }
+                }
+
+                // release write lock on subscribers
+                ret = pthread_rwlock_unlock(topic->subscribers->listrwlock);
+                assert(ret == 0);
+            }
         }
-        
-        curTopic = curTopic->next;
-    }
 
-    // release read lock on topics
-    ret = pthread_rwlock_unlock(topics->listrwlock);
-    assert(ret == 0);
+        // release read lock on shard
+        ret = pthread_rwlock_unlock(shard->rwlock);
+        assert(ret == 0);
+    }
 
     return 0;
 }
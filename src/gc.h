@@ -7,55 +7,31 @@
 
 /* time to wait for until another 
  * attempt to clean all messages and
- * statistics by the garbage
+ * subscribers by the garbage
  * collector is made. */
 #define GC_PASS_TIMEOUT 1
 
-/* checks whether a statistics is eligible to
- * be garbage collected: client is dead, too many
- * attempts to deliver the message have already
- * been made or the message has successfully
- * been delivered. */
-int gc_eligible_stat(struct msg_statistics *stat);
-
-/* checks whether a message is eligible to
- * be garbage collected: the message has 
- * no statistics (those would be removed
- * beforehand) */
-int gc_eligible_msg(struct message *msg);
-
-/* collects all statistics to be garbage collected
- * in the second parameter */
-int gc_collect_eligible_stats(struct list *messages,
-                              struct list *eligible);
-
-/* collects all messages to be garbage collected
- * in the second parameter */
-int gc_collect_eligible_msgs(struct list *messages,
-                             struct list *eligible);
+/* returns the offset before which the messages of the
+ * topic are eligible to be garbage collected: each alive
+ * subscriber has either received them, given up on them
+ * or subscribed only after they were sent */
+unsigned long gc_eligible_offset(struct topic *topic);
 
 /* collects the subscribers eligible for garbage
- * collection in the eligible list (3rd param). a
- * client is eligible if it is dead and no statistics
- * point to it */
-int gc_collect_eligible_subscribers(struct list *topics,
-                                    struct list *messages,
+ * collection in the eligible list (2nd param). a
+ * client is eligible if it is dead and no longer
+ * attached to its connection */
+int gc_collect_eligible_subscribers(struct topic_table *topics,
                                     struct list *eligible);
 
-/* removes all statstics passed in the second
- * parameter from the messages list. returns
- * the number of statistics removed */
-int gc_remove_eligible_stats(struct list *messages,
-                             struct list *eligible);
-
-/* removes all messages passed in the second
- * parameter from the messages list. returns
- * the number of messages removed */
+/* removes the messages before the offset (2nd param)
+ * from the log and frees them. returns the number
+ * of messages removed */
 int gc_remove_eligible_msgs(struct list *messages,
-                            struct list *eligible);
+                            unsigned long offset);
 
 /* removes all subscribers (2nd param) from the topics */
-int gc_remove_eligible_subscribers(struct list *topics,
+int gc_remove_eligible_subscribers(struct topic_table *topics,
                                    struct list *eligible);
 
 /* destroys all subscribers and associated clients */
@@ -15,14 +15,30 @@ int list_init(struct list *list) {
     list->listrwlock = rwlock;
 
     list->root = NULL;
+    list->tail = NULL;
+    list->len = 0;
+    list->nodeoff = LIST_ALLOC;
 
     return 0;
 }
 
+int list_init_intrusive(struct list *list, size_t nodeoff) {
+    int ret = list_init(list);
+    list->nodeoff = nodeoff;
+    return ret;
+}
+
+void list_node_init(struct node *node) {
+    node->entry = NULL;
+    node->next = NULL;
+    node->prev = NULL;
+    node->list = NULL;
+}
+
 int list_destroy(struct list *list) {
 
     int ret;
-    
+
     assert(list->root == NULL);
 
     ret = pthread_rwlock_destroy(list->listrwlock);
@@ -31,24 +47,37 @@ int list_destroy(struct list *list) {
     list->listrwlock = NULL;
 
     list->root = NULL;
+    list->tail = NULL;
+    list->len = 0;
 
     return 0;
 }
 
+/* returns the node embedded in the entry */
+static struct node *embedded_node(struct list *list, const void *entry) {
+    return (struct node *) ((char *) entry + list->nodeoff);
+}
+
 int list_add(struct list *list, void *entry) {
-    if (list->root == NULL) {
-        list->root = malloc(sizeof (struct node));
-        assert(list->root != NULL);
-        list->root->entry = entry;
-        list->root->next = NULL;
+    struct node *node;
+
+    if (list->nodeoff == LIST_ALLOC) {
+        node = malloc(sizeof(struct node));
+        assert(node != NULL);
     } else {
-        struct node *cur = list->root;
-        for (;cur->next != NULL; cur = cur->next);
-        cur->next = malloc(sizeof(struct list));
-        assert(cur->next != NULL);
-        cur->next->entry = entry;
-        cur->next->next = NULL;
+        node = embedded_node(list, entry);
     }
+
+    node->entry = entry;
+    node->next = NULL;
+    node->prev = list->tail;
+    node->list = list;
+
+    if (list->tail == NULL) list->root = node;
+    else list->tail->next = node;
+    list->tail = node;
+    list->len++;
+
     return 0;
 }
 
@@ -58,14 +87,28 @@ int list_empty(struct list *list) {
 
 /* returns the number of elements in a list */
 int list_len(struct list *list) {
-    struct node *cur = list->root;
-    int n = 0;
-    for (; cur != NULL; cur = cur->next) {
-        n++;
-    }
-    return n;
+    return list->len;
 }
 
+/* takes the node out of the list and frees
+ * it, unless it is embedded in its entry */
+static void unlink_node(struct list *list, struct node *node) {
+    if (node->prev == NULL) list->root = node->next;
+    else node->prev->next = node->next;
+
+    if (node->next == NULL) list->tail = node->prev;
+    else node->next->prev = node->prev;
+
+    list->len--;
+
+    if (list->nodeoff == LIST_ALLOC) {
+        free(node);
+    } else {
+        node->next = NULL;
+        node->prev = NULL;
+        node->list = NULL;
+    }
+}
 
 /* removes an element from the list based on the
  * compare function. the third arg is passed
@@ -74,25 +117,12 @@ int list_len(struct list *list) {
 int list_remove_generic(struct list *list,
         int (*cmp)(const void *, const void *),
         const void *entry) {
-    // empty list
-    if (list->root == NULL) return LIST_NOT_FOUND;
-
-    // replace root
-    if (cmp(list->root->entry, entry)) {
-        struct node *nxt = list->root->next;
-        free(list->root);
-        list->root = nxt;
-        return 0;
-    }
-    struct node *prev = list->root;
-    struct node *cur = list->root->next;
+    struct node *cur = list->root;
     while (cur != NULL) {
         if (cmp(cur->entry, entry)) {
-            prev->next = cur->next;
-            free(cur);
+            unlink_node(list, cur);
             return 0;
         } else {
-            prev = cur;
             cur = cur->next;
         }
     }
@@ -104,26 +134,44 @@ static int list_cmp_same_ref(const void *a, const void *b) {
 }
 
 int list_remove(struct list *list, void *entry) {
-    return list_remove_generic(list, list_cmp_same_ref, entry);
+    struct node *node;
+
+    if (list->nodeoff == LIST_ALLOC)
+        return list_remove_generic(list, list_cmp_same_ref, entry);
+
+    node = embedded_node(list, entry);
+    if (node->list != list) return LIST_NOT_FOUND;
+    unlink_node(list, node);
+    return 0;
 }
 
 int list_clean(struct list *messages) {
     struct node *cur = messages->root;
     while (cur != NULL) {
         struct node *next = cur->next;
-        free(cur);
+        if (messages->nodeoff == LIST_ALLOC) {
+            free(cur);
+        } else {
+            cur->next = NULL;
+            cur->prev = NULL;
+            cur->list = NULL;
+        }
         cur = next;
     }
     messages->root = NULL;
+    messages->tail = NULL;
+    messages->len = 0;
     return 0;
 }
 
 int list_contains(struct list *list, void *entry) {
     struct node *cur = list->root;
+
+    if (list->nodeoff != LIST_ALLOC)
+        return embedded_node(list, entry)->list == list;
+
     for (; cur != NULL; cur = cur->next) {
         if (cur->entry == entry) return 1;
     }
     return 0;
 }
-
-
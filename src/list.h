@@ -1,8 +1,14 @@
 #ifndef LIST_HEADER
 #define LIST_HEADER
 
+#include <stddef.h>
+#include <pthread.h>
+
 #define LIST_NOT_FOUND -2
 
+/* node offset of a list that allocates its own nodes */
+#define LIST_ALLOC -1
+
 /* root node of a linked list */
 struct list {
 
@@ -17,6 +23,17 @@ struct list {
 
     /* root node of the linked list */
     struct node *root;
+
+    /* last node, entries are added after it */
+    struct node *tail;
+
+    /* number of nodes in the list */
+    int len;
+
+    /* offset of the node embedded in each entry (see
+     * list_init_intrusive) or LIST_ALLOC if the list
+     * allocates a node for each entry */
+    long nodeoff;
 };
 
 /* node in a list. guarded by
@@ -30,12 +47,30 @@ struct node {
 
     /* pointer to next node. null
      * if this node marks the end */
-    struct node *next;   
+    struct node *next;
+
+    /* pointer to the previous node,
+     * null if this is the root */
+    struct node *prev;
+
+    /* list the node is in, null if none */
+    struct list *list;
 };
 
 /* initialize the list*/
 int list_init(struct list *list);
 
+/* initialize a list whose entries embed the node that links
+ * them at the offset (e.g. offsetof(struct message, node)).
+ * adding and removing entries does not allocate and removing
+ * or finding an entry does not search the list. an entry can
+ * therefore only be in one such list at a time. the node must
+ * have been initialized with list_node_init */
+int list_init_intrusive(struct list *list, size_t nodeoff);
+
+/* initializes a node that is embedded in an entry */
+void list_node_init(struct node *node);
+
 /* frees the list. must be empty */
 int list_destroy(struct list *list);
 
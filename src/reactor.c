@@ -0,0 +1,1369 @@
+// for SO_REUSEPORT and __thread
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <assert.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <stddef.h>
+
+#include "reactor.h"
+
+/* frees a connection that is no longer served */
+static void release_connection(struct connection *conn) {
+    int ret;
+    struct client *client = conn->client;
+
+    // acquire lock for queue, a sender that has seen the
+    // client alive notifies the connection with it held
+    ret = pthread_mutex_lock(client->mutex_w);
+    assert(ret == 0);
+
+    // acquire lock for dead flag
+    ret = pthread_mutex_lock(client->deadmutex);
+    assert(ret == 0);
+
+    // nobody queues anything from now on
+    client->dead = 1;
+
+    // release lock for dead flag
+    ret = pthread_mutex_unlock(client->deadmutex);
+    assert(ret == 0);
+
+    // the connection is not to be notified once freed
+    client->wnotify = NULL;
+    client->owner = NULL;
+
+    // release lock for queue
+    ret = pthread_mutex_unlock(client->mutex_w);
+    assert(ret == 0);
+
+    // the error queue is gone with the socket, so this is the
+    // last chance to learn about completed zerocopy sends
+    if (client->zchead != NULL) socket_reap_zerocopy(client);
+
+    release_client(client, conn->sub, conn->connected);
+
+    free(conn->wiov);
+    free(conn);
+}
+
+static void uring_close_connection(struct connection *conn);
+
+static void close_connection(struct connection *conn) {
+    int ret;
+    struct reactor_thread *thread = conn->thread;
+
+    // no more heart-beats
+    timer_cancel(&thread->timers, &conn->hbtimer);
+
+    if (thread->reactor->backend == REACTOR_URING) {
+        uring_close_connection(conn);
+        return;
+    }
+
+    ret = epoll_ctl(thread->epfd, EPOLL_CTL_DEL, conn->client->sockfd, NULL);
+    if (ret != 0)
+        fprintf(stderr, "epoll_ctl: %s\n", strerror(errno));
+
+    if (conn->client->shm != NULL) {
+        ret = epoll_ctl(thread->epfd, EPOLL_CTL_DEL,
+            conn->client->shm->rxfd, NULL);
+        if (ret != 0)
+            fprintf(stderr, "epoll_ctl: %s\n", strerror(errno));
+    }
+
+    // acquire lock for queue, no one asks
+    // for a write after this
+    ret = pthread_mutex_lock(conn->client->mutex_w);
+    assert(ret == 0);
+
+    conn->closed = 1;
+
+    // release lock for queue
+    ret = pthread_mutex_unlock(conn->client->mutex_w);
+    assert(ret == 0);
+
+    // the events of this round may still refer
+    // to the connection, freed once they are done
+    conn->wnext = thread->closed;
+    thread->closed = conn;
+}
+
+/* registers the events we are interested in for a
+ * connection: readable unless it is closing and writable
+ * if there is something in the outbound queue */
+static int watch_connection(struct connection *conn, int op, int pending) {
+    struct epoll_event ev;
+
+    ev.events = 0;
+    if (!conn->closing) ev.events |= EPOLLIN | EPOLLRDHUP;
+    if (pending) ev.events |= EPOLLOUT;
+    ev.data.ptr = conn;
+
+    // the socket only tells whether the client has gone,
+    // everything else is signalled by the channel
+    if (conn->client->shm != NULL) ev.events = EPOLLRDHUP;
+
+    return epoll_ctl(conn->thread->epfd, op, conn->client->sockfd, &ev);
+}
+
+static void uring_notify_pending(struct connection *conn);
+
+/* wnotify of the client, invoked with mutex_w held */
+static void notify_pending(struct client *client, int pending) {
+    int ret;
+    struct connection *conn = client->owner;
+
+    // no longer watched, about to be freed
+    if (conn == NULL || conn->closed) return;
+
+    if (conn->thread->reactor->backend == REACTOR_URING) {
+        if (pending) uring_notify_pending(conn);
+        return;
+    }
+
+    if (client->shm != NULL) {
+        // the i/o thread waits for its end of the channel
+        if (pending) shm_kick(client->shm);
+        return;
+    }
+
+    ret = watch_connection(conn, EPOLL_CTL_MOD, pending);
+    if (ret != 0)
+        fprintf(stderr, "epoll_ctl: %s\n", strerror(errno));
+}
+
+/* fired once a closing connection has waited
+ * REACTOR_ZEROCOPY_LINGER for its zerocopy sends */
+static void linger_expired(struct timer *timer, long now) {
+    struct connection *conn = timer->arg;
+
+    (void) now;
+    fprintf(stderr, "Broker: Zerocopy sends have not completed\n");
+    close_connection(conn);
+}
+
+/* closes a closing connection whose outbound queue has been
+ * written. the kernel still sends from the frames of zerocopy
+ * sends it has not reported complete, so they must not be
+ * released, but it reports them through the error queue of
+ * the socket, which is gone once it is closed. the connection
+ * waits for the reports instead, REACTOR_ZEROCOPY_LINGER at
+ * most, EPOLLERR is reported without being asked for */
+static void finish_connection(struct connection *conn) {
+    int ret;
+    struct reactor_thread *thread = conn->thread;
+
+    if (conn->client->zchead != NULL)
+        socket_reap_zerocopy(conn->client);
+
+    if (conn->client->zchead == NULL) {
+        close_connection(conn);
+        return;
+    }
+
+    if (conn->lingering) return;
+    conn->lingering = 1;
+
+    // acquire lock for queue, a notify
+    // re-enables writing if need be
+    ret = pthread_mutex_lock(conn->client->mutex_w);
+    assert(ret == 0);
+
+    // neither reading nor writing anymore
+    if (socket_queue_depth(conn->client) == 0 &&
+            watch_connection(conn, EPOLL_CTL_MOD, 0) != 0)
+        fprintf(stderr, "epoll_ctl: %s\n", strerror(errno));
+
+    // release lock for queue
+    ret = pthread_mutex_unlock(conn->client->mutex_w);
+    assert(ret == 0);
+
+    // no more heart-beats, the timer bounds the wait instead
+    timer_cancel(&thread->timers, &conn->hbtimer);
+    timer_init(&conn->hbtimer, linger_expired, conn);
+    timer_arm(&thread->timers, &conn->hbtimer,
+        thread->now + REACTOR_ZEROCOPY_LINGER);
+}
+
+/* stops reading from the connection and closes it once
+ * everything queued (e.g. the RECEIPT) has been written
+ * and the kernel is done with the zerocopy sends */
+static void shutdown_connection(struct connection *conn) {
+    int ret, ret2;
+
+    // acquire lock for queue, so a concurrent
+    // notify does not re-enable reading
+    ret = pthread_mutex_lock(conn->client->mutex_w);
+    assert(ret == 0);
+
+    conn->closing = 1;
+    ret = socket_flush(conn->client);
+    if (ret == SOCKET_AGAIN)
+        watch_connection(conn, EPOLL_CTL_MOD, 1);
+
+    // release lock for queue
+    ret2 = pthread_mutex_unlock(conn->client->mutex_w);
+    assert(ret2 == 0);
+
+    if (ret != SOCKET_AGAIN)
+        finish_connection(conn);
+}
+
+/* writes the outbound queue of a connection that has
+ * become writable. returns 0 if the connection is still
+ * open and -1 if it has been closed or only waits for
+ * its zerocopy sends before it is (see finish_connection) */
+static int handle_writable(struct connection *conn) {
+    int ret;
+
+    ret = socket_flush(conn->client);
+
+    if (ret == SOCKET_CLIENT_GONE) {
+        close_connection(conn);
+        return -1;
+    }
+
+    if (ret == 0 && conn->closing) {
+        finish_connection(conn);
+        return -1;
+    }
+
+    conn->lastsent = conn->thread->now;
+    return 0;
+}
+
+/* arms the heart-beat timer of the connection for
+ * the next heart-beat to be sent or to be received */
+static void schedule_heartbeat(struct connection *conn) {
+    long deadline = -1, due;
+    struct client *client = conn->client;
+
+    if (client->hbsend > 0)
+        deadline = conn->lastsent + client->hbsend;
+
+    if (client->hbrecv > 0) {
+        due = conn->lastrecv + client->hbrecv * REACTOR_HEARTBEAT_GRACE;
+        if (deadline == -1 || due < deadline) deadline = due;
+    }
+
+    if (deadline != -1)
+        timer_arm(&conn->thread->timers, &conn->hbtimer, deadline);
+}
+
+/* fired by the heart-beat timer of a connection */
+static void heartbeat_due(struct timer *timer, long now) {
+    struct connection *conn = timer->arg;
+    struct client *client = conn->client;
+
+    if (client->hbrecv > 0 && now - conn->lastrecv >=
+            client->hbrecv * REACTOR_HEARTBEAT_GRACE) {
+        fprintf(stderr, "Broker: Client '%s' missed its heart-beats\n",
+            conn->sub->name);
+        close_connection(conn);
+        return;
+    }
+
+    // written once the socket is writable, just
+    // like anything else that is queued
+    if (client->hbsend > 0 && now - conn->lastsent >= client->hbsend) {
+        if (socket_send_heartbeat(client) != 0)
+            fprintf(stderr, "Failed to send heart-beat\n");
+        conn->lastsent = now;
+    }
+
+    schedule_heartbeat(conn);
+}
+
+/* starts the heart-beats once the client has
+ * agreed on them with CONNECT, if it has */
+static void start_heartbeat(struct connection *conn) {
+    if (!conn->connected) return;
+
+    conn->heartbeating = 1;
+    conn->lastrecv = conn->thread->now;
+    conn->lastsent = conn->thread->now;
+    schedule_heartbeat(conn);
+}
+
+/* invokes the main loop for a connection that
+ * has become readable (or was hung up, in which
+ * case the read in main_loop will fail) until all
+ * commands that have arrived have been handled */
+static void handle_readable(struct connection *conn) {
+    int ret;
+
+    do {
+        ret = main_loop(conn->thread->reactor->ctx, conn->client,
+            &conn->connected, conn->sub);
+    } while (ret == WORKER_CONTINUE);
+
+    if (ret == WORKER_STOP) {
+        shutdown_connection(conn);
+    } else if (ret != WORKER_WAIT) {
+        close_connection(conn);
+    } else {
+        if (!conn->heartbeating) start_heartbeat(conn);
+
+        // responses to the commands just handled can
+        // go out right away instead of waiting for
+        // the next round through epoll
+        if (socket_queue_depth(conn->client) > 0)
+            handle_writable(conn);
+    }
+}
+
+/* handles an event of a connection with a shared memory
+ * channel. it is either about the socket, which means the
+ * client has gone, or about the channel, which means
+ * there's something to read or space to write to */
+static void handle_shm_event(struct connection *conn, uint32_t events) {
+
+    if (events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+        close_connection(conn);
+        return;
+    }
+
+    // the client has either sent something or made
+    // space, either way it is still there
+    conn->lastrecv = conn->thread->now;
+
+    shm_clear(conn->client->shm);
+
+    // may have been waiting for space or been
+    // filled by another thread in the meantime
+    if (socket_queue_depth(conn->client) > 0) {
+        if (handle_writable(conn) != 0) return;
+    }
+
+    if (!conn->closing) handle_readable(conn);
+}
+
+static void handle_event(struct connection *conn, uint32_t events) {
+
+    // there may be an event for a connection that
+    // has been closed earlier in the same round
+    if (conn->closed) return;
+
+    if (conn->client->shm != NULL) {
+        handle_shm_event(conn, events);
+        return;
+    }
+
+    // completed zerocopy sends are reported as an error,
+    // which is not one if that is all there is
+    if ((events & EPOLLERR) && conn->client->zchead != NULL &&
+        socket_reap_zerocopy(conn->client) > 0)
+        events &= ~EPOLLERR;
+
+    if (events & EPOLLOUT) {
+        if (handle_writable(conn) != 0) return;
+    }
+
+    if (events & EPOLLIN) conn->lastrecv = conn->thread->now;
+
+    if (conn->closing) {
+        // only the queue is of interest now, but a
+        // hang up means it won't be written anyway
+        if (events & (EPOLLERR | EPOLLHUP)) close_connection(conn);
+        else if (conn->lingering && conn->client->zchead == NULL)
+            close_connection(conn);
+    } else if (events & (EPOLLIN | EPOLLRDHUP | EPOLLERR | EPOLLHUP)) {
+        handle_readable(conn);
+    }
+}
+
+/* creates the connection for a freshly accepted socket */
+static struct connection *new_connection(struct reactor_thread *thread,
+                                         int sockfd) {
+    int ret;
+
+    struct connection *conn = malloc(sizeof(struct connection));
+    assert(conn != NULL);
+    conn->client = malloc(sizeof(struct client));
+    assert(conn->client != NULL);
+    conn->sub = malloc(sizeof(struct subscriber));
+    assert(conn->sub != NULL);
+    conn->connected = 0;
+    conn->closing = 0;
+    conn->lingering = 0;
+    conn->thread = thread;
+    conn->heartbeating = 0;
+    conn->lastrecv = 0;
+    conn->lastsent = 0;
+    timer_init(&conn->hbtimer, heartbeat_due, conn);
+    conn->inflight = 0;
+    conn->receiving = 0;
+    conn->writing = 0;
+    conn->closed = 0;
+    conn->queued = 0;
+    conn->wnext = NULL;
+    conn->wiov = NULL;
+
+    client_init(conn->client);
+    conn->client->sockfd = sockfd;
+    conn->client->attached = 1;
+    conn->client->wnotify = notify_pending;
+    conn->client->owner = conn;
+    conn->client->heartbeat = thread->reactor->heartbeat;
+
+    if (thread->reactor->backend == REACTOR_URING) {
+        // the ring receives into the buffer and writes the
+        // queue, the socket itself is never touched directly
+        conn->client->rexternal = 1;
+        conn->wiov = malloc(SOCKET_WQUEUE_IOV * sizeof(struct iovec));
+        assert(conn->wiov != NULL);
+    } else {
+        // main_loop must return once all commands have
+        // been read instead of blocking the i/o thread
+        ret = fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL) | O_NONBLOCK);
+        assert(ret == 0);
+
+        // large frames are sent without copying, if configured
+        socket_enable_zerocopy(conn->client);
+    }
+
+    return conn;
+}
+
+/* adds a connection for the socket to the i/o thread. if
+ * shm is set, the client is passed a shared memory channel */
+static int add_connection(struct reactor_thread *thread, int sockfd,
+                          int shm) {
+    int ret = 0;
+    struct epoll_event ev;
+    struct connection *conn = new_connection(thread, sockfd);
+
+    if (shm) {
+        ret = socket_offer_shm(conn->client, SHM_DEFAULT_RING_SIZE);
+
+        ev.events = EPOLLIN;
+        ev.data.ptr = conn;
+        if (ret == 0) {
+            ret = epoll_ctl(thread->epfd, EPOLL_CTL_ADD,
+                conn->client->shm->rxfd, &ev);
+            if (ret != 0)
+                fprintf(stderr, "epoll_ctl: %s\n", strerror(errno));
+        }
+    }
+
+    if (ret == 0) {
+        ret = watch_connection(conn, EPOLL_CTL_ADD, 0);
+        if (ret != 0)
+            fprintf(stderr, "epoll_ctl: %s\n", strerror(errno));
+    }
+
+    if (ret != 0) {
+        if (conn->client->shm != NULL)
+            epoll_ctl(thread->epfd, EPOLL_CTL_DEL,
+                conn->client->shm->rxfd, NULL);
+        socket_terminate_client(conn->client);
+        client_destroy(conn->client);
+        free(conn->client);
+        free(conn->sub);
+        free(conn);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* accepts pending connections on a listening socket of
+ * the thread. at most REACTOR_MAX_EVENTS are accepted at
+ * once, so a connection storm does not starve the clients
+ * that are already connected. the rest is reported by
+ * epoll again in the next round */
+static void accept_connections(struct reactor_thread *thread, int fd) {
+    int i, cli;
+
+    for (i = 0; i < REACTOR_MAX_EVENTS; i++) {
+        cli = accept(fd, NULL, NULL);
+        if (cli == -1) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                fprintf(stderr, "accept: %s\n", strerror(errno));
+            return;
+        }
+
+        if (add_connection(thread, cli, fd == thread->shmfd) != 0) {
+            fprintf(stderr, "Failed to add client to reactor\n");
+            close(cli);
+        }
+    }
+}
+
+/* what has completed is encoded in the low bits of the
+ * user data, the rest is the connection or the thread */
+#define OP_RECEIVE     0
+#define OP_WRITE       1
+#define OP_ACCEPT      2
+#define OP_WAKE        3
+#define OP_ACCEPT_UNIX 4
+#define OP_MASK        7
+
+/* connection whose completion is being handled by the
+ * current thread. the i/o thread looks at the outbound
+ * queue of that connection afterwards anyway */
+static __thread struct connection *dispatching = NULL;
+
+static struct io_uring_sqe *prepare(struct reactor_thread *thread,
+                                    int opcode, int fd,
+                                    void *ptr, int op) {
+    struct io_uring_sqe *sqe = uring_get_sqe(thread->ring);
+    if (sqe == NULL) return NULL;
+
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->user_data = (uint64_t) (uintptr_t) ptr | op;
+
+    return sqe;
+}
+
+/* receives into the free space of the receive buffer */
+static int start_receive(struct connection *conn) {
+    char *buf;
+    size_t len;
+    struct io_uring_sqe *sqe;
+
+    if (socket_read_space(conn->client, &buf, &len) != 0) return -1;
+
+    sqe = prepare(conn->thread, IORING_OP_RECV,
+        conn->client->sockfd, conn, OP_RECEIVE);
+    if (sqe == NULL) return -1;
+    sqe->addr = (uint64_t) (uintptr_t) buf;
+    sqe->len = len;
+
+    conn->receiving = 1;
+    conn->inflight++;
+
+    return 0;
+}
+
+/* writes the outbound queue, unless a write is
+ * already in flight or there is nothing to write */
+static int start_write(struct connection *conn) {
+    int iovcnt;
+    struct io_uring_sqe *sqe;
+
+    if (conn->writing) return 0;
+
+    iovcnt = socket_write_space(conn->client, conn->wiov);
+    if (iovcnt == 0) return 0;
+
+    memset(&conn->wmsg, 0, sizeof(struct msghdr));
+    conn->wmsg.msg_iov = conn->wiov;
+    conn->wmsg.msg_iovlen = iovcnt;
+
+    sqe = prepare(conn->thread, IORING_OP_SENDMSG,
+        conn->client->sockfd, conn, OP_WRITE);
+    if (sqe == NULL) return -1;
+    sqe->addr = (uint64_t) (uintptr_t) &conn->wmsg;
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL;
+
+    conn->writing = 1;
+    conn->inflight++;
+
+    return 0;
+}
+
+/* accepts on the tcp (OP_ACCEPT) or the
+ * unix (OP_ACCEPT_UNIX) listening socket */
+static int start_accept(struct reactor_thread *thread, int op) {
+    int fd = op == OP_ACCEPT ? thread->listenfd : thread->unixfd;
+
+    if (prepare(thread, IORING_OP_ACCEPT, fd, thread, op) == NULL)
+        return -1;
+
+    if (op == OP_ACCEPT) thread->accepting = 1;
+    else thread->accepting_unix = 1;
+    return 0;
+}
+
+static int start_wake(struct reactor_thread *thread) {
+    struct io_uring_sqe *sqe = prepare(thread, IORING_OP_READ,
+        thread->wakefd, thread, OP_WAKE);
+    if (sqe == NULL) return -1;
+
+    sqe->addr = (uint64_t) (uintptr_t) &thread->wakebuf;
+    sqe->len = sizeof(thread->wakebuf);
+
+    return 0;
+}
+
+/* hands the connection to its i/o thread, which starts
+ * receiving if it has not done so yet and writes the
+ * outbound queue. invoked by other threads */
+static void defer_connection(struct connection *conn) {
+    int ret, wake = 0;
+    uint64_t one = 1;
+    struct reactor_thread *thread = conn->thread;
+
+    // acquire lock for pending connections
+    ret = pthread_mutex_lock(thread->wmutex);
+    assert(ret == 0);
+
+    if (!conn->queued) {
+        wake = thread->wpending == NULL;
+        conn->queued = 1;
+        conn->wnext = thread->wpending;
+        thread->wpending = conn;
+    }
+
+    // release lock for pending connections
+    ret = pthread_mutex_unlock(thread->wmutex);
+    assert(ret == 0);
+
+    // one wake up for any number of connections
+    if (wake && write(thread->wakefd, &one, sizeof(one)) != sizeof(one))
+        fprintf(stderr, "write: %s\n", strerror(errno));
+}
+
+/* invoked with mutex_w held */
+static void uring_notify_pending(struct connection *conn) {
+
+    // the thread itself writes the queue once it has
+    // handled the completion. if the connection has been
+    // closed, the thread is no longer interested
+    if (dispatching == conn || conn->closed) return;
+
+    defer_connection(conn);
+}
+
+static void uring_close_connection(struct connection *conn) {
+    int ret;
+    struct connection **cur;
+    struct reactor_thread *thread = conn->thread;
+
+    // acquire lock for queue, no one asks
+    // for a write after this
+    ret = pthread_mutex_lock(conn->client->mutex_w);
+    assert(ret == 0);
+
+    conn->closed = 1;
+
+    // release lock for queue
+    ret = pthread_mutex_unlock(conn->client->mutex_w);
+    assert(ret == 0);
+
+    // acquire lock for pending connections
+    ret = pthread_mutex_lock(thread->wmutex);
+    assert(ret == 0);
+
+    if (conn->queued) {
+        for (cur = &thread->wpending; *cur != conn; cur = &(*cur)->wnext);
+        *cur = conn->wnext;
+        conn->queued = 0;
+    }
+
+    // release lock for pending connections
+    ret = pthread_mutex_unlock(thread->wmutex);
+    assert(ret == 0);
+
+    if (conn->inflight > 0) {
+        // the operations in flight still use the buffers of
+        // the connection, make them complete before freeing
+        shutdown(conn->client->sockfd, SHUT_RDWR);
+    } else {
+        release_connection(conn);
+    }
+}
+
+/* stops receiving and closes the connection once
+ * everything queued (e.g. the RECEIPT) has been written */
+static void uring_shutdown_connection(struct connection *conn) {
+    conn->closing = 1;
+
+    if (start_write(conn) != 0 || !conn->writing)
+        close_connection(conn);
+}
+
+/* hands what has been received to main_loop, just
+ * like handle_readable does for the epoll backend */
+static void handle_receive(struct connection *conn, int res) {
+    int ret;
+
+    conn->inflight--;
+    conn->receiving = 0;
+
+    if (conn->closed) {
+        if (conn->inflight == 0) release_connection(conn);
+        return;
+    }
+
+    if (res == -EINTR || res == -EAGAIN) {
+        if (start_receive(conn) != 0) close_connection(conn);
+        return;
+    }
+
+    if (res > 0) {
+        socket_read_commit(conn->client, res);
+        conn->lastrecv = conn->thread->now;
+    } else if (res < 0) {
+        fprintf(stderr, "recv: %s\n", strerror(-res));
+    }
+
+    // commands that arrived before a hang up are still handled
+    do {
+        ret = main_loop(conn->thread->reactor->ctx, conn->client,
+            &conn->connected, conn->sub);
+    } while (ret == WORKER_CONTINUE);
+
+    if (ret == WORKER_STOP) {
+        uring_shutdown_connection(conn);
+    } else if (ret != WORKER_WAIT || res <= 0) {
+        close_connection(conn);
+    } else if (start_receive(conn) != 0 || start_write(conn) != 0) {
+        close_connection(conn);
+    } else if (!conn->heartbeating) {
+        start_heartbeat(conn);
+    }
+}
+
+/* removes what has been written from the outbound queue
+ * and continues with the rest, if there is any */
+static void handle_write(struct connection *conn, int res) {
+    size_t depth;
+
+    conn->inflight--;
+    conn->writing = 0;
+
+    if (conn->closed) {
+        if (conn->inflight == 0) release_connection(conn);
+        return;
+    }
+
+    if (res == -EINTR || res == -EAGAIN) {
+        if (start_write(conn) != 0) close_connection(conn);
+        return;
+    } else if (res < 0) {
+        fprintf(stderr, "sendmsg: %s\n", strerror(-res));
+        close_connection(conn);
+        return;
+    }
+
+    depth = socket_write_commit(conn->client, res);
+    conn->lastsent = conn->thread->now;
+
+    if (depth > 0) {
+        if (start_write(conn) != 0) close_connection(conn);
+    } else if (conn->closing) {
+        close_connection(conn);
+    }
+}
+
+static void handle_accept(struct reactor_thread *thread, int res, int op) {
+    struct connection *conn;
+
+    if (op == OP_ACCEPT) thread->accepting = 0;
+    else thread->accepting_unix = 0;
+
+    if (res >= 0) {
+        conn = new_connection(thread, res);
+        if (start_receive(conn) != 0) close_connection(conn);
+    } else if (res != -EINTR && res != -EAGAIN && res != -ECONNABORTED) {
+        fprintf(stderr, "accept: %s\n", strerror(-res));
+    }
+
+    if (start_accept(thread, op) != 0)
+        fprintf(stderr, "Failed to accept on listener\n");
+}
+
+/* looks at the connections other threads have handed
+ * over (see defer_connection) */
+static void handle_wake(struct reactor_thread *thread) {
+    int ret, listenfd, unixfd;
+    struct connection *conn;
+
+    while (1) {
+        // acquire lock for pending connections
+        ret = pthread_mutex_lock(thread->wmutex);
+        assert(ret == 0);
+
+        conn = thread->wpending;
+        if (conn != NULL) {
+            thread->wpending = conn->wnext;
+            conn->queued = 0;
+        }
+        listenfd = thread->listenfd;
+        unixfd = thread->unixfd;
+
+        // release lock for pending connections
+        ret = pthread_mutex_unlock(thread->wmutex);
+        assert(ret == 0);
+
+        if (conn == NULL) break;
+
+        // new connections are not receiving yet
+        if ((!conn->receiving && !conn->closing &&
+             start_receive(conn) != 0) || start_write(conn) != 0) {
+            close_connection(conn);
+        }
+    }
+
+    if (listenfd != -1 && !thread->accepting &&
+        start_accept(thread, OP_ACCEPT) != 0)
+        fprintf(stderr, "Failed to accept on listener\n");
+
+    if (unixfd != -1 && !thread->accepting_unix &&
+        start_accept(thread, OP_ACCEPT_UNIX) != 0)
+        fprintf(stderr, "Failed to accept on unix listener\n");
+
+    if (start_wake(thread) != 0)
+        fprintf(stderr, "Failed to wait for wake ups\n");
+}
+
+/* io_uring counterpart of the epoll loop in reactor_run_once */
+static int uring_run_once(struct reactor_thread *thread, int timeout) {
+    int n = 0, res;
+    uint64_t data;
+    void *ptr;
+    struct io_uring_cqe *cqe;
+
+    // submits what has been prepared and waits for completions
+    if (uring_enter(thread->ring, 1, timeout) != 0) return 0;
+    thread->now = timer_now();
+
+    while ((cqe = uring_peek_cqe(thread->ring)) != NULL) {
+        data = cqe->user_data;
+        res = cqe->res;
+        uring_cqe_seen(thread->ring);
+
+        ptr = (void *) (uintptr_t) (data & ~(uint64_t) OP_MASK);
+
+        switch (data & OP_MASK) {
+            case OP_RECEIVE:
+                dispatching = ptr;
+                handle_receive(ptr, res);
+                dispatching = NULL;
+                break;
+            case OP_WRITE:
+                dispatching = ptr;
+                handle_write(ptr, res);
+                dispatching = NULL;
+                break;
+            case OP_ACCEPT:
+            case OP_ACCEPT_UNIX:
+                handle_accept(ptr, res, data & OP_MASK);
+                break;
+            case OP_WAKE:
+                handle_wake(ptr);
+                break;
+        }
+
+        n++;
+    }
+
+    timers_run(&thread->timers, timer_now());
+
+    // everything prepared while handling the completions
+    // goes to the kernel with one syscall
+    uring_enter(thread->ring, 0, 0);
+
+    return n;
+}
+
+int reactor_run_once(struct reactor_thread *thread, int timeout) {
+    int i, nevents, due;
+    struct connection *conn;
+    struct epoll_event events[REACTOR_MAX_EVENTS];
+
+    // wake up in time for the next timer
+    due = timers_timeout(&thread->timers, timer_now());
+    if (due != -1 && (timeout == -1 || due < timeout)) timeout = due;
+
+    if (thread->reactor->backend == REACTOR_URING)
+        return uring_run_once(thread, timeout);
+
+    nevents = epoll_wait(thread->epfd, events,
+        REACTOR_MAX_EVENTS, timeout);
+    if (nevents == -1) {
+        if (errno != EINTR)
+            fprintf(stderr, "epoll_wait: %s\n", strerror(errno));
+        nevents = 0;
+    }
+    thread->now = timer_now();
+
+    for (i = 0; i < nevents; i++) {
+        if (events[i].data.ptr == &thread->listenfd)
+            accept_connections(thread, thread->listenfd);
+        else if (events[i].data.ptr == &thread->unixfd)
+            accept_connections(thread, thread->unixfd);
+        else if (events[i].data.ptr == &thread->shmfd)
+            accept_connections(thread, thread->shmfd);
+        else
+            handle_event(events[i].data.ptr, events[i].events);
+    }
+
+    timers_run(&thread->timers, timer_now());
+
+    // no event refers to the connections closed anymore
+    while ((conn = thread->closed) != NULL) {
+        thread->closed = conn->wnext;
+        release_connection(conn);
+    }
+
+    return nevents;
+}
+
+void *reactor_main_loop(void *arg) {
+    struct reactor_thread *thread = arg;
+
+    while (1) {
+        reactor_run_once(thread, -1);
+    }
+
+    return 0;
+}
+
+int reactor_add_client(struct reactor *reactor, int sockfd) {
+    int ret;
+    struct reactor_thread *thread;
+
+    // acquire lock for round robin
+    ret = pthread_mutex_lock(reactor->mutex);
+    assert(ret == 0);
+
+    thread = &reactor->threads[reactor->next];
+    reactor->next = (reactor->next + 1) % reactor->nthreads;
+
+    // release lock for round robin
+    ret = pthread_mutex_unlock(reactor->mutex);
+    assert(ret == 0);
+
+    if (reactor->backend == REACTOR_URING) {
+        // only the i/o thread may submit to its ring
+        defer_connection(new_connection(thread, sockfd));
+        return 0;
+    }
+
+    return add_connection(thread, sockfd, 0);
+}
+
+/* creates a listening socket bound to the port */
+static int listen_socket(int port, int backlog, int nonblock) {
+    int sockfd, ret, on = 1;
+    struct sockaddr_in srvaddr;
+
+    sockfd = socket(PF_INET, SOCK_STREAM, 0);
+    if (sockfd < 0) {
+        fprintf(stderr, "socket: %s\n", strerror(errno));
+        return -1;
+    }
+
+    // each shard binds its own socket to the same port
+    ret = setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+    if (ret != 0) {
+        fprintf(stderr, "setsockopt: %s\n", strerror(errno));
+        close(sockfd);
+        return -1;
+    }
+
+    memset(&srvaddr, 0, sizeof(srvaddr));
+    srvaddr.sin_family = AF_INET;
+    srvaddr.sin_addr.s_addr = INADDR_ANY;
+    srvaddr.sin_port = htons(port);
+
+    ret = bind(sockfd, (struct sockaddr *) &srvaddr, sizeof(srvaddr));
+    if (ret != 0) {
+        fprintf(stderr, "bind: %s\n", strerror(errno));
+        close(sockfd);
+        return -1;
+    }
+
+    ret = listen(sockfd, backlog);
+    if (ret != 0) {
+        fprintf(stderr, "listen: %s\n", strerror(errno));
+        close(sockfd);
+        return -1;
+    }
+
+    // accepting must not block the i/o thread,
+    // unless the ring accepts asynchronously
+    if (nonblock) {
+        ret = fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL) | O_NONBLOCK);
+        assert(ret == 0);
+    }
+
+    return sockfd;
+}
+
+int reactor_listen(struct reactor *reactor, int port, int backlog) {
+    int i, ret, sockfd;
+    struct epoll_event ev;
+    struct sockaddr_in addr;
+    socklen_t addrlen = sizeof(addr);
+
+    for (i = 0; i < reactor->nthreads; i++) {
+        struct reactor_thread *thread = &reactor->threads[i];
+
+        sockfd = listen_socket(port, backlog,
+            reactor->backend == REACTOR_EPOLL);
+        if (sockfd == -1) return -1;
+
+        if (port == 0) {
+            // all other shards join the port picked by the kernel
+            ret = getsockname(sockfd, (struct sockaddr *) &addr, &addrlen);
+            assert(ret == 0);
+            port = ntohs(addr.sin_port);
+        }
+
+        if (reactor->backend == REACTOR_URING) {
+            // acquire lock for listening socket
+            ret = pthread_mutex_lock(thread->wmutex);
+            assert(ret == 0);
+
+            thread->listenfd = sockfd;
+
+            // release lock for listening socket
+            ret = pthread_mutex_unlock(thread->wmutex);
+            assert(ret == 0);
+
+            // the thread starts accepting once woken up
+            uint64_t one = 1;
+            if (write(thread->wakefd, &one, sizeof(one)) != sizeof(one)) {
+                fprintf(stderr, "write: %s\n", strerror(errno));
+                return -1;
+            }
+            continue;
+        }
+
+        thread->listenfd = sockfd;
+
+        // the field of the thread identifies its listening socket
+        ev.events = EPOLLIN;
+        ev.data.ptr = &thread->listenfd;
+        ret = epoll_ctl(thread->epfd, EPOLL_CTL_ADD, sockfd, &ev);
+        if (ret != 0) {
+            fprintf(stderr, "epoll_ctl: %s\n", strerror(errno));
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/* creates a unix domain socket listening on the path, see
+ * reactor_listen_unix for the abstract namespace */
+static int listen_unix_socket(const char *path, int backlog, int nonblock) {
+    int sockfd, ret;
+    socklen_t addrlen;
+    struct sockaddr_un srvaddr;
+    size_t len = strlen(path);
+
+    memset(&srvaddr, 0, sizeof(srvaddr));
+    srvaddr.sun_family = AF_UNIX;
+
+    if (path[0] == '@') {
+        // the name starts after the leading null byte
+        // and is not null terminated itself
+        if (len > sizeof(srvaddr.sun_path)) {
+            fprintf(stderr, "Unix socket name too long: %s\n", path);
+            return -1;
+        }
+        memcpy(srvaddr.sun_path + 1, path + 1, len - 1);
+        addrlen = offsetof(struct sockaddr_un, sun_path) + len;
+    } else {
+        if (len >= sizeof(srvaddr.sun_path)) {
+            fprintf(stderr, "Unix socket path too long: %s\n", path);
+            return -1;
+        }
+        memcpy(srvaddr.sun_path, path, len);
+        addrlen = sizeof(srvaddr);
+
+        // left behind by an earlier run
+        if (unlink(path) != 0 && errno != ENOENT) {
+            fprintf(stderr, "unlink: %s\n", strerror(errno));
+            return -1;
+        }
+    }
+
+    sockfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sockfd < 0) {
+        fprintf(stderr, "socket: %s\n", strerror(errno));
+        return -1;
+    }
+
+    ret = bind(sockfd, (struct sockaddr *) &srvaddr, addrlen);
+    if (ret != 0) {
+        fprintf(stderr, "bind: %s\n", strerror(errno));
+        close(sockfd);
+        return -1;
+    }
+
+    ret = listen(sockfd, backlog);
+    if (ret != 0) {
+        fprintf(stderr, "listen: %s\n", strerror(errno));
+        close(sockfd);
+        return -1;
+    }
+
+    if (nonblock) {
+        ret = fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL) | O_NONBLOCK);
+        assert(ret == 0);
+    }
+
+    return sockfd;
+}
+
+int reactor_listen_unix(struct reactor *reactor, const char *path,
+                        int backlog) {
+    int i, ret, sockfd;
+    uint64_t one = 1;
+    struct epoll_event ev;
+
+    assert(reactor->unixfd == -1);
+
+    sockfd = listen_unix_socket(path, backlog,
+        reactor->backend == REACTOR_EPOLL);
+    if (sockfd == -1) return -1;
+
+    reactor->unixfd = sockfd;
+    if (path[0] != '@') {
+        reactor->unixpath = strdup(path);
+        assert(reactor->unixpath != NULL);
+    }
+
+    // unix sockets cannot be sharded with SO_REUSEPORT,
+    // so every thread accepts on the same socket
+    for (i = 0; i < reactor->nthreads; i++) {
+        struct reactor_thread *thread = &reactor->threads[i];
+
+        if (reactor->backend == REACTOR_URING) {
+            // acquire lock for listening socket
+            ret = pthread_mutex_lock(thread->wmutex);
+            assert(ret == 0);
+
+            thread->unixfd = sockfd;
+
+            // release lock for listening socket
+            ret = pthread_mutex_unlock(thread->wmutex);
+            assert(ret == 0);
+
+            // the thread starts accepting once woken up
+            if (write(thread->wakefd, &one, sizeof(one)) != sizeof(one)) {
+                fprintf(stderr, "write: %s\n", strerror(errno));
+                return -1;
+            }
+            continue;
+        }
+
+        thread->unixfd = sockfd;
+
+        // only one of the threads is woken up per connection
+        ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+        ev.data.ptr = &thread->unixfd;
+        ret = epoll_ctl(thread->epfd, EPOLL_CTL_ADD, sockfd, &ev);
+        if (ret != 0) {
+            fprintf(stderr, "epoll_ctl: %s\n", strerror(errno));
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+int reactor_listen_shm(struct reactor *reactor, const char *path,
+                       int backlog) {
+    int i, ret, sockfd;
+    struct epoll_event ev;
+
+    assert(reactor->shmfd == -1);
+
+    if (reactor->backend != REACTOR_EPOLL) {
+        fprintf(stderr, "Shared memory requires epoll\n");
+        return -1;
+    }
+
+    sockfd = listen_unix_socket(path, backlog, 1);
+    if (sockfd == -1) return -1;
+
+    reactor->shmfd = sockfd;
+    if (path[0] != '@') {
+        reactor->shmpath = strdup(path);
+        assert(reactor->shmpath != NULL);
+    }
+
+    // shared by all threads, just like the unix listener
+    for (i = 0; i < reactor->nthreads; i++) {
+        struct reactor_thread *thread = &reactor->threads[i];
+
+        thread->shmfd = sockfd;
+
+        ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+        ev.data.ptr = &thread->shmfd;
+        ret = epoll_ctl(thread->epfd, EPOLL_CTL_ADD, sockfd, &ev);
+        if (ret != 0) {
+            fprintf(stderr, "epoll_ctl: %s\n", strerror(errno));
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+int reactor_use_uring(struct reactor *reactor) {
+    int i, ret;
+    struct reactor_thread *thread;
+
+    for (i = 0; i < reactor->nthreads; i++) {
+        thread = &reactor->threads[i];
+
+        thread->ring = malloc(sizeof(struct uring));
+        assert(thread->ring != NULL);
+        ret = uring_init(thread->ring, REACTOR_URING_ENTRIES);
+        if (ret != 0) {
+            free(thread->ring);
+            thread->ring = NULL;
+            return ret;
+        }
+
+        thread->wakefd = eventfd(0, 0);
+        if (thread->wakefd == -1) {
+            fprintf(stderr, "eventfd: %s\n", strerror(errno));
+            return -1;
+        }
+
+        pthread_mutex_t *wmutex = malloc(sizeof(pthread_mutex_t));
+        assert(wmutex != NULL);
+        ret = pthread_mutex_init(wmutex, NULL);
+        assert(ret == 0);
+        thread->wmutex = wmutex;
+
+        // the thread is not running yet, so we may submit
+        if (start_wake(thread) != 0 || uring_enter(thread->ring, 0, 0) != 0)
+            return -1;
+    }
+
+    reactor->backend = REACTOR_URING;
+
+    return 0;
+}
+
+int reactor_start(struct reactor *reactor) {
+    int i, ret;
+
+    for (i = 0; i < reactor->nthreads; i++) {
+        ret = pthread_create(&reactor->threads[i].thread, NULL,
+            &reactor_main_loop, &reactor->threads[i]);
+        if (ret != 0) {
+            fprintf(stderr, "pthread_create: %s\n", strerror(ret));
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+int reactor_init(struct reactor *reactor,
+                 struct broker_context *ctx,
+                 int nthreads) {
+    int i, ret;
+
+    assert(nthreads > 0);
+
+    reactor->ctx = ctx;
+    reactor->backend = REACTOR_EPOLL;
+    reactor->nthreads = nthreads;
+    reactor->heartbeat = REACTOR_DEFAULT_HEARTBEAT;
+    reactor->next = 0;
+    reactor->unixfd = -1;
+    reactor->unixpath = NULL;
+    reactor->shmfd = -1;
+    reactor->shmpath = NULL;
+
+    pthread_mutex_t *mutex = malloc(sizeof(pthread_mutex_t));
+    assert(mutex != NULL);
+    ret = pthread_mutex_init(mutex, NULL);
+    assert(ret == 0);
+    reactor->mutex = mutex;
+
+    reactor->threads = malloc(nthreads * sizeof(struct reactor_thread));
+    assert(reactor->threads != NULL);
+
+    for (i = 0; i < nthreads; i++) {
+        reactor->threads[i].reactor = reactor;
+        reactor->threads[i].listenfd = -1;
+        reactor->threads[i].accepting = 0;
+        reactor->threads[i].unixfd = -1;
+        reactor->threads[i].accepting_unix = 0;
+        reactor->threads[i].shmfd = -1;
+        reactor->threads[i].closed = NULL;
+        timers_init(&reactor->threads[i].timers);
+        reactor->threads[i].now = timer_now();
+        reactor->threads[i].ring = NULL;
+        reactor->threads[i].wakefd = -1;
+        reactor->threads[i].wpending = NULL;
+        reactor->threads[i].wmutex = NULL;
+        reactor->threads[i].epfd = epoll_create1(0);
+        if (reactor->threads[i].epfd == -1) {
+            fprintf(stderr, "epoll_create1: %s\n", strerror(errno));
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+void reactor_set_heartbeat(struct reactor *reactor, long heartbeat) {
+    reactor->heartbeat = heartbeat;
+}
+
+int reactor_destroy(struct reactor *reactor) {
+    int i, ret;
+
+    for (i = 0; i < reactor->nthreads; i++) {
+        struct reactor_thread *thread = &reactor->threads[i];
+
+        if (thread->listenfd != -1) close(thread->listenfd);
+        close(thread->epfd);
+        timers_destroy(&thread->timers);
+
+        if (thread->ring != NULL) {
+            uring_destroy(thread->ring);
+            free(thread->ring);
+        }
+        if (thread->wakefd != -1) close(thread->wakefd);
+        if (thread->wmutex != NULL) {
+            ret = pthread_mutex_destroy(thread->wmutex);
+            assert(ret == 0);
+            free(thread->wmutex);
+        }
+    }
+    free(reactor->threads);
+    reactor->threads = NULL;
+
+    if (reactor->unixfd != -1) close(reactor->unixfd);
+    reactor->unixfd = -1;
+    if (reactor->unixpath != NULL) {
+        unlink(reactor->unixpath);
+        free(reactor->unixpath);
+        reactor->unixpath = NULL;
+    }
+
+    if (reactor->shmfd != -1) close(reactor->shmfd);
+    reactor->shmfd = -1;
+    if (reactor->shmpath != NULL) {
+        unlink(reactor->shmpath);
+        free(reactor->shmpath);
+        reactor->shmpath = NULL;
+    }
+
+    ret = pthread_mutex_destroy(reactor->mutex);
+    assert(ret == 0);
+    free(reactor->mutex);
+    reactor->mutex = NULL;
+
+    return 0;
+}
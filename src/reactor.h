@@ -0,0 +1,319 @@
+#ifndef REACTOR_HEADER
+#define REACTOR_HEADER
+
+/* the reactor multiplexes all client connections
+ * over a small, fixed number of i/o threads rather
+ * than spawning a thread per client. each i/o thread
+ * owns an epoll instance and the connections that
+ * have been assigned to it. whenever a connection
+ * becomes readable, the thread invokes main_loop
+ * for that connection, which means the state of a
+ * connection (connected flag, subscriber) has to
+ * live in the connection struct rather than on the
+ * stack of a worker thread.
+ *
+ * each i/o thread is also a listener shard: it owns a
+ * listening socket bound to the same port with SO_REUSEPORT,
+ * so the kernel spreads incoming connections across the
+ * threads and every thread accepts into its own connection
+ * set. there is no single accept thread to serialize on.
+ * clients on the same host may connect through a unix
+ * domain socket instead (see reactor_listen_unix), which
+ * all threads accept on and skips the tcp stack entirely.
+ * those connecting to the shm listener instead (see
+ * reactor_listen_shm) exchange commands through shared
+ * memory (see shm.h), which doesn't even take a syscall
+ * as long as both sides are busy.
+ *
+ * instead of epoll, the reactor may use io_uring (see
+ * reactor_use_uring). then, each thread keeps a receive
+ * and, if there is something in the outbound queue, a
+ * write in flight for each of its connections and submits
+ * all of them with a single syscall per round, which also
+ * collects the completions. commands are parsed from the
+ * receive buffer just the same.
+ *
+ * each i/o thread also keeps the timers of its connections
+ * (see timer.h) and waits no longer than until the next one
+ * is due. they send heart-beats to the clients that have
+ * asked for them and close the connections of those that
+ * have promised to send them but have been silent for too
+ * long, which marks them dead right away instead of once a
+ * write fails after the tcp retransmits have given up.
+ *
+ * commands sent to a client are queued by the socket
+ * layer. the reactor is notified when a queue becomes
+ * non-empty and writes it out from the i/o thread once
+ * the socket is writable, so no other thread ever
+ * blocks on a slow client.
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "topic.h"
+#include "broker.h"
+#include "uring.h"
+#include "timer.h"
+
+/* i/o backends */
+#define REACTOR_EPOLL 0
+#define REACTOR_URING 1
+
+/* default number of i/o threads */
+#define REACTOR_DEFAULT_THREADS 4
+
+/* maximum number of events fetched from
+ * the kernel with a single epoll_wait */
+#define REACTOR_MAX_EVENTS 64
+
+/* default length of the queue of pending
+ * connections of each listening socket */
+#define REACTOR_DEFAULT_BACKLOG SOMAXCONN
+
+/* number of submission queue entries of
+ * each ring if io_uring is used */
+#define REACTOR_URING_ENTRIES 256
+
+/* default number of milliseconds heart-beats are
+ * offered at (see reactor_set_heartbeat) */
+#define REACTOR_DEFAULT_HEARTBEAT 5000
+
+/* a client that has promised heart-beats is taken for
+ * dead once it has been silent for this many intervals */
+#define REACTOR_HEARTBEAT_GRACE 2
+
+/* number of milliseconds a closing connection waits for the
+ * kernel to report its zerocopy sends complete, it is closed
+ * anyway after that (see socket_reap_zerocopy) */
+#define REACTOR_ZEROCOPY_LINGER 1000
+
+struct reactor_thread;
+
+/* state of a client connection that is
+ * kept between two invocations of main_loop */
+struct connection {
+
+    /* client information, socket */
+    struct client *client;
+
+    /* subscriber created at login */
+    struct subscriber *sub;
+
+    /* whether the client has sent CONNECT */
+    int connected;
+
+    /* whether the connection is to be closed once
+     * the outbound queue has been written */
+    int closing;
+
+    /* whether the outbound queue of a closing connection
+     * has been written and it only waits for its zerocopy
+     * sends to complete. hbtimer bounds the wait then */
+    int lingering;
+
+    /* i/o thread serving this connection */
+    struct reactor_thread *thread;
+
+    /* whether the heart-beats agreed on with CONNECT
+     * have been started, if there are any */
+    int heartbeating;
+
+    /* fires once a heart-beat is to be sent or the
+     * client is overdue, armed in the timers of the thread */
+    struct timer hbtimer;
+
+    /* when something has last been received from
+     * and been written to the client */
+    long lastrecv;
+    long lastsent;
+
+    /* whether the connection has been closed. set with
+     * mutex_w of the client held, so no one can ask for
+     * a write afterwards. with epoll, the connection is
+     * only freed at the end of the round, as there may
+     * be more events for it (see 'closed' of the thread) */
+    int closed;
+
+    /* the following is used by the io_uring backend only */
+
+    /* number of operations in flight. the connection
+     * is freed once it is closed and this drops to 0 */
+    int inflight;
+
+    /* whether a receive or write is in flight */
+    int receiving;
+    int writing;
+
+    /* whether the connection is waiting in the list of
+     * the thread to be handled (see 'wpending'). with epoll,
+     * wnext links the connections closed in this round */
+    int queued;
+    struct connection *wnext;
+
+    /* the write in flight, must outlive the submission */
+    struct iovec *wiov;
+    struct msghdr wmsg;
+};
+
+struct reactor;
+
+/* one i/o thread of the reactor */
+struct reactor_thread {
+
+    /* the reactor this thread belongs to */
+    struct reactor *reactor;
+
+    /* epoll instance holding the connections
+     * that are served by this thread */
+    int epfd;
+
+    /* listening socket of this shard, -1 if none */
+    int listenfd;
+
+    /* whether an accept is in flight (io_uring only) */
+    int accepting;
+
+    /* unix domain socket shared by all threads, -1 if
+     * none. guarded by wmutex just like listenfd */
+    int unixfd;
+
+    /* whether an accept on it is in flight (io_uring only) */
+    int accepting_unix;
+
+    /* unix domain socket for clients that want a shared
+     * memory channel, shared by all threads, -1 if none */
+    int shmfd;
+
+    /* connections closed in the current round (epoll only) */
+    struct connection *closed;
+
+    /* timers of the connections served by this thread */
+    struct timers timers;
+
+    /* time the current round has started at (see timer_now) */
+    long now;
+
+    /* thread running reactor_main_loop */
+    pthread_t thread;
+
+    /* the following is used by the io_uring backend only */
+
+    /* ring all operations are submitted to */
+    struct uring *ring;
+
+    /* eventfd to wake up the thread with, a read
+     * from it is always in flight */
+    int wakefd;
+    uint64_t wakebuf;
+
+    /* connections other threads want the thread to
+     * look at: new ones and those with something to
+     * write. guarded by wmutex, just like listenfd
+     * once the thread is running */
+    struct connection *wpending;
+    pthread_mutex_t *wmutex;
+};
+
+struct reactor {
+
+    /* global ctx */
+    struct broker_context *ctx;
+
+    /* REACTOR_EPOLL or REACTOR_URING */
+    int backend;
+
+    /* number of i/o threads */
+    int nthreads;
+
+    /* number of milliseconds heart-beats are offered at,
+     * 0 if none */
+    long heartbeat;
+
+    /* i/o threads */
+    struct reactor_thread *threads;
+
+    /* guards next */
+    pthread_mutex_t *mutex;
+
+    /* thread to assign the next connection to */
+    int next;
+
+    /* unix domain socket all threads accept on, -1 if
+     * none, and the path it is bound to. the path is NULL
+     * if it lives in the abstract namespace */
+    int unixfd;
+    char *unixpath;
+
+    /* the same for the shm listener */
+    int shmfd;
+    char *shmpath;
+};
+
+/* initializes a reactor with the specified number of
+ * i/o threads. the threads are not yet started */
+int reactor_init(struct reactor *reactor,
+                 struct broker_context *ctx,
+                 int nthreads);
+
+/* switches the i/o threads from epoll to io_uring. must
+ * be invoked before the reactor gets any connections or
+ * listens. returns 0 on success, URING_UNSUPPORTED if the
+ * kernel does not support it (the reactor keeps using
+ * epoll then) or -1 on failure */
+int reactor_use_uring(struct reactor *reactor);
+
+/* sets the number of milliseconds heart-beats are offered
+ * at to the clients that ask for them in CONNECT, 0 turns
+ * them off. must be invoked before the reactor gets any
+ * connections */
+void reactor_set_heartbeat(struct reactor *reactor, long heartbeat);
+
+/* destroys a reactor. must not be running */
+int reactor_destroy(struct reactor *reactor);
+
+/* starts all i/o threads */
+int reactor_start(struct reactor *reactor);
+
+/* binds one listening socket per i/o thread to the port
+ * (with SO_REUSEPORT) and registers it with the epoll
+ * instance of the thread. if port is 0, the port chosen
+ * for the first socket is used by all others. backlog
+ * is the queue length of each socket */
+int reactor_listen(struct reactor *reactor, int port, int backlog);
+
+/* binds a unix domain socket to the path and has all i/o
+ * threads accept on it. connections are served exactly like
+ * those that arrive over tcp. a path starting with '@' is
+ * bound in the abstract namespace (without the '@'), which
+ * leaves no file behind. otherwise an existing file at the
+ * path is removed first and the file is removed again when
+ * the reactor is destroyed. can be invoked once */
+int reactor_listen_unix(struct reactor *reactor, const char *path,
+                        int backlog);
+
+/* like reactor_listen_unix, but every client connecting to
+ * the socket is passed a shared memory channel right away
+ * (see shm.h), which all commands go through from then on.
+ * only available with epoll, returns -1 for io_uring */
+int reactor_listen_shm(struct reactor *reactor, const char *path,
+                       int backlog);
+
+/* hands a freshly accepted socket to one of the
+ * i/o threads, which serves it from then on */
+int reactor_add_client(struct reactor *reactor, int sockfd);
+
+/* waits at most timeout milliseconds (-1 for ever) for
+ * events on the connections of an i/o thread and handles
+ * them. returns the number of events (or completions if
+ * io_uring is used) handled. to be
+ * invoked by 'reactor_main_loop' continuously. */
+int reactor_run_once(struct reactor_thread *thread, int timeout);
+
+/* main loop of an i/o thread. accepts param of
+ * type 'struct reactor_thread' */
+void *reactor_main_loop(void *arg);
+
+#endif
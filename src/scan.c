@@ -0,0 +1,122 @@
+#include <stddef.h>
+
+#include "scan.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define SCAN_X86
+#endif
+
+static char *scan_scalar(const char *p, size_t len, const char set[4]) {
+    const char *end = p + len;
+
+    for (; p < end; p++) {
+        if (*p == set[0] || *p == set[1] || *p == set[2] || *p == set[3])
+            return (char *) p;
+    }
+
+    return NULL;
+}
+
+#ifdef SCAN_X86
+
+/* SSE2 is part of x86-64, so this is always available */
+static char *scan_sse2(const char *p, size_t len, const char set[4]) {
+    const char *end = p + len;
+    __m128i s0 = _mm_set1_epi8(set[0]);
+    __m128i s1 = _mm_set1_epi8(set[1]);
+    __m128i s2 = _mm_set1_epi8(set[2]);
+    __m128i s3 = _mm_set1_epi8(set[3]);
+    __m128i v, eq;
+    int mask;
+
+    for (; end - p >= 16; p += 16) {
+        v = _mm_loadu_si128((const __m128i *) p);
+        eq = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(v, s0), _mm_cmpeq_epi8(v, s1)),
+            _mm_or_si128(_mm_cmpeq_epi8(v, s2), _mm_cmpeq_epi8(v, s3)));
+
+        // one bit per byte, the lowest one is the first match
+        mask = _mm_movemask_epi8(eq);
+        if (mask != 0) return (char *) p + __builtin_ctz(mask);
+    }
+
+    return scan_scalar(p, end - p, set);
+}
+
+__attribute__((target("avx2")))
+static char *scan_avx2(const char *p, size_t len, const char set[4]) {
+    const char *end = p + len;
+    __m256i s0 = _mm256_set1_epi8(set[0]);
+    __m256i s1 = _mm256_set1_epi8(set[1]);
+    __m256i s2 = _mm256_set1_epi8(set[2]);
+    __m256i s3 = _mm256_set1_epi8(set[3]);
+    __m256i v, eq;
+    unsigned int mask;
+
+    for (; end - p >= 32; p += 32) {
+        v = _mm256_loadu_si256((const __m256i *) p);
+        eq = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, s0),
+                            _mm256_cmpeq_epi8(v, s1)),
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, s2),
+                            _mm256_cmpeq_epi8(v, s3)));
+
+        mask = _mm256_movemask_epi8(eq);
+        if (mask != 0) return (char *) p + __builtin_ctz(mask);
+    }
+
+    // less than 32 bytes left. mixing AVX with SSE is
+    // slow unless the upper halves are cleared first,
+    // which the compiler leaves out for the tail call
+    _mm256_zeroupper();
+    return scan_sse2(p, end - p, set);
+}
+
+#endif
+
+/* implementation in use and the function that implements it */
+static int impl = SCAN_SCALAR;
+static char *(*scan_fn)(const char *, size_t, const char *) = scan_scalar;
+
+/* picks the fastest implementation before main runs,
+ * so nothing scans while it is being changed */
+__attribute__((constructor))
+static void scan_select() {
+    if (scan_use(SCAN_AVX2) != 0 && scan_use(SCAN_SSE2) != 0)
+        scan_use(SCAN_SCALAR);
+}
+
+/* see header for doc */
+char *scan_find(const char *p, size_t len, const char set[4]) {
+    return scan_fn(p, len, set);
+}
+
+/* see header for doc */
+int scan_use(int which) {
+    switch (which) {
+        case SCAN_SCALAR:
+            scan_fn = scan_scalar;
+            break;
+#ifdef SCAN_X86
+        case SCAN_SSE2:
+            scan_fn = scan_sse2;
+            break;
+        case SCAN_AVX2:
+            __builtin_cpu_init();
+            if (!__builtin_cpu_supports("avx2")) return -1;
+            scan_fn = scan_avx2;
+            break;
+#endif
+        default:
+            return -1;
+    }
+
+    impl = which;
+    return 0;
+}
+
+/* see header for doc */
+int scan_impl() {
+    return impl;
+}
@@ -0,0 +1,38 @@
+#ifndef SCAN_HEADER
+#define SCAN_HEADER
+
+/* scan.h
+ *
+ * finds the bytes that delimit the parts of a frame:
+ * the null byte that ends it, the line breaks and the
+ * colons between keys and values. instead of looking
+ * at one byte after the other, 16 (SSE2) or 32 (AVX2)
+ * bytes are compared against all delimiters at once.
+ * which implementation is used is decided at runtime
+ * based on what the cpu supports, the scalar one is
+ * used where neither is available.
+ */
+
+#include <stddef.h>
+
+/* implementations of the scanner */
+#define SCAN_SCALAR 0
+#define SCAN_SSE2   1
+#define SCAN_AVX2   2
+
+/* returns a pointer to the first of the len bytes at p
+ * that is any of the four bytes in set or null if there
+ * is none. to look for fewer, repeat one of them */
+char *scan_find(const char *p, size_t len, const char set[4]);
+
+/* switches to the implementation (SCAN_), e.g. to compare
+ * them. the fastest one the cpu supports is used unless
+ * this is called. returns 0 on success and -1 if the cpu
+ * does not support it. must not be called while others
+ * are scanning */
+int scan_use(int impl);
+
+/* returns the implementation (SCAN_) in use */
+int scan_impl();
+
+#endif
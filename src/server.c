@@ -10,14 +10,14 @@
 #include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <pthread.h>
+#include <signal.h>
 
 #include "topic.h"
 #include "broker.h"
 #include "gc.h"
 #include "distributor.h"
+#include "reactor.h"
 
-#define MAXPENDING 10
-#define BUFSIZE    1024
 #define DEFAULT_PORT 55664
 
 #define EXIT    1
@@ -28,11 +28,22 @@ void show_error(char *fun) {
         fun, strerror(errno));
 }
 
-/* starts the socket listener, waits for
- * incoming clients and accepts commands
- * from them.
+/* starts the socket listeners. every i/o thread of
+ * the reactor gets its own listening socket, accepts
+ * incoming clients and serves them from then on. if
+ * unixpath is not NULL, the threads additionally
+ * accept on a unix domain socket bound to it and the
+ * same goes for shmpath, whose clients are passed a
+ * shared memory channel.
  */
-int handle_clients(int port, struct broker_context *ctx);
+int handle_clients(int port, int backlog, const char *unixpath,
+                   const char *shmpath, struct broker_context *ctx);
+
+/* starts the i/o threads of the reactor, using
+ * io_uring instead of epoll if uring is set. heart-beats
+ * are offered every heartbeat milliseconds */
+int start_reactor(int nthreads, int uring, long heartbeat,
+                  struct broker_context *ctx);
 
 /* starts the garbage collecting thread */
 int start_gc(struct broker_context *ctx);
@@ -41,25 +52,129 @@ int start_gc(struct broker_context *ctx);
 int start_distributor(struct broker_context *ctx);
 
 /* threads for all components */
-static pthread_t handler_thread;
 static pthread_t gc_thread;
 static pthread_t distributor_thread;
 
+/* serves all client connections */
+static struct reactor reactor;
+
+static void usage(char *prog) {
+    fprintf(stderr, "usage: %s [-p port] [-t iothreads] [-b backlog] "
+        "[-i epoll|uring] [-m maxframe] [-z zerocopy] [-k heartbeat] "
+        "[-u path] [-r path] [port]\n", prog);
+    fprintf(stderr, "\tport: port to listen on (default %d)\n",
+        DEFAULT_PORT);
+    fprintf(stderr, "\tiothreads: number of i/o threads and listener "
+        "shards (default: number of cores)\n");
+    fprintf(stderr, "\tbacklog: pending connections per shard "
+        "(default %d)\n", REACTOR_DEFAULT_BACKLOG);
+    fprintf(stderr, "\ti/o backend: epoll (default) or uring, which "
+        "falls back to epoll if the kernel does not support it\n");
+    fprintf(stderr, "\tmaxframe: maximum size of a command in bytes "
+        "(default %d)\n", SOCKET_DEFAULT_MAX_FRAME);
+    fprintf(stderr, "\tzerocopy: size in bytes from which on frames are "
+        "sent with MSG_ZEROCOPY over tcp (default 0, which is off, "
+        "epoll only)\n");
+    fprintf(stderr, "\theartbeat: milliseconds heart-beats are offered "
+        "at to clients that ask for them (default %d, 0 is off)\n",
+        REACTOR_DEFAULT_HEARTBEAT);
+    fprintf(stderr, "\t-u path: unix domain socket to listen on in "
+        "addition to the port, '@name' for the abstract namespace\n");
+    fprintf(stderr, "\t-r path: like -u, but clients exchange commands "
+        "with the broker through shared memory (epoll only)\n");
+}
+
 
 int main(int argc, char** argv) {
 
-    int port;
-    if (argc != 2) {
+    int opt;
+    int port = -1;
+    int backlog = REACTOR_DEFAULT_BACKLOG;
+    int uring = 0;
+    long heartbeat = REACTOR_DEFAULT_HEARTBEAT;
+    char *unixpath = NULL;
+    char *shmpath = NULL;
+
+    // one shard per core
+    int nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (nthreads < 1) nthreads = REACTOR_DEFAULT_THREADS;
+
+    while ((opt = getopt(argc, argv, "p:t:b:i:m:z:k:u:r:h")) != -1) {
+        switch (opt) {
+            case 'p':
+                port = atoi(optarg);
+                break;
+            case 't':
+                nthreads = atoi(optarg);
+                break;
+            case 'b':
+                backlog = atoi(optarg);
+                break;
+            case 'm':
+                if (atol(optarg) < 1) {
+                    usage(argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+                socket_set_max_frame(atol(optarg));
+                break;
+            case 'z':
+                if (atol(optarg) < 0) {
+                    usage(argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+                socket_set_zerocopy(atol(optarg));
+                break;
+            case 'k':
+                heartbeat = atol(optarg);
+                if (heartbeat < 0) {
+                    usage(argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'u':
+                unixpath = optarg;
+                break;
+            case 'r':
+                shmpath = optarg;
+                break;
+            case 'i':
+                if (strcmp(optarg, "uring") == 0) {
+                    uring = 1;
+                } else if (strcmp(optarg, "epoll") != 0) {
+                    usage(argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            default:
+                usage(argv[0]);
+                exit(opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+    }
+
+    // port used to be the only (positional) argument
+    if (optind < argc) {
+        port = atoi(argv[optind]);
+    }
+
+    if (port == -1) {
         port = DEFAULT_PORT;
         fprintf(stderr, "Usng default port %d\n", port);
-    } else {
-        port = atoi(argv[1]);
     }
 
+    if (nthreads < 1 || backlog < 1) {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    // a client that has gone away must not take
+    // the broker down, writing to it fails instead
+    signal(SIGPIPE, SIG_IGN);
+
     struct broker_context ctx;
     broker_context_init(&ctx);
 
-    if (handle_clients(port, &ctx) == 0 &&
+    if (start_reactor(nthreads, uring, heartbeat, &ctx) == 0 &&
+        handle_clients(port, backlog, unixpath, shmpath, &ctx) == 0 &&
         start_gc(&ctx) == 0 &&
         start_distributor(&ctx) == 0) {
         fprintf(stderr, "All components started successfully\n");
@@ -69,75 +184,83 @@ int main(int argc, char** argv) {
         exit(EXIT_FAILURE);
     }
 
-    pthread_join(handler_thread, NULL);
     pthread_join(gc_thread, NULL);
     pthread_join(distributor_thread, NULL);
+    for (int i = 0; i < reactor.nthreads; i++)
+        pthread_join(reactor.threads[i].thread, NULL);
 }
 
-static void * start_handler(void *arg) {
-    int cli;
-    struct sockaddr_in clientaddr;
-    socklen_t clilen = sizeof(clientaddr);
-    struct handler_params *params = arg;
-
-    while (1) {
-        cli = accept(params->sock,
-                     (struct sockaddr *) &clientaddr,
-                     &clilen);
-        if (cli == -1) {
-            show_error("start_handler/accept");
-            continue;
-        }
+int handle_clients(int port, int backlog, const char *unixpath,
+                   const char *shmpath, struct broker_context *ctx) {
+    int ret;
 
-        struct handler_params client_handler_params;
-        client_handler_params.ctx = params->ctx;
-        client_handler_params.sock = cli;
+    fprintf(stderr, "Starting %d listener shards.. ", reactor.nthreads);
+
+    ret = reactor_listen(&reactor, port, backlog);
+    if (ret != 0) {
+        fprintf(stderr, "Failed to start listeners\n");
+        return -1;
+    }
+    fprintf(stderr, "success\n");
+
+    if (unixpath != NULL) {
+        fprintf(stderr, "Starting unix listener.. ");
+        ret = reactor_listen_unix(&reactor, unixpath, backlog);
+        if (ret != 0) {
+            fprintf(stderr, "Failed to start unix listener\n");
+            return -1;
+        }
+        fprintf(stderr, "success\n");
+        fprintf(stderr, "Waiting for clients to connect on %s\n", unixpath);
+    }
 
-        pthread_t handler_thread;
-        pthread_create(&handler_thread, NULL,
-            &handle_client, &client_handler_params);
+    if (shmpath != NULL) {
+        fprintf(stderr, "Starting shm listener.. ");
+        ret = reactor_listen_shm(&reactor, shmpath, backlog);
+        if (ret != 0) {
+            fprintf(stderr, "Failed to start shm listener\n");
+            return -1;
+        }
+        fprintf(stderr, "success\n");
+        fprintf(stderr, "Waiting for clients to connect on %s\n", shmpath);
     }
 
+    fprintf(stderr, "Waiting for clients to connect on port %d\n", port);
     return 0;
 }
 
-int handle_clients(int port, struct broker_context *ctx) {
+int start_reactor(int nthreads, int uring, long heartbeat,
+                  struct broker_context *ctx) {
+    int ret;
+
+    fprintf(stderr, "Starting reactor with %d i/o threads.. ", nthreads);
 
-    int sockfd, ret;
-    struct sockaddr_in srvaddr;
-    struct handler_params *params =
-        malloc(sizeof(struct handler_params));
-    if (params == NULL) {
-        show_error("handle_clients/socket");
+    ret = reactor_init(&reactor, ctx, nthreads);
+    if (ret != 0) {
+        fprintf(stderr, "Failed to initialize reactor\n");
         return -1;
     }
 
-    // init socket
-    sockfd = socket(PF_INET, SOCK_STREAM, 0);
-    if (sockfd < 0) { show_error("handle_clients/socket"); return -1; }
-
-    memset(&srvaddr, 0, sizeof(srvaddr));
-    srvaddr.sin_family = AF_INET;
-    srvaddr.sin_addr.s_addr = INADDR_ANY;
-    srvaddr.sin_port = htons(port);
-
-    ret = bind(sockfd, (struct sockaddr *) &srvaddr, sizeof(srvaddr));
-    if (ret != 0) { show_error("handle_clients/bind"); return -1; }
-
-    ret = listen(sockfd, MAXPENDING);
-    if (ret != 0) { show_error("handle_clients/listen"); return -1; }
-
-    params->ctx = ctx;
-    params->sock = sockfd;
+    reactor_set_heartbeat(&reactor, heartbeat);
+
+    if (uring) {
+        ret = reactor_use_uring(&reactor);
+        if (ret == URING_UNSUPPORTED) {
+            fprintf(stderr, "io_uring not supported, using epoll.. ");
+        } else if (ret != 0) {
+            fprintf(stderr, "Failed to set up io_uring\n");
+            return -1;
+        } else {
+            fprintf(stderr, "using io_uring.. ");
+        }
+    }
 
-    ret = pthread_create(&handler_thread, NULL, &start_handler, params);
+    ret = reactor_start(&reactor);
     if (ret != 0) {
-        show_error("handle_clients/pthread_create");
-        fprintf(stderr, "Failed to start client handler\n");
+        fprintf(stderr, "Failed to start reactor\n");
         return -1;
     } else {
-        fprintf(stderr, "Waiting for clients to connect on port %d\n", port);
-        fprintf(stderr, "Successfully started client handler\n");
+        fprintf(stderr, "success\n");
         return 0;
     }
 }
@@ -0,0 +1,380 @@
+// for syscall and SCM_RIGHTS
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <assert.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include <linux/memfd.h>
+
+#include "shm.h"
+
+#define SHM_MAGIC 0x53544f4d
+
+/* beginning of the shared memory, followed by the
+ * bytes of the two rings */
+struct shm_header {
+    uint32_t magic;
+    uint32_t size;
+    char pad[56];
+
+    /* from the client to the broker and back */
+    struct shm_ring rings[2];
+};
+
+/* number of file descriptors passed with shm_send */
+#define SHM_NFDS 3
+
+/* points the rings of the channel into the memory. the
+ * broker reads the first ring and the client the second */
+static void map_rings(struct shm_channel *ch, int broker) {
+    struct shm_header *header = ch->mem;
+    char *data = (char *) ch->mem + sizeof(struct shm_header);
+
+    ch->rx = &header->rings[broker ? 0 : 1];
+    ch->rxdata = data + (broker ? 0 : ch->size);
+    ch->tx = &header->rings[broker ? 1 : 0];
+    ch->txdata = data + (broker ? ch->size : 0);
+}
+
+static void wake(int fd) {
+    uint64_t one = 1;
+
+    // the counter can't overflow, nothing to do if this fails
+    if (write(fd, &one, sizeof(one)) != sizeof(one))
+        fprintf(stderr, "write: %s\n", strerror(errno));
+}
+
+int shm_create(struct shm_channel *ch, uint32_t size) {
+    struct shm_header *header;
+
+    assert(size > 0 && (size & (size - 1)) == 0);
+
+    ch->size = size;
+    ch->memlen = sizeof(struct shm_header) + 2 * (size_t) size;
+    ch->mem = MAP_FAILED;
+    ch->rxfd = -1;
+    ch->txfd = -1;
+
+    ch->memfd = syscall(__NR_memfd_create, "message-broker", MFD_CLOEXEC);
+    if (ch->memfd == -1) {
+        fprintf(stderr, "memfd_create: %s\n", strerror(errno));
+        return -1;
+    }
+
+    if (ftruncate(ch->memfd, ch->memlen) != 0) {
+        fprintf(stderr, "ftruncate: %s\n", strerror(errno));
+        shm_destroy(ch);
+        return -1;
+    }
+
+    ch->mem = mmap(NULL, ch->memlen, PROT_READ | PROT_WRITE,
+        MAP_SHARED, ch->memfd, 0);
+    if (ch->mem == MAP_FAILED) {
+        fprintf(stderr, "mmap: %s\n", strerror(errno));
+        shm_destroy(ch);
+        return -1;
+    }
+
+    ch->rxfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    ch->txfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (ch->rxfd == -1 || ch->txfd == -1) {
+        fprintf(stderr, "eventfd: %s\n", strerror(errno));
+        shm_destroy(ch);
+        return -1;
+    }
+
+    // the memory of a fresh memfd is zeroed. both sides
+    // wait for the first bytes before they have read any
+    header = ch->mem;
+    header->magic = SHM_MAGIC;
+    header->size = size;
+    header->rings[0].consumer_waiting = 1;
+    header->rings[1].consumer_waiting = 1;
+
+    map_rings(ch, 1);
+
+    return 0;
+}
+
+int shm_send(struct shm_channel *ch, int sockfd) {
+    ssize_t n;
+    char tag = 'S';
+    int fds[SHM_NFDS] = { ch->memfd, ch->rxfd, ch->txfd };
+    char control[CMSG_SPACE(sizeof(fds))];
+    struct iovec iov;
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+
+    iov.iov_base = &tag;
+    iov.iov_len = 1;
+
+    memset(&msg, 0, sizeof(msg));
+    memset(control, 0, sizeof(control));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    do {
+        n = sendmsg(sockfd, &msg, MSG_NOSIGNAL);
+    } while (n == -1 && errno == EINTR);
+
+    if (n != 1) {
+        fprintf(stderr, "sendmsg: %s\n", strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+int shm_receive(struct shm_channel *ch, int sockfd) {
+    ssize_t n;
+    char tag;
+    int fds[SHM_NFDS];
+    char control[CMSG_SPACE(sizeof(fds))];
+    struct iovec iov;
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+    struct stat st;
+    struct shm_header *header;
+
+    iov.iov_base = &tag;
+    iov.iov_len = 1;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    do {
+        n = recvmsg(sockfd, &msg, MSG_CMSG_CLOEXEC);
+    } while (n == -1 && errno == EINTR);
+
+    if (n == -1) {
+        fprintf(stderr, "recvmsg: %s\n", strerror(errno));
+        return -1;
+    }
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET ||
+            cmsg->cmsg_type != SCM_RIGHTS)
+        return SHM_INVALID;
+
+    if (n != 1 || tag != 'S' || cmsg->cmsg_len != CMSG_LEN(sizeof(fds))) {
+        // don't leak whatever has been passed along
+        int *fd = (int *) CMSG_DATA(cmsg);
+        int *end = (int *) ((char *) cmsg + cmsg->cmsg_len);
+        for (; fd < end; fd++) close(*fd);
+        return SHM_INVALID;
+    }
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+
+    // what the broker reads from, we write to and vice versa
+    ch->memfd = fds[0];
+    ch->txfd = fds[1];
+    ch->rxfd = fds[2];
+    ch->mem = MAP_FAILED;
+
+    if (fstat(ch->memfd, &st) != 0 ||
+            (size_t) st.st_size < sizeof(struct shm_header)) {
+        shm_destroy(ch);
+        return SHM_INVALID;
+    }
+    ch->memlen = st.st_size;
+
+    ch->mem = mmap(NULL, ch->memlen, PROT_READ | PROT_WRITE,
+        MAP_SHARED, ch->memfd, 0);
+    if (ch->mem == MAP_FAILED) {
+        fprintf(stderr, "mmap: %s\n", strerror(errno));
+        shm_destroy(ch);
+        return -1;
+    }
+
+    header = ch->mem;
+    ch->size = header->size;
+    if (header->magic != SHM_MAGIC || ch->size == 0 ||
+            (ch->size & (ch->size - 1)) != 0 ||
+            ch->memlen != sizeof(struct shm_header) + 2 * (size_t) ch->size) {
+        shm_destroy(ch);
+        return SHM_INVALID;
+    }
+
+    map_rings(ch, 0);
+
+    return 0;
+}
+
+void shm_destroy(struct shm_channel *ch) {
+    if (ch->mem != MAP_FAILED) munmap(ch->mem, ch->memlen);
+    ch->mem = MAP_FAILED;
+
+    if (ch->memfd != -1) close(ch->memfd);
+    if (ch->rxfd != -1) close(ch->rxfd);
+    if (ch->txfd != -1) close(ch->txfd);
+    ch->memfd = -1;
+    ch->rxfd = -1;
+    ch->txfd = -1;
+}
+
+ssize_t shm_writev(struct shm_channel *ch, const struct iovec *iov,
+                   int iovcnt) {
+    int i;
+    size_t total = 0, n, first;
+    struct shm_ring *ring = ch->tx;
+    uint32_t head = ring->head;
+    uint32_t used = head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    uint32_t space;
+
+    // the other side cannot have read more than has been
+    // written, the copies below would leave the ring
+    if (used > ch->size) return SHM_INVALID;
+    space = ch->size - used;
+
+    for (i = 0; i < iovcnt && space > 0; i++) {
+        n = iov[i].iov_len < space ? iov[i].iov_len : space;
+
+        // the bytes may wrap around the end of the ring
+        first = ch->size - (head & (ch->size - 1));
+        if (first > n) first = n;
+        memcpy(ch->txdata + (head & (ch->size - 1)), iov[i].iov_base, first);
+        memcpy(ch->txdata, (char *) iov[i].iov_base + first, n - first);
+
+        head += n;
+        space -= n;
+        total += n;
+    }
+
+    if (total == 0) return 0;
+
+    // publish the bytes, then see whether the consumer
+    // has gone to sleep before it could see them
+    __atomic_store_n(&ring->head, head, __ATOMIC_RELEASE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&ring->consumer_waiting, __ATOMIC_RELAXED) &&
+            __atomic_exchange_n(&ring->consumer_waiting, 0, __ATOMIC_ACQ_REL))
+        wake(ch->txfd);
+
+    return total;
+}
+
+ssize_t shm_write(struct shm_channel *ch, const void *buf, size_t len) {
+    struct iovec iov;
+
+    iov.iov_base = (void *) buf;
+    iov.iov_len = len;
+
+    return shm_writev(ch, &iov, 1);
+}
+
+ssize_t shm_read(struct shm_channel *ch, void *buf, size_t len) {
+    size_t n, first;
+    struct shm_ring *ring = ch->rx;
+    uint32_t tail = ring->tail;
+    uint32_t avail = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) - tail;
+
+    // nor can it have written more than the ring holds
+    if (avail > ch->size) return SHM_INVALID;
+
+    n = len < avail ? len : avail;
+    if (n == 0) return 0;
+
+    first = ch->size - (tail & (ch->size - 1));
+    if (first > n) first = n;
+    memcpy(buf, ch->rxdata + (tail & (ch->size - 1)), first);
+    memcpy((char *) buf + first, ch->rxdata, n - first);
+
+    // free the space, then see whether the
+    // producer has gone to sleep waiting for it
+    __atomic_store_n(&ring->tail, tail + n, __ATOMIC_RELEASE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&ring->producer_waiting, __ATOMIC_RELAXED) &&
+            __atomic_exchange_n(&ring->producer_waiting, 0, __ATOMIC_ACQ_REL))
+        wake(ch->txfd);
+
+    return n;
+}
+
+int shm_read_wait(struct shm_channel *ch) {
+    struct shm_ring *ring = ch->rx;
+
+    __atomic_store_n(&ring->consumer_waiting, 1, __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    // the producer may have written before it saw the flag
+    if (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) != ring->tail) {
+        __atomic_store_n(&ring->consumer_waiting, 0, __ATOMIC_RELAXED);
+        return 1;
+    }
+
+    return 0;
+}
+
+int shm_write_wait(struct shm_channel *ch) {
+    struct shm_ring *ring = ch->tx;
+
+    __atomic_store_n(&ring->producer_waiting, 1, __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    // the consumer may have read before it saw the flag
+    if (ring->head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE)
+            < ch->size) {
+        __atomic_store_n(&ring->producer_waiting, 0, __ATOMIC_RELAXED);
+        return 1;
+    }
+
+    return 0;
+}
+
+void shm_kick(struct shm_channel *ch) {
+    wake(ch->rxfd);
+}
+
+void shm_clear(struct shm_channel *ch) {
+    uint64_t val;
+
+    // non-blocking, fails if it has been reset already
+    if (read(ch->rxfd, &val, sizeof(val)) == -1 && errno != EAGAIN)
+        fprintf(stderr, "read: %s\n", strerror(errno));
+}
+
+int shm_wait(struct shm_channel *ch, int timeout) {
+    int ret;
+    struct pollfd pfd;
+
+    pfd.fd = ch->rxfd;
+    pfd.events = POLLIN;
+
+    do {
+        ret = poll(&pfd, 1, timeout);
+    } while (ret == -1 && errno == EINTR);
+
+    if (ret == -1) {
+        fprintf(stderr, "poll: %s\n", strerror(errno));
+        return -1;
+    }
+
+    if (ret == 0) return 0;
+
+    shm_clear(ch);
+    return 1;
+}
@@ -0,0 +1,140 @@
+#ifndef SHM_HEADER
+#define SHM_HEADER
+
+/* shared memory transport for clients on the same host.
+ * a channel consists of two single-producer/single-consumer
+ * byte rings in a memfd, one per direction, and one eventfd
+ * per side to wake it up with. the bytes that go through
+ * the rings are exactly those that would go over a socket,
+ * i.e. null terminated STOMP commands.
+ *
+ * no syscall is needed as long as both sides are busy: a
+ * consumer that finds its ring empty announces that it
+ * is about to wait (see shm_read_wait) and only then the
+ * producer wakes it up after having written. the same goes
+ * for a producer that finds the ring full.
+ *
+ * the broker creates the channel when a client connects to
+ * its shm listener (see reactor_listen_shm) and passes the
+ * memfd and the eventfds over that unix domain socket. the
+ * socket stays open to tell either side if the other one
+ * has gone.
+ *
+ * each ring must only be written by one thread and read by
+ * one thread at a time.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#define SHM_INVALID -2
+
+/* default number of bytes each ring holds */
+#define SHM_DEFAULT_RING_SIZE (256 * 1024)
+
+/* one direction of a channel, lives in the shared
+ * memory. head and tail grow continuously and are
+ * taken modulo the size of the ring. fields written
+ * by different sides are on separate cache lines */
+struct shm_ring {
+
+    /* position the next byte is written to and whether
+     * the producer waits for space, set by the producer */
+    uint32_t head;
+    uint32_t producer_waiting;
+    char pad1[56];
+
+    /* position the next byte is read from and whether
+     * the consumer waits for bytes, set by the consumer */
+    uint32_t tail;
+    uint32_t consumer_waiting;
+    char pad2[56];
+};
+
+/* view of a channel from one side */
+struct shm_channel {
+
+    /* the shared memory */
+    int memfd;
+    void *mem;
+    size_t memlen;
+
+    /* size of each ring, a power of two */
+    uint32_t size;
+
+    /* ring this side reads from */
+    struct shm_ring *rx;
+    char *rxdata;
+
+    /* ring this side writes to */
+    struct shm_ring *tx;
+    char *txdata;
+
+    /* eventfd this side is woken up with, if bytes have
+     * arrived in rx or space has been freed in tx */
+    int rxfd;
+
+    /* eventfd to wake up the other side with */
+    int txfd;
+};
+
+/* creates a channel with rings of the specified size (a
+ * power of two) as seen by the broker. returns 0 on
+ * success and -1 on failure */
+int shm_create(struct shm_channel *ch, uint32_t size);
+
+/* passes the channel to the other side over the unix
+ * domain socket. returns 0 on success and -1 on failure */
+int shm_send(struct shm_channel *ch, int sockfd);
+
+/* receives a channel that has been passed with shm_send,
+ * as seen by the client. returns 0 on success, SHM_INVALID
+ * if something other than a channel has been received and
+ * -1 on failure */
+int shm_receive(struct shm_channel *ch, int sockfd);
+
+/* unmaps the memory and closes the file descriptors */
+void shm_destroy(struct shm_channel *ch);
+
+/* copies as many bytes of iov as there is space for into
+ * tx and wakes up the other side if it waits for them.
+ * returns the number of bytes copied or SHM_INVALID if the
+ * other side has moved the tail of tx past its head */
+ssize_t shm_writev(struct shm_channel *ch, const struct iovec *iov,
+                   int iovcnt);
+
+/* shm_writev with a single buffer */
+ssize_t shm_write(struct shm_channel *ch, const void *buf, size_t len);
+
+/* copies at most len bytes from rx to buf and wakes up
+ * the other side if it waits for space. returns the
+ * number of bytes copied or SHM_INVALID if the other side
+ * claims to have written more than rx holds */
+ssize_t shm_read(struct shm_channel *ch, void *buf, size_t len);
+
+/* announces that this side waits for bytes in rx. returns
+ * 1 if some have arrived in the meantime, in which case we
+ * do not wait after all. otherwise 0 is returned and rxfd
+ * becomes readable as soon as there are bytes */
+int shm_read_wait(struct shm_channel *ch);
+
+/* announces that this side waits for space in tx, see
+ * shm_read_wait */
+int shm_write_wait(struct shm_channel *ch);
+
+/* wakes up this side, i.e. makes rxfd readable. this
+ * allows other threads of the same side to hand work
+ * to the thread waiting for the channel */
+void shm_kick(struct shm_channel *ch);
+
+/* resets rxfd after it has become readable */
+void shm_clear(struct shm_channel *ch);
+
+/* waits at most timeout milliseconds (-1 for ever) for
+ * rxfd to become readable and resets it. returns 1 if
+ * it did, 0 on timeout and -1 on failure */
+int shm_wait(struct shm_channel *ch, int timeout);
+
+#endif
@@ -1,3 +1,8 @@
+// for MSG_ZEROCOPY
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -5,10 +10,15 @@
 #include <string.h>
 #include <pthread.h>
 #include <assert.h>
+#include <poll.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <linux/errqueue.h>
 
 #include "socket.h"
-
-#define BUFSIZE 1024
+#include "scan.h"
+#include "binary.h"
 
 static void set_client_dead(struct client *client) {
 
@@ -25,14 +35,217 @@ static void set_client_dead(struct client *client) {
     assert(ret == 0);
 }
 
+/* maximum size of a command */
+static size_t max_frame = SOCKET_DEFAULT_MAX_FRAME;
+
+void socket_set_max_frame(size_t max) {
+    max_frame = max;
+}
+
+size_t socket_max_frame() {
+    return max_frame;
+}
+
+/* size from which on frames are sent with MSG_ZEROCOPY */
+static size_t zerocopy_threshold = 0;
+
+void socket_set_zerocopy(size_t threshold) {
+    zerocopy_threshold = threshold;
+}
+
+size_t socket_zerocopy() {
+    return zerocopy_threshold;
+}
+
+/* returns the length of the command (including the null
+ * byte) that starts with the len bytes at raw, if its
+ * headers are complete and contain a content-length.
+ * otherwise, the command ends with the null byte and
+ * 0 is returned */
+static size_t frame_length(const char *raw, size_t len) {
+    size_t i, hdrlen = 0, content;
+    const char *line = NULL, *end;
+    char *nl;
+    static const char key[] = "content-length:";
+    static const char delims[4] = { '\n', '\0', '\n', '\n' };
+
+    // jump from one line break to the next
+    for (i = 0; i + 1 < len; i = nl - raw + 1) {
+        nl = scan_find(raw + i, len - 1 - i, delims);
+        if (nl == NULL || *nl == '\0') break;
+        i = nl - raw;
+
+        // an empty line ends the header, lines
+        // may end with CRLF
+        if (raw[i+1] == '\n') {
+            hdrlen = i + 2;
+            break;
+        }
+        if (i + 2 < len && raw[i+1] == '\r' && raw[i+2] == '\n') {
+            hdrlen = i + 3;
+            break;
+        }
+
+        // the first one counts
+        if (line == NULL && len - (i+1) > sizeof(key) - 1 &&
+                strncmp(raw + i + 1, key, sizeof(key) - 1) == 0)
+            line = raw + i + 1 + sizeof(key) - 1;
+    }
+
+    if (hdrlen == 0 || line == NULL) return 0;
+
+    // the same value as the parser takes, it
+    // rejects the command if there is none
+    end = memchr(line, '\n', raw + hdrlen - line);
+    if (end > line && end[-1] == '\r') end--;
+    if (stomp_content_length(line, end - line, &content) != 0) return 0;
+
+    // too much anyway, don't let the sum overflow
+    if (content >= max_frame) return max_frame + 1;
+
+    // header, empty line, content, null byte
+    return hdrlen + content + 1;
+}
+
+/* returns the length, including the null byte, of the
+ * command at the beginning of the unconsumed part of the
+ * receive buffer or 0 if it is not complete yet. what has
+ * been learned about it is kept, so the next call does not
+ * search again. mutex_r must be held */
+static size_t buffered_length(struct client *client) {
+    char *start = client->rbuf + client->rbufpos;
+    size_t avail = client->rbuflen - client->rbufpos;
+    char *end;
+
+    // heart-beats in front of the next command are
+    // dropped, they only tell that the client is there
+    if (client->rframelen == 0 && client->rscanned == 0) {
+        while (avail > 0 && (client->binary ? *start == '\0'
+                : (*start == '\n' || *start == '\r'))) {
+            start++;
+            avail--;
+        }
+        client->rbufpos = start - client->rbuf;
+    }
+
+    // binary frames start with their length, there
+    // is nothing to search for until all of it is there
+    if (client->rframelen == 0 && client->binary) {
+        client->rframelen = binary_frame_length(start, avail);
+        if (client->rframelen == 0) return 0;
+        if (client->rframelen > max_frame)
+            client->rframelen = max_frame + 1;
+    } else if (client->rframelen == 0) {
+        client->rframelen = frame_length(start, avail);
+    }
+
+    // the content may be anything, the command ends
+    // where the header said. if that's not the null
+    // byte, the parser rejects it
+    if (client->rframelen != 0)
+        return avail < client->rframelen ? 0 : client->rframelen;
+
+    // only look at what has not been searched yet,
+    // large commands arrive with many reads
+    end = memchr(start + client->rscanned, '\0',
+        avail - client->rscanned);
+    if (end == NULL) {
+        client->rscanned = avail;
+        return 0;
+    }
+
+    client->rscanned = end - start;
+    return end - start + 1;
+}
+
+/* returns the next complete command from the receive buffer
+ * and marks it as consumed or null if there is none. its
+ * length, including the null byte, is stored in len. mutex_r
+ * must be held */
+static char *next_buffered_command(struct client *client, size_t *len) {
+    char *start;
+
+    // heart-beats in front of it are consumed as well
+    *len = buffered_length(client);
+    if (*len == 0) return NULL;
+
+    start = client->rbuf + client->rbufpos;
+
+    client->rbufpos += *len;
+    client->rframelen = 0;
+    client->rscanned = 0;
+    return start;
+}
+
+/* moves the unconsumed bytes to the beginning of the
+ * receive buffer. a buffer that has grown for a large
+ * command is shrunk once it is empty again, so idle
+ * clients don't hold on to it. mutex_r must be held */
+static void compact_buffer(struct client *client) {
+    size_t remaining = client->rbuflen - client->rbufpos;
+
+    if (remaining == 0 && client->rbufcap > SOCKET_BUFSIZE) {
+        free(client->rbuf);
+        client->rbuf = malloc(SOCKET_BUFSIZE);
+        assert(client->rbuf != NULL);
+        client->rbufcap = SOCKET_BUFSIZE;
+    }
+
+    if (client->rbufpos == 0) return;
+
+    memmove(client->rbuf, client->rbuf + client->rbufpos, remaining);
+    client->rbuflen = remaining;
+    client->rbufpos = 0;
+}
+
+/* makes room for more bytes of the incomplete command,
+ * which must be at the beginning of the buffer. if its
+ * length is known, the buffer is grown to fit it all at
+ * once. otherwise, the size is doubled whenever it is
+ * full. returns SOCKET_TOO_MUCH if the maximum frame size
+ * would be exceeded. mutex_r must be held */
+static int reserve_buffer(struct client *client) {
+    size_t size = client->rframelen;
+    char *rbuf;
+
+    assert(client->rbufpos == 0);
+
+    if (size > max_frame) return SOCKET_TOO_MUCH;
+
+    if (size == 0) {
+        if (client->rbuflen < client->rbufcap) return 0;
+        if (client->rbufcap >= max_frame) return SOCKET_TOO_MUCH;
+
+        size = client->rbufcap * 2;
+        if (size > max_frame) size = max_frame;
+    } else if (size <= client->rbufcap) {
+        return 0;
+    }
+
+    rbuf = realloc(client->rbuf, size);
+    assert(rbuf != NULL);
+    client->rbuf = rbuf;
+    client->rbufcap = size;
+
+    return 0;
+}
+
+/* drops the buffered bytes, the connection is
+ * going to be closed anyway. mutex_r must be held */
+static void drop_buffer(struct client *client) {
+    client->rbuflen = 0;
+    client->rbufpos = 0;
+    client->rframelen = 0;
+    client->rscanned = 0;
+}
+
 int socket_read_command(struct client *client,
         struct stomp_command *cmd) {
 
     int ret;
-
-    int pos;
-    char buf[BUFSIZE];
-    char c;
+    ssize_t nread;
+    char *raw;
+    size_t len;
 
     // accquire lock to read entire command
     ret = pthread_mutex_lock(client->mutex_r);
@@ -57,14 +270,74 @@ int socket_read_command(struct client *client,
         return SOCKET_NECROMANCE;
     }
 
-    pos = 0;
-    while (pos < BUFSIZE) {
-        ret = read(client->sockfd, &c, 1); 
+    // read until the buffer holds a complete command. a
+    // single read may return any number of commands, those
+    // are returned by the next calls without a syscall
+    while ((raw = next_buffered_command(client, &len)) == NULL) {
 
-        // error
-        if (ret < 1) {
+        compact_buffer(client);
+
+        if (reserve_buffer(client) != 0) {
+            drop_buffer(client);
+
+            ret = pthread_mutex_unlock(client->mutex_r);
+            assert(ret == 0);
+
+            return SOCKET_TOO_MUCH;
+        }
+
+        if (client->rexternal) {
+            // the owner receives the rest
+            ret = pthread_mutex_unlock(client->mutex_r);
+            assert(ret == 0);
+
+            return SOCKET_AGAIN;
+        }
+
+        if (client->shm != NULL) {
+            nread = shm_read(client->shm, client->rbuf + client->rbuflen,
+                client->rbufcap - client->rbuflen);
+
+            // the client has broken the ring, it is not
+            // to be trusted with it any longer
+            if (nread < 0) {
+                fprintf(stderr, "shm_read: invalid ring\n");
+
+                ret = pthread_mutex_unlock(client->mutex_r);
+                assert(ret == 0);
+
+                set_client_dead(client);
+
+                return SOCKET_CLIENT_GONE;
+            }
+
+            // the client wakes us up once there is more
+            if (nread == 0 && !shm_read_wait(client->shm)) {
+                ret = pthread_mutex_unlock(client->mutex_r);
+                assert(ret == 0);
+
+                return SOCKET_AGAIN;
+            }
 
-            if (ret < 0) {
+            client->rbuflen += nread;
+            continue;
+        }
+
+        nread = read(client->sockfd, client->rbuf + client->rbuflen,
+            client->rbufcap - client->rbuflen);
+
+        if (nread == -1 && errno == EINTR) {
+            continue;
+        } else if (nread == -1 &&
+                  (errno == EAGAIN || errno == EWOULDBLOCK)) {
+
+            ret = pthread_mutex_unlock(client->mutex_r);
+            assert(ret == 0);
+
+            return SOCKET_AGAIN;
+        } else if (nread < 1) {
+
+            if (nread < 0) {
                 fprintf(stderr, "read: %s\n", strerror(errno));
             }
 
@@ -75,52 +348,293 @@ int socket_read_command(struct client *client,
             set_client_dead(client);
 
             return SOCKET_CLIENT_GONE;
-        } 
+        }
+
+        client->rbuflen += nread;
+    }
 
-        buf[pos++] = c;
+    // parse with the lock held, the command
+    // is still part of the receive buffer
+    int parsed = client->binary ? binary_parse(raw, len, cmd)
+                                : parse_frame(raw, len, cmd);
 
-        // end of command
-        if (c == '\0') {
-            break;
-        }
+    // release lock
+    ret = pthread_mutex_unlock(client->mutex_r);
+    assert(ret == 0);
+
+    if (parsed != 0) {
+        char errbuf[32];
+        stomp_strerror(parsed, errbuf);
+        fprintf(stderr, "parse_command: %s\n", errbuf);
+        return -1;
+    } else {
+
+        return 0;
     }
+}
+
+int socket_command_buffered(struct client *client) {
+    int ret, buffered;
+
+    // acquire lock to look at the receive buffer
+    ret = pthread_mutex_lock(client->mutex_r);
+    assert(ret == 0);
+
+    buffered = buffered_length(client) != 0;
 
     // release lock
     ret = pthread_mutex_unlock(client->mutex_r);
     assert(ret == 0);
 
-    if (pos == BUFSIZE && buf[pos-1] != '\0') {
-        return SOCKET_TOO_MUCH;
+    return buffered;
+}
+
+int socket_read_space(struct client *client, char **buf, size_t *len) {
+    int ret;
+
+    // acquire lock for receive buffer
+    ret = pthread_mutex_lock(client->mutex_r);
+    assert(ret == 0);
+
+    compact_buffer(client);
+    int val = reserve_buffer(client);
+    if (val != 0) drop_buffer(client);
+
+    *buf = client->rbuf + client->rbuflen;
+    *len = client->rbufcap - client->rbuflen;
+
+    // release lock for receive buffer
+    ret = pthread_mutex_unlock(client->mutex_r);
+    assert(ret == 0);
+
+    return val;
+}
+
+void socket_read_commit(struct client *client, size_t len) {
+    int ret;
+
+    // acquire lock for receive buffer
+    ret = pthread_mutex_lock(client->mutex_r);
+    assert(ret == 0);
+
+    assert(client->rbuflen + len <= client->rbufcap);
+    client->rbuflen += len;
+
+    // release lock for receive buffer
+    ret = pthread_mutex_unlock(client->mutex_r);
+    assert(ret == 0);
+}
+
+/* appends a frame to the outbound queue and acquires
+ * a reference to it. mutex_w must be held */
+static void enqueue_chunk(struct client *client, struct frame *frame) {
+    struct wchunk *chunk = malloc(sizeof(struct wchunk));
+    assert(chunk != NULL);
+
+    frame_ref(frame);
+    chunk->frame = frame;
+    chunk->off = 0;
+    chunk->next = NULL;
+
+    if (client->wqtail == NULL) {
+        client->wqhead = chunk;
     } else {
-        ret = parse_command(buf, cmd);
+        client->wqtail->next = chunk;
+    }
+    client->wqtail = chunk;
+    client->wqlen += frame->len;
+}
 
-        if (ret != 0) {
-            char errbuf[32];
-            stomp_strerror(ret, errbuf);
-            fprintf(stderr, "parse_command: %s\n", errbuf);
-            return -1;
+/* removes the first chunk from the outbound queue
+ * and releases its frame. mutex_w must be held */
+static void dequeue_chunk(struct client *client) {
+    struct wchunk *chunk = client->wqhead;
+
+    client->wqhead = chunk->next;
+    if (client->wqhead == NULL) client->wqtail = NULL;
+
+    frame_unref(chunk->frame);
+    free(chunk);
+}
+
+/* drops everything in the outbound queue. mutex_w must be held */
+static void clear_queue(struct client *client) {
+    while (client->wqhead != NULL) dequeue_chunk(client);
+    client->wqlen = 0;
+}
+
+/* whether the rest of the chunk is sent
+ * with MSG_ZEROCOPY. mutex_w must be held */
+static int zerocopy_chunk(struct client *client, struct wchunk *chunk) {
+    return client->zerocopy &&
+        chunk->frame->len - chunk->off >= zerocopy_threshold;
+}
+
+/* gathers the unwritten part of the outbound queue
+ * into iov, up to a chunk that is sent with zerocopy.
+ * returns the number of entries. mutex_w must be held */
+static int gather_queue(struct client *client, struct iovec *iov) {
+    int iovcnt = 0;
+    struct wchunk *chunk;
+
+    for (chunk = client->wqhead;
+         chunk != NULL && iovcnt < SOCKET_WQUEUE_IOV;
+         chunk = chunk->next) {
+        if (zerocopy_chunk(client, chunk)) break;
+
+        iov[iovcnt].iov_base = chunk->frame->data + chunk->off;
+        iov[iovcnt].iov_len = chunk->frame->len - chunk->off;
+        iovcnt++;
+    }
+
+    return iovcnt;
+}
+
+/* drops what has been written entirely and remembers
+ * how far we got into the next chunk. mutex_w must be held */
+static void consume_queue(struct client *client, size_t nwritten) {
+    struct wchunk *chunk;
+
+    client->wqlen -= nwritten;
+
+    while (nwritten > 0) {
+        chunk = client->wqhead;
+        size_t left = chunk->frame->len - chunk->off;
+        if (nwritten >= left) {
+            nwritten -= left;
+            dequeue_chunk(client);
         } else {
+            chunk->off += nwritten;
+            nwritten = 0;
+        }
+    }
+}
+
+/* sends the rest of the chunk with MSG_ZEROCOPY. the frame
+ * is referenced until the kernel reports the send complete
+ * (see socket_reap_zerocopy). returns what sendmsg returns.
+ * mutex_w must be held */
+static ssize_t send_zerocopy(struct client *client, struct wchunk *chunk) {
+    ssize_t nwritten;
+    struct iovec iov;
+    struct msghdr msg;
+    struct zcref *ref;
+
+    iov.iov_base = chunk->frame->data + chunk->off;
+    iov.iov_len = chunk->frame->len - chunk->off;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+    nwritten = sendmsg(client->sockfd, &msg, MSG_ZEROCOPY);
+
+    if (nwritten == -1 && errno == ENOBUFS) {
+        // not allowed to pin any more pages
+        // right now, copy this time
+        return sendmsg(client->sockfd, &msg, 0);
+    }
 
-            return 0;
+    if (nwritten == -1) return -1;
+
+    // every send is counted, even a partial one
+    ref = malloc(sizeof(struct zcref));
+    assert(ref != NULL);
+    frame_ref(chunk->frame);
+    ref->frame = chunk->frame;
+    ref->seq = client->zcseq++;
+    ref->next = NULL;
+
+    if (client->zctail == NULL) {
+        client->zchead = ref;
+    } else {
+        client->zctail->next = ref;
+    }
+    client->zctail = ref;
+
+    return nwritten;
+}
+
+/* write_queue for clients with a shared memory channel.
+ * the channel is out of space rather than the socket
+ * not writable. mutex_w must be held */
+static int write_queue_shm(struct client *client, int block) {
+    int iovcnt;
+    ssize_t nwritten;
+    struct iovec iov[SOCKET_WQUEUE_IOV];
+
+    while (client->wqhead != NULL) {
+
+        iovcnt = gather_queue(client, iov);
+
+        nwritten = shm_writev(client->shm, iov, iovcnt);
+        if (nwritten < 0) {
+            fprintf(stderr, "shm_writev: invalid ring\n");
+            return -1;
+        } else if (nwritten > 0) {
+            consume_queue(client, nwritten);
+        } else if (!shm_write_wait(client->shm)) {
+            // the client wakes us up once there is space
+            if (!block) return SOCKET_AGAIN;
+            if (shm_wait(client->shm, -1) == -1) return -1;
         }
     }
+
+    return 0;
 }
 
-int socket_send_command(struct client *client, struct stomp_command cmd) {
-    int ret, resplen, val;
-    char *resp;
+/* writes the outbound queue to the socket, chunks are
+ * gathered into a single writev and partial writes
+ * continue where they left off. the socket may be
+ * non-blocking, in which case we return SOCKET_AGAIN
+ * or, if block is set, wait for it to become writable.
+ * returns 0 once the queue is empty and -1 if the write
+ * failed. mutex_w must be held */
+static int write_queue(struct client *client, int block) {
+    int iovcnt;
+    ssize_t nwritten;
+    struct iovec iov[SOCKET_WQUEUE_IOV];
+    struct pollfd pfd;
 
-    ret = create_command(cmd, &resp);
-    if (ret != 0) {
-        char buf[32];
-        stomp_strerror(ret, buf);
-        fprintf(stderr, "Error: %s\n", buf);
-        return -1;
+    if (client->shm != NULL) return write_queue_shm(client, block);
+
+    while (client->wqhead != NULL) {
+
+        if (zerocopy_chunk(client, client->wqhead)) {
+            nwritten = send_zerocopy(client, client->wqhead);
+        } else {
+            iovcnt = gather_queue(client, iov);
+            nwritten = writev(client->sockfd, iov, iovcnt);
+        }
+
+        if (nwritten == -1 && errno == EINTR) {
+            continue;
+        } else if (nwritten == -1 &&
+                  (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            if (!block) return SOCKET_AGAIN;
+
+            pfd.fd = client->sockfd;
+            pfd.events = POLLOUT;
+            poll(&pfd, 1, -1);
+        } else if (nwritten == -1) {
+            fprintf(stderr, "Error: %s\n", strerror(errno));
+            return -1;
+        } else {
+            consume_queue(client, nwritten);
+        }
     }
 
-    resplen = strlen(resp) + 1;
+    return 0;
+}
 
-    // accquire lock to write entire command
+/* queues the frame for the client. if capped is set, it is
+ * not queued once the outbound queue holds SOCKET_WQUEUE_MAX
+ * bytes and SOCKET_QUEUE_FULL is returned instead */
+static int queue_frame(struct client *client, struct frame *frame,
+        int capped) {
+    int ret, val;
+
+    // accquire lock to queue entire command
     ret = pthread_mutex_lock(client->mutex_w);
     assert(ret == 0);
 
@@ -143,16 +657,33 @@ int socket_send_command(struct client *client, struct stomp_command cmd) {
         return SOCKET_NECROMANCE;
     }
 
-    val = write(client->sockfd, resp, resplen);
+    if (capped && client->wqlen > 0 &&
+            client->wqlen + frame->len > SOCKET_WQUEUE_MAX) {
+
+        // release lock to write to socket
+        ret = pthread_mutex_unlock(client->mutex_w);
+        assert(ret == 0);
+
+        return SOCKET_QUEUE_FULL;
+    }
+
+    int pending = client->wqhead != NULL;
+    enqueue_chunk(client, frame);
 
-    // acquire lock
+    if (client->wnotify != NULL) {
+        // the owner flushes once the socket is writable
+        if (!pending) client->wnotify(client, 1);
+        val = 0;
+    } else {
+        val = write_queue(client, 1);
+        if (val != 0) clear_queue(client);
+    }
+
+    // release lock
     ret = pthread_mutex_unlock(client->mutex_w);
     assert(ret == 0);
 
-    free(resp);
-    if (val == -1) {
-        fprintf(stderr, "Error: %s\n", strerror(val));
-
+    if (val != 0) {
         set_client_dead(client);
 
         return SOCKET_CLIENT_GONE;
@@ -161,9 +692,230 @@ int socket_send_command(struct client *client, struct stomp_command cmd) {
     return 0;
 }
 
+int socket_send_command(struct client *client,
+        const struct stomp_command *cmd) {
+    int ret;
+    struct frame *frame;
+
+    if (client->binary) ret = frame_create_binary(cmd, &frame);
+    else ret = frame_create(cmd, &frame);
+    if (ret != 0) {
+        char buf[32];
+        stomp_strerror(ret, buf);
+        fprintf(stderr, "Error: %s\n", buf);
+        return -1;
+    }
+
+    // replies of the broker are not retried like deliveries,
+    // so they are queued however long the queue is
+    ret = queue_frame(client, frame, 0);
+
+    // the queue holds its own reference
+    frame_unref(frame);
+
+    return ret;
+}
+
+int socket_send_frame(struct client *client, struct frame *frame) {
+    return queue_frame(client, frame, 1);
+}
+
+int socket_flush(struct client *client) {
+    int ret, val;
+
+    // acquire lock to write from queue
+    ret = pthread_mutex_lock(client->mutex_w);
+    assert(ret == 0);
+
+    val = write_queue(client, 0);
+    if (val == -1) {
+        clear_queue(client);
+        set_client_dead(client);
+        val = SOCKET_CLIENT_GONE;
+    }
+
+    if (val != SOCKET_AGAIN && client->wnotify != NULL)
+        client->wnotify(client, 0);
+
+    // release lock
+    ret = pthread_mutex_unlock(client->mutex_w);
+    assert(ret == 0);
+
+    return val;
+}
+
+int socket_write_space(struct client *client, struct iovec *iov) {
+    int ret, iovcnt;
+
+    // acquire lock for queue
+    ret = pthread_mutex_lock(client->mutex_w);
+    assert(ret == 0);
+
+    iovcnt = gather_queue(client, iov);
+
+    // release lock for queue
+    ret = pthread_mutex_unlock(client->mutex_w);
+    assert(ret == 0);
+
+    return iovcnt;
+}
+
+size_t socket_write_commit(struct client *client, size_t len) {
+    int ret;
+    size_t depth;
+
+    // acquire lock for queue
+    ret = pthread_mutex_lock(client->mutex_w);
+    assert(ret == 0);
+
+    assert(len <= client->wqlen);
+    consume_queue(client, len);
+    depth = client->wqlen;
+
+    // release lock for queue
+    ret = pthread_mutex_unlock(client->mutex_w);
+    assert(ret == 0);
+
+    return depth;
+}
+
+int socket_enable_zerocopy(struct client *client) {
+    int on = 1;
+
+    if (zerocopy_threshold == 0) return -1;
+
+    if (setsockopt(client->sockfd, SOL_SOCKET, SO_ZEROCOPY,
+                   &on, sizeof(on)) != 0)
+        return -1;
+
+    client->zerocopy = 1;
+    return 0;
+}
+
+/* releases the zerocopy sends up to and including the
+ * one with the number hi. returns the number released.
+ * mutex_w must be held */
+static int complete_zerocopy(struct client *client, uint32_t hi) {
+    int n = 0;
+    struct zcref *ref;
+
+    // the numbers wrap around, the kernel reports in order
+    while ((ref = client->zchead) != NULL &&
+           (int32_t) (ref->seq - hi) <= 0) {
+        client->zchead = ref->next;
+        if (client->zchead == NULL) client->zctail = NULL;
+
+        frame_unref(ref->frame);
+        free(ref);
+        n++;
+    }
+
+    return n;
+}
+
+int socket_reap_zerocopy(struct client *client) {
+    int ret, n = 0;
+    char control[128];
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+    struct sock_extended_err *serr;
+
+    // acquire lock for zerocopy sends
+    ret = pthread_mutex_lock(client->mutex_w);
+    assert(ret == 0);
+
+    while (client->zchead != NULL) {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        // never blocks, fails once the queue is empty
+        if (recvmsg(client->sockfd, &msg, MSG_ERRQUEUE) == -1) break;
+
+        for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+             cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (!(cmsg->cmsg_level == IPPROTO_IP &&
+                  cmsg->cmsg_type == IP_RECVERR) &&
+                !(cmsg->cmsg_level == IPPROTO_IPV6 &&
+                  cmsg->cmsg_type == IPV6_RECVERR))
+                continue;
+
+            serr = (struct sock_extended_err *) CMSG_DATA(cmsg);
+            if (serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY ||
+                serr->ee_errno != 0)
+                continue;
+
+            // ee_info to ee_data is the range that completed
+            n += complete_zerocopy(client, serr->ee_data);
+
+            // the kernel had to copy after all (e.g. over
+            // loopback), so pinning the pages is just overhead
+            if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+                client->zerocopy = 0;
+        }
+    }
+
+    // release lock for zerocopy sends
+    ret = pthread_mutex_unlock(client->mutex_w);
+    assert(ret == 0);
+
+    return n;
+}
+
+int socket_offer_shm(struct client *client, uint32_t size) {
+    struct shm_channel *shm = malloc(sizeof(struct shm_channel));
+    assert(shm != NULL);
+
+    if (shm_create(shm, size) != 0) {
+        free(shm);
+        return -1;
+    }
+
+    if (shm_send(shm, client->sockfd) != 0) {
+        shm_destroy(shm);
+        free(shm);
+        return -1;
+    }
+
+    client->shm = shm;
+
+    return 0;
+}
+
+int socket_send_heartbeat(struct client *client) {
+    int ret;
+    struct frame *frame;
+
+    if (socket_queue_depth(client) > 0) return 0;
+
+    frame_create_heartbeat(client->binary, &frame);
+    ret = socket_send_frame(client, frame);
+    frame_unref(frame);
+
+    return ret;
+}
+
+size_t socket_queue_depth(struct client *client) {
+    int ret;
+    size_t depth;
+
+    // acquire lock for queue
+    ret = pthread_mutex_lock(client->mutex_w);
+    assert(ret == 0);
+
+    depth = client->wqlen;
+
+    // release lock for queue
+    ret = pthread_mutex_unlock(client->mutex_w);
+    assert(ret == 0);
+
+    return depth;
+}
+
 int socket_terminate_client(struct client *client) {
 
     int ret;
+    int sockfd = client->sockfd;
 
     // acquire write lock on dead variable
     ret = pthread_mutex_lock(client->deadmutex);
@@ -171,12 +923,15 @@ int socket_terminate_client(struct client *client) {
 
     client->dead = 1; // may already be the case though
 
+    // the gc may destroy the client from now on
+    client->attached = 0;
+
     // release lock for dead flag
     ret = pthread_mutex_unlock(client->deadmutex);
     assert(ret == 0);
 
     // may fail if already closed
-    close(client->sockfd);
+    close(sockfd);
 
     return 0;
 }
@@ -208,7 +963,35 @@ int client_init(struct client *client) {
     ret = pthread_mutex_init(mutex_w, &wmutattr);
     assert(ret == 0);
 
+    char *rbuf = malloc(SOCKET_BUFSIZE);
+    assert(rbuf != NULL);
+
     client->dead = 0;
+    client->rbuf = rbuf;
+    client->rbufcap = SOCKET_BUFSIZE;
+    client->rbuflen = 0;
+    client->rbufpos = 0;
+    client->rframelen = 0;
+    client->rscanned = 0;
+    client->rexternal = 0;
+    client->wqhead = NULL;
+    client->wqtail = NULL;
+    client->wqlen = 0;
+    client->wnotify = NULL;
+    client->owner = NULL;
+    client->shm = NULL;
+    client->zerocopy = 0;
+    client->zcseq = 0;
+    client->zchead = NULL;
+    client->zctail = NULL;
+    client->attached = 0;
+    client->receipt = NULL;
+    client->receiptcap = 0;
+    client->binary = 0;
+    client->deflate = 0;
+    client->heartbeat = 0;
+    client->hbsend = 0;
+    client->hbrecv = 0;
     client->deadmutex = deadmutex;
     client->mutex_r = mutex_r;
     client->mutex_w = mutex_w;
@@ -220,6 +1003,21 @@ void client_destroy(struct client *client) {
 
     int ret;
 
+    clear_queue(client);
+
+    // the kernel keeps the pages pinned and may still send from
+    // them, but with the socket closed it cannot report when it
+    // is done. the reactor waits for the reports before closing
+    // (see REACTOR_ZEROCOPY_LINGER), what is left after that is
+    // released anyway and may be reused while still being sent
+    while (client->zchead != NULL) {
+        struct zcref *ref = client->zchead;
+        client->zchead = ref->next;
+        frame_unref(ref->frame);
+        free(ref);
+    }
+    client->zctail = NULL;
+
     ret = pthread_mutex_destroy(client->mutex_r);
     assert(ret == 0);
     free(client->mutex_r);
@@ -234,4 +1032,17 @@ void client_destroy(struct client *client) {
     assert(ret == 0);
     free(client->deadmutex);
     client->deadmutex = NULL;
+
+    free(client->rbuf);
+    client->rbuf = NULL;
+
+    free(client->receipt);
+    client->receipt = NULL;
+
+    // only now no one uses the client anymore
+    if (client->shm != NULL) {
+        shm_destroy(client->shm);
+        free(client->shm);
+        client->shm = NULL;
+    }
 }
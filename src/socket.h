@@ -2,15 +2,74 @@
 #define SOCKET_HEADER
 
 #include <stdlib.h>
+#include <stdint.h>
 #include <unistd.h>
+#include <sys/uio.h>
 
 #include "stomp.h"
+#include "frame.h"
+#include "shm.h"
 
 #define SOCKET_TOO_MUCH    -2
 #define SOCKET_INVALID     -3
 #define SOCKET_CLIENT_GONE -4
 #define SOCKET_NECROMANCE  -5
 
+/* returned by socket_read_command if the socket is
+ * non-blocking and no complete command has arrived yet */
+#define SOCKET_AGAIN       -6
+
+/* returned by socket_send_frame if the client's
+ * outbound queue cannot take another frame */
+#define SOCKET_QUEUE_FULL  -7
+
+/* initial size of the receive buffer. it grows up
+ * to the maximum frame size if a command does not fit */
+#define SOCKET_BUFSIZE 1024
+
+/* default maximum size of a command, including
+ * headers and content (see socket_set_max_frame) */
+#define SOCKET_DEFAULT_MAX_FRAME (8 * 1024 * 1024)
+
+/* maximum number of bytes waiting in the outbound
+ * queue of a client. a subscriber that does not
+ * read fast enough is not sent more messages than
+ * that (see socket_send_frame), replies of the broker
+ * are queued anyway. a single frame is queued
+ * regardless of its size if the queue is empty */
+#define SOCKET_WQUEUE_MAX (1024 * 1024)
+
+/* maximum number of chunks written with one syscall */
+#define SOCKET_WQUEUE_IOV 64
+
+/* frame in the outbound queue of a client */
+struct wchunk {
+    /* frame to be written, the
+     * chunk holds a reference */
+    struct frame *frame;
+
+    /* number of bytes already written */
+    size_t off;
+
+    /* next chunk in queue, null if last */
+    struct wchunk *next;
+};
+
+/* frame that has been sent with MSG_ZEROCOPY. the kernel
+ * may still read from it until it reports the send with
+ * the sequence number as complete */
+struct zcref {
+    /* number of the send, counted by the kernel */
+    uint32_t seq;
+
+    /* frame sent, the reference is released
+     * once the send has completed */
+    struct frame *frame;
+
+    /* next send, with a higher number */
+    struct zcref *next;
+};
+
 /* structure used to communicate with the
  * client. mutex is used to synchronize
  * access to the file descriptor. note that
@@ -58,6 +117,122 @@ struct client {
      * might have come unexpected (failed to write)
      * or expected (orderly disconnect). */
     int dead;
+
+    /* receive buffer, guarded by mutex_r. holds
+     * the bytes that have been read from the socket
+     * but not yet been consumed as a command. this
+     * may be any number of complete commands followed
+     * by the beginning of an incomplete one */
+    char *rbuf;
+
+    /* size of the receive buffer */
+    size_t rbufcap;
+
+    /* number of bytes in the receive buffer */
+    size_t rbuflen;
+
+    /* offset of the first byte in the receive
+     * buffer that has not been consumed yet */
+    size_t rbufpos;
+
+    /* length of the incomplete command at rbufpos,
+     * including the null byte, as soon as it is known
+     * from its content-length header (or the length in
+     * front of a binary frame) or 0 otherwise.
+     * the buffer is grown to fit it all at once */
+    size_t rframelen;
+
+    /* number of bytes of the incomplete command that
+     * have already been searched for the null byte */
+    size_t rscanned;
+
+    /* whether the owner of the connection fills the
+     * receive buffer (see socket_read_space) rather than
+     * socket_read_command reading from the socket. if
+     * set, socket_read_command returns SOCKET_AGAIN
+     * once no complete command is buffered anymore */
+    int rexternal;
+
+    /* outbound queue, guarded by mutex_w. commands
+     * are appended by socket_send_command and
+     * written by socket_flush */
+    struct wchunk *wqhead;
+    struct wchunk *wqtail;
+
+    /* number of bytes in the outbound queue
+     * that have not been written yet */
+    size_t wqlen;
+
+    /* invoked with mutex_w held whenever the outbound
+     * queue becomes non-empty (pending is 1) or has been
+     * drained (pending is 0). the owner of the connection
+     * uses this to call socket_flush once the socket is
+     * writable. if this is null, the queue is flushed
+     * right away by socket_send_command, blocking until
+     * everything has been written */
+    void (*wnotify)(struct client *client, int pending);
+
+    /* passed back to the owner of the connection
+     * with wnotify, opaque to the socket layer */
+    void *owner;
+
+    /* shared memory channel commands are read from and
+     * written to instead of the socket, null if none (see
+     * socket_offer_shm). the socket itself is only used
+     * to tell whether the client is still there */
+    struct shm_channel *shm;
+
+    /* whether frames of at least the zerocopy threshold are
+     * sent with MSG_ZEROCOPY (see socket_enable_zerocopy) */
+    int zerocopy;
+
+    /* number the kernel assigns to the next zerocopy send
+     * and the sends that have not completed yet, oldest
+     * first. guarded by mutex_w */
+    uint32_t zcseq;
+    struct zcref *zchead;
+    struct zcref *zctail;
+
+    /* whether a reactor or handler thread still
+     * serves the connection, guarded by deadmutex.
+     * a dead client may still be attached while
+     * its outbound queue is being drained and must
+     * not be destroyed before it is detached by
+     * socket_terminate_client */
+    int attached;
+
+    /* id of the last receipt that has been asked for
+     * but not been sent yet, null or empty if none (see
+     * confirm_send in broker.c). only used by the
+     * thread that handles the commands of the client */
+    char *receipt;
+
+    /* size of the receipt buffer, which is reused */
+    size_t receiptcap;
+
+    /* whether commands are framed as in binary.h rather
+     * than as text, as negotiated with CONNECT. set
+     * before the first command that uses it is read
+     * and never changes after that */
+    int binary;
+
+    /* whether the content of MESSAGEs may be compressed
+     * (see compress.h), as negotiated with CONNECT */
+    int deflate;
+
+    /* number of milliseconds the owner of the connection can
+     * send heart-beats at and check for them (see heart-beat
+     * in stomp.h), 0 if it has no timers to do so. offered to
+     * the client with CONNECTED */
+    long heartbeat;
+
+    /* number of milliseconds the broker sends a heart-beat
+     * at least every and the client has promised to send
+     * something at least every, as negotiated with CONNECT.
+     * 0 if none. set before CONNECTED is sent and never
+     * changed after that */
+    long hbsend;
+    long hbrecv;
 };
 
 /* initializes the client struct */
@@ -66,13 +241,132 @@ int client_init(struct client *client);
 /* destroys a client and frees resources */
 void client_destroy(struct client *client);
 
-/* reads a command from the socket. it reads until
- * it sees the null byte or the maximum buffer size
- * is reached */
+/* sets the maximum size of a command that is read
+ * from any client. larger commands are rejected with
+ * SOCKET_TOO_MUCH */
+void socket_set_max_frame(size_t max);
+
+/* returns the maximum size of a command */
+size_t socket_max_frame();
+
+/* sets the size from which on frames are sent without
+ * copying them into the socket buffer (0 turns it off,
+ * which is the default). sending a frame this way is more
+ * expensive in itself, as the pages have to be pinned and
+ * the kernel reports back when it is done with them, so
+ * it only pays off for large frames */
+void socket_set_zerocopy(size_t threshold);
+
+/* returns the zerocopy threshold */
+size_t socket_zerocopy();
+
+/* enables MSG_ZEROCOPY for the socket of the client if a
+ * threshold has been set. large frames are then sent from
+ * the encoded frame directly and stay referenced until the
+ * kernel reports them complete through the error queue of
+ * the socket (see socket_reap_zerocopy). returns 0 if it
+ * has been enabled and -1 otherwise, e.g. for unix domain
+ * sockets, in which case frames are copied as usual */
+int socket_enable_zerocopy(struct client *client);
+
+/* releases the frames of all zerocopy sends the kernel has
+ * reported complete. to be called once the socket reports
+ * an error (EPOLLERR), which is how the kernel signals
+ * completions. returns the number of sends that completed */
+int socket_reap_zerocopy(struct client *client);
+
+/* reads a command from the socket. if a complete
+ * command is already in the receive buffer, it is
+ * returned without touching the socket. otherwise,
+ * as many bytes as are available are read into the
+ * receive buffer until it contains the entire command
+ * (which ends with the null byte or, if it has a
+ * content-length header, after the content) or the
+ * maximum frame size is reached. if the socket
+ * is non-blocking and the command is incomplete,
+ * SOCKET_AGAIN is returned and the partial command
+ * is kept for the next call. the command points into
+ * the receive buffer (see parse_command) and is only
+ * valid until the buffer is used again, i.e. until
+ * the next call for the same client */
 int socket_read_command(struct client *client, struct stomp_command *cmd);
 
-/* sends a command to the client */
-int socket_send_command(struct client *client, struct stomp_command cmd);
+/* returns whether a complete command is waiting in the
+ * receive buffer, i.e. whether the next socket_read_command
+ * returns it right away. this allows to tell whether the
+ * client has sent more commands without waiting for an
+ * answer */
+int socket_command_buffered(struct client *client);
+
+/* returns the free space at the end of the receive buffer
+ * for owners that fill it themselves (see rexternal). the
+ * space must not be used by anyone else until the bytes
+ * that have been received are handed over with
+ * socket_read_commit. the buffer is grown if needed.
+ * returns 0 on success and SOCKET_TOO_MUCH if the
+ * command exceeds the maximum frame size */
+int socket_read_space(struct client *client, char **buf, size_t *len);
+
+/* appends len bytes that have been received into the
+ * space returned by socket_read_space to the buffer */
+void socket_read_commit(struct client *client, size_t len);
+
+/* sends a command to the client. the command is
+ * appended to the outbound queue of the client and
+ * written as soon as the socket is writable (see
+ * wnotify in the client struct). it is meant for the
+ * replies of the broker, which are queued no matter
+ * how full the queue is */
+int socket_send_command(struct client *client,
+        const struct stomp_command *cmd);
+
+/* queues an encoded frame for the client, just like
+ * socket_send_command. the queue acquires its own
+ * reference, which is released once the frame has been
+ * written. this allows the same frame to be sent to any
+ * number of clients without encoding it again. returns
+ * SOCKET_QUEUE_FULL if the queue already holds
+ * SOCKET_WQUEUE_MAX bytes, the frame is to be retried */
+int socket_send_frame(struct client *client, struct frame *frame);
+
+/* writes as much of the outbound queue as the socket
+ * takes without blocking. returns 0 if the queue has
+ * been drained, SOCKET_AGAIN if data is left and
+ * SOCKET_CLIENT_GONE if writing failed */
+int socket_flush(struct client *client);
+
+/* fills iov with the unwritten part of the outbound queue
+ * (at most SOCKET_WQUEUE_IOV entries) for owners that write
+ * the queue themselves instead of calling socket_flush.
+ * the chunks stay in the queue until they have been
+ * consumed with socket_write_commit, which is the only
+ * place they are removed. returns the number of entries */
+int socket_write_space(struct client *client, struct iovec *iov);
+
+/* removes len bytes that have been written from the front
+ * of the outbound queue. returns the number of bytes that
+ * are still queued */
+size_t socket_write_commit(struct client *client, size_t len);
+
+/* creates a shared memory channel with rings of the
+ * specified size and passes it to the client over its
+ * socket, which must be a unix domain socket. from then
+ * on, all commands go through the channel. reading from it
+ * never blocks, but returns SOCKET_AGAIN if the command is
+ * incomplete, just like a non-blocking socket. once the
+ * channel is out of space, socket_flush returns SOCKET_AGAIN
+ * and the rx eventfd of the channel becomes readable as
+ * soon as there is space again. returns 0 on success
+ * and -1 on failure */
+int socket_offer_shm(struct client *client, uint32_t size);
+
+/* queues a heart-beat (see stomp.h) for the client unless
+ * something else is queued already, which does just as well.
+ * returns 0 on success or the error of socket_send_frame */
+int socket_send_heartbeat(struct client *client);
+
+/* returns the number of bytes waiting in the outbound queue */
+size_t socket_queue_depth(struct client *client);
 
 /* terminates the connection with a client */
 int socket_terminate_client(struct client *client);
@@ -5,138 +5,311 @@
 #include <assert.h>
 
 #include "stomp.h"
+#include "scan.h"
 
-/* trims a string on boths sides */
-static void trim(char **str) {
-    int i;
+/*
+ * terminates the line that starts at pos in place,
+ * dropping the carriage return of a CRLF. returns
+ * the start of the next line or null if there is
+ * no newline before end.
+ */
+static char *take_line(char *pos, char *end) {
+    char *nl = memchr(pos, '\n', end - pos);
+    if (nl == NULL) return NULL;
+
+    if (nl > pos && nl[-1] == '\r') nl[-1] = '\0';
+    *nl = '\0';
+
+    return nl + 1;
+}
+
+/*
+ * decodes the escape sequences of a header key or value
+ * in place. those are \r, \n, \c (colon) and \\, anything
+ * else after a backslash is an error.
+ */
+static int unescape(char *str) {
+    char *src, *dst;
+
+    for (src = dst = str; *src != '\0'; src++, dst++) {
+        if (*src != '\\') {
+            *dst = *src;
+            continue;
+        }
+
+        switch (*++src) {
+            case 'r':  *dst = '\r'; break;
+            case 'n':  *dst = '\n'; break;
+            case 'c':  *dst = ':';  break;
+            case '\\': *dst = '\\'; break;
+            default: return STOMP_INVALID_HEADER;
+        }
+    }
+    *dst = '\0';
+
+    return 0;
+}
+
+/* see header for doc */
+int stomp_content_length(const char *val, size_t n, size_t *len) {
+    size_t i, digit;
+
+    if (n == 0) return STOMP_INVALID_HEADER;
+
+    *len = 0;
+    for (i = 0; i < n; i++) {
+        if (val[i] < '0' || val[i] > '9') return STOMP_INVALID_HEADER;
+
+        digit = val[i] - '0';
+        if (*len > ((size_t)-1 - digit) / 10) return STOMP_INVALID_HEADER;
+        *len = *len * 10 + digit;
+    }
+
+    return 0;
+}
+
+/*
+ * checks the value of the batch header against the
+ * content: a comma-separated list of at most
+ * STOMP_MAX_BATCH lengths, none of them zero, that
+ * add up to the length of the content. returns 0 if
+ * it does, STOMP_INVALID_HEADER if the list is malformed
+ * and STOMP_INVALID_CONTENT if the lengths do not match.
+ */
+static int parse_batch(const char *val, size_t contentlen) {
+    size_t n = 0, sum = 0, len;
+    const char *c = val;
+
+    while (1) {
+        if (*c < '0' || *c > '9') return STOMP_INVALID_HEADER;
+
+        len = 0;
+        for (; *c >= '0' && *c <= '9'; c++) {
+            len = len * 10 + *c - '0';
+            if (len > contentlen) return STOMP_INVALID_CONTENT;
+        }
+
+        if (len == 0 || ++n > STOMP_MAX_BATCH)
+            return STOMP_INVALID_HEADER;
+
+        sum += len;
+        if (sum > contentlen) return STOMP_INVALID_CONTENT;
+
+        if (*c == '\0') break;
+        if (*c++ != ',') return STOMP_INVALID_HEADER;
+    }
+
+    return sum == contentlen ? 0 : STOMP_INVALID_CONTENT;
+}
+
+/* keys of the well-known headers, by STOMP_HDR_ */
+static const char *known_keys[STOMP_NKNOWN] = {
+    "login", "topic", "destination", "content-length", "content-type",
+    "receipt", "receipt-id", "message-id", "priority", "expires",
+    "batch", "accept-framing", "accept-encoding", "content-encoding",
+    "heart-beat"
+};
 
-    // drop from left
-    while (**str == ' ') (*str)++;
+/* see header for doc */
+int stomp_header_known(const char *key) {
+    int hdr;
+
+    // the first letters tell which one it could be,
+    // only that one is compared
+    switch (key[0]) {
+        case 'l': hdr = STOMP_HDR_LOGIN; break;
+        case 't': hdr = STOMP_HDR_TOPIC; break;
+        case 'd': hdr = STOMP_HDR_DESTINATION; break;
+        case 'm': hdr = STOMP_HDR_MESSAGE_ID; break;
+        case 'p': hdr = STOMP_HDR_PRIORITY; break;
+        case 'e': hdr = STOMP_HDR_EXPIRES; break;
+        case 'b': hdr = STOMP_HDR_BATCH; break;
+        case 'h': hdr = STOMP_HDR_HEART_BEAT; break;
+        case 'a':
+            if (strncmp(key, "accept-", 7) != 0) return -1;
+            hdr = key[7] == 'f' ? STOMP_HDR_ACCEPT_FRAMING
+                                : STOMP_HDR_ACCEPT_ENCODING;
+            break;
+        case 'c':
+            if (strncmp(key, "content-", 8) != 0) return -1;
+            switch (key[8]) {
+                case 'l': hdr = STOMP_HDR_CONTENT_LENGTH; break;
+                case 'e': hdr = STOMP_HDR_CONTENT_ENCODING; break;
+                default:  hdr = STOMP_HDR_CONTENT_TYPE;
+            }
+            break;
+        case 'r':
+            if (strncmp(key, "receipt", 7) != 0) return -1;
+            hdr = key[7] == '\0' ? STOMP_HDR_RECEIPT
+                                 : STOMP_HDR_RECEIPT_ID;
+            break;
+        default:
+            return -1;
+    }
 
-    i = strlen(*str) - 1;
-    // move 0 on the to the left
-    while (i > 0 && (*str)[i] == ' ') (*str)[i--] = '\0';
+    return strcmp(known_keys[hdr], key) == 0 ? hdr : -1;
 }
 
+/* see header for doc */
+char *stomp_header_get(const struct stomp_command *cmd, int hdr) {
+    int pos = cmd->known[hdr];
+    return pos == 0 ? NULL : cmd->headers[pos - 1].val;
+}
+
+/* what ends a header line or its parts */
+static const char header_delims[4] = { '\n', ':', '\\', '\0' };
+
 /*
- * parses header key value pairs from the
- * null-terminated raw string. each header is
- * on one line and the end of the headers marks
- * an empty line.
+ * parses the header lines from pos up to the empty
+ * line that ends them into the headers of the command.
+ * each line is a key and a value separated by the first
+ * colon, spaces are part of either. the value may be
+ * empty. the lines may end with CRLF. unless the command
+ * is CONNECT, keys and values are unescaped and further
+ * colons must be escaped, otherwise they belong to the
+ * value. the keys and values are terminated in place,
+ * they point into the raw string.
  *
- * the stomp_command struct is expected to be
- * partially filled with the number of headers
- * that are expected for the command to be parsed.
- * if more or less headers are found, an error
- * is returned.
+ * the position of the well-known headers is noted. if
+ * there is a content-length header, its value is stored
+ * in len and haslen is set.
  *
- * the headers field in the stomp command is expected
- * to be set with all keys for the expected headers.
+ * pos is set to the first byte after the empty line
+ * or to null if the header is not terminated.
  *
  * the return code is 0 on success or any of the
  * STOMP_ error codes on failure.
  */
-static int parse_header(char *raw, struct stomp_command *cmd) {
-    char *rawline;
-    char *saveraw, *saveline;
-    int i = 0;
-
-    if (raw == NULL && cmd->nheaders == 0)
-        return 0;
-    else if (raw == NULL && cmd->nheaders != 0)
-        return STOMP_MISSING_HEADER;
+static int parse_header(char **pos, char *end, int escaped,
+        struct stomp_command *cmd, int *haslen, size_t *len) {
+    char *line, *next, *eol, *colon, *key, *val;
+    int ret, hdr, backslash;
 
-    rawline = strtok_r(raw, "\n", &saveraw);
-    if (rawline == NULL && cmd->nheaders != 0)
-        return STOMP_MISSING_HEADER;
-    // at most expected, unless end or empty
-    while (i < cmd->nheaders && rawline != NULL
-            && strnlen(rawline, 1) != 0) {
-        char *line = strdup(rawline);
-
-        // key
-        char *key = strtok_r(line, ":", &saveline);
-        if (key == NULL) return STOMP_INVALID_HEADER;
-        trim(&key);
-        if (strlen(key) == 0) return STOMP_INVALID_HEADER;
-
-        // val
-        char *val = strtok_r(NULL, ":", &saveline);
-        if (val == NULL) return STOMP_INVALID_HEADER;
-        trim(&val);
-        if (strlen(val) == 0) return STOMP_INVALID_HEADER;
-
-        // more?
-        if (strtok_r(NULL, ":", &saveline) != NULL)
-            return STOMP_INVALID_HEADER;
+    *haslen = 0;
+    cmd->headers = cmd->parsed;
+    cmd->nheaders = 0;
+    memset(cmd->known, 0, sizeof(cmd->known));
+
+    for (line = *pos; ; line = next) {
+
+        // a single pass over the line finds its end, the
+        // colon after the key and whether anything needs
+        // to be unescaped
+        colon = NULL;
+        backslash = 0;
+        for (next = line; ; next++) {
+            next = scan_find(next, end - next, header_delims);
+            if (next == NULL || *next == '\n') break;
+
+            if (*next == '\\') {
+                backslash = 1;
+            } else if (*next == '\0') {
+                return STOMP_INVALID_HEADER;
+            } else if (colon == NULL) {
+                colon = next;
+            } else if (escaped) {
+                // colons in an escaped value must be escaped
+                return STOMP_INVALID_HEADER;
+            }
+        }
+
+        if (next == NULL) {
+            // without the empty line, there's no header at
+            // all. what's left must not look like one
+            *pos = NULL;
+            cmd->nheaders = 0;
+            memset(cmd->known, 0, sizeof(cmd->known));
+            if (line < end) return STOMP_INVALID_HEADER;
+            return 0;
+        }
 
-        // correct header?
-        if (strcmp(cmd->headers[i].key, key) != 0)
+        // lines may end with CRLF
+        eol = next > line && next[-1] == '\r' ? next - 1 : next;
+        *eol = '\0';
+        next++;
+
+        // empty line ends the header
+        if (eol == line) break;
+
+        if (cmd->nheaders == STOMP_MAX_HEADERS)
+            return STOMP_TOO_MANY_HEADERS;
+
+        if (colon == NULL) return STOMP_INVALID_HEADER;
+
+        if (colon == line) return STOMP_INVALID_HEADER;
+
+        *colon = '\0';
+        key = line;
+        val = colon + 1;
+
+        if (escaped && backslash &&
+                (unescape(key) != 0 || unescape(val) != 0))
             return STOMP_INVALID_HEADER;
-        else 
-            cmd->headers[i].val = strdup(val);
 
-        rawline = strtok_r(NULL, "\n", &saveraw);
-        i++;
+        // the first one counts
+        hdr = stomp_header_known(key);
+        if (hdr != -1 && cmd->known[hdr] == 0) {
+            cmd->known[hdr] = cmd->nheaders + 1;
+
+            if (hdr == STOMP_HDR_CONTENT_LENGTH) {
+                ret = stomp_content_length(val, strlen(val), len);
+                if (ret != 0) return ret;
+                *haslen = 1;
+            }
+        }
+
+        cmd->headers[cmd->nheaders].key = key;
+        cmd->headers[cmd->nheaders].val = val;
+        cmd->nheaders++;
     }
 
-    if (i < (((int)cmd->nheaders)-1)) return STOMP_MISSING_HEADER;   
-    else if (rawline != NULL) return STOMP_INVALID_HEADER;
-    else return 0;
+    *pos = next;
+    return 0;
 }
 
 /*
- * splits the raw string into header and content.
- * it is assumed that both of them are separated by two
- * newlines.
+ * finds the content between pos and end, the null
+ * byte that terminates the frame. if there is a
+ * content-length header, the content is exactly that
+ * many bytes and may be anything, including null
+ * bytes. otherwise, it runs up to the first null byte,
+ * without the newlines at the end (which are sent
+ * by clients that separate it with an empty line).
  *
- * the command name (including the newline) must
- * have been removed before.
- *
- * the resulting pointers are assigned to the second
- * and third param. if only one is present, it is
- * assumed to be the header. and the other one is null.
- * if none is present, both are set to null.
+ * empty content is set to null.
  */
-static int split_cmd(char *raw, char **header, char **content) {
-    char *headerend, *contentend;
-
-    // search for header/content separator
-    headerend = strstr(raw, "\n\n"); 
-    if (headerend == NULL) {
-        // no header found, later parsing
-        // will handle this
-        *header = NULL;
-        *content = NULL;
+static int take_content(char *pos, char *end, int haslen, size_t len,
+        struct stomp_command *cmd) {
+
+    cmd->content = NULL;
+    cmd->contentlen = 0;
+
+    // no header, no content
+    if (pos == NULL) return 0;
+
+    if (haslen) {
+        if ((size_t)(end - pos) != len || *end != '\0')
+            return STOMP_INVALID_CONTENT;
     } else {
+        len = strnlen(pos, end - pos);
+        while (len > 0 && (pos[len-1] == '\n' || pos[len-1] == '\r'))
+            len--;
+        pos[len] = '\0';
+    }
 
-        // mark end of string for header at newline
-        *headerend = '\0';
-        *header = raw;
-
-        contentend = strstr(headerend+2, "\n\n");
-        // content is optional
-        if (contentend != NULL) {
-            // end content
-            *contentend = '\0';
-            *content = headerend+2;
-        } else {
-            *content = NULL;    
-        }
+    if (len > 0) {
+        cmd->content = pos;
+        cmd->contentlen = len;
     }
 
     return 0;
 }
 
 /*
- * parses the raw header string and the raw
- * content string into the command.
- * the number of headers is expected to be set in
- * the stomp_command struct.
- *
- * see the doc for the function parse_header
- * for what is expected to be set in the headers
- * field of the stomp_command struct.
+ * parses what follows the command name (i.e. starts at
+ * pos) into the command. the parameter required is the
+ * well-known header (STOMP_HDR_) the command must have
+ * or -1 if there is none.
  *
  * the parameter expect_content should be set
  * to 1 if this command is expected to have
@@ -145,162 +318,293 @@ static int split_cmd(char *raw, char **header, char **content) {
  * met, an error is returned.
  *
  * on success, the stomp_command struct
- * is filled with the parsed string and
- * 0 is returned.
+ * is filled with pointers into the raw
+ * strings and 0 is returned.
  *
  */
-static int parse_command_generic(const char *cmdname,
-        char *rawheader, const char *rawcontent,
-        int expect_content, struct stomp_command *cmd) {
-    
-    int parsed = parse_header(rawheader, cmd);
+static int parse_command_generic(char *cmdname, int required,
+        char *pos, char *end, int expect_content,
+        struct stomp_command *cmd) {
+    int haslen, parsed;
+    size_t len = 0;
+
+    // CONNECT comes before the version has been
+    // negotiated and is therefore never escaped
+    int escaped = strcmp("CONNECT", cmdname) != 0;
+
+    cmd->topicid = 0;
+
+    parsed = parse_header(&pos, end, escaped, cmd, &haslen, &len);
+    if (parsed != 0) return parsed;
+
+    if (required != -1 && cmd->known[required] == 0)
+        return STOMP_MISSING_HEADER;
+
+    // other values may be empty, not the one that is required
+    if (required != -1 && *stomp_header_get(cmd, required) == '\0')
+        return STOMP_INVALID_HEADER;
+
+    parsed = take_content(pos, end, haslen, len, cmd);
     if (parsed != 0) return parsed;
 
-    if (expect_content == 1 && rawcontent == NULL)
+    parsed = stomp_check_command(cmd, required, expect_content);
+    if (parsed != 0) return parsed;
+
+    cmd->name = cmdname;
+    return 0;
+}
+
+/* see header for doc */
+int stomp_check_command(struct stomp_command *cmd, int required,
+        int expect_content) {
+
+    // the topic may be referred to by its id instead
+    if (required != -1 && cmd->known[required] == 0 && cmd->topicid == 0)
+        return STOMP_MISSING_HEADER;
+
+    if (expect_content == 1 && cmd->content == NULL)
         return STOMP_MISSING_CONTENT;
-    else if (expect_content == 0 && rawcontent != NULL)
+    else if (expect_content == 0 && cmd->content != NULL)
         return STOMP_UNEXPECTED_CONTENT;
-    
-    cmd->name = strdup(cmdname);
-    if (expect_content == 1) 
-        cmd->content = strdup(rawcontent);
-    else
-        cmd->content = NULL;
+
+    if (expect_content == 1 && cmd->known[STOMP_HDR_BATCH] != 0)
+        return parse_batch(stomp_header_get(cmd, STOMP_HDR_BATCH),
+            cmd->contentlen);
+
     return 0;
 }
 
-static int parse_command_connect(char *rawheader,
-                const char *rawcontent, struct stomp_command* cmd) {
-    cmd->headers = malloc(sizeof(struct stomp_header));
-    cmd->headers[0].key = strdup("login");
-    cmd->nheaders = 1;
-    return parse_command_generic("CONNECT", rawheader,
-        rawcontent, 0, cmd);
-}
+/* what has to be escaped in a header key or value */
+static const char escape_delims[4] = { '\r', '\n', ':', '\\' };
 
-static int parse_command_send(char *rawheader,
-                const char *rawcontent, struct stomp_command* cmd) {
-    cmd->headers = malloc(sizeof(struct stomp_header));
-    cmd->headers[0].key = strdup("topic");
-    cmd->nheaders = 1;
-    return parse_command_generic("SEND", rawheader,
-        rawcontent, 1, cmd);
+/*
+ * copies the len bytes of the header key or value to dst,
+ * escaping them. the parts in between the characters that
+ * are escaped are copied at once. returns the first byte
+ * after it
+ */
+static char *escape(char *dst, const char *val, size_t len) {
+    const char *end = val + len, *c;
+
+    while ((c = scan_find(val, end - val, escape_delims)) != NULL) {
+        memcpy(dst, val, c - val);
+        dst += c - val;
+
+        *dst++ = '\\';
+        switch (*c) {
+            case '\r': *dst++ = 'r';  break;
+            case '\n': *dst++ = 'n';  break;
+            case ':':  *dst++ = 'c';  break;
+            default:   *dst++ = '\\';
+        }
+        val = c + 1;
+    }
+
+    memcpy(dst, val, end - val);
+    return dst + (end - val);
 }
 
-static int parse_command_subscribe(char *rawheader,
-                const char *rawcontent, struct stomp_command* cmd) {
-    cmd->headers = malloc(sizeof(struct stomp_header));
-    cmd->headers[0].key = strdup("destination");
-    cmd->nheaders = 1;
-    return parse_command_generic("SUBSCRIBE", rawheader,
-        rawcontent, 0, cmd);
+/*
+ * copies the header key or value to dst, escaping it if
+ * escaped is set. returns the first byte after it
+ */
+static char *put_string(char *dst, const char *val, int escaped) {
+    size_t len = strlen(val);
+
+    if (escaped) return escape(dst, val, len);
+
+    memcpy(dst, val, len);
+    return dst + len;
 }
 
-static int parse_command_disconnect(char *rawheader,
-                const char *rawcontent, struct stomp_command* cmd) {
-    cmd->headers = NULL;
-    cmd->nheaders = 0;
-    return parse_command_generic("DISCONNECT", rawheader,
-        rawcontent, 0, cmd);
+/*
+ * writes the number in decimal to dst. returns the
+ * first byte after it
+ */
+static char *put_number(char *dst, size_t val) {
+    char buf[24], *p = buf + sizeof(buf);
+    size_t n;
+
+    do {
+        *--p = '0' + val % 10;
+        val /= 10;
+    } while (val != 0);
+
+    n = buf + sizeof(buf) - p;
+    memcpy(dst, p, n);
+    return dst + n;
 }
 
 /*
- * creates a string based on the passed command. no
- * checks are done to validate the command -
- * everything will be concatenated with separating
- * newlines according to the specification.
+ * encodes the command into a new buffer in a single pass.
+ * if prefix is set, it takes the place of the command line
+ * and the headers it has been created with (see
+ * stomp_create_prefix). otherwise, the frame starts with the
+ * name. if whole is 0, the frame ends after the headers, which
+ * is how a prefix is created. no checks are done to validate
+ * the command - everything will be concatenated according to
+ * the specification: the name and each header on a line, an
+ * empty line and the content, followed by the null byte. the
+ * header values are escaped and if there is content, its
+ * length is sent along so it may contain anything. the buffer
+ * is sized for the worst case, where every byte of the headers
+ * needs escaping, so it is not known before they have been
+ * written. returns the number of bytes
  */
-static int create_command_generic(struct stomp_command cmd,
-        char **str) {
+static size_t encode_command(const struct stomp_command *cmd,
+        const char *prefix, size_t prefixlen, int whole, char **str) {
     int i;
-    size_t len;
-
-    // length calc
-    len = 0;
-    len += strlen(cmd.name) + 1; // name\n
-    for (i = 0; i < cmd.nheaders; i++) {
-        len += strlen(cmd.headers[i].key);
-        len += 1; // :
-        len += strlen(cmd.headers[i].val);
+    size_t n;
+    char *dst;
+    const char *clkey = known_keys[STOMP_HDR_CONTENT_LENGTH];
+
+    // CONNECTED comes before the version has been
+    // negotiated and is therefore never escaped
+    int escaped = strcmp("CONNECTED", cmd->name) != 0;
+
+    // upper bound
+    n = prefix != NULL ? prefixlen : strlen(cmd->name) + 1; // name\n
+    for (i = 0; i < cmd->nheaders; i++) {
+        n += (strlen(cmd->headers[i].key) +
+              strlen(cmd->headers[i].val)) * (escaped ? 2 : 1);
+        n += 2; // : and \n
     }
-    if (cmd.nheaders != 0) len += 2; // \n\n
-    if (cmd.content != NULL) {
-        len += strlen(cmd.content);
-        len += 2; // \n\n
+    if (whole && cmd->content != NULL) {
+        n += strlen(clkey) + 1 + 20 + 1; // :len\n
+        n += cmd->contentlen;
     }
-    if (cmd.nheaders == 0 && cmd.content == NULL)
-        len += 1; // another \n
-    len += 1; // \0
-
-    // memory for string
-    *str = malloc(sizeof(char) * len);
-
-    // strcat appends to the first parameter
-    // by removing the first zero byte
-    // and at the end appending a zero byte
-    (*str)[0] = '\0';
-
-    // string construction, always reset dst to beginning
-    // of next token
-    strcat(*str, cmd.name);
-    strcat(*str, "\n");
-    for (i = 0; i < cmd.nheaders; i++) {
-        strcat(*str, cmd.headers[i].key);
-
-        strcat(*str, ":");
-
-        strcat(*str, cmd.headers[i].val);
+    n += 2; // \n and \0
+
+    // memory for frame
+    *str = malloc(sizeof(char) * n);
+    assert(*str != NULL);
+
+    // frame construction, dst always points to
+    // the beginning of the next token
+    dst = *str;
+    if (prefix != NULL) {
+        memcpy(dst, prefix, prefixlen);
+        dst += prefixlen;
+    } else {
+        dst = put_string(dst, cmd->name, 0);
+        *dst++ = '\n';
     }
-    if (cmd.nheaders != 0) {
-        strcat(*str, "\n\n");
+    for (i = 0; i < cmd->nheaders; i++) {
+        dst = put_string(dst, cmd->headers[i].key, escaped);
+        *dst++ = ':';
+        dst = put_string(dst, cmd->headers[i].val, escaped);
+        *dst++ = '\n';
     }
-    if (cmd.content != NULL) {
-        strcat(*str, cmd.content);
+    if (!whole) return dst - *str;
 
-        strcat(*str, "\n\n");
+    if (cmd->content != NULL) {
+        dst = put_string(dst, clkey, 0);
+        *dst++ = ':';
+        dst = put_number(dst, cmd->contentlen);
+        *dst++ = '\n';
     }
-    if (cmd.nheaders == 0 && cmd.content == NULL) {
-        strcat(*str, "\n");    
+    *dst++ = '\n';
+    if (cmd->content != NULL) {
+        memcpy(dst, cmd->content, cmd->contentlen);
+        dst += cmd->contentlen;
     }
-    return 0;
+    *dst++ = '\0';
+
+    assert((size_t) (dst - *str) <= n);
+    return dst - *str;
+}
+
+/* whether the broker sends the command */
+static int known_command(const char *name) {
+    return strcmp(name, "CONNECTED") == 0
+        || strcmp(name, "ERROR") == 0
+        || strcmp(name, "MESSAGE") == 0
+        || strcmp(name, "RECEIPT") == 0;
 }
 
 /* see header for doc */
-int parse_command(char* raw, struct stomp_command* cmd) {
-    char *header, *content;
-    int split;
-
-    if (strncmp("CONNECT\n", raw, 8) == 0) {
-        split = split_cmd(raw+8, &header, &content);
-        if (split != 0) return split;
-        return parse_command_connect(header, content, cmd);
-    } else if (strncmp("SEND\n", raw, 5) == 0) {
-        split = split_cmd(raw+5, &header, &content);
-        if (split != 0) return split;
-        return parse_command_send(header, content, cmd);
-    } else if (strncmp("SUBSCRIBE\n", raw, 10) == 0) {
-        split = split_cmd(raw+10, &header, &content);
-        if (split != 0) return split;
-        return parse_command_subscribe(header, content, cmd);
-    } else if (strncmp("DISCONNECT\n", raw, 10) == 0) {
-        split = split_cmd(raw+10, &header, &content);
-        if (split != 0) return split;
-        return parse_command_disconnect(header, content, cmd);
+int parse_frame(char *raw, size_t len, struct stomp_command *cmd) {
+    char *pos, *end;
+
+    // the frame ends with the null byte
+    if (len == 0) return STOMP_INVALID_CONTENT;
+    end = raw + len - 1;
+
+    // the command name is the first line
+    pos = take_line(raw, end);
+    if (pos == NULL) pos = end;
+
+    if (strcmp("CONNECT", raw) == 0) {
+        return parse_command_generic("CONNECT", STOMP_HDR_LOGIN,
+            pos, end, 0, cmd);
+    } else if (strcmp("SEND", raw) == 0) {
+        return parse_command_generic("SEND", STOMP_HDR_TOPIC,
+            pos, end, 1, cmd);
+    } else if (strcmp("SUBSCRIBE", raw) == 0) {
+        return parse_command_generic("SUBSCRIBE", STOMP_HDR_DESTINATION,
+            pos, end, 0, cmd);
+    } else if (strcmp("DISCONNECT", raw) == 0) {
+        return parse_command_generic("DISCONNECT", -1, pos, end, 0, cmd);
     } else {
         return STOMP_UNKNOWN_COMMAND;
     }
 }
 
 /* see header for doc */
-int create_command(struct stomp_command cmd, char **str) {
-    if (strcmp(cmd.name, "CONNECTED") == 0
-     || strcmp(cmd.name, "ERROR") == 0
-     || strcmp(cmd.name, "MESSAGE") == 0
-     || strcmp(cmd.name, "RECEIPT") == 0) {
-        return create_command_generic(cmd, str);
-    } else {
-        return STOMP_UNKNOWN_COMMAND;
+size_t stomp_batch_split(const struct stomp_command *cmd,
+                         struct iovec *bodies) {
+    size_t n = 0;
+    char *c, *content = cmd->content;
+    char *val = stomp_header_get(cmd, STOMP_HDR_BATCH);
+
+    if (val == NULL) {
+        bodies[0].iov_base = cmd->content;
+        bodies[0].iov_len = cmd->contentlen;
+        return 1;
     }
+
+    // validated by parse_batch
+    for (c = val; *c != '\0'; n++) {
+        bodies[n].iov_base = content;
+        bodies[n].iov_len = strtoul(c, &c, 10);
+        content += bodies[n].iov_len;
+        if (*c == ',') c++;
+    }
+
+    assert(content == cmd->content + cmd->contentlen);
+    return n;
+}
+
+/* see header for doc */
+int parse_command(char* raw, struct stomp_command* cmd) {
+    return parse_frame(raw, strlen(raw) + 1, cmd);
+}
+
+/* see header for doc */
+int create_command(const struct stomp_command *cmd, char **str,
+        size_t *len) {
+    if (!known_command(cmd->name)) return STOMP_UNKNOWN_COMMAND;
+
+    *len = encode_command(cmd, NULL, 0, 1, str);
+    return 0;
+}
+
+/* see header for doc */
+int stomp_create_prefix(const struct stomp_command *cmd, char **str,
+        size_t *len) {
+    if (!known_command(cmd->name)) return STOMP_UNKNOWN_COMMAND;
+
+    *len = encode_command(cmd, NULL, 0, 0, str);
+    return 0;
+}
+
+/* see header for doc */
+int create_command_prefixed(const struct stomp_command *cmd,
+        const char *prefix, size_t prefixlen, char **str, size_t *len) {
+    if (!known_command(cmd->name)) return STOMP_UNKNOWN_COMMAND;
+
+    *len = encode_command(cmd, prefix, prefixlen, 1, str);
+    return 0;
 }
 
 void stomp_strerror(int errcode, char *buf) {
@@ -326,31 +630,22 @@ void stomp_strerror(int errcode, char *buf) {
         case STOMP_UNKNOWN_COMMAND:
             sprintf(buf,"STOMP_UNKNOWN_COMMAND");
             break;
+        case STOMP_TOO_MANY_HEADERS:
+            sprintf(buf,"STOMP_TOO_MANY_HEADERS");
+            break;
         default:
             sprintf(buf, "UNKNOWN_ERROR");
     }
 }
 
 int stomp_command_fields_destroy(struct stomp_command *cmd) {
-    free(cmd->name);
+    // everything points into the raw string
     cmd->name = NULL;
-
-    free(cmd->content);
+    cmd->headers = NULL;
+    cmd->nheaders = 0;
     cmd->content = NULL;
-
-    // currently nothing has more headers
-    assert(cmd->nheaders < 2);
-    if (cmd->nheaders == 1) {
-        struct stomp_header *hdr = cmd->headers;
-        free(hdr->key);
-        hdr->key = NULL;
-
-        free(hdr->val);
-        hdr->val = NULL;
-
-        free(cmd->headers);
-        cmd->headers = NULL;
-    }
+    cmd->contentlen = 0;
+    cmd->topicid = 0;
 
     return 0;
 }
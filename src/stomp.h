@@ -1,13 +1,45 @@
 #ifndef STOMP_HEADER
 #define STOMP_HEADER
+
+#include <stddef.h>
+#include <sys/uio.h>
+
 /*
  * STOMP Protocol
  *
  * This rough* implementation of the stomp protocol supports a
  * number of commands, each of which is described in the following
  * section. All have uppercase have uppercase names followed by
- * a newline and a list of values. Each command is terminated
- * by a newline followed by the null-byte (^@).
+ * a newline and a list of headers, one per line. An empty line
+ * separates the headers from the content, which is followed by
+ * the null-byte (^@). Lines may end with CRLF instead of a
+ * newline.
+ *
+ * Framing follows STOMP 1.2:
+ * - If there is a content-length header, the content is exactly
+ *   that many bytes and may contain anything, null-bytes
+ *   included. The byte after it must be the null-byte.
+ * - Otherwise, the content ends at the first null-byte. Newlines
+ *   at its end are dropped, so clients may still separate it
+ *   from the null-byte by an empty line.
+ * - A header line is split at its first colon. Spaces belong
+ *   to the key or the value, which may be empty.
+ * - In header keys and values (except in CONNECT and CONNECTED),
+ *   a carriage return, a newline, a colon and a backslash are
+ *   escaped as \r, \n, \c and \\ respectively. In CONNECT and
+ *   CONNECTED, further colons are part of the value.
+ * - The broker sends the content-length header along with any
+ *   content.
+ * - Besides the headers listed for each command, any other
+ *   header may be sent. If a header is repeated, the first
+ *   one counts. A command has at most STOMP_MAX_HEADERS (32)
+ *   headers, the broker rejects it otherwise.
+ * - A client may ask for a RECEIPT of SEND, SUBSCRIBE and
+ *   DISCONNECT with the receipt header. The RECEIPT then has
+ *   the receipt-id header with the same value.
+ * - Between frames, either side may send heart-beats, which
+ *   are newlines (or CRLF) and otherwise ignored. With the
+ *   binary framing, a heart-beat is a frame of length 0.
  *
  * *rough: While this implementation is very similar to the
  *         original STOMP specification, it does not adhere
@@ -25,26 +57,49 @@
  *
  * Example:
  *    COMMAND
- *    key: value
- *    key: value
+ *    key:value
+ *    key:value
  *    ..
  *
- *    Content
- *
- *    ^@
+ *    Content^@
  *
  * Commands:
  * 1. CONNECT
  *    a. Sent by client to initiate connection
  *    b. Headers
- *       i. login: a string identifying the client
+ *       i.  login: a string identifying the client
+ *       ii. accept-framing: (optional) comma-separated list
+ *           of the framings the client supports. with
+ *           binary, all commands after CONNECTED are framed
+ *           in binary (see binary.h)
+ *       iii. accept-encoding: (optional) comma-separated list
+ *            of the encodings the client can decode. with
+ *            deflate, the content of MESSAGEs may be
+ *            compressed (see compress.h)
+ *       iv.  heart-beat: (optional) cx,cy where cx is the
+ *            number of milliseconds the client sends a
+ *            heart-beat (or anything else) at least every and
+ *            cy the number of milliseconds it wants to get one
+ *            at least every. 0 means none, which is also the
+ *            default
  *    c. No Content
  *    d. Response from broker
  *       i.  CONNECTED on success
  *       ii. ERROR on failure
  * 2. CONNECTED
  *    a. Sent by broker to client upon successful connection
- *    b. No Headers
+ *    b. Headers
+ *       i.  framing: (optional) binary if the commands that
+ *           follow are framed in binary
+ *       ii. encoding: (optional) deflate if the content of
+ *           MESSAGEs may be compressed
+ *       iii. heart-beat: (optional) sx,sy, just like for
+ *            CONNECT but for the broker. only sent if the
+ *            client has asked for heart-beats. the broker
+ *            sends them every max(sx,cy) milliseconds unless
+ *            either is 0 and expects them every max(cx,sy),
+ *            a client that is silent for twice as long is
+ *            taken for dead
  *    c. No Content
  * 3. ERROR
  *    a. Sent by broker to client on any failure
@@ -54,10 +109,28 @@
  * 4. SEND
  *    a. Sent by a connected publisher to publish to a topic
  *    b. Headers
- *       i. topic: a string identifying the topic
+ *       i.  topic: a string identifying the topic
+ *       ii. content-length: (optional) number of bytes of
+ *           content. if present, the content may contain
+ *           anything (see framing above). this also allows
+ *           the receiver to allocate memory for large
+ *           messages upfront.
+ *       iii. batch: (optional) comma-separated lengths of the
+ *            messages the content consists of, e.g. 3,5
+ *            for two messages of three and five bytes.
+ *            they must add up to the length of the content
+ *            (content-length should be sent, so nothing is
+ *            stripped) and none may be empty. a batch holds
+ *            at most STOMP_MAX_BATCH messages. they are
+ *            added to the topic at once and in order, each
+ *            as if it had been sent in a SEND of its own
+ *       iv. any other header (e.g. content-type, priority,
+ *            expires or those of the application) is
+ *            passed on to the subscribers, except receipt
  *    c. Content: The message to be sent to the topic
  *    d. Response from broker
- *       i. ERROR on failure
+ *       i.  ERROR on failure
+ *       ii. RECEIPT if asked for, one for the whole batch
  * 5. SUBSCRIBE
  *    a. Sent by a connected subscriber to subscribe to a topic
  *    b. Headers
@@ -65,12 +138,18 @@
  *                       subscribe to
  *    c. No Content
  *    d. Response from broker
- *       i. ERROR if subscription cannot be created
+ *       i.  ERROR if subscription cannot be created
+ *       ii. RECEIPT if asked for
  * 6. MESSAGE
  *    a. Message sent to a subscriber of a topic
  *    b. Headers
- *       i. destination: a string identifying the topic
- *          this message was sent to
+ *       i.   destination: a string identifying the topic
+ *            this message was sent to
+ *       ii.  message-id: a number identifying the message
+ *       iii. content-encoding: deflate if the content has
+ *            been compressed, only if the client accepts it
+ *       iv.  the headers of the SEND
+ *       v.   content-length: number of bytes of content
  *    c. Content: The contents of the message
  * 7. DISCONNECT
  *    a. Sent by a connected client to end a connection
@@ -80,8 +159,24 @@
  *       i. RECEIPT to confirm
  * 8. RECEIPT
  *    a. Sent by the broker to a client as confirmation that
- *       the connection has been successfully ended.
- *    b. No Headers
+ *       the connection has been successfully ended or that
+ *       a command has been processed.
+ *    b. Headers
+ *       i. receipt-id: (optional) value of the receipt header
+ *          of the command
+ *    c. No Content
+ *    d. A receipt confirms the command it has been asked for
+ *       with and all commands the client has sent before it.
+ *       receipts are therefore cumulative: a publisher that
+ *       sends many SENDs without waiting in between may only
+ *       get a receipt for the last of them that asked for one.
+ * 9. TOPIC
+ *    a. Sent by the broker to a client with the binary framing
+ *       that has named a topic in SEND or SUBSCRIBE (only in
+ *       binary, see binary.h)
+ *    b. Headers
+ *       i. destination: the name of the topic, along with the
+ *          id the client may use instead from now on
  *    c. No Content
  *
  */
@@ -93,6 +188,35 @@
 #define STOMP_MISSING_CONTENT    -6
 #define STOMP_INVALID_CONTENT    -7
 #define STOMP_UNKNOWN_COMMAND    -8
+#define STOMP_TOO_MANY_HEADERS   -9
+
+/* headers the broker knows about, their position in a
+ * parsed command is looked up in constant time (see
+ * stomp_header_get) */
+#define STOMP_HDR_LOGIN          0
+#define STOMP_HDR_TOPIC          1
+#define STOMP_HDR_DESTINATION    2
+#define STOMP_HDR_CONTENT_LENGTH 3
+#define STOMP_HDR_CONTENT_TYPE   4
+#define STOMP_HDR_RECEIPT        5
+#define STOMP_HDR_RECEIPT_ID     6
+#define STOMP_HDR_MESSAGE_ID     7
+#define STOMP_HDR_PRIORITY       8
+#define STOMP_HDR_EXPIRES        9
+#define STOMP_HDR_BATCH          10
+#define STOMP_HDR_ACCEPT_FRAMING 11
+#define STOMP_HDR_ACCEPT_ENCODING  12
+#define STOMP_HDR_CONTENT_ENCODING 13
+#define STOMP_HDR_HEART_BEAT     14
+#define STOMP_NKNOWN             15
+
+/* maximum number of headers of a command, more are
+ * rejected with STOMP_TOO_MANY_HEADERS. parsing does not
+ * allocate, the headers live in the command itself */
+#define STOMP_MAX_HEADERS 32
+
+/* maximum number of messages in a batch SEND */
+#define STOMP_MAX_BATCH 1024
 
 struct stomp_header {
     char* key;
@@ -104,30 +228,109 @@ struct stomp_command {
     struct stomp_header* headers;
     size_t               nheaders;
     char*                content;
+
+    /* number of bytes of content, which may
+     * contain null bytes */
+    size_t               contentlen;
+
+    /* id of the topic if it is referred to by its id
+     * instead of its header (only in binary framing, see
+     * binary.h) or 0 */
+    unsigned long        topicid;
+
+    /* position in headers plus one of the first header
+     * with each of the well-known keys (STOMP_HDR_) or 0
+     * if there is none. only set by parse_frame */
+    unsigned char        known[STOMP_NKNOWN];
+
+    /* room for the headers of a parsed command, so
+     * parsing does not allocate. the headers field
+     * points here */
+    struct stomp_header  parsed[STOMP_MAX_HEADERS];
 };
 
-/* parses a raw string into the stomp_command struct.
+/* parses a raw frame of len bytes, including the
+ * null byte that ends it, into the stomp_command struct.
  * based on the command, different headers are expected
  * if anything is missing from a command, an error
  * code is returned. see the above error codes on the
  * possibilities. if the parsing was successful, 0 is
  * returned and the stomp_command struct is filled
+ * with all headers in the order they were sent.
  *
- * the raw string must be null-terminated.
+ * the frame is modified in place and the command does
+ * not copy anything: the name and the header keys are
+ * constants, the header values and the content point
+ * into the frame. they are only valid as long as the
+ * frame is. header values and the content are null-
+ * terminated, but the content may contain null bytes
+ * as well (see contentlen).
  */
+int parse_frame(char *raw, size_t len, struct stomp_command *cmd);
+
+/* checks a command whose headers and content have been
+ * filled in against the rules parse_frame applies: the
+ * required header (STOMP_HDR_ or -1) must be there unless
+ * topicid is set, there must (expect_content is 1) or must
+ * not (0) be content and the batch must match it. returns
+ * 0 if it does or any of the STOMP_ error codes */
+int stomp_check_command(struct stomp_command *cmd, int required,
+                        int expect_content);
+
+/* returns the value of the well-known header (STOMP_HDR_)
+ * of a parsed command or null if it has not been sent */
+char *stomp_header_get(const struct stomp_command *cmd, int hdr);
+
+/* returns which of the well-known headers (STOMP_HDR_)
+ * the key is or -1 if it is none of them */
+int stomp_header_known(const char *key);
+
+/* parses the n bytes of a content-length value into len.
+ * it must be a decimal number without anything around it,
+ * the reader (see socket.c) and the parser both go by this.
+ * returns 0 on success or STOMP_INVALID_HEADER */
+int stomp_content_length(const char *val, size_t n, size_t *len);
+
+/* splits the content of a SEND into the messages of
+ * its batch header (see above), or the whole content if
+ * there is none. bodies must have room for STOMP_MAX_BATCH
+ * messages, they point into the content. returns the
+ * number of messages */
+size_t stomp_batch_split(const struct stomp_command *cmd,
+                         struct iovec *bodies);
+
+/* parse_frame for a null-terminated raw string */
 int parse_command(char* raw, struct stomp_command* cmd);
 
-/* assembles a string based on the passed command
+/* assembles a frame based on the passed command
  * so that it may be sent to a client. no validations
- * are made.
+ * are made. the number of bytes, including the null
+ * byte at the end, is stored in len.
  */
-int create_command(struct stomp_command cmd, char** str);
+int create_command(const struct stomp_command *cmd, char** str, size_t *len);
+
+/* encodes the beginning of a frame, i.e. the command line and
+ * the headers of the command, which is neither terminated nor
+ * sent on its own. frames that have it in common are then
+ * created with create_command_prefixed without encoding
+ * it again, e.g. the MESSAGEs of a topic all start with
+ * "MESSAGE\ndestination:<topic>\n". the string is not
+ * null-terminated, its length is stored in len */
+int stomp_create_prefix(const struct stomp_command *cmd, char **str,
+        size_t *len);
+
+/* like create_command, but the frame starts with the prefix
+ * (see stomp_create_prefix), followed by the headers of the
+ * command. the name must be the one of the prefix */
+int create_command_prefixed(const struct stomp_command *cmd,
+        const char *prefix, size_t prefixlen, char **str, size_t *len);
 
 /* converts a stomp error code (STOMP_) to a string.
  * the buffer should be 32 bytes */
 void stomp_strerror(int errcode, char *buf);
 
-/* frees up the fields */
+/* resets the fields of a parsed command. nothing
+ * needs to be freed, as nothing has been copied */
 int stomp_command_fields_destroy(struct stomp_command *cmd);
 
 #endif
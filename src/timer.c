@@ -0,0 +1,158 @@
+#include <stdlib.h>
+#include <limits.h>
+#include <assert.h>
+#include <time.h>
+
+#include "timer.h"
+
+/* initial size of the heap */
+#define TIMERS_INITIAL_CAP 16
+
+static void place(struct timers *timers, struct timer *timer, size_t i) {
+    timers->heap[i] = timer;
+    timer->index = i;
+}
+
+/* moves the timer at i towards the root
+ * while it is due before its parent */
+static void sift_up(struct timers *timers, size_t i) {
+    struct timer *timer = timers->heap[i];
+    size_t parent;
+
+    while (i > 0) {
+        parent = (i - 1) / 2;
+        if (timers->heap[parent]->deadline <= timer->deadline) break;
+        place(timers, timers->heap[parent], i);
+        i = parent;
+    }
+
+    place(timers, timer, i);
+}
+
+/* moves the timer at i towards the leaves
+ * while one of its children is due before it */
+static void sift_down(struct timers *timers, size_t i) {
+    struct timer *timer = timers->heap[i];
+    size_t child;
+
+    while ((child = 2 * i + 1) < timers->len) {
+        if (child + 1 < timers->len &&
+                timers->heap[child + 1]->deadline <
+                timers->heap[child]->deadline)
+            child++;
+        if (timer->deadline <= timers->heap[child]->deadline) break;
+        place(timers, timers->heap[child], i);
+        i = child;
+    }
+
+    place(timers, timer, i);
+}
+
+/* see header for doc */
+int timers_init(struct timers *timers) {
+    timers->heap = malloc(TIMERS_INITIAL_CAP * sizeof(struct timer *));
+    assert(timers->heap != NULL);
+    timers->len = 0;
+    timers->cap = TIMERS_INITIAL_CAP;
+    return 0;
+}
+
+/* see header for doc */
+int timers_destroy(struct timers *timers) {
+    size_t i;
+
+    for (i = 0; i < timers->len; i++)
+        timers->heap[i]->index = TIMER_NONE;
+
+    free(timers->heap);
+    timers->heap = NULL;
+    timers->len = 0;
+    timers->cap = 0;
+    return 0;
+}
+
+/* see header for doc */
+void timer_init(struct timer *timer,
+        void (*fire)(struct timer *, long), void *arg) {
+    timer->deadline = 0;
+    timer->index = TIMER_NONE;
+    timer->fire = fire;
+    timer->arg = arg;
+}
+
+/* see header for doc */
+long timer_now() {
+    struct timespec ts;
+    int ret = clock_gettime(CLOCK_MONOTONIC, &ts);
+    assert(ret == 0);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
+/* see header for doc */
+void timer_arm(struct timers *timers, struct timer *timer, long deadline) {
+    struct timer **heap;
+
+    if (timer->index != TIMER_NONE) {
+        timer->deadline = deadline;
+        sift_up(timers, timer->index);
+        sift_down(timers, timer->index);
+        return;
+    }
+
+    if (timers->len == timers->cap) {
+        heap = realloc(timers->heap,
+            2 * timers->cap * sizeof(struct timer *));
+        assert(heap != NULL);
+        timers->heap = heap;
+        timers->cap *= 2;
+    }
+
+    timer->deadline = deadline;
+    place(timers, timer, timers->len++);
+    sift_up(timers, timer->index);
+}
+
+/* see header for doc */
+void timer_cancel(struct timers *timers, struct timer *timer) {
+    size_t i = timer->index;
+    struct timer *last;
+
+    if (i == TIMER_NONE) return;
+    assert(i < timers->len && timers->heap[i] == timer);
+
+    timer->index = TIMER_NONE;
+    if (i == --timers->len) return;
+
+    // the last one takes its place and
+    // may have to go either way from there
+    last = timers->heap[timers->len];
+    place(timers, last, i);
+    sift_up(timers, i);
+    sift_down(timers, last->index);
+}
+
+/* see header for doc */
+int timers_timeout(struct timers *timers, long now) {
+    long left;
+
+    if (timers->len == 0) return -1;
+
+    left = timers->heap[0]->deadline - now;
+    if (left < 0) return 0;
+    return left > INT_MAX ? INT_MAX : (int) left;
+}
+
+/* see header for doc */
+int timers_run(struct timers *timers, long now) {
+    int n = 0;
+    struct timer *timer;
+
+    while (timers->len > 0 && timers->heap[0]->deadline <= now) {
+        timer = timers->heap[0];
+        timer_cancel(timers, timer);
+        timer->fire(timer, now);
+        n++;
+    }
+
+    return n;
+}
@@ -0,0 +1,82 @@
+#ifndef TIMER_HEADER
+#define TIMER_HEADER
+
+/* timer.h
+ *
+ * timers that fire once a deadline has passed, kept in a
+ * binary heap ordered by the deadline. there is no thread
+ * of their own: the owner asks how long it may sleep until
+ * the next one is due (see timers_timeout), e.g. to pass it
+ * on to epoll_wait, and fires the expired ones afterwards
+ * (see timers_run). arming, cancelling and firing a timer
+ * are O(log n), so each of any number of connections may
+ * have one.
+ *
+ * the timers are not synchronized, they must only be used
+ * by the thread that owns them.
+ */
+
+#include <stdlib.h>
+
+/* index of a timer that is not armed */
+#define TIMER_NONE ((size_t) -1)
+
+struct timer {
+    /* when the timer fires, in milliseconds
+     * of the monotonic clock (see timer_now) */
+    long deadline;
+
+    /* position in the heap or TIMER_NONE */
+    size_t index;
+
+    /* invoked once the deadline has passed, with the
+     * time the timers are run at. the timer is no longer
+     * armed by then, but may be armed again */
+    void (*fire)(struct timer *timer, long now);
+
+    /* passed back with fire, opaque to the timers */
+    void *arg;
+};
+
+/* set of timers, ordered by their deadline */
+struct timers {
+    /* binary heap, the next timer to fire first */
+    struct timer **heap;
+
+    /* number of armed timers */
+    size_t len;
+
+    /* size of the heap */
+    size_t cap;
+};
+
+/* initializes an empty set of timers */
+int timers_init(struct timers *timers);
+
+/* destroys the set. the timers that are
+ * still armed are not fired */
+int timers_destroy(struct timers *timers);
+
+/* initializes a timer that is not armed */
+void timer_init(struct timer *timer,
+        void (*fire)(struct timer *, long), void *arg);
+
+/* returns the time of the monotonic clock in milliseconds */
+long timer_now();
+
+/* arms the timer to fire at the deadline. a timer
+ * that is already armed is moved to the new deadline */
+void timer_arm(struct timers *timers, struct timer *timer, long deadline);
+
+/* disarms the timer, if it is armed */
+void timer_cancel(struct timers *timers, struct timer *timer);
+
+/* returns the number of milliseconds until the next timer
+ * is due, 0 if one is overdue or -1 if none is armed */
+int timers_timeout(struct timers *timers, long now);
+
+/* fires all timers whose deadline has passed by now, the
+ * earliest first. returns the number of timers fired */
+int timers_run(struct timers *timers, long now);
+
+#endif
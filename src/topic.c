@@ -6,22 +6,197 @@
 
 #include "topic.h"
 
-/* at least read lock for list of topics must be held by 
- * the funciton calling this function */
-static struct topic *find_topic(struct list *topics, char *name) {
-    struct node *cur = topics->root;
-    while (cur != NULL) {
-        struct topic *topic = cur->entry;
-        if (strcmp(topic->name, name) == 0)
+/* id of the last message, modified atomically */
+static unsigned long next_message_id = 0;
+
+/* fnv-1a hash of the name of a topic */
+static uint64_t hash_name(const char *name) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (; *name != '\0'; name++) {
+        hash ^= (unsigned char) *name;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+/* the shard is chosen by the low bits of the hash, which
+ * fnv-1a spreads better than the high ones for short names */
+static struct topic_shard *shard_of(struct topic_table *topics,
+        uint64_t hash) {
+    return &topics->shards[hash & (TOPIC_TABLE_SHARDS - 1)];
+}
+
+/* the bucket within the shard is chosen by the bits above
+ * those of the shard, which all its topics have in common */
+static size_t bucket_of(uint64_t hash, size_t nbuckets) {
+    return (hash >> TOPIC_SHARD_BITS) & (nbuckets - 1);
+}
+
+/* see header for doc */
+int topic_table_init(struct topic_table *table) {
+    int ret;
+    size_t i;
+    struct topic_shard *shard;
+
+    for (i = 0; i < TOPIC_TABLE_SHARDS; i++) {
+        shard = &table->shards[i];
+
+        pthread_rwlock_t *rwlock = malloc(sizeof(pthread_rwlock_t));
+        assert(rwlock != NULL);
+        ret = pthread_rwlock_init(rwlock, NULL);
+        assert(ret == 0);
+        shard->rwlock = rwlock;
+
+        shard->buckets = calloc(TOPIC_SHARD_BUCKETS, sizeof(struct topic *));
+        assert(shard->buckets != NULL);
+        shard->nbuckets = TOPIC_SHARD_BUCKETS;
+
+        shard->byid = malloc(TOPIC_SHARD_BUCKETS * sizeof(struct topic *));
+        assert(shard->byid != NULL);
+        shard->ntopics = 0;
+        shard->cap = TOPIC_SHARD_BUCKETS;
+    }
+
+    return 0;
+}
+
+/* see header for doc */
+int topic_table_destroy(struct topic_table *table) {
+    int ret;
+    size_t i;
+    struct topic_shard *shard;
+
+    for (i = 0; i < TOPIC_TABLE_SHARDS; i++) {
+        shard = &table->shards[i];
+
+        ret = pthread_rwlock_destroy(shard->rwlock);
+        assert(ret == 0);
+        free(shard->rwlock);
+        shard->rwlock = NULL;
+
+        free(shard->buckets);
+        shard->buckets = NULL;
+        shard->nbuckets = 0;
+
+        free(shard->byid);
+        shard->byid = NULL;
+        shard->ntopics = 0;
+        shard->cap = 0;
+    }
+
+    return 0;
+}
+
+/* at least read lock for the shard must be held
+ * by the funciton calling this function */
+static struct topic *find_topic(struct topic_shard *shard,
+        uint64_t hash, char *name) {
+    struct topic *topic = shard->buckets[bucket_of(hash, shard->nbuckets)];
+    while (topic != NULL) {
+        if (topic->hash == hash && strcmp(topic->name, name) == 0)
             return topic;
         else
-            cur = cur->next;
+            topic = topic->next;
     }
     return NULL;
 }
 
-/* write lock on topic list must be held */
-static struct topic *create_new_topic(struct list *topics, char *name) {
+/* doubles the number of buckets. the hashes are kept
+ * in the topics, so the names are not hashed again.
+ * write lock on the shard must be held */
+static void grow_buckets(struct topic_shard *shard) {
+    size_t i, nbuckets = 2 * shard->nbuckets;
+    struct topic *topic, **slot;
+    struct topic **buckets = calloc(nbuckets, sizeof(struct topic *));
+    assert(buckets != NULL);
+
+    for (i = 0; i < shard->ntopics; i++) {
+        topic = shard->byid[i];
+        slot = &buckets[bucket_of(topic->hash, nbuckets)];
+        topic->next = *slot;
+        *slot = topic;
+    }
+
+    free(shard->buckets);
+    shard->buckets = buckets;
+    shard->nbuckets = nbuckets;
+}
+
+/* adds the topic, whose hash has been set, and assigns
+ * it the next id. write lock on the shard must be held */
+static void insert_topic(struct topic_table *topics,
+        struct topic_shard *shard, struct topic *topic) {
+    struct topic **byid, **slot;
+
+    if (shard->ntopics == shard->cap) {
+        byid = realloc(shard->byid, 2 * shard->cap * sizeof(struct topic *));
+        assert(byid != NULL);
+        shard->byid = byid;
+        shard->cap *= 2;
+    }
+
+    topic->id = shard->ntopics * TOPIC_TABLE_SHARDS
+        + (shard - topics->shards) + 1;
+    shard->byid[shard->ntopics++] = topic;
+
+    if (shard->ntopics > shard->nbuckets) {
+        // the new topic is linked in along with all others
+        grow_buckets(shard);
+    } else {
+        slot = &shard->buckets[bucket_of(topic->hash, shard->nbuckets)];
+        topic->next = *slot;
+        *slot = topic;
+    }
+}
+
+/* see header for doc */
+int topic_table_add(struct topic_table *table, struct topic *topic) {
+    int ret;
+    struct topic_shard *shard;
+
+    topic->hash = hash_name(topic->name);
+    shard = shard_of(table, topic->hash);
+
+    // acquire write lock for shard
+    ret = pthread_rwlock_wrlock(shard->rwlock);
+    assert(ret == 0);
+
+    assert(find_topic(shard, topic->hash, topic->name) == NULL);
+    insert_topic(table, shard, topic);
+
+    // release write lock for shard
+    ret = pthread_rwlock_unlock(shard->rwlock);
+    assert(ret == 0);
+
+    return 0;
+}
+
+/* see header for doc */
+size_t topic_table_len(struct topic_table *table) {
+    int ret;
+    size_t i, len = 0;
+    struct topic_shard *shard;
+
+    for (i = 0; i < TOPIC_TABLE_SHARDS; i++) {
+        shard = &table->shards[i];
+
+        // acquire read lock for shard
+        ret = pthread_rwlock_rdlock(shard->rwlock);
+        assert(ret == 0);
+
+        len += shard->ntopics;
+
+        // release read lock for shard
+        ret = pthread_rwlock_unlock(shard->rwlock);
+        assert(ret == 0);
+    }
+
+    return len;
+}
+
+/* write lock on the shard must be held */
+static struct topic *create_new_topic(struct topic_table *topics,
+        struct topic_shard *shard, uint64_t hash, char *name) {
     int ret;
 
     struct topic *topic = malloc(sizeof(struct topic));
@@ -31,146 +206,231 @@ static struct topic *create_new_topic(struct list *topics, char *name) {
     assert(ret == 0);
 
     topic->name = strdup(name);
-
-    ret = list_add(topics, topic);
+    topic->hash = hash;
+
+    // all messages of the topic start the same
+    struct stomp_command cmd;
+    struct stomp_header header;
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.name = "MESSAGE";
+    header.key = "destination";
+    header.val = topic->name;
+    cmd.headers = &header;
+    cmd.nheaders = 1;
+    cmd.content = NULL;
+    ret = stomp_create_prefix(&cmd, &topic->prefix, &topic->prefixlen);
     assert(ret == 0);
+
+    insert_topic(topics, shard, topic);
     return topic;
 }
 
-int topic_add_subscriber(struct list *topics, char *name,
-                struct subscriber *subscriber) {
-
-    int ret; // return values from other functions
-    int val = 0; // return value for this function
+/* see header for doc */
+struct topic *topic_find(struct topic_table *topics, char *name) {
+    int ret;
+    uint64_t hash = hash_name(name);
+    struct topic_shard *shard = shard_of(topics, hash);
     struct topic *topic;
 
-    /* first try with readlock if the
-     * topic exists. this will be faster in most
-     * scenarios. if it doesn't exist, create it
-     * with the write lock 
-     */
+    // acquire read lock for shard
+    ret = pthread_rwlock_rdlock(shard->rwlock);
+    assert(ret == 0);
+
+    topic = find_topic(shard, hash, name);
 
-    // acquire read lock for topics list
-    ret = pthread_rwlock_rdlock(topics->listrwlock);
+    // release read lock for shard
+    ret = pthread_rwlock_unlock(shard->rwlock);
     assert(ret == 0);
 
+    return topic;
+}
 
-    topic = find_topic(topics, name);
+/* see header for doc */
+size_t topic_foreach(struct topic_table *topics,
+        void (*fn)(struct topic *topic, void *arg), void *arg) {
+    int ret;
+    size_t i, j, n = 0;
+    struct topic_shard *shard;
+    struct topic *topic;
 
-    if (topic != NULL) {
+    for (i = 0; i < TOPIC_TABLE_SHARDS; i++) {
+        shard = &topics->shards[i];
 
-        /* we are still holding the read lock for the
-         * topics list, which is enough to add to the
-         * subscribers list
-         */
+        for (j = 0; ; j++) {
+            // acquire read lock for shard
+            ret = pthread_rwlock_rdlock(shard->rwlock);
+            assert(ret == 0);
 
-        // acquire subscribers list write lock
-        ret = pthread_rwlock_wrlock(topic->subscribers->listrwlock);
-        assert(ret == 0);
+            // the array may move while the lock is not held,
+            // the topics themselves never do
+            topic = j < shard->ntopics ? shard->byid[j] : NULL;
 
-        ret = list_add(topic->subscribers, subscriber);
-        assert(ret == 0);
+            // release read lock for shard
+            ret = pthread_rwlock_unlock(shard->rwlock);
+            assert(ret == 0);
 
-        // release subscribers list write lock
-        ret = pthread_rwlock_unlock(topic->subscribers->listrwlock);
-        assert(ret == 0);
+            if (topic == NULL) break;
+            fn(topic, arg);
+            n++;
+        }
+    }
 
-        // release read lock for topics list
-        ret = pthread_rwlock_unlock(topics->listrwlock);
-        assert(ret == 0);
-    } else {
+    return n;
+}
 
-        /* topic does not exist --> release
-        * readlock and acquire write lock for creation.
-        * then check again whether it exists.
-        */
+/* returns the topic with the name, which is created if it
+ * does not exist yet. no lock must be held, the shard of
+ * the topic is locked in write mode only to create it */
+static struct topic *ensure_topic(struct topic_table *topics, char *name) {
+    int ret;
+    uint64_t hash = hash_name(name);
+    struct topic_shard *shard = shard_of(topics, hash);
+    struct topic *topic;
 
-        // release topics list read lock
-        ret = pthread_rwlock_unlock(topics->listrwlock);
-        assert(ret == 0);
+    /* first try with readlock if the
+     * topic exists. this will be faster in most
+     * scenarios. if it doesn't exist, create it
+     * with the write lock 
+     */
 
-        // acquire topics list write lock
-        ret = pthread_rwlock_wrlock(topics->listrwlock);
-        assert(ret == 0);
+    // acquire read lock for shard
+    ret = pthread_rwlock_rdlock(shard->rwlock);
+    assert(ret == 0);
 
-        // check existence again
-        topic = find_topic(topics, name);
+    topic = find_topic(shard, hash, name);
 
-        if (topic == NULL) {
-            topic = create_new_topic(topics, name);
-        }
+    // release read lock for shard
+    ret = pthread_rwlock_unlock(shard->rwlock);
+    assert(ret == 0);
 
-        // acquire subscribers list write lock
-        ret = pthread_rwlock_wrlock(topic->subscribers->listrwlock);
-        assert(ret == 0);
+    // topics are never removed
+    if (topic != NULL) return topic;
 
-        ret = list_add(topic->subscribers, subscriber);
-        assert(ret == 0);
+    // acquire write lock for shard
+    ret = pthread_rwlock_wrlock(shard->rwlock);
+    assert(ret == 0);
 
-        // release subscribers list write lock
-        ret = pthread_rwlock_unlock(topic->subscribers->listrwlock);
-        assert(ret == 0);
+    // check existence again
+    topic = find_topic(shard, hash, name);
+    if (topic == NULL) topic = create_new_topic(topics, shard, hash, name);
 
-        // release topics list write lock
-        ret = pthread_rwlock_unlock(topics->listrwlock);
-        assert(ret == 0);
-    }
+    // release write lock for shard
+    ret = pthread_rwlock_unlock(shard->rwlock);
+    assert(ret == 0);
 
-    return val;
+    return topic;
 }
 
-int topic_remove_subscriber(struct list *topics,
-            struct subscriber *subscriber) {
+int topic_add_subscriber(struct topic_table *topics, char *name,
+                struct subscriber *subscriber) {
 
     int ret;
+    struct topic *topic = ensure_topic(topics, name);
 
-    // acquire read lock of topics
-    ret = pthread_rwlock_rdlock(topics->listrwlock);
+    struct subscription *sub = malloc(sizeof(struct subscription));
+    assert(sub != NULL);
+    ret = subscription_init(sub);
     assert(ret == 0);
+    sub->subscriber = subscriber;
 
-    struct node *cur = topics->root;
-    while (cur != NULL) {
-        struct topic *topic = cur->entry;
+    // acquire subscribers list write lock
+    ret = pthread_rwlock_wrlock(topic->subscribers->listrwlock);
+    assert(ret == 0);
 
-        // acquire write lock of subscribers
-        ret = pthread_rwlock_wrlock(topic->subscribers->listrwlock);
-        assert(ret == 0);
+    // acquire read lock for log of the topic
+    ret = pthread_rwlock_rdlock(topic->messages->listrwlock);
+    assert(ret == 0);
 
-        ret = list_remove(topic->subscribers, subscriber);
-        // not found is ok, since we just try
-        assert(ret == LIST_NOT_FOUND || ret == 0);
+    // the messages sent before are not for this subscriber
+    sub->cursor = topic->nextoffset;
 
-        // release write lock of subscribers
-        ret = pthread_rwlock_unlock(topic->subscribers->listrwlock);
-        assert(ret == 0);
+    // release read lock for log of the topic
+    ret = pthread_rwlock_unlock(topic->messages->listrwlock);
+    assert(ret == 0);
 
-        cur = cur->next;
-    }
+    ret = list_add(topic->subscribers, sub);
+    assert(ret == 0);
 
-    // release read lock of topics
-    ret = pthread_rwlock_unlock(topics->listrwlock);
+    // release subscribers list write lock
+    ret = pthread_rwlock_unlock(topic->subscribers->listrwlock);
     assert(ret == 0);
 
     return 0;
 }
 
-static int subscriber_dead(struct subscriber *sub) {
+unsigned long topic_ensure(struct topic_table *topics, char *name) {
+    return ensure_topic(topics, name)->id;
+}
+
+char *topic_name(struct topic_table *topics, unsigned long id) {
     int ret;
-    int dead;
+    char *name = NULL;
+    struct topic_shard *shard;
+    size_t i;
 
-    struct client *client = sub->client;
+    if (id == 0) return NULL;
+    shard = &topics->shards[(id - 1) % TOPIC_TABLE_SHARDS];
+    i = (id - 1) / TOPIC_TABLE_SHARDS;
 
-    // acquire read lock on dead flag
-    ret = pthread_mutex_lock(client->deadmutex);
+    // acquire read lock for shard
+    ret = pthread_rwlock_rdlock(shard->rwlock);
     assert(ret == 0);
 
-    dead = client->dead;
-    
-    // release read lock on dead flag
-    ret = pthread_mutex_unlock(client->deadmutex);
+    if (i < shard->ntopics) name = shard->byid[i]->name;
+
+    // release read lock for shard
+    ret = pthread_rwlock_unlock(shard->rwlock);
     assert(ret == 0);
 
-    return dead;
+    return name;
+}
+
+int topic_remove_subscriber(struct topic_table *topics,
+            struct subscriber *subscriber) {
+
+    int ret;
+    size_t i, j;
+    struct topic_shard *shard;
+
+    for (i = 0; i < TOPIC_TABLE_SHARDS; i++) {
+        shard = &topics->shards[i];
+
+        // acquire read lock of shard
+        ret = pthread_rwlock_rdlock(shard->rwlock);
+        assert(ret == 0);
+
+        for (j = 0; j < shard->ntopics; j++) {
+            struct topic *topic = shard->byid[j];
+
+            // acquire write lock of subscribers
+            ret = pthread_rwlock_wrlock(topic->subscribers->listrwlock);
+            assert(ret == 0);
+
+            // none is ok, since we just try
+            struct node *cur = topic->subscribers->root;
+            while (cur != NULL) {
+                struct subscription *sub = cur->entry;
+                cur = cur->next;
+
+                if (sub->subscriber == subscriber) {
+                    ret = list_remove(topic->subscribers, sub);
+                    assert(ret == 0);
+                    subscription_destroy(sub);
+                    free(sub);
+                }
+            }
+
+            // release write lock of subscribers
+            ret = pthread_rwlock_unlock(topic->subscribers->listrwlock);
+            assert(ret == 0);
+        }
+
+        // release read lock of shard
+        ret = pthread_rwlock_unlock(shard->rwlock);
+        assert(ret == 0);
+    }
+
+    return 0;
 }
 
 static int count_alive_subscriber(struct list *subscribers) {
@@ -179,9 +439,9 @@ static int count_alive_subscriber(struct list *subscribers) {
     
     struct node *cur = subscribers->root;
     while (cur != NULL) {
-        struct subscriber *sub = cur->entry;
+        struct subscription *sub = cur->entry;
 
-        if (!subscriber_dead(sub)) {
+        if (!subscriber_is_dead(sub->subscriber)) {
             nsubs++;
         }
         
@@ -191,18 +451,73 @@ static int count_alive_subscriber(struct list *subscribers) {
     return nsubs;
 }
 
-int topic_add_message(struct list *topics, struct list *messages,
-        char *topicname, char *content){
+/* copies the headers into a single block of memory */
+static void copy_headers(struct message *msg,
+        struct stomp_header *headers, size_t nheaders) {
+    size_t i, len, size;
+    char *dst;
+
+    if (nheaders == 0) return;
+
+    size = nheaders * sizeof(struct stomp_header);
+    for (i = 0; i < nheaders; i++)
+        size += strlen(headers[i].key) + strlen(headers[i].val) + 2;
+
+    msg->headers = malloc(size);
+    assert(msg->headers != NULL);
+    msg->nheaders = nheaders;
+
+    // strings go after the array
+    dst = (char *) (msg->headers + nheaders);
+    for (i = 0; i < nheaders; i++) {
+        len = strlen(headers[i].key) + 1;
+        msg->headers[i].key = memcpy(dst, headers[i].key, len);
+        dst += len;
+
+        len = strlen(headers[i].val) + 1;
+        msg->headers[i].val = memcpy(dst, headers[i].val, len);
+        dst += len;
+    }
+}
+
+/* creates a message of the topic, which is
+ * given its offset once it is appended */
+static struct message *create_message(struct topic *topic,
+        struct stomp_header *headers, size_t nheaders,
+        const char *content, size_t contentlen, unsigned long id) {
+
+    struct message *msg = malloc(sizeof(struct message));
+    assert(msg != NULL);
+    message_init(msg);
+    msg->content = malloc(contentlen + 1);
+    assert(msg->content != NULL);
+    memcpy(msg->content, content, contentlen);
+    msg->content[contentlen] = '\0';
+    msg->contentlen = contentlen;
+    msg->topicname = topic->name;
+    msg->topicid = topic->id;
+    msg->prefix = topic->prefix;
+    msg->prefixlen = topic->prefixlen;
+    msg->id = id;
+    copy_headers(msg, headers, nheaders);
+
+    return msg;
+}
+
+int topic_add_messages(struct topic_table *topics,
+        char *topicname, struct stomp_header *headers, size_t nheaders,
+        const struct iovec *bodies, size_t nbodies) {
 
     int ret; // to check other methods return values
     int val = -1; // this return value
+    size_t i;
+    unsigned long id;
     struct topic *topic;
+    struct message **msgs;
 
-    // acquire topics list lock
-    ret = pthread_rwlock_rdlock(topics->listrwlock);
-    assert(ret == 0);
-
-    topic = find_topic(topics, topicname);
+    // topics are never removed, so the topic
+    // stays valid without the lock of its shard
+    topic = topic_find(topics, topicname);
     if (topic == NULL) {
         val = TOPIC_NOT_FOUND;
     } else {
@@ -218,98 +533,52 @@ int topic_add_message(struct list *topics, struct list *messages,
             assert(ret == 0);
         } else {
 
-            // create message and copy subscribers
-
-            struct message *msg = malloc(sizeof(struct message));
-            message_init(msg);
-            msg->content = strdup(content);
-            msg->topicname = strdup(topicname);
-
-            // add statistics entry for each alive subscriber
-            struct node *cur = topic->subscribers->root;
-            while (cur != NULL) {
-                struct subscriber *sub = cur->entry;
-
-                if (!subscriber_dead(sub)) {
-                    struct msg_statistics *stat =
-                        malloc(sizeof(struct msg_statistics));
-                    msg_statistics_init(stat);
-                    stat->last_fail = 0;
-                    stat->nattempts = 0;
-                    stat->subscriber = sub;
-                    int ret = list_add(msg->stats, stat);
-                    assert(ret == 0);
-                }
-
-                cur = cur->next;
-            }
-
-            // release subscribers list readlock
-            ret = pthread_rwlock_unlock(topic->subscribers->listrwlock);
+            // create messages, the ids of a batch are consecutive
+            msgs = malloc(nbodies * sizeof(struct message *));
+            assert(msgs != NULL);
+            id = __sync_add_and_fetch(&next_message_id, nbodies)
+                - nbodies;
+            for (i = 0; i < nbodies; i++)
+                msgs[i] = create_message(topic, headers, nheaders,
+                    bodies[i].iov_base, bodies[i].iov_len, id + i + 1);
+
+            // acquire write lock for log of the topic
+            ret = pthread_rwlock_wrlock(topic->messages->listrwlock);
             assert(ret == 0);
 
-            // acquire write lock for message list
-            ret = pthread_rwlock_wrlock(messages->listrwlock);
-            assert(ret == 0);
+            for (i = 0; i < nbodies; i++) {
+                msgs[i]->offset = topic->nextoffset++;
+                ret = list_add(topic->messages, msgs[i]);
+                assert(ret == 0);
+            }
 
-            ret = list_add(messages, msg);
+            // release write lock for log of the topic
+            ret = pthread_rwlock_unlock(topic->messages->listrwlock);
             assert(ret == 0);
 
-            // release write lock for messages list
-            ret = pthread_rwlock_unlock(messages->listrwlock);
+            // released only now, so a subscriber added in
+            // the meantime starts after the messages
+            ret = pthread_rwlock_unlock(topic->subscribers->listrwlock);
             assert(ret == 0);
 
+            free(msgs);
             val = 0;
         }
     }
 
-    // release topics list readlock
-    ret = pthread_rwlock_unlock(topics->listrwlock);
-    assert(ret == 0);
-
     return val;
 }
 
-static int same_subscriber(const void *a, const void *b) {
-    const struct msg_statistics *as = a;
-    const struct msg_statistics *bs = b;
-    return as->subscriber == bs->subscriber;
-}
-
-int message_remove_subscriber(struct list *messages,
-        struct subscriber *subscriber) {
-    int ret;
-
-    // to compare against
-    struct msg_statistics stat;
-    stat.subscriber = subscriber;
-
-    // acquire lock of message list
-    ret = pthread_rwlock_rdlock(messages->listrwlock);
-    assert(ret == 0);
-
-    struct node *cur = messages->root;
-    for (;cur != NULL; cur = cur->next) {
-        struct message *msg = cur->entry;
-
-        // acquire write lock of statistics list
-        ret = pthread_rwlock_wrlock(msg->stats->listrwlock);
-        assert(ret == 0);
+int topic_add_message(struct topic_table *topics,
+        char *topicname, struct stomp_header *headers, size_t nheaders,
+        char *content, size_t contentlen){
 
-        ret = list_remove_generic(msg->stats, same_subscriber, &stat);
-        // not found is ok since we just try
-        assert(ret == LIST_NOT_FOUND || ret == 0);
+    struct iovec body;
+    body.iov_base = content;
+    body.iov_len = contentlen;
 
-        // release write lock of statistics list
-        ret = pthread_rwlock_unlock(msg->stats->listrwlock);
-        assert(ret == 0);
-    }
-
-    // release read lock of message list
-    ret = pthread_rwlock_unlock(messages->listrwlock);
-    assert(ret == 0);
-
-    return 0;
+    return topic_add_messages(topics, topicname,
+        headers, nheaders, &body, 1);
 }
 
 void topic_strerror(int errcode, char *buf) {
@@ -329,10 +598,26 @@ int topic_init(struct topic *topic) {
 
     int ret;
 
+    topic->name = NULL;
+    topic->id = 0;
+    topic->prefix = NULL;
+    topic->prefixlen = 0;
+    topic->hash = 0;
+    topic->next = NULL;
+    topic->nextoffset = 0;
+
     topic->subscribers = malloc(sizeof(struct list));
     assert(topic->subscribers != NULL);
 
-    ret = list_init(topic->subscribers);
+    ret = list_init_intrusive(topic->subscribers,
+        offsetof(struct subscription, node));
+    assert(ret == 0);
+
+    topic->messages = malloc(sizeof(struct list));
+    assert(topic->messages != NULL);
+
+    ret = list_init_intrusive(topic->messages,
+        offsetof(struct message, node));
     assert(ret == 0);
 
     return 0;
@@ -340,63 +625,145 @@ int topic_init(struct topic *topic) {
 
 int topic_destroy(struct topic *topic) {
 
-    list_clean(topic->subscribers);
+    // the subscriptions belong to the topic
+    while (topic->subscribers->root != NULL) {
+        struct subscription *sub = topic->subscribers->root->entry;
+        list_remove(topic->subscribers, sub);
+        subscription_destroy(sub);
+        free(sub);
+    }
     list_destroy(topic->subscribers);
 
     free(topic->subscribers);
     topic->subscribers = NULL;
 
+    // so does what is left of the log
+    while (topic->messages->root != NULL) {
+        struct message *msg = topic->messages->root->entry;
+        list_remove(topic->messages, msg);
+        message_destroy(msg);
+        free(msg);
+    }
+    list_destroy(topic->messages);
+
+    free(topic->messages);
+    topic->messages = NULL;
+
     free(topic->name);
     topic->name = NULL;
+
+    free(topic->prefix);
+    topic->prefix = NULL;
+    topic->prefixlen = 0;
     
     return 0;
 }
 
 int message_init(struct message *message) {
     message->content = NULL;
+    message->contentlen = 0;
     message->topicname = NULL;
-    struct list *stats = malloc(sizeof(struct list));
-    assert(stats != NULL);
-    list_init(stats);
-    message->stats = stats;
+    message->topicid = 0;
+    message->prefix = NULL;
+    message->prefixlen = 0;
+    message->id = 0;
+    message->offset = 0;
+    message->headers = NULL;
+    message->nheaders = 0;
+    for (int i = 0; i < MESSAGE_NFRAMES; i++)
+        message->frames[i] = NULL;
+    message->zcontent = NULL;
+    message->zcontentlen = 0;
+    message->deflated = 0;
+    list_node_init(&message->node);
     return 0;
 }
 
 int message_destroy(struct message *message) {
-    list_destroy(message->stats);
-    free(message->stats);
-    message->stats = NULL;
     free(message->content);
     message->content = NULL;
-    free(message->topicname);
     message->topicname = NULL;
+    message->prefix = NULL;
+    message->prefixlen = 0;
+    free(message->headers);
+    message->headers = NULL;
+    message->nheaders = 0;
+    for (int i = 0; i < MESSAGE_NFRAMES; i++) {
+        if (message->frames[i] != NULL) frame_unref(message->frames[i]);
+        message->frames[i] = NULL;
+    }
+    free(message->zcontent);
+    message->zcontent = NULL;
     return 0;
 }
 
-int msg_statistics_init(struct msg_statistics *stat) {
+int subscription_init(struct subscription *sub) {
     
     int ret;
 
-    pthread_rwlock_t *statrwlock = malloc(sizeof(pthread_rwlock_t));
-    assert(statrwlock != NULL);
-    ret = pthread_rwlock_init(statrwlock, NULL);
+    pthread_rwlock_t *rwlock = malloc(sizeof(pthread_rwlock_t));
+    assert(rwlock != NULL);
+    ret = pthread_rwlock_init(rwlock, NULL);
     assert(ret == 0);
 
-    stat->statrwlock = statrwlock;
-    stat->last_fail = 0;
-    stat->nattempts = 0;
+    sub->rwlock = rwlock;
+    sub->subscriber = NULL;
+    sub->cursor = 0;
+    memset(&sub->retry, 0, sizeof(sub->retry));
+    sub->retrying = 0;
+    list_node_init(&sub->node);
 
     return 0;
 }
 
-int msg_statistics_destroy(struct msg_statistics *stat) {
+int subscription_destroy(struct subscription *sub) {
 
     int ret;
 
-    ret = pthread_rwlock_destroy(stat->statrwlock);
+    ret = pthread_rwlock_destroy(sub->rwlock);
     assert(ret == 0);
-    free(stat->statrwlock);
-    stat->statrwlock = NULL;
+    free(sub->rwlock);
+    sub->rwlock = NULL;
+    sub->retrying = 0;
 
     return 0;
 }
+
+void subscription_set_retry(struct subscription *sub,
+        unsigned long offset, long last_fail) {
+    assert(!sub->retrying);
+
+    sub->retry.offset = offset;
+    sub->retry.last_fail = last_fail;
+    sub->retry.nattempts = 1;
+    sub->retrying = 1;
+}
+
+void subscription_clear_retry(struct subscription *sub) {
+    assert(sub->retrying);
+    sub->retrying = 0;
+}
+
+unsigned long subscription_oldest(struct subscription *sub) {
+    if (sub->retrying) return sub->retry.offset;
+    return sub->cursor;
+}
+
+int subscriber_is_dead(struct subscriber *sub) {
+    int ret;
+    int dead;
+
+    struct client *client = sub->client;
+
+    // acquire lock on dead flag
+    ret = pthread_mutex_lock(client->deadmutex);
+    assert(ret == 0);
+
+    dead = client->dead;
+
+    // release lock on dead flag
+    ret = pthread_mutex_unlock(client->deadmutex);
+    assert(ret == 0);
+
+    return dead;
+}
@@ -3,35 +3,40 @@
 
 /* topic.h
  *
- * the message broker has two central lists:
+ * the message broker has two central collections:
  *  1. topics
  *  2. messages
- * both of them are fields in the broker_context
- * struct that is passed around from top-level.
+ * the table of topics is a field in the broker_context
+ * struct that is passed around from top-level, the
+ * messages are queued by the topic they were sent to.
  *
  * 1. topics
  * whenever a client subscribers to a topic, an
- * entry in the topics list is added if the
+ * entry in the table of topics is added if the
  * topic does not exist yet. if it exists, the
  * subscriber is added to the list of subscribers
- * in that topic.
+ * in that topic. the table finds a topic by its
+ * name or its id in constant time.
  *
  * 2. messages
- * for each message that gets sent to a topic,
- * the list of subscribers to that topic is copied
- * and an entry is added to the list of messages
- * containing the name of the topic the message
- * was sent to, the message itself and the list
- * of subscribers. the list of subscribers is not
- * copied 1:1 though, as weed a little more
- * information for each subscriber (e.g. whether
- * is was already delivered to that subscriber,
- * etc). Therefore, the list of subscribers in
- * the message list is a list of msg_statistics,
- * which contains the additional information.
+ * each topic is a log of the messages sent to it,
+ * the oldest first. a message is appended once with
+ * the next offset of the topic, no matter how many
+ * subscribers the topic has. each subscriber has a
+ * subscription to the topic instead, which holds its
+ * cursor (the offset of the next message to be
+ * delivered to it) and the message before the
+ * cursor whose delivery has failed and is to be
+ * retried, if any. a subscriber therefore receives the
+ * messages that are sent after it has subscribed
+ * and a message can be removed from the log once
+ * the cursors of all subscribers have passed it
+ * and none of them is to retry it.
  *
  */
 
+#include <stdint.h>
+
 #include "list.h"
 #include "socket.h"
 
@@ -48,6 +53,20 @@
  * dead subscribers are in the topic */
 #define TOPIC_NO_SUBSCRIBERS  -4
 
+/* the table of topics is split into shards by
+ * the low bits of the hash of the name */
+#define TOPIC_SHARD_BITS 4
+#define TOPIC_TABLE_SHARDS (1 << TOPIC_SHARD_BITS)
+
+/* number of buckets of a new shard. it is
+ * doubled whenever there are more topics */
+#define TOPIC_SHARD_BUCKETS 16
+
+/* flags that select one of the frames of a message */
+#define MESSAGE_BINARY  1
+#define MESSAGE_DEFLATE 2
+#define MESSAGE_NFRAMES 4
+
 /* client interested in messages of a topic */
 struct subscriber {
 
@@ -56,6 +75,11 @@ struct subscriber {
 
     /* name of the subscriber, used at login */
     char *name;
+
+    /* whether it has subscribed to a topic, only set by the
+     * thread serving the client. the gc finds it through its
+     * subscriptions, one without is freed with its connection */
+    int subscribed;
 };
 
 /* each message is associated with a topic */
@@ -63,59 +87,165 @@ struct topic {
     /* name of the topic */
     char *name;  
 
-    /* list of subscribers to this topic.
-     * the list is guarded by its own lock
+    /* number identifying the topic, which clients
+     * with the binary framing use instead of the
+     * name (see binary.h). assigned on creation */
+    unsigned long id;
+
+    /* beginning of the MESSAGE frames of the topic,
+     * up to and including its destination header (see
+     * stomp_create_prefix). encoded on creation */
+    char *prefix;
+    size_t prefixlen;
+
+    /* subscriptions to this topic, one for each
+     * subscriber. the list is guarded by its own lock
      * and is to be held accoring to the
      * list lock laws (see the list struct
      * definition) */
     struct list *subscribers;
+
+    /* log of the messages sent to the topic that some
+     * subscriber has yet to receive, the oldest first.
+     * the log is guarded by its own lock, so publishing
+     * to, delivering and collecting the messages of one
+     * topic never waits for another one */
+    struct list *messages;
+
+    /* offset of the next message appended to the
+     * log. guarded by the lock of the log */
+    unsigned long nextoffset;
+
+    /* hash of the name, computed once it is added
+     * to the table, and the next topic in the same
+     * bucket. guarded by the lock of the table */
+    uint64_t hash;
+    struct topic *next;
 };
 
-/* statistics for a message. this exists
- * per subscriber for each message
- */
-struct msg_statistics {
-
-    /* guards the the last_fail
-     * as well as the nattempts field
-     * of this structure. this lock
-     * must only be acquired if the
-     * parent lock (list of statistics
-     * of the message) is held in read
-     * mode */
-    pthread_rwlock_t *statrwlock;
-
-    /* the last time the message sending failed,
-     * unix timestamp, 0 if never failed before
-     * or last delivery was successful.
-     */
+/* part of the table of topics with its own lock, so
+ * topics of different shards are looked up and added
+ * without waiting for each other */
+struct topic_shard {
+    /* guards the shard. held in read mode to look
+     * up topics and in write mode to add one */
+    pthread_rwlock_t *rwlock;
+
+    /* hash table of the topics by name, each bucket
+     * is a chain linked through the topics */
+    struct topic **buckets;
+    size_t nbuckets;
+
+    /* topics in the order they have been added to the
+     * shard. the id of the one at i is
+     * i * TOPIC_TABLE_SHARDS + the number of the shard + 1 */
+    struct topic **byid;
+    size_t ntopics;
+    size_t cap;
+};
+
+/* all topics of the broker. topics are never removed, so
+ * a topic that has been found stays valid without holding
+ * the lock of its shard */
+struct topic_table {
+    struct topic_shard shards[TOPIC_TABLE_SHARDS];
+};
+
+/* delivery of a message that has failed and is
+ * to be retried (see distributor.h) */
+struct retry {
+    /* offset of the message in the log of its topic */
+    unsigned long offset;
+
+    /* the last time the delivery failed, unix timestamp */
     long last_fail;
 
-    /* number of attempts made to deliver message. if
-     * at least one attempt was made and the last one
-     * was successful, then the entire message is
-     * to be viewed as successful and must not
-     * redelivered
-     */
+    /* number of attempts made to deliver the message */
     int nattempts;
+};
+
+/* position of a subscriber in the log of a topic.
+ * exists once per subscriber for each topic it
+ * has subscribed to
+ */
+struct subscription {
 
-    /* receiver of the message */
+    /* guards the cursor and the retry. this
+     * lock must only be acquired if the parent
+     * lock (subscribers of the topic) is held
+     * at least in read mode */
+    pthread_rwlock_t *rwlock;
+
+    /* receiver of the messages */
     struct subscriber *subscriber;
+
+    /* offset of the next message to be delivered for
+     * the first time. all messages before it have been
+     * delivered, are to be retried or have been given up */
+    unsigned long cursor;
+
+    /* delivery before the cursor that has failed and is
+     * to be retried, if retrying is set. the messages after
+     * it wait until it has been delivered or given up, so
+     * that they arrive in order, there is at most one */
+    struct retry retry;
+    int retrying;
+
+    /* links the subscriptions of a topic */
+    struct node node;
 };
 
-/* message waiting for delivery. exists
- * once per message in a topic and holds
- * statistics for all subscribers.
+/* message waiting for delivery. exists once
+ * per message in the log of a topic, however
+ * many subscribers it is delivered to.
  */
 struct message {
-    /* content to be sent */
+    /* content to be sent, null-terminated but
+     * it may contain null bytes as well */
     char *content;
+    size_t contentlen;
 
-    /* name of the topic it belongs to */
+    /* name of the topic it belongs to, owned
+     * by the topic (which is never removed) */
     char *topicname;
 
-    /* statistics of this message, per subscriber */
-    struct list *stats;
+    /* id of the topic it belongs to */
+    unsigned long topicid;
+
+    /* beginning of its MESSAGE frame, owned
+     * by the topic just like the name */
+    const char *prefix;
+    size_t prefixlen;
+
+    /* number identifying the message, sent along
+     * as the message-id header */
+    unsigned long id;
+
+    /* position in the log of the topic */
+    unsigned long offset;
+
+    /* headers of the SEND that are passed on to the
+     * subscribers. the keys and values are part of
+     * the same block of memory as the array */
+    struct stomp_header *headers;
+    size_t nheaders;
+
+    /* encoded MESSAGE frames, by framing and encoding
+     * (MESSAGE_ flags). each is shared by all subscribers
+     * that want it and created by the distributor on the
+     * first delivery to one of them */
+    struct frame *frames[MESSAGE_NFRAMES];
+
+    /* content compressed (see compress.h) once for all
+     * subscribers that accept it, if deflated is 1. it is
+     * 0 if that has not been tried yet and -1 if it has not
+     * paid off, in which case the content is sent as is */
+    char *zcontent;
+    size_t zcontentlen;
+    int deflated;
+
+    /* links the messages of the log */
+    struct node node;
 };
 
 /* initializes a topic */
@@ -130,35 +260,92 @@ int message_init(struct message *message);
 /* destroys a message */
 int message_destroy(struct message *message);
 
-/* initializes message statistics */
-int msg_statistics_init(struct msg_statistics *stat);
+/* initializes a subscription without a retry */
+int subscription_init(struct subscription *sub);
+
+/* destroys a subscription */
+int subscription_destroy(struct subscription *sub);
+
+/* sets the retry of the message at the offset, whose delivery
+ * has failed at last_fail. there must be none yet. write lock
+ * of the subscription must be held */
+void subscription_set_retry(struct subscription *sub,
+        unsigned long offset, long last_fail);
+
+/* drops the retry once it has been delivered or given
+ * up. write lock of the subscription must be held */
+void subscription_clear_retry(struct subscription *sub);
+
+/* returns the offset of the oldest message the subscriber
+ * still needs: the retry or else the cursor. at least
+ * read lock of the subscription must be held */
+unsigned long subscription_oldest(struct subscription *sub);
 
-/* destroys message statistics */
-int msg_statistics_destroy(struct msg_statistics *stat);
+/* returns whether the client of the subscriber is dead,
+ * takes the lock on the dead flag */
+int subscriber_is_dead(struct subscriber *sub);
 
-/* adds the subscriber to the topic. if the
- * topic does not exist, it is created
+/* initializes an empty table of topics */
+int topic_table_init(struct topic_table *table);
+
+/* destroys the table. the topics are not destroyed */
+int topic_table_destroy(struct topic_table *table);
+
+/* adds a topic that has a name, which must not be in the
+ * table yet, and assigns it the next id of its shard */
+int topic_table_add(struct topic_table *table, struct topic *topic);
+
+/* returns the number of topics in the table */
+size_t topic_table_len(struct topic_table *table);
+
+/* returns the topic with the name or null if there is none */
+struct topic *topic_find(struct topic_table *topics, char *name);
+
+/* invokes fn with each topic and arg, in the order they have
+ * been added to their shard. no lock is held while fn runs and
+ * topics added in the meantime may be left out. returns the
+ * number of topics visited */
+size_t topic_foreach(struct topic_table *topics,
+        void (*fn)(struct topic *topic, void *arg), void *arg);
+
+/* adds a subscription of the subscriber to the topic,
+ * whose cursor is at the end of the log. if the topic
+ * does not exist, it is created
  */
-int topic_add_subscriber(struct list *topics, char *name,
+int topic_add_subscriber(struct topic_table *topics, char *name,
     struct subscriber *subscriber);
 
-/* removes the subscriber from all topics */
-int topic_remove_subscriber(struct list *topics, struct subscriber *subscriber);
+/* returns the id of the topic, which is
+ * created if it does not exist yet */
+unsigned long topic_ensure(struct topic_table *topics, char *name);
 
-/* adds the message to the list of messages and
- * copies the subscribers from the corresponding
- * topic. if the topic does not exist, the error
+/* returns the name of the topic with the id or null
+ * if there is none. the name is owned by the topic,
+ * which is never removed */
+char *topic_name(struct topic_table *topics, unsigned long id);
+
+/* removes the subscriptions of the subscriber from all topics */
+int topic_remove_subscriber(struct topic_table *topics,
+    struct subscriber *subscriber);
+
+/* appends the message to the log of the topic. the
+ * content and the headers are copied,
+ * the name of the topic is taken from the topic
+ * itself. if the topic does not exist, the error
  * TOPIC_NOT_FOUND is returned (topic is created
  * with the first subscriber) */
-int topic_add_message(struct list *topics, struct list *messages,
-        char *topicname, char *content);
-
-/* removes a subscriber from the message statistics.
- * this means that if a previous delivery failed,
- * it will not be attempted again. if it is the last/only
- * subscriber for that message, the message is removed. */
-int message_remove_subscriber(struct list *messages,
-    struct subscriber *subscriber);
+int topic_add_message(struct topic_table *topics,
+        char *topicname, struct stomp_header *headers, size_t nheaders,
+        char *content, size_t contentlen);
+
+/* adds a message for each of the bodies with the same
+ * headers, see topic_add_message. the locks are only
+ * taken once for all of them, so subscribers see either
+ * none or all of them. the messages keep the order of
+ * the bodies */
+int topic_add_messages(struct topic_table *topics,
+        char *topicname, struct stomp_header *headers, size_t nheaders,
+        const struct iovec *bodies, size_t nbodies);
 
 /* converts a topic error code (TOPIC_) to a string.
  * the buffer should be 32 bytes */
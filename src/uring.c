@@ -0,0 +1,159 @@
+// for syscall
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <assert.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "uring.h"
+
+int uring_init(struct uring *ring, unsigned entries) {
+    struct io_uring_params params;
+    void *sqring, *cqring, *sqes;
+
+    memset(ring, 0, sizeof(struct uring));
+    memset(&params, 0, sizeof(params));
+
+    ring->fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (ring->fd == -1) {
+        if (errno == ENOSYS || errno == EPERM) return URING_UNSUPPORTED;
+        fprintf(stderr, "io_uring_setup: %s\n", strerror(errno));
+        return -1;
+    }
+
+    ring->sqringsz = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cqringsz = params.cq_off.cqes +
+        params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqessz = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    sqring = mmap(NULL, ring->sqringsz, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    cqring = mmap(NULL, ring->cqringsz, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    sqes = mmap(NULL, ring->sqessz, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (sqring == MAP_FAILED || cqring == MAP_FAILED || sqes == MAP_FAILED) {
+        fprintf(stderr, "mmap: %s\n", strerror(errno));
+        if (sqring != MAP_FAILED) munmap(sqring, ring->sqringsz);
+        if (cqring != MAP_FAILED) munmap(cqring, ring->cqringsz);
+        if (sqes != MAP_FAILED) munmap(sqes, ring->sqessz);
+        close(ring->fd);
+        return -1;
+    }
+
+    ring->sqring = sqring;
+    ring->sqhead = (void *) ((char *) sqring + params.sq_off.head);
+    ring->sqtail = (void *) ((char *) sqring + params.sq_off.tail);
+    ring->sqmask = (void *) ((char *) sqring + params.sq_off.ring_mask);
+    ring->sqentries = (void *) ((char *) sqring + params.sq_off.ring_entries);
+    ring->sqarray = (void *) ((char *) sqring + params.sq_off.array);
+    ring->sqes = sqes;
+
+    ring->cqring = cqring;
+    ring->cqhead = (void *) ((char *) cqring + params.cq_off.head);
+    ring->cqtail = (void *) ((char *) cqring + params.cq_off.tail);
+    ring->cqmask = (void *) ((char *) cqring + params.cq_off.ring_mask);
+    ring->cqes = (void *) ((char *) cqring + params.cq_off.cqes);
+
+    ring->pending = 0;
+
+    return 0;
+}
+
+void uring_destroy(struct uring *ring) {
+    munmap(ring->sqes, ring->sqessz);
+    munmap(ring->sqring, ring->sqringsz);
+    munmap(ring->cqring, ring->cqringsz);
+    close(ring->fd);
+    ring->fd = -1;
+}
+
+struct io_uring_sqe *uring_get_sqe(struct uring *ring) {
+    unsigned head, tail, idx;
+    struct io_uring_sqe *sqe;
+
+    head = __atomic_load_n(ring->sqhead, __ATOMIC_ACQUIRE);
+    tail = *ring->sqtail + ring->pending;
+
+    if (tail - head == *ring->sqentries) {
+        // make room by handing everything to the kernel
+        if (uring_enter(ring, 0, 0) != 0) return NULL;
+        head = __atomic_load_n(ring->sqhead, __ATOMIC_ACQUIRE);
+        tail = *ring->sqtail;
+        if (tail - head == *ring->sqentries) return NULL;
+    }
+
+    idx = tail & *ring->sqmask;
+    sqe = &ring->sqes[idx];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    ring->sqarray[idx] = idx;
+    ring->pending++;
+
+    return sqe;
+}
+
+int uring_enter(struct uring *ring, unsigned wait, int timeout) {
+    int ret;
+    unsigned flags = 0;
+    unsigned submit;
+    struct io_uring_getevents_arg arg;
+    struct __kernel_timespec ts;
+    void *argp = NULL;
+    size_t argsz = 0;
+
+    // publish the prepared entries
+    if (ring->pending > 0) {
+        __atomic_store_n(ring->sqtail, *ring->sqtail + ring->pending,
+            __ATOMIC_RELEASE);
+        ring->pending = 0;
+    }
+
+    // including those left over by a previous call
+    submit = *ring->sqtail - __atomic_load_n(ring->sqhead, __ATOMIC_ACQUIRE);
+
+    if (wait > 0) {
+        flags |= IORING_ENTER_GETEVENTS;
+
+        if (timeout >= 0) {
+            ts.tv_sec = timeout / 1000;
+            ts.tv_nsec = (timeout % 1000) * 1000000L;
+            memset(&arg, 0, sizeof(arg));
+            arg.ts = (uint64_t) (uintptr_t) &ts;
+            argp = &arg;
+            argsz = sizeof(arg);
+            flags |= IORING_ENTER_EXT_ARG;
+        }
+    }
+
+    if (submit == 0 && wait == 0) return 0;
+
+    ret = syscall(__NR_io_uring_enter, ring->fd, submit, wait,
+        flags, argp, argsz);
+
+    if (ret == -1 && errno != ETIME && errno != EINTR) {
+        fprintf(stderr, "io_uring_enter: %s\n", strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+struct io_uring_cqe *uring_peek_cqe(struct uring *ring) {
+    unsigned head = *ring->cqhead;
+    unsigned tail = __atomic_load_n(ring->cqtail, __ATOMIC_ACQUIRE);
+
+    if (head == tail) return NULL;
+
+    return &ring->cqes[head & *ring->cqmask];
+}
+
+void uring_cqe_seen(struct uring *ring) {
+    __atomic_store_n(ring->cqhead, *ring->cqhead + 1, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,79 @@
+#ifndef URING_HEADER
+#define URING_HEADER
+
+/* minimal wrapper around the io_uring interface of
+ * the kernel. the submission and completion rings are
+ * shared with the kernel through mmap and entered with
+ * a single syscall, which submits everything that has
+ * been prepared since the last call and optionally
+ * waits for completions. this allows handling any
+ * number of reads and writes on different sockets
+ * with one syscall.
+ *
+ * a ring must only be used by a single thread.
+ */
+
+#include <stdint.h>
+#include <linux/io_uring.h>
+
+/* returned if the kernel does not support io_uring
+ * (or it has been disabled) */
+#define URING_UNSUPPORTED -2
+
+struct uring {
+
+    /* file descriptor of the ring */
+    int fd;
+
+    /* submission ring, shared with the kernel */
+    void *sqring;
+    size_t sqringsz;
+    unsigned *sqhead;
+    unsigned *sqtail;
+    unsigned *sqmask;
+    unsigned *sqentries;
+    unsigned *sqarray;
+
+    /* submission queue entries */
+    struct io_uring_sqe *sqes;
+    size_t sqessz;
+
+    /* completion ring, shared with the kernel */
+    void *cqring;
+    size_t cqringsz;
+    unsigned *cqhead;
+    unsigned *cqtail;
+    unsigned *cqmask;
+    struct io_uring_cqe *cqes;
+
+    /* number of entries prepared, but not yet submitted */
+    unsigned pending;
+};
+
+/* sets up a ring with space for the specified
+ * number of submission queue entries. returns 0
+ * on success, URING_UNSUPPORTED or -1 */
+int uring_init(struct uring *ring, unsigned entries);
+
+/* tears down the ring */
+void uring_destroy(struct uring *ring);
+
+/* returns the next free submission queue entry, which
+ * has been cleared. if the ring is full, everything
+ * prepared so far is submitted first */
+struct io_uring_sqe *uring_get_sqe(struct uring *ring);
+
+/* submits all prepared entries and waits until at
+ * least wait completions are available or timeout
+ * milliseconds (-1 for ever) have passed. returns
+ * 0 on success (including timeouts) and -1 on error */
+int uring_enter(struct uring *ring, unsigned wait, int timeout);
+
+/* returns the next completion or null if there is none.
+ * it must be released with uring_cqe_seen once handled */
+struct io_uring_cqe *uring_peek_cqe(struct uring *ring);
+
+/* releases the completion returned by uring_peek_cqe */
+void uring_cqe_seen(struct uring *ring);
+
+#endif
@@ -0,0 +1,349 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "../src/shm.h"
+
+/* compares the latency of publishing over loopback tcp with
+ * that over a unix domain socket and a shared memory channel.
+ * a broker has to be running with the listeners, e.g.
+ * 'run -p 55664 -u @broker -s @broker-shm'.
+ *
+ * the broker does not answer a SEND, so each sample is a
+ * confirmed publish: on a fresh connection that has already
+ * been answered CONNECTED, SEND and DISCONNECT are written at
+ * once and the time until the RECEIPT arrives is taken. the
+ * broker handles the commands of a connection in order, so the
+ * RECEIPT means the message has been added to its topic. the
+ * time to connect and log in is reported separately. as a topic
+ * only exists once someone subscribes to it, the connection
+ * subscribes to the topic it publishes to when logging in.
+ */
+
+#define DEFAULT_PORT    55664
+#define DEFAULT_SAMPLES 10000
+#define DEFAULT_SIZE    64
+
+/* where and how to connect to */
+struct target {
+    const char *name;
+    int family;
+    struct sockaddr_storage addr;
+    socklen_t addrlen;
+
+    /* whether the broker passes a shared memory channel */
+    int shm;
+};
+
+/* connection to the broker */
+struct session {
+    int sockfd;
+
+    /* channel to use instead of the socket, null if none */
+    struct shm_channel *ch;
+};
+
+static double now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int write_all(struct session *sess, const char *buf, size_t len) {
+    ssize_t n;
+
+    while (len > 0) {
+        if (sess->ch != NULL) {
+            n = shm_write(sess->ch, buf, len);
+            if (n < 0) return -1;
+            if (n == 0 && !shm_write_wait(sess->ch) &&
+                    shm_wait(sess->ch, -1) == -1)
+                return -1;
+        } else {
+            n = write(sess->sockfd, buf, len);
+        }
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+/* reads commands from the server until one with the
+ * name arrives. messages delivered in the meantime are
+ * skipped, an error fails */
+static int expect(struct session *sess, const char *name) {
+    char c, buf[16];
+    size_t pos = 0;
+    ssize_t n;
+
+    while (1) {
+        if (sess->ch != NULL) {
+            n = shm_read(sess->ch, &c, 1);
+            if (n == 0) {
+                if (!shm_read_wait(sess->ch) &&
+                        shm_wait(sess->ch, -1) == -1)
+                    return -1;
+                continue;
+            }
+        } else {
+            n = read(sess->sockfd, &c, 1);
+        }
+        if (n == -1 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+
+        if (pos < sizeof(buf)) buf[pos] = c;
+        pos++;
+        if (c != '\0') continue;
+
+        if (strncmp(buf, name, strlen(name)) == 0) return 0;
+        if (strncmp(buf, "ERROR", strlen("ERROR")) == 0) return -1;
+        pos = 0;
+    }
+}
+
+static int connect_target(struct target *target) {
+    int on = 1;
+    int sockfd = socket(target->family, SOCK_STREAM, 0);
+    if (sockfd == -1) return -1;
+
+    // latency, not throughput is of interest
+    if (target->family == AF_INET)
+        setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+    if (connect(sockfd, (struct sockaddr *) &target->addr,
+                target->addrlen) != 0) {
+        close(sockfd);
+        return -1;
+    }
+
+    return sockfd;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *) a, y = *(const double *) b;
+    return x < y ? -1 : x > y;
+}
+
+static void report(const char *target, const char *what,
+                   double *samples, int n) {
+    int i;
+    double sum = 0;
+
+    qsort(samples, n, sizeof(double), cmp_double);
+    for (i = 0; i < n; i++) sum += samples[i];
+
+    printf("%-5s %-8s avg %8.1fus  p50 %8.1fus  p90 %8.1fus  "
+        "p99 %8.1fus  max %8.1fus\n", target, what, sum / n,
+        samples[n / 2], samples[n * 9 / 10], samples[n * 99 / 100],
+        samples[n - 1]);
+}
+
+/* connects, logs in and publishes one message, taking the
+ * time of both. returns 0 on success and -1 on failure */
+static int sample(struct target *target, const char *cmds, size_t len,
+                  double *connect, double *publish) {
+    int ret = -1;
+    double start;
+    struct session sess;
+    struct shm_channel ch;
+    char login[] = "CONNECT\nlogin:bench\n\n\0"
+                   "SUBSCRIBE\ndestination:bench\n\n";
+
+    start = now_us();
+    sess.ch = NULL;
+    sess.sockfd = connect_target(target);
+    if (sess.sockfd == -1) {
+        fprintf(stderr, "%s: Failed to connect: %s\n",
+            target->name, strerror(errno));
+        return -1;
+    }
+
+    if (target->shm) {
+        if (shm_receive(&ch, sess.sockfd) != 0) {
+            fprintf(stderr, "%s: No channel from broker\n", target->name);
+            close(sess.sockfd);
+            return -1;
+        }
+        sess.ch = &ch;
+    }
+
+    if (write_all(&sess, login, sizeof(login)) != 0 ||
+        expect(&sess, "CONNECTED") != 0) {
+        fprintf(stderr, "%s: Failed to log in\n", target->name);
+    } else {
+        *connect = now_us() - start;
+
+        start = now_us();
+        if (write_all(&sess, cmds, len) != 0 ||
+            expect(&sess, "RECEIPT") != 0) {
+            fprintf(stderr, "%s: Failed to publish\n", target->name);
+        } else {
+            *publish = now_us() - start;
+            ret = 0;
+        }
+    }
+
+    if (sess.ch != NULL) shm_destroy(sess.ch);
+    close(sess.sockfd);
+    return ret;
+}
+
+/* takes the samples of all targets in turns, so each of them
+ * sees the broker in the same state (e.g. number of messages) */
+static int run(struct target *targets, int ntargets,
+               int nsamples, size_t size) {
+    int i, t;
+    double *connects, *publishes;
+    char *cmds;
+    size_t len;
+
+    cmds = malloc(size + 128);
+    connects = malloc(ntargets * nsamples * sizeof(double));
+    publishes = malloc(ntargets * nsamples * sizeof(double));
+    if (cmds == NULL || connects == NULL || publishes == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    len = sprintf(cmds, "SEND\ntopic:bench\n\n");
+    memset(cmds + len, 'x', size);
+    len += size;
+    len += sprintf(cmds + len, "\n\n") + 1;
+    len += sprintf(cmds + len, "DISCONNECT\n\n") + 1;
+
+    for (i = 0; i < nsamples; i++) {
+        for (t = 0; t < ntargets; t++) {
+            if (sample(&targets[t], cmds, len,
+                       &connects[t * nsamples + i],
+                       &publishes[t * nsamples + i]) != 0)
+                return -1;
+        }
+    }
+
+    for (t = 0; t < ntargets; t++) {
+        report(targets[t].name, "connect",
+            &connects[t * nsamples], nsamples);
+        report(targets[t].name, "publish",
+            &publishes[t * nsamples], nsamples);
+    }
+
+    free(cmds);
+    free(connects);
+    free(publishes);
+
+    return 0;
+}
+
+/* sets up a target for the unix domain socket at path,
+ * '@name' being in the abstract namespace */
+static void unix_target(struct target *target, const char *name,
+                        const char *path, int shm) {
+    struct sockaddr_un *un = (struct sockaddr_un *) &target->addr;
+
+    if (strlen(path) >= sizeof(un->sun_path)) {
+        fprintf(stderr, "Path too long: %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+
+    target->name = name;
+    target->family = AF_UNIX;
+    target->shm = shm;
+    un->sun_family = AF_UNIX;
+
+    if (path[0] == '@') {
+        // see reactor_listen_unix
+        memcpy(un->sun_path + 1, path + 1, strlen(path) - 1);
+        target->addrlen = offsetof(struct sockaddr_un, sun_path)
+            + strlen(path);
+    } else {
+        strcpy(un->sun_path, path);
+        target->addrlen = sizeof(struct sockaddr_un);
+    }
+}
+
+static void usage(char *prog) {
+    fprintf(stderr, "usage: %s [-p port] [-u path] [-r path] "
+        "[-n samples] [-s size]\n", prog);
+    fprintf(stderr, "\tport: tcp port of the broker on localhost "
+        "(default %d)\n", DEFAULT_PORT);
+    fprintf(stderr, "\t-u path: unix domain socket of the broker, "
+        "'@name' for the abstract namespace\n");
+    fprintf(stderr, "\t-r path: shm listener of the broker\n");
+    fprintf(stderr, "\tsamples: publishes per transport "
+        "(default %d)\n", DEFAULT_SAMPLES);
+    fprintf(stderr, "\tsize: bytes of content per message "
+        "(default %d)\n", DEFAULT_SIZE);
+}
+
+int main(int argc, char **argv) {
+    int opt, ntargets = 1;
+    int port = DEFAULT_PORT;
+    int nsamples = DEFAULT_SAMPLES;
+    long size = DEFAULT_SIZE;
+    char *path = NULL, *shmpath = NULL;
+    struct target targets[3];
+    struct sockaddr_in *in;
+
+    while ((opt = getopt(argc, argv, "p:u:r:n:s:h")) != -1) {
+        switch (opt) {
+            case 'p':
+                port = atoi(optarg);
+                break;
+            case 'u':
+                path = optarg;
+                break;
+            case 'r':
+                shmpath = optarg;
+                break;
+            case 'n':
+                nsamples = atoi(optarg);
+                break;
+            case 's':
+                size = atol(optarg);
+                break;
+            default:
+                usage(argv[0]);
+                exit(opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+    }
+
+    if (nsamples < 1 || size < 0) {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    memset(targets, 0, sizeof(targets));
+
+    targets[0].name = "tcp";
+    targets[0].family = AF_INET;
+    in = (struct sockaddr_in *) &targets[0].addr;
+    in->sin_family = AF_INET;
+    in->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    in->sin_port = htons(port);
+    targets[0].addrlen = sizeof(struct sockaddr_in);
+
+    if (path != NULL)
+        unix_target(&targets[ntargets++], "unix", path, 0);
+    if (shmpath != NULL)
+        unix_target(&targets[ntargets++], "shm", shmpath, 1);
+
+    if (run(targets, ntargets, nsamples, size) != 0)
+        return EXIT_FAILURE;
+
+    return EXIT_SUCCESS;
+}
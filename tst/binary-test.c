@@ -0,0 +1,206 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <CUnit/CUnit.h>
+#include <CUnit/Basic.h>
+
+#include "../src/binary.h"
+
+/* encodes a command like a client would */
+static size_t binary_frame(struct stomp_command cmd, char *buf) {
+    char *str;
+    size_t len;
+
+    assert(0 == binary_create(&cmd, &str, &len));
+    memcpy(buf, str, len);
+    free(str);
+    return len;
+}
+
+void test_binary_send_by_name() {
+    struct stomp_command in, out;
+    struct stomp_header headers[3] = {
+        { "x-app", "1" }, { "topic", "stocks" }, { "receipt", "77" }
+    };
+    char buf[128];
+    size_t len;
+
+    in.name = "SEND";
+    in.headers = headers;
+    in.nheaders = 3;
+    in.content = "a\0b";
+    in.contentlen = 3;
+    in.topicid = 0;
+
+    // the topic goes first, the other headers keep their order
+    len = binary_frame(in, buf);
+    CU_ASSERT_EQUAL_FATAL(len, binary_frame_length(buf, len));
+    CU_ASSERT_EQUAL_FATAL(0, binary_parse(buf, len, &out));
+    CU_ASSERT_STRING_EQUAL_FATAL("SEND", out.name);
+    CU_ASSERT_EQUAL_FATAL(0, out.topicid);
+    CU_ASSERT_EQUAL_FATAL(3, out.nheaders);
+    CU_ASSERT_STRING_EQUAL_FATAL("topic", out.headers[0].key);
+    CU_ASSERT_STRING_EQUAL_FATAL("stocks", out.headers[0].val);
+    CU_ASSERT_STRING_EQUAL_FATAL("x-app", out.headers[1].key);
+    CU_ASSERT_STRING_EQUAL_FATAL("1", out.headers[1].val);
+    CU_ASSERT_STRING_EQUAL_FATAL("receipt", out.headers[2].key);
+    CU_ASSERT_STRING_EQUAL_FATAL("77", out.headers[2].val);
+    CU_ASSERT_STRING_EQUAL_FATAL("stocks",
+        stomp_header_get(&out, STOMP_HDR_TOPIC));
+    CU_ASSERT_STRING_EQUAL_FATAL("77",
+        stomp_header_get(&out, STOMP_HDR_RECEIPT));
+    CU_ASSERT_EQUAL_FATAL(3, out.contentlen);
+    CU_ASSERT_EQUAL_FATAL(0, memcmp("a\0b", out.content, 3));
+}
+
+void test_binary_by_id() {
+    struct stomp_command in, out;
+    struct stomp_header header = { "destination", "stocks" };
+    char buf[64], *str;
+    size_t len, idlen;
+
+    in.name = "SUBSCRIBE";
+    in.headers = &header;
+    in.nheaders = 1;
+    in.content = NULL;
+    in.contentlen = 0;
+    in.topicid = 300;
+
+    // the name is left out once there is an id
+    idlen = binary_frame(in, buf);
+    CU_ASSERT_EQUAL_FATAL(0, binary_parse(buf, idlen, &out));
+    CU_ASSERT_STRING_EQUAL_FATAL("SUBSCRIBE", out.name);
+    CU_ASSERT_EQUAL_FATAL(300, out.topicid);
+    CU_ASSERT_EQUAL_FATAL(0, out.nheaders);
+    CU_ASSERT_PTR_NULL_FATAL(out.content);
+
+    // except for TOPIC, which announces it
+    in.name = "TOPIC";
+    len = binary_frame(in, buf);
+    CU_ASSERT_EQUAL_FATAL(idlen + 1 + strlen("stocks"), len);
+    CU_ASSERT_EQUAL_FATAL(0, memcmp(buf + 5, "stocks", 6));
+
+    // neither name nor id
+    in.name = "SEND";
+    in.topicid = 0;
+    in.nheaders = 0;
+    in.content = "x";
+    in.contentlen = 1;
+    CU_ASSERT_EQUAL_FATAL(STOMP_MISSING_HEADER,
+        binary_create(&in, &str, &len));
+}
+
+void test_binary_parse_invalid() {
+    struct stomp_command cmd;
+    char buf[64];
+
+    // empty DISCONNECT: length, command, id, headers, content, null
+    char ok[] = { 5, BINARY_DISCONNECT, 0, 0, 0, 0 };
+    CU_ASSERT_EQUAL_FATAL(0, binary_parse(ok, sizeof(ok), &cmd));
+    CU_ASSERT_STRING_EQUAL_FATAL("DISCONNECT", cmd.name);
+
+    // a length that does not match
+    memcpy(buf, ok, sizeof(ok));
+    buf[0] = 6;
+    CU_ASSERT_EQUAL_FATAL(STOMP_INVALID_CONTENT,
+        binary_parse(buf, sizeof(ok), &cmd));
+
+    // no null byte at the end
+    memcpy(buf, ok, sizeof(ok));
+    buf[5] = 1;
+    CU_ASSERT_EQUAL_FATAL(STOMP_INVALID_CONTENT,
+        binary_parse(buf, sizeof(ok), &cmd));
+
+    // only the broker sends MESSAGE
+    memcpy(buf, ok, sizeof(ok));
+    buf[1] = BINARY_MESSAGE;
+    CU_ASSERT_EQUAL_FATAL(STOMP_UNKNOWN_COMMAND,
+        binary_parse(buf, sizeof(ok), &cmd));
+
+    // DISCONNECT has no topic
+    memcpy(buf, ok, sizeof(ok));
+    buf[2] = 1;
+    CU_ASSERT_EQUAL_FATAL(STOMP_UNEXPECTED_HEADER,
+        binary_parse(buf, sizeof(ok), &cmd));
+
+    // more headers than a command holds
+    memcpy(buf, ok, sizeof(ok));
+    buf[3] = STOMP_MAX_HEADERS + 1;
+    CU_ASSERT_EQUAL_FATAL(STOMP_TOO_MANY_HEADERS,
+        binary_parse(buf, sizeof(ok), &cmd));
+
+    // content where there must be none
+    char content[] = { 6, BINARY_DISCONNECT, 0, 0, 1, 'x', 0 };
+    CU_ASSERT_EQUAL_FATAL(STOMP_UNEXPECTED_CONTENT,
+        binary_parse(content, sizeof(content), &cmd));
+
+    // a SEND without content
+    char nocontent[] = { 0, BINARY_SEND, 0, 3, 'a', 'b', 'c', 0, 0, 0 };
+    nocontent[0] = sizeof(nocontent) - 1;
+    CU_ASSERT_EQUAL_FATAL(STOMP_MISSING_CONTENT,
+        binary_parse(nocontent, sizeof(nocontent), &cmd));
+
+    // a topic name that runs past the end
+    char past[] = { 0, BINARY_SEND, 0, 9, 'a', 'b', 'c', 0, 1, 'x', 0 };
+    past[0] = sizeof(past) - 1;
+    CU_ASSERT_EQUAL_FATAL(STOMP_INVALID_HEADER,
+        binary_parse(past, sizeof(past), &cmd));
+
+    // an empty topic name
+    char empty[] = { 0, BINARY_SEND, 0, 0, 0, 1, 'x', 0 };
+    empty[0] = sizeof(empty) - 1;
+    CU_ASSERT_EQUAL_FATAL(STOMP_INVALID_HEADER,
+        binary_parse(empty, sizeof(empty), &cmd));
+
+    // a null byte in a header
+    char nul[] = { 0, BINARY_SEND, 0, 1, 't', 1, 1, 'k', 2, 'v', 0,
+        1, 'x', 0 };
+    nul[0] = sizeof(nul) - 1;
+    CU_ASSERT_EQUAL_FATAL(STOMP_INVALID_HEADER,
+        binary_parse(nul, sizeof(nul), &cmd));
+
+    // the same without it, empty values are fine
+    char hdr[] = { 0, BINARY_SEND, 0, 1, 't', 2, 1, 'k', 1, 'v',
+        1, 'e', 0, 1, 'x', 0 };
+    hdr[0] = sizeof(hdr) - 1;
+    CU_ASSERT_EQUAL_FATAL(0, binary_parse(hdr, sizeof(hdr), &cmd));
+    CU_ASSERT_EQUAL_FATAL(3, cmd.nheaders);
+    CU_ASSERT_STRING_EQUAL_FATAL("t", cmd.headers[0].val);
+    CU_ASSERT_STRING_EQUAL_FATAL("k", cmd.headers[1].key);
+    CU_ASSERT_STRING_EQUAL_FATAL("v", cmd.headers[1].val);
+    CU_ASSERT_STRING_EQUAL_FATAL("e", cmd.headers[2].key);
+    CU_ASSERT_STRING_EQUAL_FATAL("", cmd.headers[2].val);
+    CU_ASSERT_EQUAL_FATAL('x', *cmd.content);
+}
+
+void test_binary_frame_length() {
+    char buf[16] = { 0 };
+
+    // not a single byte of the length yet
+    CU_ASSERT_EQUAL_FATAL(0, binary_frame_length(buf, 0));
+
+    // 300 takes two bytes
+    buf[0] = (char) (0x80 | (300 & 0x7f));
+    buf[1] = 300 >> 7;
+    CU_ASSERT_EQUAL_FATAL(0, binary_frame_length(buf, 1));
+    CU_ASSERT_EQUAL_FATAL(302, binary_frame_length(buf, 2));
+    CU_ASSERT_EQUAL_FATAL(302, binary_frame_length(buf, 16));
+
+    // more bytes than any size_t has
+    memset(buf, 0x80, sizeof(buf));
+    CU_ASSERT_EQUAL_FATAL(0, binary_frame_length(buf, 9));
+    CU_ASSERT_EQUAL_FATAL(SIZE_MAX, binary_frame_length(buf, 11));
+}
+
+void binary_test_suite() {
+    CU_pSuite binarySuite = CU_add_suite("binary", NULL, NULL);
+    CU_add_test(binarySuite, "test_binary_send_by_name",
+        test_binary_send_by_name);
+    CU_add_test(binarySuite, "test_binary_by_id", test_binary_by_id);
+    CU_add_test(binarySuite, "test_binary_parse_invalid",
+        test_binary_parse_invalid);
+    CU_add_test(binarySuite, "test_binary_frame_length",
+        test_binary_frame_length);
+}
@@ -13,6 +13,10 @@
 #include "../src/topic.h"
 #include "../src/distributor.h"
 #include "../src/stomp.h"
+#include "../src/binary.h"
+#include "../src/frame.h"
+#include "../src/socket.h"
+#include "../src/gc.h"
 
 void test_send_error() {
 
@@ -47,12 +51,18 @@ void test_send_receipt() {
     client_init(&client);
     client.sockfd = fds[1];
 
-    ret = send_receipt(&client);
+    ret = send_receipt(&client, NULL);
     CU_ASSERT_EQUAL_FATAL(0, ret);
 
     assert(read(fds[0], rawcmd, 32) > 0);
     CU_ASSERT_STRING_EQUAL_FATAL("RECEIPT\n\n", rawcmd);
 
+    ret = send_receipt(&client, "42");
+    CU_ASSERT_EQUAL_FATAL(0, ret);
+
+    assert(read(fds[0], rawcmd, 32) > 0);
+    CU_ASSERT_STRING_EQUAL_FATAL("RECEIPT\nreceipt-id:42\n\n", rawcmd);
+
     assert(0 == close(fds[0]));
     assert(0 == close(fds[1]));
     client_destroy(&client);
@@ -62,18 +72,31 @@ void test_send_connected() {
     int ret;
     int fds[2]; // 0=read, 1=write
     struct client client;
-    char rawcmd[32];
+    char rawcmd[64];
 
     assert(pipe(fds) == 0);
     client_init(&client);
     client.sockfd = fds[1];
 
-    ret = send_connected(&client);
+    ret = send_connected(&client, 0);
     CU_ASSERT_EQUAL_FATAL(0, ret);
 
-    assert(read(fds[0], rawcmd, 32) > 0);
+    assert(read(fds[0], rawcmd, 64) > 0);
     CU_ASSERT_STRING_EQUAL_FATAL("CONNECTED\n\n", rawcmd);
 
+    ret = send_connected(&client, BROKER_BINARY);
+    CU_ASSERT_EQUAL_FATAL(0, ret);
+
+    assert(read(fds[0], rawcmd, 64) > 0);
+    CU_ASSERT_STRING_EQUAL_FATAL("CONNECTED\nframing:binary\n\n", rawcmd);
+
+    ret = send_connected(&client, BROKER_BINARY | BROKER_DEFLATE);
+    CU_ASSERT_EQUAL_FATAL(0, ret);
+
+    assert(read(fds[0], rawcmd, 64) > 0);
+    CU_ASSERT_STRING_EQUAL_FATAL(
+        "CONNECTED\nframing:binary\nencoding:deflate\n\n", rawcmd);
+
     assert(0 == close(fds[0]));
     assert(0 == close(fds[1]));
     client_destroy(&client);
@@ -83,9 +106,8 @@ void test_process_send() {
     int ret;
     struct broker_context ctx ;
     struct stomp_command cmd;
-    struct stomp_header header;
-    struct list topics;
-    struct list messages;
+    struct topic_table topics;
+    struct list *messages;
     struct client c;
     struct subscriber sub = {&c, "foo"};
     struct message *msg;
@@ -93,29 +115,89 @@ void test_process_send() {
     struct client client;
 
 
+    int fds[2];
+    char resp[64];
+    char rawcmd[] = "SEND\ntopic:stocks\ncontent-type:text/plain\n"
+        "receipt:7\nx-app:foo\n\nprice: 22.3";
+
     client_init(&c);
-    cmd.name = "SEND";
-    header.key = "topic";
-    header.val = "stocks";
-    cmd.headers = &header;
-    cmd.nheaders = 1;
-    cmd.content = "price: 22.3";
-    list_init(&topics);
+    assert(0 == parse_command(rawcmd, &cmd));
+    topic_table_init(&topics);
     ctx.topics = &topics;
-    list_init(&messages);
-    ctx.messages = &messages;
+    assert(pipe(fds) == 0);
     client_init(&client);
+    client.sockfd = fds[1];
 
     assert(0 == topic_add_subscriber(&topics, "stocks", &sub));
-    ret = process_send(&ctx, &client, cmd);
+    messages = topic_find(&topics, "stocks")->messages;
+    ret = process_send(&ctx, &client, &cmd);
 
     CU_ASSERT_EQUAL_FATAL(0, ret);
-    msg = messages.root->entry;
+    msg = messages->root->entry;
     CU_ASSERT_STRING_EQUAL_FATAL("price: 22.3", msg->content);
     CU_ASSERT_STRING_EQUAL_FATAL("stocks", msg->topicname);
 
-    topic = topics.root->entry;
+    // headers of the application are passed on
+    CU_ASSERT_EQUAL_FATAL(2, msg->nheaders);
+    CU_ASSERT_STRING_EQUAL_FATAL("content-type", msg->headers[0].key);
+    CU_ASSERT_STRING_EQUAL_FATAL("text/plain", msg->headers[0].val);
+    CU_ASSERT_STRING_EQUAL_FATAL("x-app", msg->headers[1].key);
+    CU_ASSERT_STRING_EQUAL_FATAL("foo", msg->headers[1].val);
+
+    // the receipt is for the publisher
+    assert(0 < read(fds[0], resp, 64));
+    CU_ASSERT_STRING_EQUAL_FATAL("RECEIPT\nreceipt-id:7\n\n", resp);
+
+    topic = topic_find(&topics, "stocks");
+    CU_ASSERT_PTR_NOT_NULL_FATAL(topic);
     CU_ASSERT_STRING_EQUAL_FATAL("stocks", topic->name);
+    assert(close(fds[0]) == 0);
+    assert(close(fds[1]) == 0);
+    client_destroy(&client);
+}
+
+void test_process_send_batch() {
+    int ret;
+    struct broker_context ctx ;
+    struct stomp_command cmd;
+    struct topic_table topics;
+    struct list *messages;
+    struct client c;
+    struct subscriber sub = {&c, "foo"};
+    struct message *msg;
+    struct client client;
+
+    int fds[2];
+    char resp[64];
+    char rawcmd[] = "SEND\ntopic:stocks\nbatch:4,5\nreceipt:8\n\n"
+        "22.322.35";
+
+    client_init(&c);
+    assert(0 == parse_command(rawcmd, &cmd));
+    topic_table_init(&topics);
+    ctx.topics = &topics;
+    assert(pipe(fds) == 0);
+    client_init(&client);
+    client.sockfd = fds[1];
+
+    assert(0 == topic_add_subscriber(&topics, "stocks", &sub));
+    messages = topic_find(&topics, "stocks")->messages;
+    ret = process_send(&ctx, &client, &cmd);
+
+    CU_ASSERT_EQUAL_FATAL(0, ret);
+    CU_ASSERT_EQUAL_FATAL(2, list_len(messages));
+    msg = messages->root->entry;
+    CU_ASSERT_STRING_EQUAL_FATAL("22.3", msg->content);
+    CU_ASSERT_EQUAL_FATAL(0, msg->nheaders);
+    msg = messages->root->next->entry;
+    CU_ASSERT_STRING_EQUAL_FATAL("22.35", msg->content);
+
+    // one receipt for all of them
+    CU_ASSERT_EQUAL_FATAL(23, read(fds[0], resp, 64));
+    CU_ASSERT_STRING_EQUAL_FATAL("RECEIPT\nreceipt-id:8\n\n", resp);
+
+    assert(close(fds[0]) == 0);
+    assert(close(fds[1]) == 0);
     client_destroy(&client);
 }
 
@@ -123,28 +205,20 @@ void test_process_send_no_subscriber() {
     int ret;
     struct broker_context ctx ;
     struct stomp_command cmd;
-    struct stomp_header header;
-    struct list topics;
-    struct list messages;
+    struct topic_table topics;
     struct client client;
     int fds[2];
     char resp[64];
+    char rawcmd[] = "SEND\ntopic:stocks\n\nprice: 22.3";
 
-    cmd.name = "SEND";
-    header.key = "topic";
-    header.val = "stocks";
-    cmd.headers = &header;
-    cmd.nheaders = 1;
-    cmd.content = "price: 22.3";
-    list_init(&topics);
+    assert(0 == parse_command(rawcmd, &cmd));
+    topic_table_init(&topics);
     ctx.topics = &topics;
-    list_init(&messages);
-    ctx.messages = &messages;
     assert(pipe(fds) == 0);
     client_init(&client);
     client.sockfd = fds[1];
 
-    ret = process_send(&ctx, &client, cmd);
+    ret = process_send(&ctx, &client, &cmd);
 
     CU_ASSERT_EQUAL_FATAL(-1, ret);
     assert(0 < read(fds[0], resp, 64));
@@ -159,42 +233,41 @@ void test_process_subscribe() {
     int ret;
     struct broker_context ctx ;
     struct stomp_command cmd;
-    struct stomp_header header;
-    struct list topics;
-    struct list messages;
+    struct topic_table topics;
     struct list *subscribers;
     struct subscriber sub1;
-    struct subscriber *sub2;
+    struct subscription *sub2;
     struct topic *topic;
+    struct client client;
+    char rawcmd[] = "SUBSCRIBE\ndestination:stocks\n\n";
 
-    cmd.name = "SUBSCRIBE";
-    header.key = "destination";
-    header.val = "stocks";
-    cmd.headers = &header;
-    cmd.nheaders = 1;
-    list_init(&topics);
+    assert(0 == parse_command(rawcmd, &cmd));
+    topic_table_init(&topics);
     ctx.topics = &topics;
-    list_init(&messages);
-    ctx.messages = &messages;
+    client_init(&client);
     sub1.name = "x2y";
+    sub1.client = &client;
 
-    ret = process_subscribe(&ctx, cmd, &sub1);
+    ret = process_subscribe(&ctx, &cmd, &sub1);
 
     CU_ASSERT_EQUAL_FATAL(0, ret);
-    CU_ASSERT_PTR_NULL(messages.root);
 
-    topic = topics.root->entry;
+    topic = topic_find(&topics, "stocks");
+    CU_ASSERT_PTR_NOT_NULL_FATAL(topic);
+    CU_ASSERT_PTR_NULL(topic->messages->root);
     CU_ASSERT_STRING_EQUAL_FATAL("stocks", topic->name);
     subscribers = topic->subscribers;
     sub2 = subscribers->root->entry;
-    CU_ASSERT_EQUAL_FATAL(sub2, &sub1);
+    CU_ASSERT_EQUAL_FATAL(sub2->subscriber, &sub1);
+    CU_ASSERT_EQUAL_FATAL(0, sub2->cursor);
+
+    client_destroy(&client);
 }
 
 void test_process_disconnect() {
     int ret;
     struct broker_context ctx ;
-    struct list topics;
-    struct list messages;
+    struct topic_table topics;
     struct subscriber sub;
     struct topic *topic;
     struct client client;
@@ -202,23 +275,22 @@ void test_process_disconnect() {
     sub.name = "X2Y";
     sub.client = &client;
 
-    list_init(&topics);
+    topic_table_init(&topics);
     ctx.topics = &topics;
-    list_init(&messages);
-    ctx.messages = &messages;
     client_init(&client);
 
     topic_add_subscriber(&topics, "stocks", &sub);
-    topic_add_message(&topics, &messages, "stocks", "price: 22.3");
+    topic_add_message(&topics, "stocks", NULL, 0, "price: 22.3", 11);
 
-    ret = process_disconnect(&ctx, &client, &sub);
+    ret = process_disconnect(&ctx, &client, &sub, NULL);
 
     CU_ASSERT_EQUAL_FATAL(0, ret);
 
     CU_ASSERT(client.dead);
 
     // topic is not deleted
-    topic = topics.root->entry;
+    topic = topic_find(&topics, "stocks");
+    CU_ASSERT_PTR_NOT_NULL_FATAL(topic);
     CU_ASSERT_STRING_EQUAL_FATAL("stocks", topic->name);
     client_destroy(&client);
 }
@@ -226,20 +298,17 @@ void test_process_disconnect() {
 void test_process_disconnect_not_subscribed() {
     int ret;
     struct broker_context ctx ;
-    struct list topics;
-    struct list messages;
+    struct topic_table topics;
     struct subscriber sub;
     struct client client;
 
     sub.name = "X2Y";
 
-    list_init(&topics);
+    topic_table_init(&topics);
     ctx.topics = &topics;
-    list_init(&messages);
     client_init(&client);
-    ctx.messages = &messages;
 
-    ret = process_disconnect(&ctx, &client, &sub);
+    ret = process_disconnect(&ctx, &client, &sub, NULL);
 
     CU_ASSERT_EQUAL_FATAL(0, ret);
 
@@ -248,16 +317,13 @@ void test_process_disconnect_not_subscribed() {
 
 void test_handle_client() {
     struct broker_context ctx;
-    struct list topics;
-    struct list messages;
+    struct topic_table topics;
     int fds[2];
     struct handler_params hparams;
 
     assert(0 == socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
-    list_init(&messages);
-    list_init(&topics);
+    topic_table_init(&topics);
     ctx.topics = &topics;
-    ctx.messages = &messages;
     hparams.sock = fds[0];
     hparams.ctx = &ctx;
 
@@ -286,8 +352,7 @@ void test_handle_client() {
 
 void test_handle_client_first_command_not_connect() {
     struct broker_context ctx;
-    struct list topics;
-    struct list messages;
+    struct topic_table topics;
     struct subscriber sub;
     struct client client;
     int connected = 0;
@@ -296,10 +361,8 @@ void test_handle_client_first_command_not_connect() {
     client_init(&client);
     assert(0 == socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
     client.sockfd = fds[0];
-    list_init(&messages);
-    list_init(&topics);
+    topic_table_init(&topics);
     ctx.topics = &topics;
-    ctx.messages = &messages;
 
     char cmd1[] = "SUBSCRIBE\ndestination:stocks\n\n";
 
@@ -311,8 +374,7 @@ void test_handle_client_first_command_not_connect() {
     char resp1[64]; 
     assert(0 < read(fds[1], resp1, resp1len));
     CU_ASSERT_STRING_EQUAL_FATAL("ERROR\nmessage:Expected CONNECT\n\n", resp1);
-    list_destroy(&messages);
-    list_destroy(&topics);
+    topic_table_destroy(&topics);
     client_destroy(&client);
 }
 
@@ -320,8 +382,7 @@ void test_main_loop_strdup_subscriber_name() {
     // subscriber name must be strdup'ed
     // because the stomp_command will be freed
     struct broker_context ctx;
-    struct list topics;
-    struct list messages;
+    struct topic_table topics;
     struct subscriber sub;
     struct client client;
     int connected = 0;
@@ -330,10 +391,8 @@ void test_main_loop_strdup_subscriber_name() {
     client_init(&client);
     assert(0 == socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
     client.sockfd = fds[0];
-    list_init(&messages);
-    list_init(&topics);
+    topic_table_init(&topics);
     ctx.topics = &topics;
-    ctx.messages = &messages;
 
     char cmd1[] = "CONNECT\nlogin:foo\n\n";
 
@@ -344,15 +403,360 @@ void test_main_loop_strdup_subscriber_name() {
     // fails if value was directly assigned,
     // because command will be freed by now
     free(sub.name);
-    list_destroy(&messages);
-    list_destroy(&topics);
+    topic_table_destroy(&topics);
+    client_destroy(&client);
+}
+
+void test_main_loop_coalesce_receipts() {
+    struct broker_context ctx;
+    struct topic_table topics;
+    struct list *messages;
+    struct subscriber sub, other;
+    struct client client, c;
+    int i, connected = 0;
+    int fds[2];
+    char resp[128];
+
+    client_init(&client);
+    client_init(&c);
+    assert(0 == socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    client.sockfd = fds[0];
+    topic_table_init(&topics);
+    ctx.topics = &topics;
+    other.client = &c;
+    other.name = "other";
+    assert(0 == topic_add_subscriber(&topics, "stocks", &other));
+    messages = topic_find(&topics, "stocks")->messages;
+
+    char cmds[] = "CONNECT\nlogin:foo\n\n\0"
+        "SEND\ntopic:stocks\nreceipt:1\n\na\0"
+        "SEND\ntopic:stocks\nreceipt:2\n\nb\0"
+        "SEND\ntopic:stocks\n\nc\0"
+        "SEND\ntopic:stocks\nreceipt:4\n\nd\0"
+        "SEND\ntopic:stocks\n\ne";
+
+    // all of them arrive at once
+    assert(sizeof(cmds) == write(fds[1], cmds, sizeof(cmds)));
+    for (i = 0; i < 6; i++)
+        CU_ASSERT_EQUAL_FATAL(WORKER_CONTINUE,
+            main_loop(&ctx, &client, &connected, &sub));
+    CU_ASSERT_EQUAL_FATAL(5, list_len(messages));
+
+    // one receipt for the last one asked for, sent
+    // once there was nothing left to process
+    memset(resp, 0, sizeof(resp));
+    assert(0 < read(fds[1], resp, sizeof(resp)));
+    CU_ASSERT_STRING_EQUAL_FATAL("CONNECTED\n\n", resp);
+    CU_ASSERT_STRING_EQUAL_FATAL("RECEIPT\nreceipt-id:4\n\n",
+        resp + strlen("CONNECTED\n\n") + 1);
+    CU_ASSERT_EQUAL_FATAL(0, resp[strlen("CONNECTED\n\n") +
+        strlen("RECEIPT\nreceipt-id:4\n\n") + 2]);
+
+    free(sub.name);
+    close(fds[1]);
+    client_destroy(&client);
+}
+
+/* the owner of the connection in the tests
+ * below never flushes the outbound queue */
+static void ignore_notify(struct client *client, int pending) {
+    (void) client;
+    (void) pending;
+}
+
+void test_main_loop_receipt_queue_full() {
+    struct broker_context ctx;
+    struct topic_table topics;
+    struct subscriber sub, other;
+    struct client client, c;
+    struct stomp_command cmd;
+    struct stomp_header header;
+    struct frame *frame;
+    int ret, connected = 0;
+    int fds[2];
+    char reason[1000];
+
+    client_init(&client);
+    client_init(&c);
+    assert(0 == socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    client.sockfd = fds[0];
+    client.wnotify = ignore_notify;
+    topic_table_init(&topics);
+    ctx.topics = &topics;
+    other.client = &c;
+    other.name = "other";
+    assert(0 == topic_add_subscriber(&topics, "stocks", &other));
+
+    memset(reason, 'x', sizeof(reason) - 1);
+    reason[sizeof(reason) - 1] = '\0';
+    cmd.name = "ERROR";
+    header.key = "message";
+    header.val = reason;
+    cmd.headers = &header;
+    cmd.nheaders = 1;
+    cmd.content = NULL;
+
+    // deliveries have filled the outbound queue
+    assert(0 == frame_create(&cmd, &frame));
+    do {
+        ret = socket_send_frame(&client, frame);
+    } while (ret == 0);
+    frame_unref(frame);
+    CU_ASSERT_EQUAL_FATAL(SOCKET_QUEUE_FULL, ret);
+
+    char cmds[] = "CONNECT\nlogin:foo\n\n\0"
+        "SEND\ntopic:stocks\nreceipt:1\n\na";
+    assert(sizeof(cmds) == write(fds[1], cmds, sizeof(cmds)));
+    CU_ASSERT_EQUAL_FATAL(WORKER_CONTINUE,
+        main_loop(&ctx, &client, &connected, &sub));
+    CU_ASSERT_EQUAL_FATAL(WORKER_CONTINUE,
+        main_loop(&ctx, &client, &connected, &sub));
+
+    // the receipt is queued nonetheless
+    CU_ASSERT_FATAL(client.receipt == NULL || client.receipt[0] == '\0');
+    CU_ASSERT_STRING_EQUAL_FATAL("RECEIPT\nreceipt-id:1\n\n",
+        client.wqtail->frame->data);
+
+    // held back while the next command is buffered
+    char cmds2[] = "SEND\ntopic:stocks\nreceipt:2\n\nb\0"
+        "SEND\ntopic:stocks\n\nc";
+    assert(sizeof(cmds2) == write(fds[1], cmds2, sizeof(cmds2)));
+    CU_ASSERT_EQUAL_FATAL(WORKER_CONTINUE,
+        main_loop(&ctx, &client, &connected, &sub));
+    CU_ASSERT_STRING_EQUAL_FATAL("2", client.receipt);
+
+    // a receipt that cannot be sent does not confirm it
+    client.dead = 1;
+    CU_ASSERT_EQUAL_FATAL(SOCKET_NECROMANCE, send_receipt(&client, "3"));
+    CU_ASSERT_STRING_EQUAL_FATAL("2", client.receipt);
+
+    // it is sent once nothing is buffered anymore
+    client.dead = 0;
+    CU_ASSERT_EQUAL_FATAL(WORKER_CONTINUE,
+        main_loop(&ctx, &client, &connected, &sub));
+    CU_ASSERT_EQUAL_FATAL('\0', client.receipt[0]);
+    CU_ASSERT_STRING_EQUAL_FATAL("RECEIPT\nreceipt-id:2\n\n",
+        client.wqtail->frame->data);
+
+    free(sub.name);
+    close(fds[1]);
+    topic_table_destroy(&topics);
+    client_destroy(&client);
+    client_destroy(&c);
+}
+
+/* reads a frame with the binary framing and compares it
+ * to the command, encoded the same way */
+static void assert_binary_frame(int fd, struct stomp_command cmd) {
+    char *expected, buf[128];
+    size_t len;
+
+    assert(0 == binary_create(&cmd, &expected, &len));
+    assert(len <= sizeof(buf));
+    CU_ASSERT_EQUAL_FATAL(len, read(fd, buf, len));
+    CU_ASSERT_EQUAL_FATAL(0, memcmp(expected, buf, len));
+    free(expected);
+}
+
+void test_main_loop_binary_framing() {
+    struct broker_context ctx;
+    struct topic_table topics;
+    struct list *messages;
+    struct subscriber sub;
+    struct client client;
+    struct message *msg;
+    struct stomp_command cmd;
+    struct stomp_header header = { "destination", "stocks" };
+    struct stomp_header error = { "message", "Unknown topic id" };
+    int connected = 0;
+    int fds[2];
+    char resp[64], *frame;
+    size_t len;
+    unsigned long id;
+
+    client_init(&client);
+    assert(0 == socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    client.sockfd = fds[0];
+    topic_table_init(&topics);
+    ctx.topics = &topics;
+
+    char connect[] = "CONNECT\nlogin:foo\naccept-framing:text,binary\n\n";
+    assert(0 < write(fds[1], connect, sizeof(connect)));
+    CU_ASSERT_EQUAL_FATAL(WORKER_CONTINUE,
+        main_loop(&ctx, &client, &connected, &sub));
+    CU_ASSERT_EQUAL_FATAL(1, client.binary);
+
+    // CONNECTED is still text
+    memset(resp, 0, sizeof(resp));
+    len = strlen("CONNECTED\nframing:binary\n\n") + 1;
+    CU_ASSERT_EQUAL_FATAL(len, read(fds[1], resp, len));
+    CU_ASSERT_STRING_EQUAL_FATAL("CONNECTED\nframing:binary\n\n", resp);
+
+    // subscribe by name, the broker answers with the id
+    cmd.name = "SUBSCRIBE";
+    cmd.headers = &header;
+    cmd.nheaders = 1;
+    cmd.content = NULL;
+    cmd.contentlen = 0;
+    cmd.topicid = 0;
+    assert(0 == binary_create(&cmd, &frame, &len));
+    assert(len == write(fds[1], frame, len));
+    free(frame);
+    CU_ASSERT_EQUAL_FATAL(WORKER_CONTINUE,
+        main_loop(&ctx, &client, &connected, &sub));
+
+    id = topic_ensure(&topics, "stocks");
+    messages = topic_find(&topics, "stocks")->messages;
+    cmd.name = "TOPIC";
+    cmd.topicid = id;
+    assert_binary_frame(fds[1], cmd);
+
+    // send by id
+    cmd.name = "SEND";
+    cmd.nheaders = 0;
+    cmd.content = "hi";
+    cmd.contentlen = 2;
+    assert(0 == binary_create(&cmd, &frame, &len));
+    assert(len == write(fds[1], frame, len));
+    free(frame);
+    CU_ASSERT_EQUAL_FATAL(WORKER_CONTINUE,
+        main_loop(&ctx, &client, &connected, &sub));
+
+    CU_ASSERT_EQUAL_FATAL(1, list_len(messages));
+    msg = messages->root->entry;
+    CU_ASSERT_STRING_EQUAL_FATAL("stocks", msg->topicname);
+    CU_ASSERT_EQUAL_FATAL(id, msg->topicid);
+    CU_ASSERT_STRING_EQUAL_FATAL("hi", msg->content);
+
+    // an id the broker has not handed out
+    cmd.topicid = id + 1000;
+    assert(0 == binary_create(&cmd, &frame, &len));
+    assert(len == write(fds[1], frame, len));
+    free(frame);
+    CU_ASSERT_EQUAL_FATAL(WORKER_CONTINUE,
+        main_loop(&ctx, &client, &connected, &sub));
+
+    cmd.name = "ERROR";
+    cmd.headers = &error;
+    cmd.nheaders = 1;
+    cmd.content = NULL;
+    assert_binary_frame(fds[1], cmd);
+    CU_ASSERT_EQUAL_FATAL(1, list_len(messages));
+
+    free(sub.name);
+    close(fds[1]);
+    client_destroy(&client);
+}
+
+void test_main_loop_accept_encoding() {
+    struct broker_context ctx;
+    struct topic_table topics;
+    struct subscriber sub;
+    struct client client;
+    int connected = 0;
+    int fds[2];
+    char resp[64];
+    size_t len;
+
+    client_init(&client);
+    assert(0 == socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    client.sockfd = fds[0];
+    topic_table_init(&topics);
+    ctx.topics = &topics;
+
+    // unknown encodings are ignored
+    char connect[] = "CONNECT\nlogin:foo\naccept-encoding:br,deflate\n\n";
+    assert(0 < write(fds[1], connect, sizeof(connect)));
+    CU_ASSERT_EQUAL_FATAL(WORKER_CONTINUE,
+        main_loop(&ctx, &client, &connected, &sub));
+    CU_ASSERT_EQUAL_FATAL(1, client.deflate);
+    CU_ASSERT_EQUAL_FATAL(0, client.binary);
+
+    memset(resp, 0, sizeof(resp));
+    len = strlen("CONNECTED\nencoding:deflate\n\n") + 1;
+    CU_ASSERT_EQUAL_FATAL(len, read(fds[1], resp, len));
+    CU_ASSERT_STRING_EQUAL_FATAL("CONNECTED\nencoding:deflate\n\n", resp);
+
+    free(sub.name);
+    close(fds[1]);
+    client_destroy(&client);
+}
+
+void test_main_loop_heartbeat() {
+    struct broker_context ctx;
+    struct topic_table topics;
+    struct subscriber sub;
+    struct client client;
+    int connected = 0;
+    int fds[2];
+    char resp[64];
+    size_t len;
+
+    client_init(&client);
+    assert(0 == socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    client.sockfd = fds[0];
+    client.heartbeat = 1000;
+    topic_table_init(&topics);
+    ctx.topics = &topics;
+
+    // the longer of the intervals counts
+    char connect[] = "CONNECT\nlogin:foo\nheart-beat:500,2000\n\n";
+    assert(0 < write(fds[1], connect, sizeof(connect)));
+    CU_ASSERT_EQUAL_FATAL(WORKER_CONTINUE,
+        main_loop(&ctx, &client, &connected, &sub));
+    CU_ASSERT_EQUAL_FATAL(2000, client.hbsend);
+    CU_ASSERT_EQUAL_FATAL(1000, client.hbrecv);
+
+    memset(resp, 0, sizeof(resp));
+    len = strlen("CONNECTED\nheart-beat:1000,1000\n\n") + 1;
+    CU_ASSERT_EQUAL_FATAL(len, read(fds[1], resp, len));
+    CU_ASSERT_STRING_EQUAL_FATAL("CONNECTED\nheart-beat:1000,1000\n\n",
+        resp);
+    free(sub.name);
+
+    // only one way, the other is not offered
+    connected = 0;
+    char oneway[] = "CONNECT\nlogin:foo\nheart-beat:0,300\n\n";
+    assert(0 < write(fds[1], oneway, sizeof(oneway)));
+    CU_ASSERT_EQUAL_FATAL(WORKER_CONTINUE,
+        main_loop(&ctx, &client, &connected, &sub));
+    CU_ASSERT_EQUAL_FATAL(1000, client.hbsend);
+    CU_ASSERT_EQUAL_FATAL(0, client.hbrecv);
+    CU_ASSERT_EQUAL_FATAL(len, read(fds[1], resp, len));
+    free(sub.name);
+
+    // taken for none
+    connected = 0;
+    char invalid[] = "CONNECT\nlogin:foo\nheart-beat:10,x\n\n";
+    assert(0 < write(fds[1], invalid, sizeof(invalid)));
+    CU_ASSERT_EQUAL_FATAL(WORKER_CONTINUE,
+        main_loop(&ctx, &client, &connected, &sub));
+    CU_ASSERT_EQUAL_FATAL(0, client.hbsend);
+    CU_ASSERT_EQUAL_FATAL(0, client.hbrecv);
+    len = strlen("CONNECTED\n\n") + 1;
+    CU_ASSERT_EQUAL_FATAL(len, read(fds[1], resp, len));
+    CU_ASSERT_STRING_EQUAL_FATAL("CONNECTED\n\n", resp);
+    free(sub.name);
+
+    // the owner of the connection cannot do it
+    connected = 0;
+    client.heartbeat = 0;
+    assert(0 < write(fds[1], connect, sizeof(connect)));
+    CU_ASSERT_EQUAL_FATAL(WORKER_CONTINUE,
+        main_loop(&ctx, &client, &connected, &sub));
+    CU_ASSERT_EQUAL_FATAL(0, client.hbsend);
+    CU_ASSERT_EQUAL_FATAL(0, client.hbrecv);
+    CU_ASSERT_EQUAL_FATAL(len, read(fds[1], resp, len));
+    CU_ASSERT_STRING_EQUAL_FATAL("CONNECTED\n\n", resp);
+
+    free(sub.name);
+    close(fds[1]);
     client_destroy(&client);
 }
 
 void test_handle_client_send_command_unknown() {
     struct broker_context ctx;
-    struct list topics;
-    struct list messages;
+    struct topic_table topics;
     struct subscriber sub;
     struct client client;
     int connected = 0;
@@ -361,10 +765,8 @@ void test_handle_client_send_command_unknown() {
     client_init(&client);
     assert(0 == socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
     client.sockfd = fds[0];
-    list_init(&messages);
-    list_init(&topics);
+    topic_table_init(&topics);
     ctx.topics = &topics;
-    ctx.messages = &messages;
 
     char cmd1[] = "UNKNOWN\nfoo\n\n";
 
@@ -376,21 +778,18 @@ void test_handle_client_send_command_unknown() {
     char resp1[64]; 
     assert(0 < read(fds[1], resp1, resp1len));
     CU_ASSERT_STRING_EQUAL_FATAL("ERROR\nmessage:Expected CONNECT\n\n", resp1);
-    list_destroy(&messages);
-    list_destroy(&topics);
+    topic_table_destroy(&topics);
     client_destroy(&client);
 }
 
 void test_handle_client_dead() {
     struct broker_context ctx ;
-    struct list topics;
-    struct list messages;
-    int fds[2];
+    struct topic_table topics;
     struct handler_params hparams;
 
     ctx.topics = &topics;
-    ctx.messages = &messages;
-    hparams.sock = fds[0];
+    // no socket at all, reading fails right away
+    hparams.sock = -1;
     hparams.ctx = &ctx;
 
     handle_client(&hparams);
@@ -401,25 +800,24 @@ void test_handle_client_dead() {
 
 void test_handle_client_too_much() {
     struct broker_context ctx;
-    struct list topics;
-    struct list messages;
+    struct topic_table topics;
     int fds[2];
     struct handler_params hparams;
 
     assert(0 == socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
-    list_init(&messages);
-    list_init(&topics);
+    topic_table_init(&topics);
     ctx.topics = &topics;
-    ctx.messages = &messages;
     hparams.sock = fds[0];
     hparams.ctx = &ctx;
 
     char *cmd = malloc(4096);
     memset(cmd, 1, 4095);
     cmd[4095] = '\0';
+    socket_set_max_frame(1024);
 
     assert(0 < write(fds[1], cmd, 4096));
     handle_client(&hparams);
+    socket_set_max_frame(SOCKET_DEFAULT_MAX_FRAME);
 
     // should have been closed
     CU_ASSERT_EQUAL_FATAL(-1, close(fds[0]));
@@ -429,53 +827,125 @@ void test_init_destory_context() {
     int ret;
 
     struct broker_context ctx;
-    struct message msg;
     struct topic topic;
 
     ret = broker_context_init(&ctx);
     CU_ASSERT_EQUAL_FATAL(0, ret);
 
-    ret = list_add(ctx.messages, &msg);
-    CU_ASSERT_EQUAL_FATAL(0, ret);
-
-    ret = list_add(ctx.topics, &topic);
+    topic.name = "stocks";
+    ret = topic_table_add(ctx.topics, &topic);
     CU_ASSERT_EQUAL_FATAL(0, ret);
+    CU_ASSERT_EQUAL_FATAL(&topic, topic_find(ctx.topics, "stocks"));
+    CU_ASSERT_STRING_EQUAL_FATAL("stocks", topic_name(ctx.topics, topic.id));
     
-    assert(0 == list_remove(ctx.messages, &msg));
-    assert(0 == list_remove(ctx.topics, &topic));
     ret = broker_context_destroy(&ctx);
     CU_ASSERT_EQUAL_FATAL(0, ret);
 }
 
+void test_release_client() {
+    struct broker_context ctx;
+    struct topic_table topics;
+    struct subscriber *pubsub, *sub;
+    struct client *pub, *client;
+    struct list eligible;
+    int connected;
+    int fds[2];
+    char resp[64];
+
+    topic_table_init(&topics);
+    ctx.topics = &topics;
+
+    // a publisher is not known to the gc, it is freed right away
+    pub = malloc(sizeof(struct client));
+    pubsub = malloc(sizeof(struct subscriber));
+    assert(pub != NULL && pubsub != NULL);
+    client_init(pub);
+    assert(0 == socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    pub->sockfd = fds[0];
+    pub->attached = 1;
+    connected = 0;
+
+    char cmd1[] = "CONNECT\nlogin:foo\n\n";
+    assert(0 < write(fds[1], cmd1, strlen(cmd1)+1));
+    CU_ASSERT_EQUAL_FATAL(WORKER_CONTINUE,
+        main_loop(&ctx, pub, &connected, pubsub));
+    release_client(pub, pubsub, connected);
+
+    // its socket has been closed
+    assert(0 < read(fds[1], resp, strlen("CONNECTED\n\n")+1));
+    CU_ASSERT_EQUAL_FATAL(0, read(fds[1], resp, sizeof(resp)));
+    close(fds[1]);
+
+    // nor is a client that has never sent CONNECT
+    pub = malloc(sizeof(struct client));
+    pubsub = malloc(sizeof(struct subscriber));
+    assert(pub != NULL && pubsub != NULL);
+    client_init(pub);
+    pub->sockfd = -1;
+    release_client(pub, pubsub, 0);
+
+    // a subscriber is left to the gc
+    client = malloc(sizeof(struct client));
+    sub = malloc(sizeof(struct subscriber));
+    assert(client != NULL && sub != NULL);
+    client_init(client);
+    assert(0 == socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    client->sockfd = fds[0];
+    client->attached = 1;
+    connected = 0;
+
+    char cmds[] = "CONNECT\nlogin:bar\n\n\0"
+        "SUBSCRIBE\ndestination:stocks\n\n";
+    assert(sizeof(cmds) == write(fds[1], cmds, sizeof(cmds)));
+    CU_ASSERT_EQUAL_FATAL(WORKER_CONTINUE,
+        main_loop(&ctx, client, &connected, sub));
+    CU_ASSERT_EQUAL_FATAL(WORKER_CONTINUE,
+        main_loop(&ctx, client, &connected, sub));
+    release_client(client, sub, connected);
+
+    CU_ASSERT_EQUAL_FATAL(client, sub->client);
+    list_init(&eligible);
+    CU_ASSERT_EQUAL_FATAL(0,
+        gc_collect_eligible_subscribers(&topics, &eligible));
+    CU_ASSERT_EQUAL_FATAL(1, list_len(&eligible));
+    CU_ASSERT_FATAL(list_contains(&eligible, sub));
+    CU_ASSERT_EQUAL_FATAL(0,
+        gc_remove_eligible_subscribers(&topics, &eligible));
+    CU_ASSERT_EQUAL_FATAL(0, gc_destroy_subscribers(&eligible));
+    list_clean(&eligible);
+    list_destroy(&eligible);
+
+    free(sub);
+    close(fds[1]);
+    topic_table_destroy(&topics);
+}
+
 void test_deliver_after_disconnect() {
     int ret;
-    struct stomp_command cmd;
-    struct stomp_header header;
+    struct stomp_command subcmd, sendcmd;
     struct broker_context ctx ;
     struct subscriber sub;
     struct client client;
+    char rawsub[] = "SUBSCRIBE\ndestination:stocks\n\n";
+    char rawsend[] = "SEND\ntopic:stocks\n\nprice: 22.3";
 
-    cmd.name = strdup("SEND");
-    header.key = strdup("topic");
-    header.val = strdup("stocks");
-    cmd.headers = &header;
-    cmd.nheaders = 1;
-    cmd.content = strdup("price: 22.3");
+    assert(0 == parse_command(rawsub, &subcmd));
+    assert(0 == parse_command(rawsend, &sendcmd));
     broker_context_init(&ctx);
     client_init(&client);
     sub.name = strdup("foo");
     sub.client = &client;
 
-    ret = process_subscribe(&ctx, cmd, &sub);
+    ret = process_subscribe(&ctx, &subcmd, &sub);
     CU_ASSERT_EQUAL_FATAL(0, ret);
 
-    ret = process_send(&ctx, &client, cmd);
+    ret = process_send(&ctx, &client, &sendcmd);
     CU_ASSERT_EQUAL_FATAL(0, ret);
 
-    ret = process_disconnect(&ctx, &client, &sub);
+    ret = process_disconnect(&ctx, &client, &sub, NULL);
     CU_ASSERT_EQUAL_FATAL(0, ret);
 
-    deliver_messages(ctx.messages);
+    deliver_topics(ctx.topics);
 
     CU_ASSERT_FATAL(client.dead);
     CU_ASSERT_PTR_NOT_NULL_FATAL(client.mutex_w);
@@ -488,6 +958,8 @@ void test_deliver_after_disconnect() {
 void broker_test_suite() {
     CU_pSuite socketSuite = CU_add_suite("broker", NULL, NULL);
     CU_add_test(socketSuite, "test_process_send", test_process_send);
+    CU_add_test(socketSuite, "test_process_send_batch",
+        test_process_send_batch);
     CU_add_test(socketSuite, "test_process_send_no_subscriber", test_process_send_no_subscriber);
     CU_add_test(socketSuite, "test_process_subscribe",
         test_process_subscribe);
@@ -512,8 +984,20 @@ void broker_test_suite() {
     CU_add_test(socketSuite,
         "test_main_loop_strdup_subscriber_name",
         test_main_loop_strdup_subscriber_name);
+    CU_add_test(socketSuite, "test_main_loop_coalesce_receipts",
+        test_main_loop_coalesce_receipts);
+    CU_add_test(socketSuite, "test_main_loop_receipt_queue_full",
+        test_main_loop_receipt_queue_full);
+    CU_add_test(socketSuite, "test_main_loop_binary_framing",
+        test_main_loop_binary_framing);
+    CU_add_test(socketSuite, "test_main_loop_accept_encoding",
+        test_main_loop_accept_encoding);
+    CU_add_test(socketSuite, "test_main_loop_heartbeat",
+        test_main_loop_heartbeat);
     CU_add_test(socketSuite, "test_init_destory_context",
         test_init_destory_context);
     CU_add_test(socketSuite, "test_deliver_after_disconnect",
         test_deliver_after_disconnect);
+    CU_add_test(socketSuite, "test_release_client",
+        test_release_client);
 }
@@ -0,0 +1,71 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <CUnit/CUnit.h>
+#include <CUnit/Basic.h>
+
+#include "../src/compress.h"
+
+void test_compress_round_trip() {
+    char src[4096], *dst, *back;
+    size_t dstlen, backlen, i;
+
+    // market data repeats itself
+    for (i = 0; i < sizeof(src); i++)
+        src[i] = "price:22.3;volume:100\n"[i % 22];
+
+    CU_ASSERT_EQUAL_FATAL(0,
+        compress_deflate(src, sizeof(src), &dst, &dstlen));
+    CU_ASSERT_FATAL(dstlen < sizeof(src) / 10);
+
+    CU_ASSERT_EQUAL_FATAL(0, compress_inflate(dst, dstlen, &back, &backlen));
+    CU_ASSERT_EQUAL_FATAL(sizeof(src), backlen);
+    CU_ASSERT_EQUAL_FATAL(0, memcmp(src, back, backlen));
+    CU_ASSERT_EQUAL_FATAL('\0', back[backlen]);
+    free(back);
+
+    // cut off
+    CU_ASSERT_EQUAL_FATAL(-1,
+        compress_inflate(dst, dstlen - 1, &back, &backlen));
+
+    // trailing garbage
+    dst = realloc(dst, dstlen + 1);
+    dst[dstlen] = 'x';
+    CU_ASSERT_EQUAL_FATAL(-1,
+        compress_inflate(dst, dstlen + 1, &back, &backlen));
+    free(dst);
+}
+
+void test_compress_not_worth_it() {
+    char src[1024], *dst = NULL;
+    size_t dstlen = 0, i;
+    unsigned int r = 42;
+
+    // too short
+    memset(src, 'a', sizeof(src));
+    CU_ASSERT_EQUAL_FATAL(-1,
+        compress_deflate(src, COMPRESS_MIN - 1, &dst, &dstlen));
+    CU_ASSERT_PTR_NULL_FATAL(dst);
+
+    // random bytes don't get smaller
+    for (i = 0; i < sizeof(src); i++) {
+        r = r * 1103515245 + 12345;
+        src[i] = r >> 16;
+    }
+    CU_ASSERT_EQUAL_FATAL(-1,
+        compress_deflate(src, sizeof(src), &dst, &dstlen));
+    CU_ASSERT_PTR_NULL_FATAL(dst);
+
+    // not compressed at all
+    CU_ASSERT_EQUAL_FATAL(-1,
+        compress_inflate(src, sizeof(src), &dst, &dstlen));
+}
+
+void compress_test_suite() {
+    CU_pSuite compressSuite = CU_add_suite("compress", NULL, NULL);
+    CU_add_test(compressSuite, "test_compress_round_trip",
+        test_compress_round_trip);
+    CU_add_test(compressSuite, "test_compress_not_worth_it",
+        test_compress_not_worth_it);
+}
@@ -10,43 +10,49 @@
 #include <CUnit/Basic.h>
 
 #include "../src/distributor.h"
+#include "../src/compress.h"
 
 #define HOUR (60*60)
 #define DAY (60*60*24)
 
-static struct list messages;
+static struct topic topic;
 static struct message msg1;
 static struct message msg2;
-static struct msg_statistics stat1;
-static struct msg_statistics stat2;
-static struct msg_statistics stat3;
+static struct subscription subs1;
+static struct subscription subs2;
 static struct subscriber sub1;
 static struct subscriber sub2;
-static struct subscriber sub3;
 static struct client client1;
 static struct client client2;
-static struct client client3;
 static int fds1[2];
 static int fds2[2];
 
 static int before_test() {
-    list_init(&messages);
+    topic_init(&topic);
 
     message_init(&msg1);
     message_init(&msg2);
-    msg1.topicname = strdup("stocks");
-    msg2.topicname = strdup("stocks");
+    msg1.topicname = "stocks";
+    msg2.topicname = "stocks";
     msg1.content = strdup("price:23.3");
     msg2.content = strdup("price:22.2");
-    list_add(&messages, &msg1);
-    list_add(&messages, &msg2); 
-
-    msg_statistics_init(&stat1);
-    msg_statistics_init(&stat2);
-    msg_statistics_init(&stat3);
-    list_add(msg1.stats, &stat1);
-    list_add(msg2.stats, &stat2);
-    list_add(msg2.stats, &stat3);
+    msg1.contentlen = 10;
+    msg2.contentlen = 10;
+    msg1.offset = 0;
+    msg2.offset = 1;
+    list_add(topic.messages, &msg1);
+    list_add(topic.messages, &msg2); 
+    topic.nextoffset = 2;
+
+    // sub1 is to receive both messages, sub2 only msg2
+    subscription_init(&subs1);
+    subscription_init(&subs2);
+    subs1.subscriber = &sub1;
+    subs1.cursor = 0;
+    subs2.subscriber = &sub2;
+    subs2.cursor = 1;
+    list_add(topic.subscribers, &subs1);
+    list_add(topic.subscribers, &subs2);
 
     client_init(&client1);
     client_init(&client2);
@@ -58,10 +64,6 @@ static int before_test() {
     client2.dead = 0;
     sub1.client = &client1;
     sub2.client = &client2;
-    sub3.client = &client3;
-    stat1.subscriber = &sub1;
-    stat2.subscriber = &sub1;
-    stat3.subscriber = &sub2;
     return 0;
 }
 
@@ -72,19 +74,17 @@ static int after_test() {
     close(fds1[1]);
     close(fds2[0]);
     close(fds2[1]);
-    list_remove(msg1.stats, &stat1);
-    list_remove(msg2.stats, &stat2);
-    list_remove(msg2.stats, &stat3);
-    msg_statistics_destroy(&stat1);
-    msg_statistics_destroy(&stat2);
-    msg_statistics_destroy(&stat3);
-
-    list_remove(&messages, &msg1);
-    list_remove(&messages, &msg2);
+    list_remove(topic.subscribers, &subs1);
+    list_remove(topic.subscribers, &subs2);
+    subscription_destroy(&subs1);
+    subscription_destroy(&subs2);
+
+    list_remove(topic.messages, &msg1);
+    list_remove(topic.messages, &msg2);
     message_destroy(&msg1);
     message_destroy(&msg2);
 
-    list_destroy(&messages);
+    topic_destroy(&topic);
     return 0;
 }
 
@@ -97,155 +97,278 @@ static long now() {
 void test_deliver_messages() {
     before_test();
     int ret;
-    // never tried before
-    stat1.nattempts = 0;
-    stat1.last_fail = 0;
-
-    // long ago
-    stat2.nattempts = 1;
-    stat2.last_fail = now() - HOUR;
 
-    // very long ago
-    stat3.nattempts = 3;
-    stat3.last_fail = now() - DAY;
-
-    ret = deliver_messages(&messages);
+    ret = deliver_messages(&topic);
     CU_ASSERT_EQUAL_FATAL(3, ret);
-    CU_ASSERT_EQUAL_FATAL(1, stat1.nattempts);
-    CU_ASSERT_EQUAL_FATAL(2, stat2.nattempts);
-    CU_ASSERT_EQUAL_FATAL(4, stat3.nattempts);
-    CU_ASSERT_EQUAL_FATAL(0, stat1.last_fail);
-    CU_ASSERT_EQUAL_FATAL(0, stat2.last_fail);
-    CU_ASSERT_EQUAL_FATAL(0, stat3.last_fail);
+    CU_ASSERT_EQUAL_FATAL(2, subs1.cursor);
+    CU_ASSERT_EQUAL_FATAL(2, subs2.cursor);
+    CU_ASSERT_EQUAL_FATAL(0, subs1.retrying);
+    CU_ASSERT_EQUAL_FATAL(0, subs2.retrying);
 
     size_t nbytes;
-    char msgbuf[64];
-    nbytes = read(fds1[1], msgbuf, 41);
+    char msgbuf[128];
+    nbytes = read(fds1[1], msgbuf, 70);
     assert(nbytes > 0);
     CU_ASSERT_STRING_EQUAL_FATAL(
-        "MESSAGE\ndestination:stocks\n\nprice:23.3\n\n", msgbuf);
-    assert(0 < read(fds1[1], msgbuf, 41));
+        "MESSAGE\ndestination:stocks\nmessage-id:0\ncontent-length:10\n\nprice:23.3", msgbuf);
+    assert(0 < read(fds1[1], msgbuf, 70));
     CU_ASSERT_STRING_EQUAL_FATAL(
-        "MESSAGE\ndestination:stocks\n\nprice:22.2\n\n", msgbuf);
-    assert(0 < read(fds2[1], msgbuf, 41));
+        "MESSAGE\ndestination:stocks\nmessage-id:0\ncontent-length:10\n\nprice:22.2", msgbuf);
+    assert(0 < read(fds2[1], msgbuf, 70));
     CU_ASSERT_STRING_EQUAL_FATAL(
-        "MESSAGE\ndestination:stocks\n\nprice:22.2\n\n", msgbuf);
+        "MESSAGE\ndestination:stocks\nmessage-id:0\ncontent-length:10\n\nprice:22.2", msgbuf);
+
+    // nothing new
+    ret = deliver_messages(&topic);
+    CU_ASSERT_EQUAL_FATAL(0, ret);
     after_test();
 }
 
 void test_deliver_messages_not_eligible() {
     before_test();
     int ret;
-    // too many attempts: dont deliver
-    stat1.nattempts = 999;
-    long stat1_fail = now() - HOUR;
-    stat1.last_fail = stat1_fail;
+    // both have failed before and the cursors are past them
+    subs1.cursor = 2;
+    subs2.cursor = 2;
 
     // just tried: dont deliver
-    stat2.nattempts = 1;
-    long stat2_fail = now();
-    stat2.last_fail = stat2_fail;
+    long fail = now();
+    subscription_set_retry(&subs1, 1, fail);
 
     // very long ago: deliver
-    stat3.nattempts = 3;
-    stat3.last_fail = now() - DAY;
+    subscription_set_retry(&subs2, 1, now() - DAY);
+    subs2.retry.nattempts = 3;
 
-    ret = deliver_messages(&messages);
+    ret = deliver_messages(&topic);
     CU_ASSERT_EQUAL_FATAL(1, ret);
-    CU_ASSERT_EQUAL_FATAL(999, stat1.nattempts);
-    CU_ASSERT_EQUAL_FATAL(1, stat2.nattempts);
-    CU_ASSERT_EQUAL_FATAL(4, stat3.nattempts);
-    CU_ASSERT_EQUAL_FATAL(stat1_fail, stat1.last_fail); // not changed
-    CU_ASSERT_EQUAL_FATAL(stat2_fail, stat2.last_fail); // not changed
-    CU_ASSERT_EQUAL_FATAL(0, stat3.last_fail);
-
-    char msgbuf[64];
-    assert(0 < read(fds2[1], msgbuf, 46));
+    CU_ASSERT_EQUAL_FATAL(1, subs1.retrying);
+    CU_ASSERT_EQUAL_FATAL(1, subs1.retry.nattempts);
+    CU_ASSERT_EQUAL_FATAL(fail, subs1.retry.last_fail); // not changed
+    CU_ASSERT_EQUAL_FATAL(0, subs2.retrying); // delivered
+    CU_ASSERT_EQUAL_FATAL(2, subs1.cursor);
+    CU_ASSERT_EQUAL_FATAL(2, subs2.cursor);
+
+    char msgbuf[128];
+    assert(0 < read(fds2[1], msgbuf, 70));
     CU_ASSERT_STRING_EQUAL_FATAL(
-        "MESSAGE\ndestination:stocks\n\nprice:22.2\n\n", msgbuf);
+        "MESSAGE\ndestination:stocks\nmessage-id:0\ncontent-length:10\n\nprice:22.2", msgbuf);
     after_test();
 }
 
 void test_is_eligible() {
-    before_test();
-    // already successfully sent
-    stat1.nattempts = 1;
-    stat1.last_fail = 0;
-    CU_ASSERT_EQUAL_FATAL(0, is_eligible(&stat1));
+    struct retry retry;
 
     // just tried: dont deliver
-    stat2.nattempts = 1;
-    long stat2_fail = now();
-    stat2.last_fail = stat2_fail;
-    CU_ASSERT_EQUAL_FATAL(0, is_eligible(&stat2));
+    retry.nattempts = 1;
+    retry.last_fail = now();
+    CU_ASSERT_EQUAL_FATAL(0, is_eligible(&retry));
 
     // very long ago: deliver
-    stat3.nattempts = 3;
-    stat3.last_fail = now() - DAY;
-    CU_ASSERT_EQUAL_FATAL(1, is_eligible(&stat3));
+    retry.nattempts = 3;
+    retry.last_fail = now() - DAY;
+    CU_ASSERT_EQUAL_FATAL(1, is_eligible(&retry));
+
+    // too many attempts
+    retry.nattempts = MAX_ATTEMPTS;
+    CU_ASSERT_EQUAL_FATAL(0, is_eligible(&retry));
+}
 
+static void queue_only(struct client *client, int pending) { }
+
+void test_deliver_messages_shared_frame() {
+    before_test();
+    int ret;
+    // only msg2 is delivered, to two subscribers
+    subs1.cursor = 1;
+
+    // queue instead of writing right away
+    client1.wnotify = queue_only;
+    client2.wnotify = queue_only;
+
+    ret = deliver_messages(&topic);
+    CU_ASSERT_EQUAL_FATAL(2, ret);
+    CU_ASSERT_PTR_NULL_FATAL(msg1.frames[0]);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(msg2.frames[0]);
+
+    // encoded once, referenced by the message and both queues
+    CU_ASSERT_EQUAL_FATAL(3, msg2.frames[0]->refs);
+    CU_ASSERT_PTR_EQUAL_FATAL(msg2.frames[0], client1.wqhead->frame);
+    CU_ASSERT_PTR_EQUAL_FATAL(msg2.frames[0], client2.wqhead->frame);
+
+    CU_ASSERT_EQUAL_FATAL(0, socket_flush(&client1));
+    CU_ASSERT_EQUAL_FATAL(0, socket_flush(&client2));
+    CU_ASSERT_EQUAL_FATAL(1, msg2.frames[0]->refs);
+
+    char msgbuf[128];
+    assert(0 < read(fds1[1], msgbuf, 70));
+    CU_ASSERT_STRING_EQUAL_FATAL(
+        "MESSAGE\ndestination:stocks\nmessage-id:0\ncontent-length:10\n\nprice:22.2", msgbuf);
+    assert(0 < read(fds2[1], msgbuf, 70));
+    CU_ASSERT_STRING_EQUAL_FATAL(
+        "MESSAGE\ndestination:stocks\nmessage-id:0\ncontent-length:10\n\nprice:22.2", msgbuf);
+    after_test();
+}
+
+void test_deliver_messages_deflate() {
+    before_test();
+    int ret;
+    char msgbuf[256], *content, *header, *plain;
+    size_t len, plainlen;
+
+    // only msg2 is delivered, to two subscribers of
+    // which one accepts compressed content
+    subs1.cursor = 1;
+    client1.wnotify = queue_only;
+    client2.wnotify = queue_only;
+    client2.deflate = 1;
+
+    // too short to be worth it, both get the same
+    ret = deliver_messages(&topic);
+    CU_ASSERT_EQUAL_FATAL(2, ret);
+    CU_ASSERT_EQUAL_FATAL(-1, msg2.deflated);
+    CU_ASSERT_PTR_EQUAL_FATAL(msg2.frames[0],
+        msg2.frames[MESSAGE_DEFLATE]);
+    CU_ASSERT_PTR_EQUAL_FATAL(client1.wqhead->frame,
+        client2.wqhead->frame);
+    CU_ASSERT_EQUAL_FATAL(0, socket_flush(&client1));
+    CU_ASSERT_EQUAL_FATAL(0, socket_flush(&client2));
+    assert(0 < read(fds1[1], msgbuf, sizeof(msgbuf)));
+    assert(0 < read(fds2[1], msgbuf, sizeof(msgbuf)));
+
+    // compressed once, for the one that accepts it
+    free(msg2.content);
+    msg2.content = malloc(1001);
+    memset(msg2.content, 'a', 1000);
+    msg2.content[1000] = '\0';
+    msg2.contentlen = 1000;
+    msg2.deflated = 0;
+    frame_unref(msg2.frames[0]);
+    frame_unref(msg2.frames[MESSAGE_DEFLATE]);
+    msg2.frames[0] = msg2.frames[MESSAGE_DEFLATE] = NULL;
+    subs1.cursor = subs2.cursor = 1;
+
+    ret = deliver_messages(&topic);
+    CU_ASSERT_EQUAL_FATAL(2, ret);
+    CU_ASSERT_EQUAL_FATAL(1, msg2.deflated);
+    CU_ASSERT_PTR_EQUAL_FATAL(msg2.frames[0], client1.wqhead->frame);
+    CU_ASSERT_PTR_EQUAL_FATAL(msg2.frames[MESSAGE_DEFLATE],
+        client2.wqhead->frame);
+    CU_ASSERT_FATAL(msg2.frames[MESSAGE_DEFLATE]->len < 200);
+    CU_ASSERT_EQUAL_FATAL(0, socket_flush(&client2));
+
+    len = read(fds2[1], msgbuf, sizeof(msgbuf));
+    assert(len > 0);
+    header = "MESSAGE\ndestination:stocks\nmessage-id:0\n"
+        "content-encoding:deflate\n";
+    CU_ASSERT_EQUAL_FATAL(0, strncmp(header, msgbuf, strlen(header)));
+
+    // the subscriber gets back what has been sent
+    content = strstr(msgbuf, "\n\n") + 2;
+    CU_ASSERT_EQUAL_FATAL(0, compress_inflate(content,
+        msgbuf + len - 1 - content, &plain, &plainlen));
+    CU_ASSERT_EQUAL_FATAL(1000, plainlen);
+    CU_ASSERT_STRING_EQUAL_FATAL(msg2.content, plain);
+    free(plain);
     after_test();
 }
 
 void test_deliver_message_already_delivered() {
     before_test();
-    // already successfully sent
-    stat1.nattempts = 1;
-    stat1.last_fail = 0;
+    // sub1 has received both already
+    subs1.cursor = 2;
 
-    // just tried: dont deliver
-    stat2.nattempts = 1;
-    long stat2_fail = now();
-    stat2.last_fail = stat2_fail;
+    CU_ASSERT_EQUAL_FATAL(1, deliver_messages(&topic));
+    CU_ASSERT_EQUAL_FATAL(2, subs1.cursor);
+    CU_ASSERT_EQUAL_FATAL(2, subs2.cursor);
 
-    // very long ago: deliver
-    stat3.nattempts = 3;
-    stat3.last_fail = now() - DAY;
-
-    deliver_messages(&messages);
-    CU_ASSERT_EQUAL_FATAL(1, stat1.nattempts);
-    CU_ASSERT_EQUAL_FATAL(1, stat2.nattempts);
-    CU_ASSERT_EQUAL_FATAL(4, stat3.nattempts);
-    CU_ASSERT_EQUAL_FATAL(0, stat1.last_fail); // not changed
-    CU_ASSERT_EQUAL_FATAL(stat2_fail, stat2.last_fail); // not changed
-    CU_ASSERT_EQUAL_FATAL(0, stat3.last_fail);
-
-    char msgbuf[64];
-    assert(0 < read(fds2[1], msgbuf, 46));
+    char msgbuf[128];
+    assert(0 < read(fds2[1], msgbuf, 70));
     CU_ASSERT_STRING_EQUAL_FATAL(
-        "MESSAGE\ndestination:stocks\n\nprice:22.2\n\n", msgbuf);
+        "MESSAGE\ndestination:stocks\nmessage-id:0\ncontent-length:10\n\nprice:22.2", msgbuf);
     after_test();
 }
 
-void test_handle_closed_socket_and_dead_client() {
+void test_deliver_messages_queue_full() {
     before_test();
-    // never tried before
-    stat1.nattempts = 0;
-    stat1.last_fail = 0;
+    int ret;
+    client1.wnotify = queue_only;
+    client2.wnotify = queue_only;
+
+    // sub1 does not keep up
+    client1.wqlen = SOCKET_WQUEUE_MAX;
 
-    // long ago
-    stat2.nattempts = 1;
-    stat2.last_fail = now() - HOUR;
+    // msg1 is to be retried, msg2 waits for the next pass
+    ret = deliver_messages(&topic);
+    CU_ASSERT_EQUAL_FATAL(1, ret);
+    CU_ASSERT_EQUAL_FATAL(1, subs1.cursor);
+    CU_ASSERT_EQUAL_FATAL(1, subs1.retrying);
+    CU_ASSERT_EQUAL_FATAL(0, subs1.retry.offset);
+    CU_ASSERT_EQUAL_FATAL(1, subs1.retry.nattempts);
+    CU_ASSERT_NOT_EQUAL_FATAL(0, subs1.retry.last_fail);
+    CU_ASSERT_EQUAL_FATAL(2, subs2.cursor);
+    CU_ASSERT_EQUAL_FATAL(0, subs2.retrying);
+
+    // not again right away, and msg2 does not overtake it
+    client1.wqlen = 0;
+    ret = deliver_messages(&topic);
+    CU_ASSERT_EQUAL_FATAL(0, ret);
+    CU_ASSERT_EQUAL_FATAL(1, subs1.cursor);
+    CU_ASSERT_EQUAL_FATAL(1, subs1.retrying);
+    CU_ASSERT_PTR_NULL_FATAL(client1.wqhead);
+
+    // but once it has been long enough, both go
+    subs1.retry.last_fail = now() - HOUR;
+    ret = deliver_messages(&topic);
+    CU_ASSERT_EQUAL_FATAL(2, ret);
+    CU_ASSERT_EQUAL_FATAL(0, subs1.retrying);
+    CU_ASSERT_EQUAL_FATAL(2, subs1.cursor);
+
+    // msg1 first, then msg2 in order
+    CU_ASSERT_PTR_EQUAL_FATAL(msg1.frames[0], client1.wqhead->frame);
+    CU_ASSERT_PTR_EQUAL_FATAL(msg2.frames[0],
+        client1.wqhead->next->frame);
+    CU_ASSERT_EQUAL_FATAL(0, socket_flush(&client1));
+    CU_ASSERT_EQUAL_FATAL(0, socket_flush(&client2));
+    after_test();
+}
 
-    // very long ago
-    stat3.nattempts = 3;
-    stat3.last_fail = now() - DAY;
+void test_deliver_messages_give_up() {
+    before_test();
+    subs1.cursor = 2;
+    subs2.cursor = 2;
+    client1.wnotify = queue_only;
+    client1.wqlen = SOCKET_WQUEUE_MAX;
+
+    // the last attempt fails as well
+    subscription_set_retry(&subs1, 1, now() - HOUR);
+    subs1.retry.nattempts = MAX_ATTEMPTS - 1;
+
+    CU_ASSERT_EQUAL_FATAL(0, deliver_messages(&topic));
+    CU_ASSERT_EQUAL_FATAL(0, subs1.retrying);
+    client1.wqlen = 0;
+    after_test();
+}
+
+void test_handle_closed_socket_and_dead_client() {
+    before_test();
 
     // client1 is dead, client2 has closed socket
     client1.dead = 1;
     assert(close(fds2[0]) == 0);
 
-    deliver_messages(&messages);
+    deliver_messages(&topic);
 
     CU_ASSERT(client2.dead);
     after_test();
 }
 
-void test_dead_client_not_eligible() {
+void test_dead_client_not_delivered() {
     before_test();
     
     client1.dead = 1;
-    CU_ASSERT_EQUAL_FATAL(0, is_eligible(&stat1));
+    CU_ASSERT_EQUAL_FATAL(1, deliver_messages(&topic));
+    CU_ASSERT_EQUAL_FATAL(0, subs1.cursor);
+    CU_ASSERT_EQUAL_FATAL(2, subs2.cursor);
     
     after_test();   
 }
@@ -257,12 +380,20 @@ void distributor_test_suite() {
         test_deliver_messages);
     CU_add_test(distrSuite, "test_deliver_messages_not_eligible",
         test_deliver_messages_not_eligible);
+    CU_add_test(distrSuite, "test_deliver_messages_shared_frame",
+        test_deliver_messages_shared_frame);
+    CU_add_test(distrSuite, "test_deliver_messages_deflate",
+        test_deliver_messages_deflate);
+    CU_add_test(distrSuite, "test_deliver_messages_queue_full",
+        test_deliver_messages_queue_full);
+    CU_add_test(distrSuite, "test_deliver_messages_give_up",
+        test_deliver_messages_give_up);
     CU_add_test(distrSuite, "test_handle_closed_socket_and_dead_client",
         test_handle_closed_socket_and_dead_client);
     CU_add_test(distrSuite, "test_deliver_message_already_delivered",
         test_deliver_message_already_delivered);
-    CU_add_test(distrSuite, "test_dead_client_not_eligible",
-        test_dead_client_not_eligible);
+    CU_add_test(distrSuite, "test_dead_client_not_delivered",
+        test_dead_client_not_delivered);
     CU_add_test(distrSuite, "test_is_eligible",
         test_is_eligible);
 }
@@ -0,0 +1,84 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include <CUnit/CUnit.h>
+#include <CUnit/Basic.h>
+
+#include "../src/frame.h"
+
+void test_frame_create() {
+    int ret;
+    struct frame *frame;
+    struct stomp_header header;
+    struct stomp_command cmd;
+
+    header.key = "destination";
+    header.val = "stocks";
+    cmd.name = "MESSAGE";
+    cmd.headers = &header;
+    cmd.nheaders = 1;
+    cmd.content = "price:22.2";
+    cmd.contentlen = 10;
+
+    ret = frame_create(&cmd, &frame);
+    CU_ASSERT_EQUAL_FATAL(0, ret);
+    CU_ASSERT_STRING_EQUAL_FATAL(
+        "MESSAGE\ndestination:stocks\ncontent-length:10\n\nprice:22.2", frame->data);
+
+    // includes the null byte
+    CU_ASSERT_EQUAL_FATAL(strlen(frame->data) + 1, frame->len);
+    CU_ASSERT_EQUAL_FATAL(1, frame->refs);
+
+    frame_unref(frame);
+}
+
+void test_frame_create_invalid() {
+    int ret;
+    struct frame *frame = NULL;
+    struct stomp_command cmd;
+
+    cmd.name = "FOO";
+    cmd.headers = NULL;
+    cmd.nheaders = 0;
+    cmd.content = NULL;
+
+    ret = frame_create(&cmd, &frame);
+    CU_ASSERT_EQUAL_FATAL(STOMP_UNKNOWN_COMMAND, ret);
+    CU_ASSERT_PTR_NULL_FATAL(frame);
+}
+
+void test_frame_ref_unref() {
+    int ret;
+    struct frame *frame;
+    struct stomp_command cmd;
+
+    cmd.name = "CONNECTED";
+    cmd.headers = NULL;
+    cmd.nheaders = 0;
+    cmd.content = NULL;
+
+    ret = frame_create(&cmd, &frame);
+    CU_ASSERT_EQUAL_FATAL(0, ret);
+
+    frame_ref(frame);
+    frame_ref(frame);
+    CU_ASSERT_EQUAL_FATAL(3, frame->refs);
+
+    frame_unref(frame);
+    frame_unref(frame);
+    CU_ASSERT_EQUAL_FATAL(1, frame->refs);
+    CU_ASSERT_STRING_EQUAL_FATAL("CONNECTED\n\n", frame->data);
+
+    // frees the frame
+    frame_unref(frame);
+}
+
+void frame_test_suite() {
+    CU_pSuite frameSuite = CU_add_suite("frame", NULL, NULL);
+    CU_add_test(frameSuite, "test_frame_create", test_frame_create);
+    CU_add_test(frameSuite, "test_frame_create_invalid",
+        test_frame_create_invalid);
+    CU_add_test(frameSuite, "test_frame_ref_unref", test_frame_ref_unref);
+}
@@ -157,6 +157,86 @@ void test_list_clean() {
 
     list_destroy(&list);
 }
+/* entry that embeds its node */
+struct item {
+    int val;
+    struct node node;
+};
+
+void test_list_intrusive() {
+    int i;
+    struct item items[4];
+    struct list list;
+    struct list other;
+    struct node *cur;
+
+    list_init_intrusive(&list, offsetof(struct item, node));
+    list_init_intrusive(&other, offsetof(struct item, node));
+    for (i = 0; i < 4; i++) {
+        items[i].val = i;
+        list_node_init(&items[i].node);
+        list_add(&list, &items[i]);
+    }
+    CU_ASSERT_EQUAL_FATAL(4, list_len(&list));
+    CU_ASSERT_EQUAL_FATAL(&items[3], list.tail->entry);
+
+    // entries are in the order they have been added
+    for (i = 0, cur = list.root; cur != NULL; i++, cur = cur->next)
+        CU_ASSERT_EQUAL_FATAL(i, ((struct item *) cur->entry)->val);
+
+    // middle, first and last
+    CU_ASSERT_EQUAL_FATAL(0, list_remove(&list, &items[1]));
+    CU_ASSERT_EQUAL_FATAL(0, list_remove(&list, &items[0]));
+    CU_ASSERT_EQUAL_FATAL(0, list_remove(&list, &items[3]));
+    CU_ASSERT_EQUAL_FATAL(1, list_len(&list));
+    CU_ASSERT_EQUAL_FATAL(&items[2], list.root->entry);
+    CU_ASSERT_EQUAL_FATAL(&items[2], list.tail->entry);
+    CU_ASSERT_EQUAL_FATAL(0, list_contains(&list, &items[1]));
+    CU_ASSERT_EQUAL_FATAL(1, list_contains(&list, &items[2]));
+
+    // an entry that is in another list is not found
+    list_add(&other, &items[1]);
+    CU_ASSERT_EQUAL_FATAL(LIST_NOT_FOUND, list_remove(&list, &items[1]));
+    CU_ASSERT_EQUAL_FATAL(0, list_contains(&list, &items[1]));
+    CU_ASSERT_EQUAL_FATAL(1, list_contains(&other, &items[1]));
+
+    // removed entries can be added again
+    list_add(&list, &items[0]);
+    CU_ASSERT_EQUAL_FATAL(&items[0], list.tail->entry);
+    CU_ASSERT_EQUAL_FATAL(2, list_len(&list));
+
+    list_clean(&list);
+    CU_ASSERT_EQUAL_FATAL(0, list_len(&list));
+    CU_ASSERT_PTR_NULL_FATAL(list.tail);
+    CU_ASSERT_EQUAL_FATAL(0, list_contains(&list, &items[0]));
+    list_clean(&other);
+    list_destroy(&list);
+    list_destroy(&other);
+}
+
+void test_list_tail() {
+    char a, b, c;
+    struct list list;
+
+    list_init(&list);
+    list_add(&list, &a);
+    list_add(&list, &b);
+    CU_ASSERT_EQUAL_FATAL(&b, list.tail->entry);
+
+    // the tail moves back when it is removed
+    list_remove(&list, &b);
+    CU_ASSERT_EQUAL_FATAL(&a, list.tail->entry);
+    list_add(&list, &c);
+    CU_ASSERT_EQUAL_FATAL(&c, list.tail->entry);
+    CU_ASSERT_EQUAL_FATAL(&c, list.root->next->entry);
+
+    list_remove(&list, &a);
+    list_remove(&list, &c);
+    CU_ASSERT_PTR_NULL_FATAL(list.root);
+    CU_ASSERT_PTR_NULL_FATAL(list.tail);
+    list_destroy(&list);
+}
+
 void topic_add_list_suite() {
     CU_pSuite listSuite = CU_add_suite("list", NULL, NULL);
     CU_add_test(listSuite, "test_add_remove_list",
@@ -165,4 +245,10 @@ void topic_add_list_suite() {
         test_list_empty);
     CU_add_test(listSuite, "test_list_clean",
         test_list_clean);
+    CU_add_test(listSuite, "test_list_len",
+        test_list_len);
+    CU_add_test(listSuite, "test_list_tail",
+        test_list_tail);
+    CU_add_test(listSuite, "test_list_intrusive",
+        test_list_intrusive);
 }
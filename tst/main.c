@@ -8,12 +8,20 @@
 
 #include "util.c"
 #include "stomp-test.c"
+#include "scan-test.c"
+#include "binary-test.c"
+#include "compress-test.c"
+#include "frame-test.c"
 #include "topic-test.c"
 #include "socket-test.c"
 #include "broker-test.c"
 #include "distributor-test.c"
 #include "gc-test.c"
 #include "list-test.c"
+#include "uring-test.c"
+#include "shm-test.c"
+#include "timer-test.c"
+#include "reactor-test.c"
 
 int main(int argc, char **argv) {
     install_segfault_handler();
@@ -22,12 +30,20 @@ int main(int argc, char **argv) {
 
     add_stomp_parse_suite();
     add_stomp_create_suite();
+    scan_test_suite();
+    binary_test_suite();
+    compress_test_suite();
+    frame_test_suite();
     topic_add_topic_suite();
     topic_add_list_suite();
     socket_test_suite();
     broker_test_suite();
     distributor_test_suite();
     gc_test_suite();
+    uring_test_suite();
+    shm_test_suite();
+    timer_test_suite();
+    reactor_test_suite();
 
     CU_basic_run_tests();
     CU_cleanup_registry();
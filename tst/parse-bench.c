@@ -0,0 +1,156 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "../src/stomp.h"
+#include "../src/scan.h"
+
+/* compares the implementations of the scanner that finds
+ * the delimiters of a frame (see scan.h) by parsing SEND
+ * frames of 64 bytes, 1KB and 64KB. the frames consist of
+ * application headers for the most part and have a
+ * content-length, which is where the scanner does the work.
+ *
+ * the parser terminates the parts of the frame in place,
+ * so each round parses a fresh copy. the time it takes to
+ * copy it is measured on its own and taken off.
+ */
+
+#define DEFAULT_BYTES (64 * 1024 * 1024)
+
+static const char *impl_names[] = { "scalar", "sse2", "avx2" };
+
+static double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* builds a frame of about size bytes, including the null
+ * byte. returns its length */
+static size_t build_frame(char *frame, size_t size) {
+    size_t len, hdrlen, content, i, n;
+    int nheaders;
+
+    // a quarter is content, at least a byte
+    content = size / 4 > 0 ? size / 4 : 1;
+    len = sprintf(frame, "SEND\ntopic:bench\ncontent-length:%zu\n",
+        content);
+
+    // the rest is spread over the headers, as
+    // many as allowed but not below 8 bytes each
+    hdrlen = size - len - content - 2;
+    nheaders = hdrlen / 16;
+    if (nheaders > STOMP_MAX_HEADERS - 2) nheaders = STOMP_MAX_HEADERS - 2;
+    if (nheaders < 1) nheaders = 1;
+
+    for (i = 0; i < nheaders; i++) {
+        n = hdrlen / nheaders;
+        len += sprintf(frame + len, "x-%02zu:", i);
+        n = n > 7 ? n - 7 : 1;
+        memset(frame + len, 'v', n);
+        len += n;
+        frame[len++] = '\n';
+    }
+
+    frame[len++] = '\n';
+    memset(frame + len, 'c', content);
+    len += content;
+    frame[len++] = '\0';
+
+    return len;
+}
+
+/* returns the nanoseconds per round to copy the frame
+ * and, if parse is set, to parse it */
+static double measure(const char *frame, char *work, size_t len,
+                      long rounds, int parse) {
+    long i;
+    double start;
+    struct stomp_command cmd;
+
+    start = now_ns();
+    for (i = 0; i < rounds; i++) {
+        memcpy(work, frame, len);
+        if (parse && parse_frame(work, len, &cmd) != 0) {
+            fprintf(stderr, "Failed to parse\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    return (now_ns() - start) / rounds;
+}
+
+static void run(size_t size, long total) {
+    int impl;
+    size_t len;
+    long rounds;
+    double copy, parse, base = 0;
+    char *frame = malloc(size + 64);
+    char *work = malloc(size + 64);
+
+    if (frame == NULL || work == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    len = build_frame(frame, size);
+
+    // the same number of bytes for every size
+    rounds = total / len;
+    if (rounds < 100) rounds = 100;
+
+    copy = measure(frame, work, len, rounds, 0);
+
+    for (impl = SCAN_SCALAR; impl <= SCAN_AVX2; impl++) {
+        if (scan_use(impl) != 0) continue;
+
+        // warm up
+        measure(frame, work, len, rounds / 10, 1);
+        parse = measure(frame, work, len, rounds, 1) - copy;
+        if (impl == SCAN_SCALAR) base = parse;
+
+        printf("%6zu bytes %-7s %10.1fns/frame %8.1fMB/s  x%.2f\n",
+            len, impl_names[impl], parse, len / parse * 1e3,
+            base / parse);
+    }
+
+    free(frame);
+    free(work);
+}
+
+static void usage(char *prog) {
+    fprintf(stderr, "usage: %s [-n bytes]\n", prog);
+    fprintf(stderr, "\tbytes: parsed per frame size and implementation "
+        "(default %d)\n", DEFAULT_BYTES);
+}
+
+int main(int argc, char **argv) {
+    int opt, impl = scan_impl();
+    long total = DEFAULT_BYTES;
+
+    while ((opt = getopt(argc, argv, "n:h")) != -1) {
+        switch (opt) {
+            case 'n':
+                total = atol(optarg);
+                break;
+            default:
+                usage(argv[0]);
+                exit(opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+    }
+
+    if (total < 1) {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    printf("chosen at runtime: %s\n", impl_names[impl]);
+    run(64, total);
+    run(1024, total);
+    run(64 * 1024, total);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,713 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <assert.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <CUnit/CUnit.h>
+#include <CUnit/Basic.h>
+
+#include "../src/reactor.h"
+
+void test_reactor_handle_client() {
+    int ret;
+    int fds[2];
+    struct broker_context ctx;
+    struct reactor reactor;
+    char resp[32];
+
+    assert(0 == socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    broker_context_init(&ctx);
+    ret = reactor_init(&reactor, &ctx, 1);
+    CU_ASSERT_EQUAL_FATAL(0, ret);
+
+    ret = reactor_add_client(&reactor, fds[0]);
+    CU_ASSERT_EQUAL_FATAL(0, ret);
+
+    // nothing to do yet
+    CU_ASSERT_EQUAL_FATAL(0, reactor_run_once(&reactor.threads[0], 0));
+
+    char cmd1[] = "CONNECT\nlogin:foo\n\n";
+    assert(0 < write(fds[1], cmd1, strlen(cmd1)+1));
+    CU_ASSERT_EQUAL_FATAL(1, reactor_run_once(&reactor.threads[0], 1000));
+    assert(0 < read(fds[1], resp, strlen("CONNECTED\n\n")+1));
+    CU_ASSERT_STRING_EQUAL_FATAL("CONNECTED\n\n", resp);
+
+    char cmd2[] = "DISCONNECT\n\n";
+    assert(0 < write(fds[1], cmd2, strlen(cmd2)+1));
+    CU_ASSERT_EQUAL_FATAL(1, reactor_run_once(&reactor.threads[0], 1000));
+    assert(0 < read(fds[1], resp, strlen("RECEIPT\n\n")+1));
+    CU_ASSERT_STRING_EQUAL_FATAL("RECEIPT\n\n", resp);
+
+    // connection has been closed by the reactor
+    CU_ASSERT_EQUAL_FATAL(0, read(fds[1], resp, sizeof(resp)));
+    CU_ASSERT_EQUAL_FATAL(0, reactor_run_once(&reactor.threads[0], 0));
+
+    close(fds[1]);
+    reactor_destroy(&reactor);
+}
+
+void test_reactor_pipelined() {
+    int ret;
+    int fds[2];
+    struct broker_context ctx;
+    struct reactor reactor;
+    char resp[32];
+    char cmds[] = "CONNECT\nlogin:foo\n\n\0"
+                  "SUBSCRIBE\ndestination:stocks\n\n\0"
+                  "DISCONNECT\n\n";
+
+    assert(0 == socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    broker_context_init(&ctx);
+    ret = reactor_init(&reactor, &ctx, 1);
+    CU_ASSERT_EQUAL_FATAL(0, ret);
+
+    ret = reactor_add_client(&reactor, fds[0]);
+    CU_ASSERT_EQUAL_FATAL(0, ret);
+
+    // all commands are handled with a single event
+    assert(sizeof(cmds) == write(fds[1], cmds, sizeof(cmds)));
+    CU_ASSERT_EQUAL_FATAL(1, reactor_run_once(&reactor.threads[0], 1000));
+
+    assert(0 < read(fds[1], resp, strlen("CONNECTED\n\n")+1));
+    CU_ASSERT_STRING_EQUAL_FATAL("CONNECTED\n\n", resp);
+    assert(0 < read(fds[1], resp, strlen("RECEIPT\n\n")+1));
+    CU_ASSERT_STRING_EQUAL_FATAL("RECEIPT\n\n", resp);
+    CU_ASSERT_EQUAL_FATAL(0, read(fds[1], resp, sizeof(resp)));
+
+    close(fds[1]);
+    reactor_destroy(&reactor);
+}
+
+void test_reactor_flush_when_writable() {
+    int ret;
+    int fds[2];
+    struct broker_context ctx;
+    struct reactor reactor;
+    struct topic *topic;
+    struct subscriber *sub;
+    struct stomp_command cmd;
+    struct stomp_header header;
+    char resp[64];
+    char cmds[] = "CONNECT\nlogin:foo\n\n\0"
+                  "SUBSCRIBE\ndestination:stocks\n\n";
+
+    assert(0 == socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    broker_context_init(&ctx);
+    ret = reactor_init(&reactor, &ctx, 1);
+    CU_ASSERT_EQUAL_FATAL(0, ret);
+
+    ret = reactor_add_client(&reactor, fds[0]);
+    CU_ASSERT_EQUAL_FATAL(0, ret);
+
+    assert(sizeof(cmds) == write(fds[1], cmds, sizeof(cmds)));
+    CU_ASSERT_EQUAL_FATAL(1, reactor_run_once(&reactor.threads[0], 1000));
+    assert(0 < read(fds[1], resp, strlen("CONNECTED\n\n")+1));
+    CU_ASSERT_STRING_EQUAL_FATAL("CONNECTED\n\n", resp);
+
+    // send from another thread (like the distributor)
+    topic = topic_find(ctx.topics, "stocks");
+    sub = ((struct subscription *) topic->subscribers->root->entry)
+        ->subscriber;
+    header.key = "destination";
+    header.val = "stocks";
+    cmd.name = "MESSAGE";
+    cmd.headers = &header;
+    cmd.nheaders = 1;
+    cmd.content = "price: 22.3";
+    cmd.contentlen = 11;
+    ret = socket_send_command(sub->client, &cmd);
+    CU_ASSERT_EQUAL_FATAL(0, ret);
+
+    // only queued, the i/o thread writes it
+    CU_ASSERT_FATAL(socket_queue_depth(sub->client) > 0);
+    CU_ASSERT_EQUAL_FATAL(1, reactor_run_once(&reactor.threads[0], 1000));
+    CU_ASSERT_EQUAL_FATAL(0, socket_queue_depth(sub->client));
+    assert(0 < read(fds[1], resp, sizeof(resp)));
+    CU_ASSERT_STRING_EQUAL_FATAL(
+        "MESSAGE\ndestination:stocks\ncontent-length:11\n\nprice: 22.3", resp);
+
+    // not interested in writing anymore
+    CU_ASSERT_EQUAL_FATAL(0, reactor_run_once(&reactor.threads[0], 0));
+
+    close(fds[1]);
+    CU_ASSERT_EQUAL_FATAL(1, reactor_run_once(&reactor.threads[0], 1000));
+
+    // the connection is gone, senders no longer get to it
+    CU_ASSERT_FATAL(sub->client->dead);
+    CU_ASSERT_PTR_NULL_FATAL(sub->client->owner);
+    CU_ASSERT_PTR_NULL_FATAL(sub->client->wnotify);
+    CU_ASSERT_EQUAL_FATAL(SOCKET_NECROMANCE,
+        socket_send_command(sub->client, &cmd));
+    reactor_destroy(&reactor);
+}
+
+void test_reactor_client_gone() {
+    int ret;
+    int fds[2];
+    struct broker_context ctx;
+    struct reactor reactor;
+    char resp[32];
+
+    assert(0 == socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    broker_context_init(&ctx);
+    ret = reactor_init(&reactor, &ctx, 1);
+    CU_ASSERT_EQUAL_FATAL(0, ret);
+
+    ret = reactor_add_client(&reactor, fds[0]);
+    CU_ASSERT_EQUAL_FATAL(0, ret);
+
+    // hang up without DISCONNECT
+    shutdown(fds[1], SHUT_WR);
+    CU_ASSERT_EQUAL_FATAL(1, reactor_run_once(&reactor.threads[0], 1000));
+
+    // connection has been closed by the reactor
+    CU_ASSERT_EQUAL_FATAL(0, read(fds[1], resp, sizeof(resp)));
+    CU_ASSERT_EQUAL_FATAL(0, reactor_run_once(&reactor.threads[0], 0));
+
+    close(fds[1]);
+    reactor_destroy(&reactor);
+}
+
+void test_reactor_round_robin() {
+    int ret;
+    int fds1[2];
+    int fds2[2];
+    struct broker_context ctx;
+    struct reactor reactor;
+
+    assert(0 == socketpair(AF_UNIX, SOCK_STREAM, 0, fds1));
+    assert(0 == socketpair(AF_UNIX, SOCK_STREAM, 0, fds2));
+    broker_context_init(&ctx);
+    ret = reactor_init(&reactor, &ctx, 2);
+    CU_ASSERT_EQUAL_FATAL(0, ret);
+
+    assert(0 == reactor_add_client(&reactor, fds1[0]));
+    assert(0 == reactor_add_client(&reactor, fds2[0]));
+
+    // each thread serves exactly one of the clients
+    shutdown(fds1[1], SHUT_WR);
+    shutdown(fds2[1], SHUT_WR);
+    CU_ASSERT_EQUAL_FATAL(1, reactor_run_once(&reactor.threads[0], 1000));
+    CU_ASSERT_EQUAL_FATAL(1, reactor_run_once(&reactor.threads[1], 1000));
+
+    close(fds1[1]);
+    close(fds2[1]);
+    reactor_destroy(&reactor);
+}
+
+void test_reactor_listen_shards() {
+    int i, ret, cli;
+    struct broker_context ctx;
+    struct reactor reactor;
+    struct sockaddr_in addr;
+    socklen_t addrlen = sizeof(addr);
+    char resp[32];
+    char cmd[] = "CONNECT\nlogin:foo\n\n";
+
+    broker_context_init(&ctx);
+    ret = reactor_init(&reactor, &ctx, 2);
+    CU_ASSERT_EQUAL_FATAL(0, ret);
+
+    // let the kernel pick the port
+    ret = reactor_listen(&reactor, 0, 16);
+    CU_ASSERT_EQUAL_FATAL(0, ret);
+
+    // each shard has its own socket on the same port
+    CU_ASSERT_FATAL(reactor.threads[0].listenfd != -1);
+    CU_ASSERT_FATAL(reactor.threads[1].listenfd != -1);
+    CU_ASSERT_FATAL(
+        reactor.threads[0].listenfd != reactor.threads[1].listenfd);
+    assert(0 == getsockname(reactor.threads[1].listenfd,
+        (struct sockaddr *) &addr, &addrlen));
+    CU_ASSERT_FATAL(addr.sin_port != 0);
+
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    cli = socket(PF_INET, SOCK_STREAM, 0);
+    assert(cli != -1);
+    assert(0 == connect(cli, (struct sockaddr *) &addr, sizeof(addr)));
+    assert(0 < write(cli, cmd, strlen(cmd)+1));
+
+    // whichever shard got the connection accepts and serves it
+    for (i = 0; i < 10; i++) {
+        reactor_run_once(&reactor.threads[0], 10);
+        reactor_run_once(&reactor.threads[1], 10);
+    }
+
+    assert(0 < read(cli, resp, strlen("CONNECTED\n\n")+1));
+    CU_ASSERT_STRING_EQUAL_FATAL("CONNECTED\n\n", resp);
+
+    close(cli);
+    reactor_run_once(&reactor.threads[0], 10);
+    reactor_run_once(&reactor.threads[1], 10);
+    reactor_destroy(&reactor);
+}
+
+/* gives the ring of the thread a few rounds to
+ * submit and complete whatever is going on */
+static void run_uring(struct reactor_thread *thread) {
+    int i;
+    for (i = 0; i < 5; i++) reactor_run_once(thread, 20);
+}
+
+void test_reactor_uring_handle_client() {
+    int ret;
+    int fds[2];
+    struct broker_context ctx;
+    struct reactor reactor;
+    char resp[32];
+
+    assert(0 == socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    broker_context_init(&ctx);
+    ret = reactor_init(&reactor, &ctx, 1);
+    CU_ASSERT_EQUAL_FATAL(0, ret);
+
+    ret = reactor_use_uring(&reactor);
+    if (ret == URING_UNSUPPORTED) {
+        close(fds[0]);
+        close(fds[1]);
+        reactor_destroy(&reactor);
+        return;
+    }
+    CU_ASSERT_EQUAL_FATAL(0, ret);
+    CU_ASSERT_EQUAL_FATAL(REACTOR_URING, reactor.backend);
+
+    ret = reactor_add_client(&reactor, fds[0]);
+    CU_ASSERT_EQUAL_FATAL(0, ret);
+
+    // commands arriving at once, answered in one write
+    char cmds[] = "CONNECT\nlogin:foo\n\n\0"
+                  "SUBSCRIBE\ndestination:stocks\n\n";
+    assert(sizeof(cmds) == write(fds[1], cmds, sizeof(cmds)));
+    run_uring(&reactor.threads[0]);
+    assert(0 < read(fds[1], resp, strlen("CONNECTED\n\n")+1));
+    CU_ASSERT_STRING_EQUAL_FATAL("CONNECTED\n\n", resp);
+
+    char cmd[] = "DISCONNECT\n\n";
+    assert(0 < write(fds[1], cmd, strlen(cmd)+1));
+    run_uring(&reactor.threads[0]);
+    assert(0 < read(fds[1], resp, strlen("RECEIPT\n\n")+1));
+    CU_ASSERT_STRING_EQUAL_FATAL("RECEIPT\n\n", resp);
+
+    // connection has been closed by the reactor
+    CU_ASSERT_EQUAL_FATAL(0, read(fds[1], resp, sizeof(resp)));
+
+    close(fds[1]);
+    reactor_destroy(&reactor);
+}
+
+void test_reactor_uring_flush_from_other_thread() {
+    int ret;
+    int fds[2];
+    struct broker_context ctx;
+    struct reactor reactor;
+    struct topic *topic;
+    struct subscriber *sub;
+    struct stomp_command cmd;
+    struct stomp_header header;
+    char resp[64];
+    char cmds[] = "CONNECT\nlogin:foo\n\n\0"
+                  "SUBSCRIBE\ndestination:stocks\n\n";
+
+    assert(0 == socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    broker_context_init(&ctx);
+    ret = reactor_init(&reactor, &ctx, 1);
+    CU_ASSERT_EQUAL_FATAL(0, ret);
+
+    ret = reactor_use_uring(&reactor);
+    if (ret == URING_UNSUPPORTED) {
+        close(fds[0]);
+        close(fds[1]);
+        reactor_destroy(&reactor);
+        return;
+    }
+    CU_ASSERT_EQUAL_FATAL(0, ret);
+
+    assert(0 == reactor_add_client(&reactor, fds[0]));
+    assert(sizeof(cmds) == write(fds[1], cmds, sizeof(cmds)));
+    run_uring(&reactor.threads[0]);
+    assert(0 < read(fds[1], resp, strlen("CONNECTED\n\n")+1));
+
+    // send from outside the i/o thread (like the distributor)
+    topic = topic_find(ctx.topics, "stocks");
+    sub = ((struct subscription *) topic->subscribers->root->entry)
+        ->subscriber;
+    header.key = "destination";
+    header.val = "stocks";
+    cmd.name = "MESSAGE";
+    cmd.headers = &header;
+    cmd.nheaders = 1;
+    cmd.content = "price: 22.3";
+    cmd.contentlen = 11;
+    ret = socket_send_command(sub->client, &cmd);
+    CU_ASSERT_EQUAL_FATAL(0, ret);
+
+    // only queued, the i/o thread is woken up to write it
+    CU_ASSERT_FATAL(socket_queue_depth(sub->client) > 0);
+    CU_ASSERT_PTR_EQUAL_FATAL(sub->client->owner,
+        reactor.threads[0].wpending);
+    run_uring(&reactor.threads[0]);
+    CU_ASSERT_EQUAL_FATAL(0, socket_queue_depth(sub->client));
+    assert(0 < read(fds[1], resp, sizeof(resp)));
+    CU_ASSERT_STRING_EQUAL_FATAL(
+        "MESSAGE\ndestination:stocks\ncontent-length:11\n\nprice: 22.3", resp);
+
+    // hang up, the receive in flight completes
+    close(fds[1]);
+    run_uring(&reactor.threads[0]);
+    CU_ASSERT_FATAL(sub->client->dead);
+    CU_ASSERT_FATAL(!sub->client->attached);
+    reactor_destroy(&reactor);
+}
+
+void test_reactor_uring_listen() {
+    int ret, cli;
+    struct broker_context ctx;
+    struct reactor reactor;
+    struct sockaddr_in addr;
+    socklen_t addrlen = sizeof(addr);
+    char resp[32];
+    char cmd[] = "CONNECT\nlogin:foo\n\n";
+
+    broker_context_init(&ctx);
+    ret = reactor_init(&reactor, &ctx, 1);
+    CU_ASSERT_EQUAL_FATAL(0, ret);
+
+    ret = reactor_use_uring(&reactor);
+    if (ret == URING_UNSUPPORTED) {
+        reactor_destroy(&reactor);
+        return;
+    }
+    CU_ASSERT_EQUAL_FATAL(0, ret);
+
+    ret = reactor_listen(&reactor, 0, 16);
+    CU_ASSERT_EQUAL_FATAL(0, ret);
+    run_uring(&reactor.threads[0]);
+    CU_ASSERT_EQUAL_FATAL(1, reactor.threads[0].accepting);
+
+    assert(0 == getsockname(reactor.threads[0].listenfd,
+        (struct sockaddr *) &addr, &addrlen));
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    cli = socket(PF_INET, SOCK_STREAM, 0);
+    assert(cli != -1);
+    assert(0 == connect(cli, (struct sockaddr *) &addr, sizeof(addr)));
+    assert(0 < write(cli, cmd, strlen(cmd)+1));
+
+    run_uring(&reactor.threads[0]);
+    assert(0 < read(cli, resp, strlen("CONNECTED\n\n")+1));
+    CU_ASSERT_STRING_EQUAL_FATAL("CONNECTED\n\n", resp);
+
+    close(cli);
+    run_uring(&reactor.threads[0]);
+    reactor_destroy(&reactor);
+}
+
+void test_reactor_listen_unix_abstract() {
+    int i, ret, cli;
+    struct broker_context ctx;
+    struct reactor reactor;
+    struct sockaddr_un addr;
+    char name[] = "@message-broker-test";
+    char resp[32];
+    char cmd[] = "CONNECT\nlogin:foo\n\n";
+
+    broker_context_init(&ctx);
+    ret = reactor_init(&reactor, &ctx, 2);
+    CU_ASSERT_EQUAL_FATAL(0, ret);
+
+    ret = reactor_listen_unix(&reactor, name, 16);
+    CU_ASSERT_EQUAL_FATAL(0, ret);
+
+    // one socket shared by all threads, nothing on disk
+    CU_ASSERT_FATAL(reactor.unixfd != -1);
+    CU_ASSERT_EQUAL_FATAL(reactor.unixfd, reactor.threads[0].unixfd);
+    CU_ASSERT_EQUAL_FATAL(reactor.unixfd, reactor.threads[1].unixfd);
+    CU_ASSERT_PTR_NULL_FATAL(reactor.unixpath);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path + 1, name + 1, strlen(name) - 1);
+    cli = socket(AF_UNIX, SOCK_STREAM, 0);
+    assert(cli != -1);
+    assert(0 == connect(cli, (struct sockaddr *) &addr,
+        offsetof(struct sockaddr_un, sun_path) + strlen(name)));
+    assert(0 < write(cli, cmd, strlen(cmd)+1));
+
+    // whichever thread is woken up accepts and serves it
+    for (i = 0; i < 10; i++) {
+        reactor_run_once(&reactor.threads[0], 10);
+        reactor_run_once(&reactor.threads[1], 10);
+    }
+
+    assert(0 < read(cli, resp, strlen("CONNECTED\n\n")+1));
+    CU_ASSERT_STRING_EQUAL_FATAL("CONNECTED\n\n", resp);
+
+    close(cli);
+    reactor_run_once(&reactor.threads[0], 10);
+    reactor_run_once(&reactor.threads[1], 10);
+    reactor_destroy(&reactor);
+}
+
+void test_reactor_uring_listen_unix() {
+    int ret, cli;
+    struct broker_context ctx;
+    struct reactor reactor;
+    struct sockaddr_un addr;
+    struct stat st;
+    char path[] = "/tmp/message-broker-test.sock";
+    char resp[32];
+    char cmd[] = "CONNECT\nlogin:foo\n\n";
+
+    broker_context_init(&ctx);
+    ret = reactor_init(&reactor, &ctx, 1);
+    CU_ASSERT_EQUAL_FATAL(0, ret);
+
+    ret = reactor_use_uring(&reactor);
+    if (ret == URING_UNSUPPORTED) {
+        reactor_destroy(&reactor);
+        return;
+    }
+    CU_ASSERT_EQUAL_FATAL(0, ret);
+
+    ret = reactor_listen_unix(&reactor, path, 16);
+    CU_ASSERT_EQUAL_FATAL(0, ret);
+    run_uring(&reactor.threads[0]);
+    CU_ASSERT_EQUAL_FATAL(1, reactor.threads[0].accepting_unix);
+    CU_ASSERT_EQUAL_FATAL(0, stat(path, &st));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    cli = socket(AF_UNIX, SOCK_STREAM, 0);
+    assert(cli != -1);
+    assert(0 == connect(cli, (struct sockaddr *) &addr, sizeof(addr)));
+    assert(0 < write(cli, cmd, strlen(cmd)+1));
+
+    run_uring(&reactor.threads[0]);
+    assert(0 < read(cli, resp, strlen("CONNECTED\n\n")+1));
+    CU_ASSERT_STRING_EQUAL_FATAL("CONNECTED\n\n", resp);
+
+    close(cli);
+    run_uring(&reactor.threads[0]);
+    reactor_destroy(&reactor);
+
+    // the file is removed with the reactor
+    CU_ASSERT_NOT_EQUAL_FATAL(0, stat(path, &st));
+}
+
+void test_reactor_listen_shm() {
+    int i, ret, cli;
+    struct broker_context ctx;
+    struct reactor reactor;
+    struct sockaddr_un addr;
+    struct shm_channel ch;
+    char name[] = "@message-broker-shm-test";
+    char resp[32];
+    char cmds[] = "CONNECT\nlogin:foo\n\n\0"
+                  "DISCONNECT\n\n";
+
+    broker_context_init(&ctx);
+    ret = reactor_init(&reactor, &ctx, 2);
+    CU_ASSERT_EQUAL_FATAL(0, ret);
+
+    ret = reactor_listen_shm(&reactor, name, 16);
+    CU_ASSERT_EQUAL_FATAL(0, ret);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path + 1, name + 1, strlen(name) - 1);
+    cli = socket(AF_UNIX, SOCK_STREAM, 0);
+    assert(cli != -1);
+    assert(0 == connect(cli, (struct sockaddr *) &addr,
+        offsetof(struct sockaddr_un, sun_path) + strlen(name)));
+
+    // the channel is passed right after accepting
+    for (i = 0; i < 2; i++) {
+        reactor_run_once(&reactor.threads[0], 10);
+        reactor_run_once(&reactor.threads[1], 10);
+    }
+    ret = shm_receive(&ch, cli);
+    CU_ASSERT_EQUAL_FATAL(0, ret);
+
+    // commands go through the channel only
+    CU_ASSERT_EQUAL_FATAL(sizeof(cmds), shm_write(&ch, cmds, sizeof(cmds)));
+    for (i = 0; i < 10; i++) {
+        reactor_run_once(&reactor.threads[0], 10);
+        reactor_run_once(&reactor.threads[1], 10);
+    }
+
+    CU_ASSERT_EQUAL_FATAL(strlen("CONNECTED\n\n")+1,
+        shm_read(&ch, resp, strlen("CONNECTED\n\n")+1));
+    CU_ASSERT_STRING_EQUAL_FATAL("CONNECTED\n\n", resp);
+    CU_ASSERT_EQUAL_FATAL(strlen("RECEIPT\n\n")+1,
+        shm_read(&ch, resp, sizeof(resp)));
+    CU_ASSERT_STRING_EQUAL_FATAL("RECEIPT\n\n", resp);
+
+    // the broker has hung up after the RECEIPT
+    CU_ASSERT_EQUAL_FATAL(0, read(cli, resp, sizeof(resp)));
+
+    shm_destroy(&ch);
+    close(cli);
+    reactor_destroy(&reactor);
+}
+
+void test_reactor_heartbeat() {
+    int ret, i;
+    int fds[2];
+    struct broker_context ctx;
+    struct reactor reactor;
+    char resp[64];
+    long start;
+    ssize_t n;
+    char cmd1[] = "CONNECT\nlogin:foo\nheart-beat:100,50\n\n";
+
+    assert(0 == socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    broker_context_init(&ctx);
+    ret = reactor_init(&reactor, &ctx, 1);
+    CU_ASSERT_EQUAL_FATAL(0, ret);
+    reactor_set_heartbeat(&reactor, 50);
+
+    ret = reactor_add_client(&reactor, fds[0]);
+    CU_ASSERT_EQUAL_FATAL(0, ret);
+
+    assert(0 < write(fds[1], cmd1, strlen(cmd1)+1));
+    CU_ASSERT_EQUAL_FATAL(1, reactor_run_once(&reactor.threads[0], 1000));
+    memset(resp, 0, sizeof(resp));
+    assert(0 < read(fds[1], resp, strlen("CONNECTED\nheart-beat:50,50\n\n")+1));
+    CU_ASSERT_STRING_EQUAL_FATAL("CONNECTED\nheart-beat:50,50\n\n", resp);
+
+    // the reactor wakes up for the heart-beat on its own
+    // and writes it once the socket is writable
+    start = timer_now();
+    CU_ASSERT_EQUAL_FATAL(0, reactor_run_once(&reactor.threads[0], 1000));
+    CU_ASSERT_FATAL(timer_now() - start < 500);
+    CU_ASSERT_EQUAL_FATAL(1, reactor_run_once(&reactor.threads[0], 1000));
+    CU_ASSERT_EQUAL_FATAL(1, read(fds[1], resp, sizeof(resp)));
+    CU_ASSERT_EQUAL_FATAL('\n', resp[0]);
+
+    // heart-beats of the client keep it alive
+    for (i = 0; i < 10; i++) {
+        assert(1 == write(fds[1], "\n", 1));
+        reactor_run_once(&reactor.threads[0], 30);
+    }
+
+    // silent for too long (twice 100ms), the connection is
+    // closed and only heart-beats have been sent until then
+    start = timer_now();
+    while (timer_now() - start < 400)
+        reactor_run_once(&reactor.threads[0], 50);
+    assert(0 == fcntl(fds[1], F_SETFL, O_NONBLOCK));
+
+    while ((n = read(fds[1], resp, sizeof(resp))) > 0) {
+        for (i = 0; i < n; i++)
+            CU_ASSERT_EQUAL_FATAL('\n', resp[i]);
+    }
+    CU_ASSERT_EQUAL_FATAL(0, n);
+    CU_ASSERT_EQUAL_FATAL(0, reactor.threads[0].timers.len);
+
+    close(fds[1]);
+    reactor_destroy(&reactor);
+}
+
+void test_reactor_zerocopy_linger() {
+    int ret;
+    int fds[2];
+    long start;
+    struct broker_context ctx;
+    struct reactor reactor;
+    struct topic *topic;
+    struct client *client;
+    struct zcref *ref;
+    struct stomp_command cmd;
+    char resp[32];
+    char cmds[] = "CONNECT\nlogin:foo\n\n\0"
+                  "SUBSCRIBE\ndestination:stocks\n\n";
+    char cmd2[] = "DISCONNECT\n\n";
+
+    assert(0 == socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    broker_context_init(&ctx);
+    ret = reactor_init(&reactor, &ctx, 1);
+    CU_ASSERT_EQUAL_FATAL(0, ret);
+
+    ret = reactor_add_client(&reactor, fds[0]);
+    CU_ASSERT_EQUAL_FATAL(0, ret);
+
+    assert(sizeof(cmds) == write(fds[1], cmds, sizeof(cmds)));
+    CU_ASSERT_EQUAL_FATAL(1, reactor_run_once(&reactor.threads[0], 1000));
+    assert(0 < read(fds[1], resp, strlen("CONNECTED\n\n")+1));
+    CU_ASSERT_STRING_EQUAL_FATAL("CONNECTED\n\n", resp);
+
+    // a zerocopy send the kernel has not reported complete
+    topic = topic_find(ctx.topics, "stocks");
+    client = ((struct subscription *) topic->subscribers->root->entry)
+        ->subscriber->client;
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.name = "MESSAGE";
+    ref = malloc(sizeof(struct zcref));
+    assert(ref != NULL);
+    assert(0 == frame_create(&cmd, &ref->frame));
+    ref->seq = client->zcseq++;
+    ref->next = NULL;
+    client->zchead = ref;
+    client->zctail = ref;
+
+    assert(0 < write(fds[1], cmd2, strlen(cmd2)+1));
+    CU_ASSERT_EQUAL_FATAL(1, reactor_run_once(&reactor.threads[0], 1000));
+    assert(0 < read(fds[1], resp, strlen("RECEIPT\n\n")+1));
+    CU_ASSERT_STRING_EQUAL_FATAL("RECEIPT\n\n", resp);
+
+    // still open, the kernel may still send from the frame
+    assert(0 == fcntl(fds[1], F_SETFL, O_NONBLOCK));
+    CU_ASSERT_EQUAL_FATAL(-1, read(fds[1], resp, sizeof(resp)));
+    CU_ASSERT_EQUAL_FATAL(1, reactor.threads[0].timers.len);
+
+    // but not for longer than the reports may take
+    start = timer_now();
+    while (timer_now() - start < REACTOR_ZEROCOPY_LINGER + 200)
+        reactor_run_once(&reactor.threads[0], 50);
+    CU_ASSERT_EQUAL_FATAL(0, read(fds[1], resp, sizeof(resp)));
+    CU_ASSERT_EQUAL_FATAL(0, reactor.threads[0].timers.len);
+
+    close(fds[1]);
+    reactor_destroy(&reactor);
+}
+
+void reactor_test_suite() {
+    CU_pSuite reactorSuite = CU_add_suite("reactor", NULL, NULL);
+    CU_add_test(reactorSuite, "test_reactor_handle_client",
+        test_reactor_handle_client);
+    CU_add_test(reactorSuite, "test_reactor_pipelined",
+        test_reactor_pipelined);
+    CU_add_test(reactorSuite, "test_reactor_flush_when_writable",
+        test_reactor_flush_when_writable);
+    CU_add_test(reactorSuite, "test_reactor_client_gone",
+        test_reactor_client_gone);
+    CU_add_test(reactorSuite, "test_reactor_round_robin",
+        test_reactor_round_robin);
+    CU_add_test(reactorSuite, "test_reactor_listen_shards",
+        test_reactor_listen_shards);
+    CU_add_test(reactorSuite, "test_reactor_uring_handle_client",
+        test_reactor_uring_handle_client);
+    CU_add_test(reactorSuite, "test_reactor_uring_flush_from_other_thread",
+        test_reactor_uring_flush_from_other_thread);
+    CU_add_test(reactorSuite, "test_reactor_uring_listen",
+        test_reactor_uring_listen);
+    CU_add_test(reactorSuite, "test_reactor_listen_unix_abstract",
+        test_reactor_listen_unix_abstract);
+    CU_add_test(reactorSuite, "test_reactor_uring_listen_unix",
+        test_reactor_uring_listen_unix);
+    CU_add_test(reactorSuite, "test_reactor_listen_shm",
+        test_reactor_listen_shm);
+    CU_add_test(reactorSuite, "test_reactor_heartbeat",
+        test_reactor_heartbeat);
+    CU_add_test(reactorSuite, "test_reactor_zerocopy_linger",
+        test_reactor_zerocopy_linger);
+}
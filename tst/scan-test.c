@@ -0,0 +1,54 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <CUnit/CUnit.h>
+#include <CUnit/Basic.h>
+
+#include "../src/scan.h"
+
+static const char scan_delims[4] = { '\n', ':', '\\', '\0' };
+
+/* every implementation the cpu supports finds the first
+ * delimiter wherever it is, at any alignment */
+void test_scan_find() {
+    int impl, before = scan_impl();
+    size_t off, pos;
+    char buf[200];
+    char *found;
+
+    for (impl = SCAN_SCALAR; impl <= SCAN_AVX2; impl++) {
+        if (scan_use(impl) != 0) continue;
+
+        for (off = 0; off < 32; off++) {
+            for (pos = 0; pos < 100; pos++) {
+                memset(buf, 'x', sizeof(buf));
+                buf[off + pos] = ':';
+                buf[off + pos + 3] = '\n';
+
+                found = scan_find(buf + off, 100, scan_delims);
+                CU_ASSERT_PTR_EQUAL_FATAL(buf + off + pos, found);
+            }
+
+            // none within len, even if right after it
+            memset(buf, 'x', sizeof(buf));
+            buf[off + 100] = '\0';
+            CU_ASSERT_PTR_NULL_FATAL(scan_find(buf + off, 100, scan_delims));
+            CU_ASSERT_PTR_NULL_FATAL(scan_find(buf + off, 0, scan_delims));
+        }
+
+        // each of them counts
+        CU_ASSERT_EQUAL_FATAL('\\', *scan_find("ab\\c:", 5, scan_delims));
+        CU_ASSERT_EQUAL_FATAL('\0', *scan_find("ab\0c:", 5, scan_delims));
+        CU_ASSERT_EQUAL_FATAL('\n', *scan_find("ab\nc:", 5, scan_delims));
+    }
+
+    CU_ASSERT_EQUAL_FATAL(0, scan_use(before));
+    CU_ASSERT_EQUAL_FATAL(-1, scan_use(42));
+    CU_ASSERT_EQUAL_FATAL(before, scan_impl());
+}
+
+void scan_test_suite() {
+    CU_pSuite scanSuite = CU_add_suite("scan", NULL, NULL);
+    CU_add_test(scanSuite, "test_scan_find", test_scan_find);
+}
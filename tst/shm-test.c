@@ -0,0 +1,184 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <assert.h>
+#include <sys/socket.h>
+
+#include <CUnit/CUnit.h>
+#include <CUnit/Basic.h>
+
+#include "../src/shm.h"
+#include "../src/socket.h"
+
+void test_shm_send_receive() {
+    int ret;
+    int fds[2];
+    struct shm_channel broker, client;
+    char buf[32];
+
+    assert(0 == socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+
+    ret = shm_create(&broker, 64);
+    CU_ASSERT_EQUAL_FATAL(0, ret);
+    ret = shm_send(&broker, fds[0]);
+    CU_ASSERT_EQUAL_FATAL(0, ret);
+    ret = shm_receive(&client, fds[1]);
+    CU_ASSERT_EQUAL_FATAL(0, ret);
+    CU_ASSERT_EQUAL_FATAL(64, client.size);
+
+    // what one side writes, the other one reads
+    CU_ASSERT_EQUAL_FATAL(4, shm_write(&client, "foo", 4));
+    CU_ASSERT_EQUAL_FATAL(4, shm_read(&broker, buf, sizeof(buf)));
+    CU_ASSERT_STRING_EQUAL_FATAL("foo", buf);
+
+    CU_ASSERT_EQUAL_FATAL(4, shm_write(&broker, "bar", 4));
+    CU_ASSERT_EQUAL_FATAL(4, shm_read(&client, buf, sizeof(buf)));
+    CU_ASSERT_STRING_EQUAL_FATAL("bar", buf);
+
+    CU_ASSERT_EQUAL_FATAL(0, shm_read(&broker, buf, sizeof(buf)));
+    CU_ASSERT_EQUAL_FATAL(0, shm_read(&client, buf, sizeof(buf)));
+
+    // anything but a channel is rejected
+    assert(1 == write(fds[0], "x", 1));
+    CU_ASSERT_EQUAL_FATAL(SHM_INVALID, shm_receive(&client, fds[1]));
+
+    shm_destroy(&client);
+    shm_destroy(&broker);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+void test_shm_wrap_around() {
+    int i, ret;
+    int fds[2];
+    struct shm_channel broker, client;
+    char in[40], out[40];
+    struct iovec iov[2];
+
+    assert(0 == socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    ret = shm_create(&broker, 64);
+    CU_ASSERT_EQUAL_FATAL(0, ret);
+    assert(0 == shm_send(&broker, fds[0]));
+    assert(0 == shm_receive(&client, fds[1]));
+
+    for (i = 0; i < sizeof(in); i++) in[i] = i;
+
+    // the second write wraps around the end of the ring
+    for (i = 0; i < 5; i++) {
+        CU_ASSERT_EQUAL_FATAL(sizeof(in), shm_write(&client, in, sizeof(in)));
+        memset(out, 0, sizeof(out));
+        CU_ASSERT_EQUAL_FATAL(sizeof(out),
+            shm_read(&broker, out, sizeof(out)));
+        CU_ASSERT_EQUAL_FATAL(0, memcmp(in, out, sizeof(in)));
+    }
+
+    // takes as much as fits, the rest is left
+    iov[0].iov_base = in;
+    iov[0].iov_len = sizeof(in);
+    iov[1].iov_base = in;
+    iov[1].iov_len = sizeof(in);
+    CU_ASSERT_EQUAL_FATAL(64, shm_writev(&client, iov, 2));
+    CU_ASSERT_EQUAL_FATAL(0, shm_write(&client, in, 1));
+
+    CU_ASSERT_EQUAL_FATAL(sizeof(out), shm_read(&broker, out, sizeof(out)));
+    CU_ASSERT_EQUAL_FATAL(0, memcmp(in, out, sizeof(in)));
+    CU_ASSERT_EQUAL_FATAL(24, shm_read(&broker, out, sizeof(out)));
+    CU_ASSERT_EQUAL_FATAL(0, memcmp(in, out, 24));
+
+    shm_destroy(&client);
+    shm_destroy(&broker);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+void test_shm_wake_up() {
+    int ret;
+    int fds[2];
+    struct shm_channel broker, client;
+    char buf[64];
+
+    assert(0 == socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    ret = shm_create(&broker, 64);
+    CU_ASSERT_EQUAL_FATAL(0, ret);
+    assert(0 == shm_send(&broker, fds[0]));
+    assert(0 == shm_receive(&client, fds[1]));
+
+    // a fresh channel waits for the first bytes
+    assert(4 == shm_write(&client, "foo", 4));
+    CU_ASSERT_EQUAL_FATAL(1, shm_wait(&broker, 0));
+
+    // nobody waits anymore, so nobody is woken up
+    assert(4 == shm_write(&client, "foo", 4));
+    CU_ASSERT_EQUAL_FATAL(0, shm_wait(&broker, 0));
+
+    // there is something to read, so we don't wait
+    CU_ASSERT_EQUAL_FATAL(1, shm_read_wait(&broker));
+    assert(8 == shm_read(&broker, buf, sizeof(buf)));
+
+    // empty now, the next write wakes us up
+    CU_ASSERT_EQUAL_FATAL(0, shm_read_wait(&broker));
+    assert(4 == shm_write(&client, "bar", 4));
+    CU_ASSERT_EQUAL_FATAL(1, shm_wait(&broker, 0));
+    CU_ASSERT_EQUAL_FATAL(0, shm_wait(&broker, 0));
+
+    // a full ring wakes up the producer once there is space
+    assert(60 == shm_write(&client, buf, sizeof(buf)));
+    CU_ASSERT_EQUAL_FATAL(0, shm_write_wait(&client));
+    assert(10 == shm_read(&broker, buf, 10));
+    CU_ASSERT_EQUAL_FATAL(1, shm_wait(&client, 0));
+
+    // other threads of the same side may wake it up
+    shm_kick(&broker);
+    CU_ASSERT_EQUAL_FATAL(1, shm_wait(&broker, 0));
+
+    shm_destroy(&client);
+    shm_destroy(&broker);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+void test_shm_corrupt_index() {
+    int ret;
+    int fds[2];
+    struct shm_channel broker, client;
+    struct client sclient;
+    struct stomp_command cmd;
+    char buf[1024];
+
+    assert(0 == socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    ret = shm_create(&broker, 64);
+    CU_ASSERT_EQUAL_FATAL(0, ret);
+    assert(0 == shm_send(&broker, fds[0]));
+    assert(0 == shm_receive(&client, fds[1]));
+
+    // the client claims to have written more than the ring holds
+    client.tx->head = client.tx->tail + 0x80000000;
+    CU_ASSERT_EQUAL_FATAL(SHM_INVALID, shm_read(&broker, buf, sizeof(buf)));
+
+    // or to have read more than has been written
+    client.rx->tail = client.rx->head + 0x80000000;
+    CU_ASSERT_EQUAL_FATAL(SHM_INVALID, shm_write(&broker, buf, sizeof(buf)));
+
+    // the broker lets go of such a client
+    client_init(&sclient);
+    sclient.shm = &broker;
+    CU_ASSERT_EQUAL_FATAL(SOCKET_CLIENT_GONE,
+        socket_read_command(&sclient, &cmd));
+    CU_ASSERT_FATAL(sclient.dead);
+    sclient.shm = NULL;
+    client_destroy(&sclient);
+
+    shm_destroy(&client);
+    shm_destroy(&broker);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+void shm_test_suite() {
+    CU_pSuite shmSuite = CU_add_suite("shm", NULL, NULL);
+    CU_add_test(shmSuite, "test_shm_send_receive", test_shm_send_receive);
+    CU_add_test(shmSuite, "test_shm_wrap_around", test_shm_wrap_around);
+    CU_add_test(shmSuite, "test_shm_wake_up", test_shm_wake_up);
+    CU_add_test(shmSuite, "test_shm_corrupt_index", test_shm_corrupt_index);
+}
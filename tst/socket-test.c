@@ -3,12 +3,18 @@
 #include <string.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 #include <assert.h>
 
 #include <CUnit/CUnit.h>
 #include <CUnit/Basic.h>
 
 #include "../src/socket.h"
+#include "../src/binary.h"
 
 void test_read_command() {
     int ret;
@@ -33,6 +39,218 @@ void test_read_command() {
     client_destroy(&client);
 }
 
+void test_read_command_pipelined() {
+    int ret;
+    int fds[2]; // 0=read, 1=write
+    struct client client;
+    struct stomp_command cmd;
+    char rawcmd[] = "CONNECT\nlogin:foo\n\n\0"
+                    "SEND\ntopic:foo\n\nbar\n\n\0"
+                    "SEND\ntopic:foo\n\nbaz\n\n";
+    size_t rawcmdlen = sizeof(rawcmd);
+
+    assert(pipe(fds) == 0);
+    client_init(&client);
+    client.sockfd = fds[0];
+
+    // all three commands arrive with one write
+    assert(write(fds[1], rawcmd, rawcmdlen) == rawcmdlen);
+    close(fds[1]);
+
+    ret = socket_read_command(&client, &cmd);
+    CU_ASSERT_EQUAL_FATAL(0, ret);
+    CU_ASSERT_STRING_EQUAL_FATAL("CONNECT", cmd.name);
+    stomp_command_fields_destroy(&cmd);
+    CU_ASSERT_EQUAL_FATAL(1, socket_command_buffered(&client));
+
+    ret = socket_read_command(&client, &cmd);
+    CU_ASSERT_EQUAL_FATAL(0, ret);
+    CU_ASSERT_STRING_EQUAL_FATAL("SEND", cmd.name);
+    CU_ASSERT_STRING_EQUAL_FATAL("bar", cmd.content);
+    stomp_command_fields_destroy(&cmd);
+
+    ret = socket_read_command(&client, &cmd);
+    CU_ASSERT_EQUAL_FATAL(0, ret);
+    CU_ASSERT_STRING_EQUAL_FATAL("SEND", cmd.name);
+    CU_ASSERT_STRING_EQUAL_FATAL("baz", cmd.content);
+    stomp_command_fields_destroy(&cmd);
+    CU_ASSERT_EQUAL_FATAL(0, socket_command_buffered(&client));
+
+    // nothing left
+    ret = socket_read_command(&client, &cmd);
+    CU_ASSERT_EQUAL_FATAL(SOCKET_CLIENT_GONE, ret);
+
+    close(fds[0]);
+    client_destroy(&client);
+}
+
+void test_read_command_partial() {
+    int ret;
+    int fds[2]; // 0=read, 1=write
+    struct client client;
+    struct stomp_command cmd;
+    char part1[] = "SEND\ntopic:fo";
+    char part2[] = "o\n\nbar\n\n";
+
+    assert(pipe(fds) == 0);
+    assert(0 == fcntl(fds[0], F_SETFL, O_NONBLOCK));
+    client_init(&client);
+    client.sockfd = fds[0];
+
+    // nothing there yet
+    ret = socket_read_command(&client, &cmd);
+    CU_ASSERT_EQUAL_FATAL(SOCKET_AGAIN, ret);
+
+    // incomplete command is kept
+    assert(write(fds[1], part1, strlen(part1)) > 0);
+    ret = socket_read_command(&client, &cmd);
+    CU_ASSERT_EQUAL_FATAL(SOCKET_AGAIN, ret);
+
+    // including the null byte
+    assert(write(fds[1], part2, strlen(part2) + 1) > 0);
+    ret = socket_read_command(&client, &cmd);
+    CU_ASSERT_EQUAL_FATAL(0, ret);
+    CU_ASSERT_STRING_EQUAL_FATAL("SEND", cmd.name);
+    CU_ASSERT_STRING_EQUAL_FATAL("foo", cmd.headers[0].val);
+    CU_ASSERT_STRING_EQUAL_FATAL("bar", cmd.content);
+    stomp_command_fields_destroy(&cmd);
+
+    close(fds[0]);
+    close(fds[1]);
+    client_destroy(&client);
+}
+
+void test_read_command_binary_partial() {
+    int ret;
+    int fds[2]; // 0=read, 1=write
+    struct client client;
+    struct stomp_command cmd;
+    struct stomp_header header = { "topic", "foo" };
+    char content[200], *frame;
+    size_t len;
+
+    assert(pipe(fds) == 0);
+    assert(0 == fcntl(fds[0], F_SETFL, O_NONBLOCK));
+    client_init(&client);
+    client.sockfd = fds[0];
+    client.binary = 1;
+
+    memset(content, 'c', sizeof(content));
+    cmd.name = "SEND";
+    cmd.headers = &header;
+    cmd.nheaders = 1;
+    cmd.content = content;
+    cmd.contentlen = sizeof(content);
+    cmd.topicid = 0;
+    assert(0 == binary_create(&cmd, &frame, &len));
+
+    // the length takes two bytes, the first one is not enough
+    // and nothing is searched for a null byte
+    assert(write(fds[1], frame, 1) == 1);
+    ret = socket_read_command(&client, &cmd);
+    CU_ASSERT_EQUAL_FATAL(SOCKET_AGAIN, ret);
+    CU_ASSERT_EQUAL_FATAL(0, client.rframelen);
+    CU_ASSERT_EQUAL_FATAL(0, client.rscanned);
+
+    // all but the null byte
+    assert(write(fds[1], frame + 1, len - 2) == len - 2);
+    ret = socket_read_command(&client, &cmd);
+    CU_ASSERT_EQUAL_FATAL(SOCKET_AGAIN, ret);
+
+    assert(write(fds[1], frame + len - 1, 1) == 1);
+    ret = socket_read_command(&client, &cmd);
+    CU_ASSERT_EQUAL_FATAL(0, ret);
+    CU_ASSERT_STRING_EQUAL_FATAL("SEND", cmd.name);
+    CU_ASSERT_STRING_EQUAL_FATAL("foo",
+        stomp_header_get(&cmd, STOMP_HDR_TOPIC));
+    CU_ASSERT_EQUAL_FATAL(sizeof(content), cmd.contentlen);
+    stomp_command_fields_destroy(&cmd);
+    free(frame);
+
+    // more than the maximum frame size, known from the length
+    char toomuch[] = { 0xff, 0xff, 0xff, 0xff, 0x7f };
+    assert(write(fds[1], toomuch, sizeof(toomuch)) > 0);
+    ret = socket_read_command(&client, &cmd);
+    CU_ASSERT_EQUAL_FATAL(SOCKET_TOO_MUCH, ret);
+
+    close(fds[0]);
+    close(fds[1]);
+    client_destroy(&client);
+}
+
+void test_read_command_heartbeats() {
+    int ret;
+    int fds[2]; // 0=read, 1=write
+    struct client client;
+    struct stomp_command cmd;
+    char rawcmd[] = "\n\r\nCONNECT\nlogin:foo\n\n\0\n\n";
+    char heartbeats[] = { 0, 0 };
+    char *frame;
+    size_t len;
+
+    assert(pipe(fds) == 0);
+    assert(0 == fcntl(fds[0], F_SETFL, O_NONBLOCK));
+    client_init(&client);
+    client.sockfd = fds[0];
+
+    // heart-beats on either side of the command
+    assert(write(fds[1], rawcmd, sizeof(rawcmd) - 1) > 0);
+    ret = socket_read_command(&client, &cmd);
+    CU_ASSERT_EQUAL_FATAL(0, ret);
+    CU_ASSERT_STRING_EQUAL_FATAL("CONNECT", cmd.name);
+    stomp_command_fields_destroy(&cmd);
+    CU_ASSERT_EQUAL_FATAL(0, socket_command_buffered(&client));
+    ret = socket_read_command(&client, &cmd);
+    CU_ASSERT_EQUAL_FATAL(SOCKET_AGAIN, ret);
+
+    // frames of length 0 with the binary framing
+    client.binary = 1;
+    cmd.name = "DISCONNECT";
+    cmd.nheaders = 0;
+    cmd.content = NULL;
+    cmd.contentlen = 0;
+    cmd.topicid = 0;
+    assert(0 == binary_create(&cmd, &frame, &len));
+    assert(write(fds[1], heartbeats, sizeof(heartbeats)) > 0);
+    assert(write(fds[1], frame, len) == len);
+    free(frame);
+    ret = socket_read_command(&client, &cmd);
+    CU_ASSERT_EQUAL_FATAL(0, ret);
+    CU_ASSERT_STRING_EQUAL_FATAL("DISCONNECT", cmd.name);
+    stomp_command_fields_destroy(&cmd);
+
+    close(fds[0]);
+    close(fds[1]);
+    client_destroy(&client);
+}
+
+void test_send_heartbeat() {
+    int ret;
+    int fds[2]; // 0=read, 1=write
+    struct client client;
+    char buf[8];
+
+    assert(pipe(fds) == 0);
+    assert(0 == fcntl(fds[0], F_SETFL, O_NONBLOCK));
+    client_init(&client);
+    client.sockfd = fds[1];
+
+    ret = socket_send_heartbeat(&client);
+    CU_ASSERT_EQUAL_FATAL(0, ret);
+    CU_ASSERT_EQUAL_FATAL(1, read(fds[0], buf, sizeof(buf)));
+    CU_ASSERT_EQUAL_FATAL('\n', buf[0]);
+
+    client.binary = 1;
+    ret = socket_send_heartbeat(&client);
+    CU_ASSERT_EQUAL_FATAL(0, ret);
+    CU_ASSERT_EQUAL_FATAL(1, read(fds[0], buf, sizeof(buf)));
+    CU_ASSERT_EQUAL_FATAL('\0', buf[0]);
+
+    close(fds[0]);
+    close(fds[1]);
+    client_destroy(&client);
+}
+
 void test_read_command_fail() {
     int ret;
     int fds[2]; // 0=read, 1=write
@@ -93,7 +311,7 @@ void test_read_or_write_to_dead_client() {
     CU_ASSERT_EQUAL_FATAL(SOCKET_NECROMANCE, ret);
 
     // cannot engage in necromantic activities
-    ret = socket_send_command(&client, cmd);
+    ret = socket_send_command(&client, &cmd);
     CU_ASSERT_EQUAL_FATAL(SOCKET_NECROMANCE, ret);
 
     client_destroy(&client);
@@ -109,7 +327,7 @@ void test_send_invalid_command() {
 
     client_init(&client);
 
-    ret = socket_send_command(&client, cmd);
+    ret = socket_send_command(&client, &cmd);
     CU_ASSERT_EQUAL_FATAL(-1, ret);
 
     client_destroy(&client);
@@ -127,12 +345,157 @@ void test_read_command_too_much() {
     assert(pipe(fds) == 0);
     client_init(&client);
     client.sockfd = fds[0];
+    socket_set_max_frame(1024);
 
     assert(write(fds[1], rawcmd, 1025) > 0);
     ret = socket_read_command(&client, &cmd);
 
     CU_ASSERT_EQUAL_FATAL(SOCKET_TOO_MUCH, ret);
 
+    socket_set_max_frame(SOCKET_DEFAULT_MAX_FRAME);
+    close(fds[0]);
+    close(fds[1]);
+    client_destroy(&client);
+}
+
+void test_read_command_content_length() {
+    int ret;
+    int fds[2];
+    struct client client;
+    struct stomp_command cmd;
+    char header[] = "SEND\r\ntopic:stocks\r\ncontent-length:65536\r\n\r\n";
+    size_t framelen = strlen(header) + 65536 + 1;
+    char *rawcmd = malloc(framelen);
+
+    // content with empty lines and null bytes, headers first
+    memcpy(rawcmd, header, strlen(header));
+    memset(rawcmd + strlen(header), '\n', 65536);
+    rawcmd[strlen(header) + 100] = '\0';
+    rawcmd[framelen - 1] = '\0';
+
+    assert(0 == socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    client_init(&client);
+    client.sockfd = fds[0];
+    assert(0 == fcntl(fds[0], F_SETFL, O_NONBLOCK));
+
+    assert(strlen(header) == write(fds[1], rawcmd, strlen(header)));
+    ret = socket_read_command(&client, &cmd);
+    CU_ASSERT_EQUAL_FATAL(SOCKET_AGAIN, ret);
+
+    // grown to fit the entire command right away
+    CU_ASSERT_EQUAL_FATAL(framelen, client.rframelen);
+    CU_ASSERT_EQUAL_FATAL(framelen, client.rbufcap);
+
+    assert(framelen - strlen(header) == write(fds[1],
+        rawcmd + strlen(header), framelen - strlen(header)));
+    ret = socket_read_command(&client, &cmd);
+    CU_ASSERT_EQUAL_FATAL(0, ret);
+    CU_ASSERT_STRING_EQUAL_FATAL("stocks", cmd.headers[0].val);
+    CU_ASSERT_EQUAL_FATAL(65536, cmd.contentlen);
+    CU_ASSERT_EQUAL_FATAL('\0', cmd.content[100]);
+    CU_ASSERT_EQUAL_FATAL('\n', cmd.content[65535]);
+    CU_ASSERT_EQUAL_FATAL(framelen, client.rbufcap);
+    stomp_command_fields_destroy(&cmd);
+
+    // shrunk once it is no longer needed
+    ret = socket_read_command(&client, &cmd);
+    CU_ASSERT_EQUAL_FATAL(SOCKET_AGAIN, ret);
+    CU_ASSERT_EQUAL_FATAL(SOCKET_BUFSIZE, client.rbufcap);
+
+    free(rawcmd);
+    close(fds[0]);
+    close(fds[1]);
+    client_destroy(&client);
+}
+
+void test_read_command_grow() {
+    int ret;
+    int fds[2];
+    struct client client;
+    struct stomp_command cmd;
+    char header[] = "SEND\ntopic:stocks\n\n";
+    char rawcmd[5000];
+
+    // no content-length, the buffer doubles until it fits
+    memset(rawcmd, 'a', sizeof(rawcmd));
+    memcpy(rawcmd, header, strlen(header));
+    memcpy(rawcmd + sizeof(rawcmd) - 3, "\n\n\0", 3);
+
+    assert(0 == socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    client_init(&client);
+    client.sockfd = fds[0];
+
+    assert(sizeof(rawcmd) == write(fds[1], rawcmd, sizeof(rawcmd)));
+    ret = socket_read_command(&client, &cmd);
+    CU_ASSERT_EQUAL_FATAL(0, ret);
+    CU_ASSERT_EQUAL_FATAL(sizeof(rawcmd) - strlen(header) - 3,
+        strlen(cmd.content));
+    CU_ASSERT_EQUAL_FATAL(8 * SOCKET_BUFSIZE, client.rbufcap);
+    stomp_command_fields_destroy(&cmd);
+
+    close(fds[0]);
+    close(fds[1]);
+    client_destroy(&client);
+}
+
+void test_read_command_content_length_too_much() {
+    int ret;
+    int fds[2];
+    struct client client;
+    struct stomp_command cmd;
+    char rawcmd[] = "SEND\ntopic:stocks\ncontent-length:4096\n\nabc";
+
+    assert(0 == socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    client_init(&client);
+    client.sockfd = fds[0];
+    socket_set_max_frame(2048);
+
+    // rejected as soon as the headers are there
+    assert(0 < write(fds[1], rawcmd, strlen(rawcmd)));
+    ret = socket_read_command(&client, &cmd);
+    CU_ASSERT_EQUAL_FATAL(SOCKET_TOO_MUCH, ret);
+    CU_ASSERT_EQUAL_FATAL(SOCKET_BUFSIZE, client.rbufcap);
+
+    socket_set_max_frame(SOCKET_DEFAULT_MAX_FRAME);
+    close(fds[0]);
+    close(fds[1]);
+    client_destroy(&client);
+}
+
+void test_read_command_content_length_rule() {
+    int ret;
+    int fds[2];
+    struct client client;
+    struct stomp_command cmd;
+
+    // only the exact key with a plain number gives the length,
+    // otherwise the reader and the parser both stop at the
+    // first null byte
+    char rawcmd[] = "SEND\ntopic:a\ncontent-length:5\n\nab\0cd\0"
+                    "SEND\ntopic:a\ncontent-length :5\n\nab\0"
+                    "SEND\ntopic:a\ncontent-length: 2\n\nab\0";
+
+    assert(0 == socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    client_init(&client);
+    client.sockfd = fds[0];
+
+    assert(sizeof(rawcmd) == write(fds[1], rawcmd, sizeof(rawcmd)));
+    ret = socket_read_command(&client, &cmd);
+    CU_ASSERT_EQUAL_FATAL(0, ret);
+    CU_ASSERT_EQUAL_FATAL(5, cmd.contentlen);
+    CU_ASSERT_EQUAL_FATAL(0, memcmp("ab\0cd", cmd.content, 5));
+    stomp_command_fields_destroy(&cmd);
+
+    ret = socket_read_command(&client, &cmd);
+    CU_ASSERT_EQUAL_FATAL(0, ret);
+    CU_ASSERT_EQUAL_FATAL(2, cmd.contentlen);
+    CU_ASSERT_STRING_EQUAL_FATAL("content-length ", cmd.headers[1].key);
+    stomp_command_fields_destroy(&cmd);
+
+    // the parser rejects it
+    ret = socket_read_command(&client, &cmd);
+    CU_ASSERT_EQUAL_FATAL(-1, ret);
+
     close(fds[0]);
     close(fds[1]);
     client_destroy(&client);
@@ -153,7 +516,7 @@ void test_send_command() {
     cmd.nheaders = 0;
     cmd.content = NULL;
 
-    ret = socket_send_command(&client, cmd);
+    ret = socket_send_command(&client, &cmd);
     CU_ASSERT_EQUAL_FATAL(0, ret);
 
     read(fds[0], &rawcmd, 32);
@@ -164,6 +527,181 @@ void test_send_command() {
     client_destroy(&client);
 }
 
+static int notified_pending = -1;
+
+static void record_notify(struct client *client, int pending) {
+    notified_pending = pending;
+}
+
+void test_send_command_queued() {
+    int ret;
+    int fds[2]; // 0=read, 1=write
+    struct client client;
+    struct stomp_command cmd;
+    char rawcmd[32];
+
+    assert(pipe(fds) == 0);
+    assert(0 == fcntl(fds[0], F_SETFL, O_NONBLOCK));
+    assert(0 == fcntl(fds[1], F_SETFL, O_NONBLOCK));
+    client_init(&client);
+    client.sockfd = fds[1];
+    client.wnotify = record_notify;
+    cmd.name = "RECEIPT";
+    cmd.headers = NULL;
+    cmd.nheaders = 0;
+    cmd.content = NULL;
+
+    // only queued, owner is notified
+    ret = socket_send_command(&client, &cmd);
+    CU_ASSERT_EQUAL_FATAL(0, ret);
+    CU_ASSERT_EQUAL_FATAL(1, notified_pending);
+    CU_ASSERT_EQUAL_FATAL(strlen("RECEIPT\n\n") + 1,
+        socket_queue_depth(&client));
+    CU_ASSERT_EQUAL_FATAL(-1, read(fds[0], &rawcmd, 32));
+
+    // second command is queued as well, no new notification
+    notified_pending = -1;
+    ret = socket_send_command(&client, &cmd);
+    CU_ASSERT_EQUAL_FATAL(0, ret);
+    CU_ASSERT_EQUAL_FATAL(-1, notified_pending);
+
+    // both are written with one flush
+    ret = socket_flush(&client);
+    CU_ASSERT_EQUAL_FATAL(0, ret);
+    CU_ASSERT_EQUAL_FATAL(0, notified_pending);
+    CU_ASSERT_EQUAL_FATAL(0, socket_queue_depth(&client));
+    CU_ASSERT_EQUAL_FATAL(2 * (strlen("RECEIPT\n\n") + 1),
+        read(fds[0], &rawcmd, 32));
+    CU_ASSERT_STRING_EQUAL_FATAL("RECEIPT\n\n", rawcmd);
+
+    close(fds[0]);
+    close(fds[1]);
+    client_destroy(&client);
+}
+
+void test_send_command_queue_full() {
+    int ret;
+    int i;
+    int fds[2]; // 0=read, 1=write
+    struct client client;
+    struct stomp_command cmd;
+    struct stomp_header header;
+    struct frame *frame;
+    size_t depth;
+    char reason[1000];
+
+    memset(reason, 'x', sizeof(reason) - 1);
+    reason[sizeof(reason) - 1] = '\0';
+
+    assert(pipe(fds) == 0);
+    client_init(&client);
+    client.sockfd = fds[1];
+    client.wnotify = record_notify;
+    cmd.name = "ERROR";
+    header.key = "message";
+    header.val = reason;
+    cmd.headers = &header;
+    cmd.nheaders = 1;
+    cmd.content = NULL;
+
+    // nobody flushes the queue
+    assert(0 == frame_create(&cmd, &frame));
+    for (i = 0; i < SOCKET_WQUEUE_MAX / sizeof(reason); i++) {
+        ret = socket_send_frame(&client, frame);
+        if (ret != 0) break;
+    }
+    frame_unref(frame);
+    CU_ASSERT_EQUAL_FATAL(SOCKET_QUEUE_FULL, ret);
+    CU_ASSERT_FATAL(socket_queue_depth(&client) <= SOCKET_WQUEUE_MAX);
+    CU_ASSERT_FATAL(socket_queue_depth(&client) >
+        SOCKET_WQUEUE_MAX - sizeof(reason) - 32);
+
+    // client is not considered dead
+    CU_ASSERT_EQUAL_FATAL(0, client.dead);
+
+    // replies of the broker are queued anyway
+    depth = socket_queue_depth(&client);
+    CU_ASSERT_EQUAL_FATAL(0, socket_send_command(&client, &cmd));
+    CU_ASSERT_FATAL(socket_queue_depth(&client) > depth);
+
+    close(fds[0]);
+    close(fds[1]);
+    client_destroy(&client);
+}
+
+void test_flush_partial_write() {
+    int ret;
+    int fds[2];
+    struct client client;
+    struct stomp_command cmd;
+    struct stomp_header header;
+    char reason[1000];
+    char expected[1024];
+    size_t expectedlen;
+    char *buf;
+    size_t queued = 0;
+    size_t received = 0;
+    ssize_t nread;
+    int sndbuf = 4096;
+    int ncmds = 500;
+
+    memset(reason, 'x', sizeof(reason) - 1);
+    reason[sizeof(reason) - 1] = '\0';
+    sprintf(expected, "ERROR\nmessage:%s\n\n", reason);
+    expectedlen = strlen(expected) + 1;
+
+    assert(0 == socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    assert(0 == setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF,
+        &sndbuf, sizeof(sndbuf)));
+    assert(0 == fcntl(fds[0], F_SETFL, O_NONBLOCK));
+    client_init(&client);
+    client.sockfd = fds[0];
+    client.wnotify = record_notify;
+    cmd.name = "ERROR";
+    header.key = "message";
+    header.val = reason;
+    cmd.headers = &header;
+    cmd.nheaders = 1;
+    cmd.content = NULL;
+
+    // much more than fits into the socket buffer
+    for (int i = 0; i < ncmds; i++) {
+        assert(0 == socket_send_command(&client, &cmd));
+    }
+    queued = socket_queue_depth(&client);
+    CU_ASSERT_EQUAL_FATAL(ncmds * expectedlen, queued);
+
+    ret = socket_flush(&client);
+    CU_ASSERT_EQUAL_FATAL(SOCKET_AGAIN, ret);
+    CU_ASSERT_FATAL(socket_queue_depth(&client) > 0);
+    CU_ASSERT_FATAL(socket_queue_depth(&client) < queued);
+
+    // alternate reading and flushing until all is through
+    buf = malloc(queued);
+    assert(buf != NULL);
+    while (received < queued) {
+        nread = read(fds[1], buf + received, queued - received);
+        CU_ASSERT_FATAL(nread > 0);
+        received += nread;
+        ret = socket_flush(&client);
+        CU_ASSERT_FATAL(ret == 0 || ret == SOCKET_AGAIN);
+    }
+
+    // every byte exactly once and in order
+    CU_ASSERT_EQUAL_FATAL(queued, received);
+    for (int i = 0; i < ncmds; i++) {
+        CU_ASSERT_FATAL(0 == memcmp(expected,
+            buf + i * expectedlen, expectedlen));
+    }
+    CU_ASSERT_EQUAL_FATAL(0, socket_queue_depth(&client));
+    CU_ASSERT_EQUAL_FATAL(0, notified_pending);
+
+    free(buf);
+    close(fds[0]);
+    close(fds[1]);
+    client_destroy(&client);
+}
+
 void test_send_command_socket_closed() {
     int ret;
     int fds[2]; // 0=read, 1=write
@@ -181,7 +719,7 @@ void test_send_command_socket_closed() {
     assert(0 == close(fds[1])); // close socket
     assert(0 == close(fds[0]));
 
-    ret = socket_send_command(&client, cmd);
+    ret = socket_send_command(&client, &cmd);
     CU_ASSERT_EQUAL_FATAL(SOCKET_CLIENT_GONE, ret);
 
     client_destroy(&client);
@@ -236,23 +774,146 @@ void test_mutex_recursiveness() {
     client_destroy(&client);
 }
 
+void test_send_zerocopy() {
+    int ret, lst, cli, srv, fds[2];
+    struct client client, uclient;
+    struct sockaddr_in addr;
+    socklen_t addrlen = sizeof(addr);
+    struct stomp_command cmd;
+    struct stomp_header header;
+    struct frame *small, *large;
+    struct pollfd pfd;
+    char reason[4096];
+    char *buf;
+    size_t received = 0, total;
+    ssize_t nread;
+
+    // a connected pair of tcp sockets over loopback
+    lst = socket(AF_INET, SOCK_STREAM, 0);
+    assert(lst != -1);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    assert(0 == bind(lst, (struct sockaddr *) &addr, sizeof(addr)));
+    assert(0 == listen(lst, 1));
+    assert(0 == getsockname(lst, (struct sockaddr *) &addr, &addrlen));
+    cli = socket(AF_INET, SOCK_STREAM, 0);
+    assert(0 == connect(cli, (struct sockaddr *) &addr, sizeof(addr)));
+    srv = accept(lst, NULL, NULL);
+    assert(srv != -1);
+
+    client_init(&client);
+    client.sockfd = srv;
+    client.wnotify = record_notify;
+
+    // off by default
+    CU_ASSERT_EQUAL_FATAL(-1, socket_enable_zerocopy(&client));
+    socket_set_zerocopy(1024);
+    CU_ASSERT_EQUAL_FATAL(0, socket_enable_zerocopy(&client));
+
+    cmd.name = "ERROR";
+    header.key = "message";
+    cmd.headers = &header;
+    cmd.nheaders = 1;
+    cmd.content = NULL;
+    header.val = "short";
+    assert(0 == frame_create(&cmd, &small));
+    memset(reason, 'x', sizeof(reason) - 1);
+    reason[sizeof(reason) - 1] = '\0';
+    header.val = reason;
+    assert(0 == frame_create(&cmd, &large));
+
+    assert(0 == socket_send_frame(&client, small));
+    assert(0 == socket_send_frame(&client, large));
+    ret = socket_flush(&client);
+    CU_ASSERT_EQUAL_FATAL(0, ret);
+
+    // the small one has been copied, the large one is
+    // still referenced as the kernel may read from it
+    CU_ASSERT_EQUAL_FATAL(1, small->refs);
+    CU_ASSERT_EQUAL_FATAL(2, large->refs);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(client.zchead);
+
+    total = small->len + large->len;
+    buf = malloc(total);
+    assert(buf != NULL);
+    while (received < total) {
+        nread = read(cli, buf + received, total - received);
+        CU_ASSERT_FATAL(nread > 0);
+        received += nread;
+    }
+    CU_ASSERT_EQUAL_FATAL(0, memcmp(buf, small->data, small->len));
+    CU_ASSERT_EQUAL_FATAL(0,
+        memcmp(buf + small->len, large->data, large->len));
+
+    // the completion arrives through the error queue
+    pfd.fd = srv;
+    pfd.events = 0;
+    CU_ASSERT_EQUAL_FATAL(1, poll(&pfd, 1, 1000));
+    CU_ASSERT_FATAL(pfd.revents & POLLERR);
+    CU_ASSERT_EQUAL_FATAL(1, socket_reap_zerocopy(&client));
+    CU_ASSERT_EQUAL_FATAL(1, large->refs);
+    CU_ASSERT_PTR_NULL_FATAL(client.zchead);
+
+    // not supported by unix domain sockets
+    assert(0 == socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    client_init(&uclient);
+    uclient.sockfd = fds[0];
+    CU_ASSERT_EQUAL_FATAL(-1, socket_enable_zerocopy(&uclient));
+
+    socket_set_zerocopy(0);
+    frame_unref(small);
+    frame_unref(large);
+    free(buf);
+    close(fds[0]);
+    close(fds[1]);
+    close(cli);
+    close(srv);
+    close(lst);
+    client_destroy(&client);
+    client_destroy(&uclient);
+}
 
 void socket_test_suite() {
     CU_pSuite socketSuite = CU_add_suite("socket", NULL, NULL);
     CU_add_test(socketSuite, "test_read_command", test_read_command);
+    CU_add_test(socketSuite, "test_read_command_pipelined",
+        test_read_command_pipelined);
+    CU_add_test(socketSuite, "test_read_command_partial",
+        test_read_command_partial);
+    CU_add_test(socketSuite, "test_read_command_binary_partial",
+        test_read_command_binary_partial);
+    CU_add_test(socketSuite, "test_read_command_heartbeats",
+        test_read_command_heartbeats);
     CU_add_test(socketSuite, "test_read_command_fail", test_read_command_fail);
     CU_add_test(socketSuite, "test_read_or_write_to_dead_client", test_read_or_write_to_dead_client);
     CU_add_test(socketSuite, "test_read_command_invalid_socket",
         test_read_command_invalid_socket);
     CU_add_test(socketSuite, "test_read_command_too_much",
         test_read_command_too_much);
+    CU_add_test(socketSuite, "test_read_command_content_length",
+        test_read_command_content_length);
+    CU_add_test(socketSuite, "test_read_command_grow",
+        test_read_command_grow);
+    CU_add_test(socketSuite, "test_read_command_content_length_too_much",
+        test_read_command_content_length_too_much);
+    CU_add_test(socketSuite, "test_read_command_content_length_rule",
+        test_read_command_content_length_rule);
     CU_add_test(socketSuite, "test_send_command_socket_closed",
         test_send_command_socket_closed);
     CU_add_test(socketSuite, "test_send_command", test_send_command);
+    CU_add_test(socketSuite, "test_send_heartbeat", test_send_heartbeat);
+    CU_add_test(socketSuite, "test_send_command_queued",
+        test_send_command_queued);
+    CU_add_test(socketSuite, "test_send_command_queue_full",
+        test_send_command_queue_full);
+    CU_add_test(socketSuite, "test_flush_partial_write",
+        test_flush_partial_write);
     CU_add_test(socketSuite, "test_terminate_client",
         test_terminate_client);
     CU_add_test(socketSuite, "test_send_invalid_command",
         test_send_invalid_command);
     CU_add_test(socketSuite, "test_mutex_recursiveness",
         test_mutex_recursiveness);
+    CU_add_test(socketSuite, "test_send_zerocopy", test_send_zerocopy);
 }
@@ -14,7 +14,7 @@ void test_parse_command_unknown() {
     struct stomp_command cmd;
 
     // unknown command
-    char str[] = "FOO\nlogin: client-1\n\n";
+    char str[] = "FOO\nlogin:client-1\n\n";
     CU_ASSERT_EQUAL_FATAL(STOMP_UNKNOWN_COMMAND,
         parse_command(str, &cmd));
 }
@@ -23,7 +23,7 @@ void test_parse_command_connect() {
     struct stomp_command cmd;
 
     // regular command
-    char str1[] = "CONNECT\nlogin: client-1\n\n";
+    char str1[] = "CONNECT\nlogin:client-1\n\n";
     int parsed = parse_command(str1, &cmd);
     CU_ASSERT_EQUAL_FATAL(0, parsed);
     CU_ASSERT_STRING_EQUAL_FATAL("CONNECT", cmd.name);
@@ -33,14 +33,16 @@ void test_parse_command_connect() {
     CU_ASSERT_PTR_NULL_FATAL(cmd.content);
     stomp_command_fields_destroy(&cmd);
     
-    // regular command with whitespaces in header
-    char str2[] = "CONNECT\n login :  client-1  \n\n";
+    // whitespaces are part of the key and the value
+    char str2[] = "CONNECT\nlogin:  client-1  \n login :x\n\n";
     parsed = parse_command(str2, &cmd);
     CU_ASSERT_EQUAL_FATAL(0, parsed);
     CU_ASSERT_STRING_EQUAL_FATAL("CONNECT", cmd.name);
-    CU_ASSERT_STRING_EQUAL_FATAL("login", cmd.headers->key);
-    CU_ASSERT_STRING_EQUAL_FATAL("client-1", cmd.headers->val);
-    CU_ASSERT_EQUAL_FATAL(1, cmd.nheaders);
+    CU_ASSERT_STRING_EQUAL_FATAL("login", cmd.headers[0].key);
+    CU_ASSERT_STRING_EQUAL_FATAL("  client-1  ", cmd.headers[0].val);
+    CU_ASSERT_STRING_EQUAL_FATAL(" login ", cmd.headers[1].key);
+    CU_ASSERT_STRING_EQUAL_FATAL("x", cmd.headers[1].val);
+    CU_ASSERT_EQUAL_FATAL(2, cmd.nheaders);
     CU_ASSERT_PTR_NULL_FATAL(cmd.content);
     stomp_command_fields_destroy(&cmd);
 
@@ -51,25 +53,27 @@ void test_parse_command_connect() {
     stomp_command_fields_destroy(&cmd);
 
     // no val for login header
-    char str4[] = "CONNECT\nlogin: \n\n";
+    char str4[] = "CONNECT\nlogin:\r\n\n";
     CU_ASSERT_EQUAL_FATAL(STOMP_INVALID_HEADER,
         parse_command(str4, &cmd));
     stomp_command_fields_destroy(&cmd);
  
     // command expects no body
-    char str5[] = "CONNECT\nlogin: client-1\n\nhello\n\n";
+    char str5[] = "CONNECT\nlogin:client-1\n\nhello\n\n";
     CU_ASSERT_EQUAL_FATAL(STOMP_UNEXPECTED_CONTENT,
         parse_command(str5, &cmd));
     stomp_command_fields_destroy(&cmd);
     // additional header
-    char str6[] = "CONNECT\nlogin: client-1\nfoo: bar\n\n";
-    CU_ASSERT_EQUAL_FATAL(STOMP_INVALID_HEADER,
-        parse_command(str6, &cmd));
+    char str6[] = "CONNECT\nfoo:bar\nlogin:client-1\n\n";
+    CU_ASSERT_EQUAL_FATAL(0, parse_command(str6, &cmd));
+    CU_ASSERT_EQUAL_FATAL(2, cmd.nheaders);
+    CU_ASSERT_STRING_EQUAL_FATAL("client-1",
+        stomp_header_get(&cmd, STOMP_HDR_LOGIN));
     stomp_command_fields_destroy(&cmd);
  
     // wrong header
-    char str7[] = "CONNECT\nfoo: bar\n\n";
-    CU_ASSERT_EQUAL_FATAL(STOMP_INVALID_HEADER,
+    char str7[] = "CONNECT\nfoo:bar\n\n";
+    CU_ASSERT_EQUAL_FATAL(STOMP_MISSING_HEADER,
         parse_command(str7, &cmd));
     stomp_command_fields_destroy(&cmd);
 }
@@ -78,7 +82,7 @@ void test_parse_command_send() {
     struct stomp_command cmd;
 
     // regular command
-    char str1[] = "SEND\ntopic: stocks\n\nnew price: 33.4\n\n";
+    char str1[] = "SEND\ntopic:stocks\n\nnew price: 33.4\n\n";
     CU_ASSERT_EQUAL_FATAL(0,
         parse_command(str1, &cmd));
     CU_ASSERT_STRING_EQUAL_FATAL("SEND", cmd.name);
@@ -86,10 +90,13 @@ void test_parse_command_send() {
     CU_ASSERT_STRING_EQUAL_FATAL("stocks", cmd.headers->val);
     CU_ASSERT_EQUAL_FATAL(1, cmd.nheaders);
     CU_ASSERT_STRING_EQUAL_FATAL("new price: 33.4", cmd.content);
+    // nothing is copied
+    CU_ASSERT_PTR_EQUAL_FATAL(str1 + 11, cmd.headers->val);
+    CU_ASSERT_PTR_EQUAL_FATAL(str1 + 19, cmd.content);
     stomp_command_fields_destroy(&cmd);
  
     // multiline regular command
-    char str2[] = "SEND\ntopic: stocks\n\no p: 23.4\nn p: 33.4\n\n";
+    char str2[] = "SEND\ntopic:stocks\n\no p: 23.4\nn p: 33.4\n\n";
     CU_ASSERT_EQUAL_FATAL(0,
         parse_command(str2,
                       &cmd));
@@ -113,29 +120,251 @@ void test_parse_command_send() {
     stomp_command_fields_destroy(&cmd);
 
     // empty value for topic header
-    char str5[] = "SEND\ntopic: \n\n new price: 33.4\n\n";
+    char str5[] = "SEND\ntopic:\r\n\n new price: 33.4\n\n";
     CU_ASSERT_EQUAL_FATAL(STOMP_INVALID_HEADER,
         parse_command(str5, &cmd));
     stomp_command_fields_destroy(&cmd);
 
     // wrong header
-    char str6[] = "SEND\ntropic: foo\n\n new price: 33.4\n\n";
-    CU_ASSERT_EQUAL_FATAL(STOMP_INVALID_HEADER,
+    char str6[] = "SEND\ntropic:foo\n\n new price: 33.4\n\n";
+    CU_ASSERT_EQUAL_FATAL(STOMP_MISSING_HEADER,
         parse_command(str6, &cmd));
     stomp_command_fields_destroy(&cmd);
     
     // additional header
-    char str7[] = "SEND\ntopic: foo\nbar:wrapm\n\n new price: 33.4\n\n";
+    char str7[] = "SEND\ntopic:foo\nbar:wrapm\n\n new price: 33.4\n\n";
+    CU_ASSERT_EQUAL_FATAL(0, parse_command(str7, &cmd));
+    CU_ASSERT_EQUAL_FATAL(2, cmd.nheaders);
+    CU_ASSERT_STRING_EQUAL_FATAL("bar", cmd.headers[1].key);
+    CU_ASSERT_STRING_EQUAL_FATAL("wrapm", cmd.headers[1].val);
+    stomp_command_fields_destroy(&cmd);
+}
+
+void test_parse_command_send_content_length() {
+    struct stomp_command cmd;
+
+    // content may contain empty lines
+    char str1[] = "SEND\ntopic:stocks\ncontent-length:20\n\n"
+                  "o p: 23.4\n\nn p: 33.4";
+    CU_ASSERT_EQUAL_FATAL(0, parse_command(str1, &cmd));
+    CU_ASSERT_STRING_EQUAL_FATAL("SEND", cmd.name);
+    CU_ASSERT_STRING_EQUAL_FATAL("topic", cmd.headers->key);
+    CU_ASSERT_STRING_EQUAL_FATAL("stocks", cmd.headers->val);
+    CU_ASSERT_EQUAL_FATAL(2, cmd.nheaders);
+    CU_ASSERT_STRING_EQUAL_FATAL("o p: 23.4\n\nn p: 33.4", cmd.content);
+    stomp_command_fields_destroy(&cmd);
+
+    // header may come first
+    char str2[] = "SEND\ncontent-length:3\ntopic:stocks\n\nabc";
+    CU_ASSERT_EQUAL_FATAL(0, parse_command(str2, &cmd));
+    CU_ASSERT_STRING_EQUAL_FATAL("stocks",
+        stomp_header_get(&cmd, STOMP_HDR_TOPIC));
+    CU_ASSERT_STRING_EQUAL_FATAL("abc", cmd.content);
+    stomp_command_fields_destroy(&cmd);
+
+    // content is shorter
+    char str3[] = "SEND\ntopic:stocks\ncontent-length:10\n\nabc";
+    CU_ASSERT_EQUAL_FATAL(STOMP_INVALID_CONTENT, parse_command(str3, &cmd));
+
+    // content is longer
+    char str4[] = "SEND\ntopic:stocks\ncontent-length:2\n\nabc";
+    CU_ASSERT_EQUAL_FATAL(STOMP_INVALID_CONTENT, parse_command(str4, &cmd));
+
+    // not a number
+    char str5[] = "SEND\ntopic:stocks\ncontent-length:ab\n\nabc";
+    CU_ASSERT_EQUAL_FATAL(STOMP_INVALID_HEADER, parse_command(str5, &cmd));
+
+    // no content
+    char str6[] = "SEND\ntopic:stocks\ncontent-length:0\n\n";
+    CU_ASSERT_EQUAL_FATAL(STOMP_MISSING_CONTENT, parse_command(str6, &cmd));
+}
+
+void test_parse_frame() {
+    struct stomp_command cmd;
+
+    // content may contain anything if its length is known
+    char str1[] = "SEND\ntopic:stocks\ncontent-length:5\n\na\0b\nc";
+    CU_ASSERT_EQUAL_FATAL(0, parse_frame(str1, sizeof(str1), &cmd));
+    CU_ASSERT_EQUAL_FATAL(5, cmd.contentlen);
+    CU_ASSERT_EQUAL_FATAL(0, memcmp("a\0b\nc", cmd.content, 5));
+    stomp_command_fields_destroy(&cmd);
+
+    // the content is only bounded by the frame
+    char str2[] = "SEND\ntopic:stocks\ncontent-length:6\n\na\0b\nc";
+    CU_ASSERT_EQUAL_FATAL(STOMP_INVALID_CONTENT,
+        parse_frame(str2, sizeof(str2), &cmd));
+
+    // but the header must not
+    char str2b[] = "SEND\ntopic:st\0cks\ncontent-length:1\n\na";
     CU_ASSERT_EQUAL_FATAL(STOMP_INVALID_HEADER,
-        parse_command(str7, &cmd));
+        parse_frame(str2b, sizeof(str2b), &cmd));
+
+    // otherwise, it runs up to the end, empty lines included
+    char str3[] = "SEND\ntopic:stocks\n\nabc\n\ndef\n\n";
+    CU_ASSERT_EQUAL_FATAL(0, parse_command(str3, &cmd));
+    CU_ASSERT_STRING_EQUAL_FATAL("abc\n\ndef", cmd.content);
+    CU_ASSERT_EQUAL_FATAL(8, cmd.contentlen);
+    stomp_command_fields_destroy(&cmd);
+
+    // lines may end with CRLF
+    char str4[] = "SEND\r\ntopic:stocks\r\ncontent-length:3\r\n\r\nabc";
+    CU_ASSERT_EQUAL_FATAL(0, parse_command(str4, &cmd));
+    CU_ASSERT_STRING_EQUAL_FATAL("stocks", cmd.headers->val);
+    CU_ASSERT_STRING_EQUAL_FATAL("abc", cmd.content);
+    stomp_command_fields_destroy(&cmd);
+
+    // header values are unescaped
+    char str5[] = "SUBSCRIBE\ndestination:a\\cb\\nc\\\\\n\n";
+    CU_ASSERT_EQUAL_FATAL(0, parse_command(str5, &cmd));
+    CU_ASSERT_STRING_EQUAL_FATAL("a:b\nc\\", cmd.headers->val);
+    stomp_command_fields_destroy(&cmd);
+
+    // undefined escape sequence
+    char str6[] = "SUBSCRIBE\ndestination:a\\tb\n\n";
+    CU_ASSERT_EQUAL_FATAL(STOMP_INVALID_HEADER, parse_command(str6, &cmd));
+
+    // except in CONNECT
+    char str7[] = "CONNECT\nlogin:a\\tb\n\n";
+    CU_ASSERT_EQUAL_FATAL(0, parse_command(str7, &cmd));
+    CU_ASSERT_STRING_EQUAL_FATAL("a\\tb", cmd.headers->val);
+    stomp_command_fields_destroy(&cmd);
+}
+
+void test_parse_headers() {
+    int i;
+    struct stomp_command cmd;
+    char str[2048];
+
+    // well-known and other headers, the first one counts
+    char str1[] = "SEND\ntopic:a\ncontent-type:text/plain\nx-id:1\n"
+                  "priority:4\ntopic:b\nexpires:100\n\nhi";
+    CU_ASSERT_EQUAL_FATAL(0, parse_command(str1, &cmd));
+    CU_ASSERT_EQUAL_FATAL(6, cmd.nheaders);
+    CU_ASSERT_STRING_EQUAL_FATAL("a", stomp_header_get(&cmd, STOMP_HDR_TOPIC));
+    CU_ASSERT_STRING_EQUAL_FATAL("text/plain",
+        stomp_header_get(&cmd, STOMP_HDR_CONTENT_TYPE));
+    CU_ASSERT_STRING_EQUAL_FATAL("4",
+        stomp_header_get(&cmd, STOMP_HDR_PRIORITY));
+    CU_ASSERT_STRING_EQUAL_FATAL("100",
+        stomp_header_get(&cmd, STOMP_HDR_EXPIRES));
+    CU_ASSERT_PTR_NULL_FATAL(stomp_header_get(&cmd, STOMP_HDR_RECEIPT));
+    CU_ASSERT_STRING_EQUAL_FATAL("x-id", cmd.headers[2].key);
+    CU_ASSERT_STRING_EQUAL_FATAL("b", cmd.headers[4].val);
+    stomp_command_fields_destroy(&cmd);
+
+    CU_ASSERT_EQUAL_FATAL(STOMP_HDR_RECEIPT_ID,
+        stomp_header_known("receipt-id"));
+    CU_ASSERT_EQUAL_FATAL(STOMP_HDR_CONTENT_LENGTH,
+        stomp_header_known("content-length"));
+    CU_ASSERT_EQUAL_FATAL(STOMP_HDR_HEART_BEAT,
+        stomp_header_known("heart-beat"));
+    CU_ASSERT_EQUAL_FATAL(-1, stomp_header_known("heart"));
+    CU_ASSERT_EQUAL_FATAL(-1, stomp_header_known("content"));
+    CU_ASSERT_EQUAL_FATAL(-1, stomp_header_known("receipts"));
+    CU_ASSERT_EQUAL_FATAL(-1, stomp_header_known(""));
+
+    // CONNECT is not escaped, the first colon splits
+    char str2[] = "CONNECT\nlogin:a\nhost:broker:61613\n\n";
+    CU_ASSERT_EQUAL_FATAL(0, parse_command(str2, &cmd));
+    CU_ASSERT_STRING_EQUAL_FATAL("host", cmd.headers[1].key);
+    CU_ASSERT_STRING_EQUAL_FATAL("broker:61613", cmd.headers[1].val);
+    stomp_command_fields_destroy(&cmd);
+
+    // other commands must escape them
+    char str3[] = "SEND\ntopic:a\nhost:broker:61613\n\nhi";
+    CU_ASSERT_EQUAL_FATAL(STOMP_INVALID_HEADER, parse_command(str3, &cmd));
+    char str4[] = "SEND\ntopic:a\nhost:broker\\c61613\n\nhi";
+    CU_ASSERT_EQUAL_FATAL(0, parse_command(str4, &cmd));
+    CU_ASSERT_STRING_EQUAL_FATAL("broker:61613", cmd.headers[1].val);
+    stomp_command_fields_destroy(&cmd);
+
+    // values may be empty, keys may not
+    char str5[] = "SEND\ntopic:a\nx-empty:\n\nhi";
+    CU_ASSERT_EQUAL_FATAL(0, parse_command(str5, &cmd));
+    CU_ASSERT_EQUAL_FATAL(2, cmd.nheaders);
+    CU_ASSERT_STRING_EQUAL_FATAL("x-empty", cmd.headers[1].key);
+    CU_ASSERT_STRING_EQUAL_FATAL("", cmd.headers[1].val);
+    stomp_command_fields_destroy(&cmd);
+    char str6[] = "SEND\ntopic:a\n:b\n\nhi";
+    CU_ASSERT_EQUAL_FATAL(STOMP_INVALID_HEADER, parse_command(str6, &cmd));
+
+    // spaces are kept, so a padded key is another header
+    char str7[] = "SEND\ntopic:a\n topic : b \n\nhi";
+    CU_ASSERT_EQUAL_FATAL(0, parse_command(str7, &cmd));
+    CU_ASSERT_STRING_EQUAL_FATAL("a", stomp_header_get(&cmd, STOMP_HDR_TOPIC));
+    CU_ASSERT_STRING_EQUAL_FATAL(" topic ", cmd.headers[1].key);
+    CU_ASSERT_STRING_EQUAL_FATAL(" b ", cmd.headers[1].val);
     stomp_command_fields_destroy(&cmd);
+
+    // too many
+    strcpy(str, "DISCONNECT\n");
+    for (i = 0; i <= STOMP_MAX_HEADERS; i++)
+        sprintf(str + strlen(str), "h%d:%d\n", i, i);
+    strcat(str, "\n");
+    CU_ASSERT_EQUAL_FATAL(STOMP_TOO_MANY_HEADERS, parse_command(str, &cmd));
+
+    // as many as fit
+    strcpy(str, "DISCONNECT\n");
+    for (i = 0; i < STOMP_MAX_HEADERS; i++)
+        sprintf(str + strlen(str), "h%d:%d\n", i, i);
+    strcat(str, "\n");
+    CU_ASSERT_EQUAL_FATAL(0, parse_command(str, &cmd));
+    CU_ASSERT_EQUAL_FATAL(STOMP_MAX_HEADERS, cmd.nheaders);
+}
+
+void test_parse_batch() {
+    struct stomp_command cmd;
+    struct iovec bodies[STOMP_MAX_BATCH];
+    char str[8192];
+    int i;
+
+    char str1[] = "SEND\ntopic:a\nbatch:2,4,1\ncontent-length:7\n\n"
+                  "hib\0yez";
+    CU_ASSERT_EQUAL_FATAL(0, parse_frame(str1, sizeof(str1), &cmd));
+    CU_ASSERT_EQUAL_FATAL(3, stomp_batch_split(&cmd, bodies));
+    CU_ASSERT_EQUAL_FATAL(2, bodies[0].iov_len);
+    CU_ASSERT_EQUAL_FATAL(0, memcmp("hi", bodies[0].iov_base, 2));
+    CU_ASSERT_EQUAL_FATAL(4, bodies[1].iov_len);
+    CU_ASSERT_EQUAL_FATAL(0, memcmp("b\0ye", bodies[1].iov_base, 4));
+    CU_ASSERT_EQUAL_FATAL(1, bodies[2].iov_len);
+    CU_ASSERT_EQUAL_FATAL(0, memcmp("z", bodies[2].iov_base, 1));
+
+    // without a batch, the whole content is one message
+    char str2[] = "SEND\ntopic:a\n\nhello";
+    CU_ASSERT_EQUAL_FATAL(0, parse_command(str2, &cmd));
+    CU_ASSERT_EQUAL_FATAL(1, stomp_batch_split(&cmd, bodies));
+    CU_ASSERT_PTR_EQUAL_FATAL(cmd.content, bodies[0].iov_base);
+    CU_ASSERT_EQUAL_FATAL(5, bodies[0].iov_len);
+
+    // lengths must add up to the content
+    char str3[] = "SEND\ntopic:a\nbatch:2,2\n\nhello";
+    CU_ASSERT_EQUAL_FATAL(STOMP_INVALID_CONTENT, parse_command(str3, &cmd));
+    char str4[] = "SEND\ntopic:a\nbatch:2,9\n\nhello";
+    CU_ASSERT_EQUAL_FATAL(STOMP_INVALID_CONTENT, parse_command(str4, &cmd));
+
+    // malformed or empty messages
+    char str5[] = "SEND\ntopic:a\nbatch:2,,3\n\nhello";
+    CU_ASSERT_EQUAL_FATAL(STOMP_INVALID_HEADER, parse_command(str5, &cmd));
+    char str6[] = "SEND\ntopic:a\nbatch:0,5\n\nhello";
+    CU_ASSERT_EQUAL_FATAL(STOMP_INVALID_HEADER, parse_command(str6, &cmd));
+    char str7[] = "SEND\ntopic:a\nbatch:2,3,\n\nhello";
+    CU_ASSERT_EQUAL_FATAL(STOMP_INVALID_HEADER, parse_command(str7, &cmd));
+    char str8[] = "SEND\ntopic:a\nbatch:x\n\nhello";
+    CU_ASSERT_EQUAL_FATAL(STOMP_INVALID_HEADER, parse_command(str8, &cmd));
+
+    // too many
+    strcpy(str, "SEND\ntopic:a\nbatch:1");
+    for (i = 1; i <= STOMP_MAX_BATCH; i++) strcat(str, ",1");
+    strcat(str, "\n\n");
+    for (i = 0; i <= STOMP_MAX_BATCH; i++) strcat(str, "x");
+    CU_ASSERT_EQUAL_FATAL(STOMP_INVALID_HEADER, parse_command(str, &cmd));
 }
 
 void test_parse_command_subscribe() {
     struct stomp_command cmd;
 
     // regular command
-    char str1[] = "SUBSCRIBE\ndestination: stocks\n\n";
+    char str1[] = "SUBSCRIBE\ndestination:stocks\n\n";
     CU_ASSERT_EQUAL_FATAL(0,
         parse_command(str1, &cmd));
     CU_ASSERT_STRING_EQUAL_FATAL("SUBSCRIBE", cmd.name);
@@ -158,27 +387,28 @@ void test_parse_command_subscribe() {
     stomp_command_fields_destroy(&cmd);
 
     // empty value for topic header
-    char str4[] = "SUBSCRIBE\ndestination: \n\n";
+    char str4[] = "SUBSCRIBE\ndestination:\r\n\n";
     CU_ASSERT_EQUAL_FATAL(STOMP_INVALID_HEADER,
         parse_command(str4, &cmd));
     stomp_command_fields_destroy(&cmd);
  
     // command expects no body
-    char str5[] = "SUBSCRIBE\ndestination: stocks\n\nhello\n\n";
+    char str5[] = "SUBSCRIBE\ndestination:stocks\n\nhello\n\n";
     CU_ASSERT_EQUAL_FATAL(STOMP_UNEXPECTED_CONTENT,
         parse_command(str5, &cmd));
     stomp_command_fields_destroy(&cmd);
     
     // wrong header
-    char str6[] = "SUBSCRIBE\ntopic: stocks\n\n";
-    CU_ASSERT_EQUAL_FATAL(STOMP_INVALID_HEADER,
+    char str6[] = "SUBSCRIBE\ntopic:stocks\n\n";
+    CU_ASSERT_EQUAL_FATAL(STOMP_MISSING_HEADER,
         parse_command(str6, &cmd));
     stomp_command_fields_destroy(&cmd);
     
     // additional header
-    char str7[] = "SUBSCRIBE\ntopic: stocks\ndestination: stocks\n\n";
-    CU_ASSERT_EQUAL_FATAL(STOMP_INVALID_HEADER,
-        parse_command(str7, &cmd));
+    char str7[] = "SUBSCRIBE\ntopic:stocks\ndestination:stocks\n\n";
+    CU_ASSERT_EQUAL_FATAL(0, parse_command(str7, &cmd));
+    CU_ASSERT_STRING_EQUAL_FATAL("stocks",
+        stomp_header_get(&cmd, STOMP_HDR_DESTINATION));
     stomp_command_fields_destroy(&cmd);
 }
 
@@ -191,14 +421,15 @@ void test_parse_command_disconnect() {
     CU_ASSERT_EQUAL_FATAL(0, cmd.nheaders);
     stomp_command_fields_destroy(&cmd);
 
-    // invalid header (wants none)
-    char str2[] = "DISCONNECT\nfoo: bar\n\n";
-    CU_ASSERT_EQUAL_FATAL(STOMP_INVALID_HEADER,
-        parse_command(str2, &cmd));
+    // any header
+    char str2[] = "DISCONNECT\nreceipt:77\n\n";
+    CU_ASSERT_EQUAL_FATAL(0, parse_command(str2, &cmd));
+    CU_ASSERT_STRING_EQUAL_FATAL("77",
+        stomp_header_get(&cmd, STOMP_HDR_RECEIPT));
     stomp_command_fields_destroy(&cmd);
 
     char str3[] = "DISCONNECT\nfoo:bar\n\nbody\n\n";
-    CU_ASSERT_EQUAL_FATAL(STOMP_INVALID_HEADER,
+    CU_ASSERT_EQUAL_FATAL(STOMP_UNEXPECTED_CONTENT,
         parse_command(str3, &cmd));
     stomp_command_fields_destroy(&cmd);
 }
@@ -253,12 +484,14 @@ void *_run_stuff(void * _) {
         cmd.name = "MESSAGE";
         cmd.headers = NULL;
         cmd.content = "hello world";
+        cmd.contentlen = 11;
         cmd.nheaders = 0;
         char* str;
-        *ret = 0, create_command(cmd, &str);
+        size_t len;
+        *ret = create_command(&cmd, &str, &len);
         if (*ret != 0) break;
 
-        if (strcmp("MESSAGE\nhello world\n\n", str) != 0) {
+        if (strcmp("MESSAGE\ncontent-length:11\n\nhello world", str) != 0) {
             *ret = -43;
             break;
         }
@@ -298,7 +531,8 @@ void test_create_command_connected() {
     cmd.nheaders = 0;
 
     char* str;
-    CU_ASSERT_EQUAL_FATAL(0, create_command(cmd, &str));
+    size_t len;
+    CU_ASSERT_EQUAL_FATAL(0, create_command(&cmd, &str, &len));
     CU_ASSERT_STRING_EQUAL_FATAL("CONNECTED\n\n", str);
 }
 
@@ -314,7 +548,8 @@ void test_create_command_error() {
     cmd.nheaders = 1;
 
     char* str;
-    CU_ASSERT_EQUAL_FATAL(0, create_command(cmd, &str));
+    size_t len;
+    CU_ASSERT_EQUAL_FATAL(0, create_command(&cmd, &str, &len));
     CU_ASSERT_STRING_EQUAL_FATAL("ERROR\nmessage:fail\n\n", str);
 }
 
@@ -325,20 +560,91 @@ void test_create_command_message() {
     cmd.name = "MESSAGE";
     cmd.headers = NULL;
     cmd.content = "hello world";
+    cmd.contentlen = 11;
     cmd.nheaders = 0;
 
     char* str;
-    CU_ASSERT_EQUAL_FATAL(0, create_command(cmd, &str));
-    CU_ASSERT_STRING_EQUAL_FATAL("MESSAGE\nhello world\n\n", str);
+    size_t len;
+    CU_ASSERT_EQUAL_FATAL(0, create_command(&cmd, &str, &len));
+    CU_ASSERT_STRING_EQUAL_FATAL("MESSAGE\ncontent-length:11\n\n"
+        "hello world", str);
+    CU_ASSERT_EQUAL_FATAL(39, len);
+    free(str);
 
     // two lines
     cmd.name = "MESSAGE";
     cmd.headers = NULL;
     cmd.content = "hello\n world";
+    cmd.contentlen = 12;
     cmd.nheaders = 0;
 
-    CU_ASSERT_EQUAL_FATAL(0, create_command(cmd, &str));
-    CU_ASSERT_STRING_EQUAL_FATAL("MESSAGE\nhello\n world\n\n", str);
+    CU_ASSERT_EQUAL_FATAL(0, create_command(&cmd, &str, &len));
+    CU_ASSERT_STRING_EQUAL_FATAL("MESSAGE\ncontent-length:12\n\n"
+        "hello\n world", str);
+    free(str);
+
+    // binary content, header is escaped
+    struct stomp_header hdr;
+    hdr.key = "destination";
+    hdr.val = "a:b\nc\\";
+    cmd.headers = &hdr;
+    cmd.nheaders = 1;
+    cmd.content = "a\0b";
+    cmd.contentlen = 3;
+
+    CU_ASSERT_EQUAL_FATAL(0, create_command(&cmd, &str, &len));
+    char expected[] = "MESSAGE\ndestination:a\\cb\\nc\\\\\n"
+                      "content-length:3\n\na\0b";
+    CU_ASSERT_EQUAL_FATAL(sizeof(expected), len);
+    CU_ASSERT_EQUAL_FATAL(0, memcmp(expected, str, len));
+    free(str);
+}
+
+void test_create_command_prefixed() {
+    struct stomp_command cmd;
+    struct stomp_header hdrs[2];
+    char *prefix, *str, *whole;
+    size_t prefixlen, len, wholelen;
+
+    // long enough for the scanner to take bigger steps
+    hdrs[0].key = "destination";
+    hdrs[0].val = "stocks:nasdaq\\2024\nabcdefghijklmnopqrstuvwxyz:"
+                  "0123456789abcdefghijklmnopqrstuvwxyz\r";
+    hdrs[1].key = "message-id";
+    hdrs[1].val = "42";
+
+    cmd.name = "MESSAGE";
+    cmd.headers = hdrs;
+    cmd.nheaders = 1;
+    cmd.content = NULL;
+
+    CU_ASSERT_EQUAL_FATAL(0, stomp_create_prefix(&cmd, &prefix, &prefixlen));
+    char expected[] = "MESSAGE\ndestination:stocks\\cnasdaq\\\\2024\\n"
+        "abcdefghijklmnopqrstuvwxyz\\c"
+        "0123456789abcdefghijklmnopqrstuvwxyz\\r\n";
+    CU_ASSERT_EQUAL_FATAL(strlen(expected), prefixlen);
+    CU_ASSERT_EQUAL_FATAL(0, memcmp(expected, prefix, prefixlen));
+
+    // the same as if it had been encoded at once
+    cmd.nheaders = 2;
+    cmd.content = "a\0b";
+    cmd.contentlen = 3;
+    CU_ASSERT_EQUAL_FATAL(0, create_command(&cmd, &whole, &wholelen));
+
+    cmd.headers = hdrs + 1;
+    cmd.nheaders = 1;
+    CU_ASSERT_EQUAL_FATAL(0,
+        create_command_prefixed(&cmd, prefix, prefixlen, &str, &len));
+    CU_ASSERT_EQUAL_FATAL(wholelen, len);
+    CU_ASSERT_EQUAL_FATAL(0, memcmp(whole, str, len));
+
+    cmd.name = "SEND";
+    CU_ASSERT_EQUAL_FATAL(STOMP_UNKNOWN_COMMAND,
+        create_command_prefixed(&cmd, prefix, prefixlen, &str, &len));
+
+    free(prefix);
+    free(whole);
+    free(str);
 }
 
 void test_create_command_receipt() {
@@ -350,7 +656,8 @@ void test_create_command_receipt() {
     cmd.nheaders = 0;
 
     char* str;
-    CU_ASSERT_EQUAL_FATAL(0, create_command(cmd, &str));
+    size_t len;
+    CU_ASSERT_EQUAL_FATAL(0, create_command(&cmd, &str, &len));
     CU_ASSERT_STRING_EQUAL_FATAL("RECEIPT\n\n", str);
 }
 
@@ -379,7 +686,8 @@ void test_create_command_strcatbug() {
     cmd.nheaders = 0;
 
     char* str;
-    CU_ASSERT_EQUAL_FATAL(0, create_command(cmd, &str));
+    size_t len;
+    CU_ASSERT_EQUAL_FATAL(0, create_command(&cmd, &str, &len));
     CU_ASSERT_STRING_EQUAL_FATAL("RECEIPT\n\n", str);
 }
 
@@ -406,6 +714,9 @@ void test_strerror() {
     stomp_strerror(STOMP_UNKNOWN_COMMAND, buf);
     CU_ASSERT_STRING_EQUAL_FATAL("STOMP_UNKNOWN_COMMAND", buf);
 
+    stomp_strerror(STOMP_TOO_MANY_HEADERS, buf);
+    CU_ASSERT_STRING_EQUAL_FATAL("STOMP_TOO_MANY_HEADERS", buf);
+
     stomp_strerror(-1, buf);
     CU_ASSERT_STRING_EQUAL_FATAL("UNKNOWN_ERROR", buf);
 }
@@ -418,6 +729,11 @@ void add_stomp_parse_suite() {
         test_parse_command_connect);
     CU_add_test(parseSuite, "test_parse_command_send",
         test_parse_command_send);
+    CU_add_test(parseSuite, "test_parse_command_send_content_length",
+        test_parse_command_send_content_length);
+    CU_add_test(parseSuite, "test_parse_frame", test_parse_frame);
+    CU_add_test(parseSuite, "test_parse_headers", test_parse_headers);
+    CU_add_test(parseSuite, "test_parse_batch", test_parse_batch);
     CU_add_test(parseSuite, "test_parse_command_subscribe",
         test_parse_command_subscribe);
     CU_add_test(parseSuite, "test_parse_command_disconnect",
@@ -434,6 +750,8 @@ void add_stomp_create_suite() {
         test_create_command_error);
     CU_add_test(createSuite, "test_create_command_message",
         test_create_command_message);
+    CU_add_test(createSuite, "test_create_command_prefixed",
+        test_create_command_prefixed);
     CU_add_test(createSuite, "test_create_command_receipt",
         test_create_command_receipt);
     CU_add_test(createSuite, "test_create_command_strcatbug",
@@ -0,0 +1,150 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <CUnit/CUnit.h>
+#include <CUnit/Basic.h>
+
+#include "../src/timer.h"
+
+/* deadlines of the timers in the order they have fired */
+static long fired[8];
+static int nfired;
+
+static void record_fire(struct timer *timer, long now) {
+    fired[nfired++] = timer->deadline;
+}
+
+void test_timers_run_in_order() {
+    struct timers timers;
+    struct timer t[5];
+    long deadlines[5] = { 50, 10, 40, 20, 30 };
+    int i;
+
+    timers_init(&timers);
+    nfired = 0;
+
+    // nothing to wait for
+    CU_ASSERT_EQUAL_FATAL(-1, timers_timeout(&timers, 0));
+
+    for (i = 0; i < 5; i++) {
+        timer_init(&t[i], record_fire, NULL);
+        timer_arm(&timers, &t[i], deadlines[i]);
+    }
+    CU_ASSERT_EQUAL_FATAL(10, timers_timeout(&timers, 0));
+
+    // not due yet
+    CU_ASSERT_EQUAL_FATAL(0, timers_run(&timers, 9));
+
+    CU_ASSERT_EQUAL_FATAL(3, timers_run(&timers, 30));
+    CU_ASSERT_EQUAL_FATAL(10, fired[0]);
+    CU_ASSERT_EQUAL_FATAL(20, fired[1]);
+    CU_ASSERT_EQUAL_FATAL(30, fired[2]);
+    CU_ASSERT_EQUAL_FATAL(TIMER_NONE, t[1].index);
+    CU_ASSERT_EQUAL_FATAL(10, timers_timeout(&timers, 30));
+
+    // overdue
+    CU_ASSERT_EQUAL_FATAL(0, timers_timeout(&timers, 45));
+
+    CU_ASSERT_EQUAL_FATAL(2, timers_run(&timers, 100));
+    CU_ASSERT_EQUAL_FATAL(40, fired[3]);
+    CU_ASSERT_EQUAL_FATAL(50, fired[4]);
+    CU_ASSERT_EQUAL_FATAL(-1, timers_timeout(&timers, 100));
+
+    timers_destroy(&timers);
+}
+
+void test_timer_rearm_and_cancel() {
+    struct timers timers;
+    struct timer t[6];
+    int i;
+
+    timers_init(&timers);
+    nfired = 0;
+
+    for (i = 0; i < 6; i++) {
+        timer_init(&t[i], record_fire, NULL);
+        timer_arm(&timers, &t[i], (i + 1) * 10);
+    }
+
+    // later and earlier than before
+    timer_arm(&timers, &t[0], 65);
+    timer_arm(&timers, &t[5], 5);
+
+    // from the middle, twice
+    timer_cancel(&timers, &t[2]);
+    timer_cancel(&timers, &t[2]);
+    CU_ASSERT_EQUAL_FATAL(TIMER_NONE, t[2].index);
+
+    CU_ASSERT_EQUAL_FATAL(5, timers_run(&timers, 100));
+    CU_ASSERT_EQUAL_FATAL(5, fired[0]);
+    CU_ASSERT_EQUAL_FATAL(20, fired[1]);
+    CU_ASSERT_EQUAL_FATAL(40, fired[2]);
+    CU_ASSERT_EQUAL_FATAL(50, fired[3]);
+    CU_ASSERT_EQUAL_FATAL(65, fired[4]);
+
+    // a timer that is never cancelled
+    timer_arm(&timers, &t[0], 200);
+    timers_destroy(&timers);
+    CU_ASSERT_EQUAL_FATAL(TIMER_NONE, t[0].index);
+}
+
+/* arms itself again until it has fired three times */
+static void rearm_fire(struct timer *timer, long now) {
+    struct timers *timers = timer->arg;
+
+    fired[nfired++] = now;
+    if (nfired < 3) timer_arm(timers, timer, now + 10);
+}
+
+void test_timer_rearm_when_fired() {
+    struct timers timers;
+    struct timer t;
+
+    timers_init(&timers);
+    nfired = 0;
+
+    timer_init(&t, rearm_fire, &timers);
+    timer_arm(&timers, &t, 10);
+
+    // fires again only once the time has come
+    CU_ASSERT_EQUAL_FATAL(1, timers_run(&timers, 10));
+    CU_ASSERT_EQUAL_FATAL(1, timers_run(&timers, 25));
+    CU_ASSERT_EQUAL_FATAL(1, timers_run(&timers, 100));
+    CU_ASSERT_EQUAL_FATAL(0, timers_run(&timers, 1000));
+    CU_ASSERT_EQUAL_FATAL(3, nfired);
+
+    timers_destroy(&timers);
+}
+
+void test_timer_growing() {
+    struct timers timers;
+    struct timer t[100];
+    int i;
+
+    timers_init(&timers);
+    nfired = 0;
+
+    // more than the heap has room for initially
+    for (i = 0; i < 100; i++) {
+        timer_init(&t[i], record_fire, NULL);
+        timer_arm(&timers, &t[i], 1000 - i);
+    }
+    CU_ASSERT_EQUAL_FATAL(100, timers.len);
+    CU_ASSERT_EQUAL_FATAL(901, timers.heap[0]->deadline);
+    CU_ASSERT_EQUAL_FATAL(1, timers_run(&timers, 901));
+    CU_ASSERT_EQUAL_FATAL(901, fired[0]);
+
+    timers_destroy(&timers);
+}
+
+void timer_test_suite() {
+    CU_pSuite timerSuite = CU_add_suite("timer", NULL, NULL);
+    CU_add_test(timerSuite, "test_timers_run_in_order",
+        test_timers_run_in_order);
+    CU_add_test(timerSuite, "test_timer_rearm_and_cancel",
+        test_timer_rearm_and_cancel);
+    CU_add_test(timerSuite, "test_timer_rearm_when_fired",
+        test_timer_rearm_when_fired);
+    CU_add_test(timerSuite, "test_timer_growing", test_timer_growing);
+}
@@ -0,0 +1,177 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "../src/topic.h"
+
+/* measures how publishers on distinct topics get in each
+ * other's way when they look up their topic in the table
+ * of topics, as process_send does for every SEND. each
+ * publisher looks up its own topic and takes the lock of
+ * its subscribers the way topic_add_messages does, with
+ * 1, 2, 4, ... up to the number of threads asked for.
+ *
+ * each measurement is run once on its own and once while
+ * another thread keeps creating topics, which takes the
+ * table (or a shard of it) in write mode.
+ */
+
+#define DEFAULT_ROUNDS 1000000
+#define DEFAULT_THREADS 8
+
+struct publisher {
+    pthread_t thread;
+    struct topic_table *topics;
+    char name[32];
+    long rounds;
+};
+
+struct creator {
+    pthread_t thread;
+    struct topic_table *topics;
+    volatile int stop;
+    long created;
+};
+
+static double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void *publish(void *arg) {
+    struct publisher *pub = arg;
+    struct topic *topic;
+    long i;
+
+    for (i = 0; i < pub->rounds; i++) {
+        topic = topic_find(pub->topics, pub->name);
+        if (topic == NULL) {
+            fprintf(stderr, "Topic %s not found\n", pub->name);
+            exit(EXIT_FAILURE);
+        }
+        pthread_rwlock_rdlock(topic->subscribers->listrwlock);
+        pthread_rwlock_unlock(topic->subscribers->listrwlock);
+    }
+
+    return NULL;
+}
+
+static void *create(void *arg) {
+    struct creator *creator = arg;
+    char name[32];
+
+    while (!creator->stop) {
+        sprintf(name, "new.%ld", creator->created++);
+        topic_ensure(creator->topics, name);
+    }
+
+    return NULL;
+}
+
+/* returns the nanoseconds per lookup, over all publishers */
+static double measure(struct topic_table *topics, int nthreads,
+        long rounds, struct creator *creator) {
+    struct publisher *pubs;
+    double start, ns;
+    int i;
+
+    pubs = malloc(nthreads * sizeof(struct publisher));
+    if (pubs == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (creator != NULL) {
+        creator->topics = topics;
+        creator->stop = 0;
+        if (pthread_create(&creator->thread, NULL, create, creator) != 0)
+            exit(EXIT_FAILURE);
+    }
+
+    start = now_ns();
+    for (i = 0; i < nthreads; i++) {
+        pubs[i].topics = topics;
+        pubs[i].rounds = rounds;
+        sprintf(pubs[i].name, "market.%d", i);
+        if (pthread_create(&pubs[i].thread, NULL, publish, &pubs[i]) != 0)
+            exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < nthreads; i++)
+        pthread_join(pubs[i].thread, NULL);
+    ns = (now_ns() - start) / ((double) rounds * nthreads);
+
+    if (creator != NULL) {
+        creator->stop = 1;
+        pthread_join(creator->thread, NULL);
+    }
+
+    free(pubs);
+    return ns;
+}
+
+static void usage(char *prog) {
+    fprintf(stderr, "usage: %s [-n rounds] [-t threads]\n", prog);
+    fprintf(stderr, "\trounds: lookups per publisher (default %d)\n",
+        DEFAULT_ROUNDS);
+    fprintf(stderr, "\tthreads: maximum number of publishers "
+        "(default %d)\n", DEFAULT_THREADS);
+}
+
+int main(int argc, char **argv) {
+    int opt, i, nthreads;
+    int maxthreads = DEFAULT_THREADS;
+    long rounds = DEFAULT_ROUNDS;
+    char name[32];
+    long created;
+    double ns;
+    struct topic_table topics;
+    struct creator creator;
+
+    while ((opt = getopt(argc, argv, "n:t:h")) != -1) {
+        switch (opt) {
+            case 'n':
+                rounds = atol(optarg);
+                break;
+            case 't':
+                maxthreads = atoi(optarg);
+                break;
+            default:
+                usage(argv[0]);
+                exit(opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+    }
+
+    if (rounds < 1 || maxthreads < 1) {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    topic_table_init(&topics);
+    creator.created = 0;
+    for (i = 0; i < maxthreads; i++) {
+        sprintf(name, "market.%d", i);
+        topic_ensure(&topics, name);
+    }
+
+    printf("%d shards\n", TOPIC_TABLE_SHARDS);
+    for (nthreads = 1; nthreads <= maxthreads; nthreads *= 2) {
+        ns = measure(&topics, nthreads, rounds, NULL);
+        printf("%3d publishers %8.1fns/lookup %8.2fM lookups/s\n",
+            nthreads, ns, 1e3 / ns);
+
+        created = creator.created;
+        ns = measure(&topics, nthreads, rounds, &creator);
+        printf("%3d publishers %8.1fns/lookup %8.2fM lookups/s, "
+            "%ld topics created\n", nthreads, ns, 1e3 / ns,
+            creator.created - created);
+
+        if (nthreads < maxthreads && 2 * nthreads > maxthreads)
+            nthreads = maxthreads / 2;
+    }
+
+    return EXIT_SUCCESS;
+}
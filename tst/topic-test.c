@@ -31,20 +31,34 @@ static void topic_after_test() {
 
 /* returns the number of topics the subscriber is subscribed
  * to. 0 if it does not exist */
-static int nsubs(struct list *list, struct subscriber *sub) {
-    struct node *topics = list->root;
+static int nsubs(struct topic_table *table, struct subscriber *sub) {
+    size_t i, j;
     int nsubs = 0;
-    for (; topics != NULL; topics = topics->next) {
-        struct topic *topic = topics->entry;
-        struct node *cur = topic->subscribers->root;
-        for (;cur != NULL; cur = cur->next) {
-           struct subscriber *cursub = cur->entry;
-           if (cursub == sub) nsubs++;
-        }           
+    for (i = 0; i < TOPIC_TABLE_SHARDS; i++) {
+        struct topic_shard *shard = &table->shards[i];
+        for (j = 0; j < shard->ntopics; j++) {
+            struct topic *topic = shard->byid[j];
+            struct node *cur = topic->subscribers->root;
+            for (;cur != NULL; cur = cur->next) {
+               struct subscription *cursub = cur->entry;
+               if (cursub->subscriber == sub) nsubs++;
+            }           
+        }
     }
     return nsubs;
 }
 
+/* returns the subscription of the subscriber to the topic */
+static struct subscription *subscription_of(struct topic_table *table,
+        char *name, struct subscriber *sub) {
+    struct node *cur = topic_find(table, name)->subscribers->root;
+    for (; cur != NULL; cur = cur->next) {
+        struct subscription *subscription = cur->entry;
+        if (subscription->subscriber == sub) return subscription;
+    }
+    return NULL;
+}
+
 static struct message *message_find_by_content(struct list *messages,
         char *content) {
 
@@ -59,9 +73,9 @@ static struct message *message_find_by_content(struct list *messages,
 
 void test_topic_add_subscriber() {
     int ret;
-    struct list ts;
+    struct topic_table ts;
 
-    list_init(&ts);
+    topic_table_init(&ts);
 
     struct subscriber sub1 = {&c1, "hans"};
     struct subscriber sub2 = {&c2, "jakob"};
@@ -69,45 +83,86 @@ void test_topic_add_subscriber() {
 
     ret = topic_add_subscriber(&ts, "stocks", &sub1);
     CU_ASSERT_EQUAL_FATAL(0, ret);
-    CU_ASSERT_EQUAL_FATAL(1, list_len(&ts));
+    CU_ASSERT_EQUAL_FATAL(1, topic_table_len(&ts));
     CU_ASSERT_EQUAL_FATAL(1, nsubs(&ts, &sub1));
     CU_ASSERT_EQUAL_FATAL(0, nsubs(&ts, &sub2));
     CU_ASSERT_EQUAL_FATAL(0, nsubs(&ts, &sub3));
 
     ret = topic_add_subscriber(&ts, "stocks", &sub2);
     CU_ASSERT_EQUAL_FATAL(0, ret);
-    CU_ASSERT_EQUAL_FATAL(1, list_len(&ts));
+    CU_ASSERT_EQUAL_FATAL(1, topic_table_len(&ts));
     CU_ASSERT_EQUAL_FATAL(1, nsubs(&ts, &sub1));
     CU_ASSERT_EQUAL_FATAL(1, nsubs(&ts, &sub2));
     CU_ASSERT_EQUAL_FATAL(0, nsubs(&ts, &sub3));
 
     ret = topic_add_subscriber(&ts, "bounds", &sub2);
     CU_ASSERT_EQUAL_FATAL(0, ret);
-    CU_ASSERT_EQUAL_FATAL(2, list_len(&ts));
+    CU_ASSERT_EQUAL_FATAL(2, topic_table_len(&ts));
     CU_ASSERT_EQUAL_FATAL(1, nsubs(&ts, &sub1));
     CU_ASSERT_EQUAL_FATAL(2, nsubs(&ts, &sub2));
     CU_ASSERT_EQUAL_FATAL(0, nsubs(&ts, &sub3));
 
     ret = topic_add_subscriber(&ts, "stocks", &sub3);
     CU_ASSERT_EQUAL_FATAL(0, ret);
-    CU_ASSERT_EQUAL_FATAL(2, list_len(&ts));
+    CU_ASSERT_EQUAL_FATAL(2, topic_table_len(&ts));
     CU_ASSERT_EQUAL_FATAL(1, nsubs(&ts, &sub1));
     CU_ASSERT_EQUAL_FATAL(2, nsubs(&ts, &sub2));
     CU_ASSERT_EQUAL_FATAL(1, nsubs(&ts, &sub3));
 }
 
+void test_topic_table() {
+    int i;
+    char name[16];
+    unsigned long ids[8 * TOPIC_SHARD_BUCKETS * TOPIC_TABLE_SHARDS];
+    struct topic_shard *shard;
+    struct topic_table ts;
+    const int n = sizeof(ids) / sizeof(ids[0]);
+
+    topic_table_init(&ts);
+
+    // enough topics for the buckets of the shards to grow
+    for (i = 0; i < n; i++) {
+        sprintf(name, "topic-%d", i);
+        ids[i] = topic_ensure(&ts, name);
+        CU_ASSERT_NOT_EQUAL_FATAL(0, ids[i]);
+    }
+    CU_ASSERT_EQUAL_FATAL(n, topic_table_len(&ts));
+
+    // the topics are spread over the shards
+    for (i = 0; i < TOPIC_TABLE_SHARDS; i++) {
+        shard = &ts.shards[i];
+        CU_ASSERT_TRUE_FATAL(shard->ntopics > 0);
+        CU_ASSERT_TRUE_FATAL(shard->nbuckets >= shard->ntopics);
+    }
+
+    // all are found by name and id
+    for (i = 0; i < n; i++) {
+        sprintf(name, "topic-%d", i);
+        CU_ASSERT_EQUAL_FATAL(ids[i], topic_ensure(&ts, name));
+        CU_ASSERT_EQUAL_FATAL(ids[i], topic_find(&ts, name)->id);
+        CU_ASSERT_STRING_EQUAL_FATAL(name, topic_name(&ts, ids[i]));
+    }
+    CU_ASSERT_EQUAL_FATAL(n, topic_table_len(&ts));
+
+    CU_ASSERT_PTR_NULL_FATAL(topic_find(&ts, "topic-none"));
+    CU_ASSERT_PTR_NULL_FATAL(topic_name(&ts, 0));
+    CU_ASSERT_PTR_NULL_FATAL(topic_name(&ts, n * TOPIC_TABLE_SHARDS + 1));
+}
+
 void test_topic_init_and_destroy() {
     int ret;
 
     struct topic t;
-    struct subscriber sub;
+    struct subscription *sub = malloc(sizeof(struct subscription));
     
     ret = topic_init(&t);   
     CU_ASSERT_EQUAL_FATAL(0, ret);
+    CU_ASSERT_EQUAL_FATAL(0, t.nextoffset);
 
     // would fail if list of subscribers
     // was not correctly initialized
-    ret = list_add(t.subscribers, &sub);
+    subscription_init(sub);
+    ret = list_add(t.subscribers, sub);
     CU_ASSERT_EQUAL_FATAL(0, ret);
 
     ret = topic_destroy(&t);   
@@ -115,11 +170,39 @@ void test_topic_init_and_destroy() {
     CU_ASSERT_PTR_NULL_FATAL(t.subscribers);
 }
 
+void test_topic_destroy_messages() {
+    int ret;
+    struct topic t;
+    struct frame *frame;
+    struct message *msg = malloc(sizeof(struct message));
+
+    ret = topic_init(&t);
+    CU_ASSERT_EQUAL_FATAL(0, ret);
+
+    // a message still in the log, along with its frame
+    message_init(msg);
+    msg->content = strdup("price: 33");
+    msg->contentlen = 9;
+    ret = frame_create_heartbeat(0, &frame);
+    CU_ASSERT_EQUAL_FATAL(0, ret);
+    msg->frames[0] = frame;
+    frame_ref(frame);
+    ret = list_add(t.messages, msg);
+    CU_ASSERT_EQUAL_FATAL(0, ret);
+
+    // the topic destroys it and lets go of the frame
+    ret = topic_destroy(&t);
+    CU_ASSERT_EQUAL_FATAL(0, ret);
+    CU_ASSERT_PTR_NULL_FATAL(t.messages);
+    CU_ASSERT_EQUAL_FATAL(1, frame->refs);
+    frame_unref(frame);
+}
+
 void test_topic_remove_subscriber() {
     int ret;
-    struct list ts;
+    struct topic_table ts;
 
-    list_init(&ts);
+    topic_table_init(&ts);
 
     struct subscriber sub1 = {&c1, "hans"};
     struct subscriber sub2 = {&c2, "jakob"};
@@ -148,36 +231,38 @@ void test_topic_remove_subscriber() {
     CU_ASSERT_EQUAL_FATAL(0, nsubs(&ts, &sub3));
 
     // topics are not removed
-    CU_ASSERT_EQUAL_FATAL(2, list_len(&ts));
+    CU_ASSERT_EQUAL_FATAL(2, topic_table_len(&ts));
 }
 
 void test_add_message_1() {
     topic_before_test();
     int ret;
-    struct list topics;
-    struct list messages;
+    struct topic_table topics;
+    struct list *messages;
     struct message *msg;
-    struct list *stats;
-    struct msg_statistics *msgstats;
+    struct subscription *subscription;
     struct subscriber sub1 = {&c1, "hans"};
-    list_init(&topics);
-    list_init(&messages);
+    topic_table_init(&topics);
 
     topic_add_subscriber(&topics, "stocks", &sub1);
+    messages = topic_find(&topics, "stocks")->messages;
 
     // single message
-    ret = topic_add_message(&topics, &messages, "stocks", "price: 33");
+    ret = topic_add_message(&topics, "stocks", NULL, 0,
+        "price: 33", 9);
     CU_ASSERT_EQUAL_FATAL(0, ret);
-    CU_ASSERT_EQUAL_FATAL(1, list_len(&messages));
-    msg = message_find_by_content(&messages, "price: 33");
+    CU_ASSERT_EQUAL_FATAL(1, list_len(messages));
+    msg = message_find_by_content(messages, "price: 33");
     CU_ASSERT_PTR_NOT_NULL_FATAL(msg);
     CU_ASSERT_STRING_EQUAL_FATAL("stocks", msg->topicname);
-    stats = msg->stats;
-    CU_ASSERT_EQUAL_FATAL(1, list_len(stats));
-    msgstats = stats->root->entry;
-    CU_ASSERT_EQUAL_FATAL(0, msgstats->last_fail);
-    CU_ASSERT_EQUAL_FATAL(0, msgstats->nattempts);
-    CU_ASSERT_EQUAL_FATAL(&sub1, msgstats->subscriber);
+    CU_ASSERT_EQUAL_FATAL(0, msg->offset);
+    CU_ASSERT_EQUAL_FATAL(1, topic_find(&topics, "stocks")->nextoffset);
+
+    // yet to be delivered
+    subscription = subscription_of(&topics, "stocks", &sub1);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(subscription);
+    CU_ASSERT_EQUAL_FATAL(0, subscription->cursor);
+    CU_ASSERT_EQUAL_FATAL(0, subscription->retrying);
 
     topic_after_test();
 }
@@ -185,90 +270,73 @@ void test_add_message_1() {
 void test_add_message_2() {
     topic_before_test();
     int ret;
-    struct list topics;
-    struct list messages;
+    struct topic_table topics;
+    struct list *messages;
     struct message *msg;
-    struct list *stats;
-    struct msg_statistics *msgstats;
     struct subscriber sub1 = {&c1, "hans"};
     struct subscriber sub2 = {&c2, "jakob"};
-    list_init(&topics);
-    list_init(&messages);
+    topic_table_init(&topics);
 
     topic_add_subscriber(&topics, "stocks", &sub1);
+    messages = topic_find(&topics, "stocks")->messages;
     topic_add_subscriber(&topics, "stocks", &sub2);
 
-    // single message
-    ret = topic_add_message(&topics, &messages, "stocks", "price: 33");
+    // single message, only once for both
+    ret = topic_add_message(&topics, "stocks", NULL, 0,
+        "price: 33", 9);
     CU_ASSERT_EQUAL_FATAL(0, ret);
-    CU_ASSERT_EQUAL_FATAL(1, list_len(&messages));
-    msg = message_find_by_content(&messages, "price: 33");
+    CU_ASSERT_EQUAL_FATAL(1, list_len(messages));
+    msg = message_find_by_content(messages, "price: 33");
     CU_ASSERT_PTR_NOT_NULL_FATAL(msg);
     CU_ASSERT_STRING_EQUAL_FATAL("stocks", msg->topicname);
-    stats = msg->stats;
-    CU_ASSERT_EQUAL_FATAL(2, list_len(stats));
-    msgstats = stats->root->entry;
-    CU_ASSERT_EQUAL_FATAL(0, msgstats->last_fail);
-    CU_ASSERT_EQUAL_FATAL(0, msgstats->nattempts);
-    CU_ASSERT_EQUAL_FATAL(&sub1, msgstats->subscriber);
-    msgstats = stats->root->next->entry;
-    CU_ASSERT_EQUAL_FATAL(0, msgstats->last_fail);
-    CU_ASSERT_EQUAL_FATAL(0, msgstats->nattempts);
-    CU_ASSERT_EQUAL_FATAL(&sub2, msgstats->subscriber);
+    CU_ASSERT_EQUAL_FATAL(0, msg->offset);
+    CU_ASSERT_EQUAL_FATAL(0,
+        subscription_of(&topics, "stocks", &sub1)->cursor);
+    CU_ASSERT_EQUAL_FATAL(0,
+        subscription_of(&topics, "stocks", &sub2)->cursor);
     topic_after_test();
 }
 
 void test_add_message_3() {
     topic_before_test();
     int ret;
-    struct list topics;
-    struct list messages;
+    struct topic_table topics;
+    struct list *messages;
     struct message *msg;
-    struct list *stats;
-    struct msg_statistics *msgstats;
     struct subscriber sub1 = {&c1, "hans"};
     struct subscriber sub2 = {&c2, "jakob"};
-    list_init(&topics);
-    list_init(&messages);
+    topic_table_init(&topics);
 
     topic_add_subscriber(&topics, "stocks", &sub1);
+    messages = topic_find(&topics, "stocks")->messages;
     topic_add_subscriber(&topics, "stocks", &sub2);
 
     // two messages
-    ret = topic_add_message(&topics, &messages, "stocks", "price: 33");
-    ret = topic_add_message(&topics, &messages, "stocks", "price: 34");
+    ret = topic_add_message(&topics, "stocks", NULL, 0,
+        "price: 33", 9);
+    ret = topic_add_message(&topics, "stocks", NULL, 0,
+        "price: 34", 9);
     CU_ASSERT_EQUAL_FATAL(0, ret);
-    CU_ASSERT_EQUAL_FATAL(2, list_len(&messages));
+    CU_ASSERT_EQUAL_FATAL(2, list_len(messages));
+    CU_ASSERT_EQUAL_FATAL(2, topic_find(&topics, "stocks")->nextoffset);
 
     // first msg
-    msg = message_find_by_content(&messages, "price: 33");
+    msg = message_find_by_content(messages, "price: 33");
     CU_ASSERT_PTR_NOT_NULL_FATAL(msg);
     CU_ASSERT_STRING_EQUAL_FATAL("stocks", msg->topicname);
-    stats = msg->stats;
-    CU_ASSERT_EQUAL_FATAL(2, list_len(stats));
-    msgstats = stats->root->entry;
-    CU_ASSERT_EQUAL_FATAL(0, msgstats->last_fail);
-    CU_ASSERT_EQUAL_FATAL(0, msgstats->nattempts);
-    CU_ASSERT_EQUAL_FATAL(&sub1, msgstats->subscriber);
-    msgstats = stats->root->next->entry;
-    CU_ASSERT_EQUAL_FATAL(0, msgstats->last_fail);
-    CU_ASSERT_EQUAL_FATAL(0, msgstats->nattempts);
-    CU_ASSERT_EQUAL_FATAL(&sub2, msgstats->subscriber);
+    CU_ASSERT_EQUAL_FATAL(0, msg->offset);
 
     // second msg
-    msg = message_find_by_content(&messages, "price: 34");
+    msg = message_find_by_content(messages, "price: 34");
     CU_ASSERT_PTR_NOT_NULL_FATAL(msg);
     CU_ASSERT_STRING_EQUAL_FATAL("stocks", msg->topicname);
-    stats = msg->stats;
-    CU_ASSERT_EQUAL_FATAL(2, list_len(stats));
-    msgstats = stats->root->entry;
-    CU_ASSERT_EQUAL_FATAL(0, msgstats->last_fail);
-    CU_ASSERT_EQUAL_FATAL(0, msgstats->nattempts);
-    CU_ASSERT_EQUAL_FATAL(&sub1, msgstats->subscriber);
-    msgstats = stats->root->next->entry;
-    CU_ASSERT_EQUAL_FATAL(0, msgstats->last_fail);
-    CU_ASSERT_EQUAL_FATAL(0, msgstats->nattempts);
-    CU_ASSERT_EQUAL_FATAL(&sub2, msgstats->subscriber);
+    CU_ASSERT_EQUAL_FATAL(1, msg->offset);
+
+    // both are yet to receive both
+    CU_ASSERT_EQUAL_FATAL(0,
+        subscription_of(&topics, "stocks", &sub1)->cursor);
+    CU_ASSERT_EQUAL_FATAL(0,
+        subscription_of(&topics, "stocks", &sub2)->cursor);
     topic_after_test();
 }
 
@@ -276,82 +344,55 @@ void test_add_message_3() {
 void test_add_message_late_subscriber() {
     topic_before_test();
     int ret;
-    struct list topics;
-    struct list messages;
+    struct topic_table topics;
+    struct list *messages;
     struct message *msg;
-    struct list *stats;
-    struct msg_statistics *msgstats;
     struct subscriber sub1 = {&c1, "hans"};
     struct subscriber sub2 = {&c2, "jakob"};
-    list_init(&topics);
-    list_init(&messages);
+    topic_table_init(&topics);
 
     topic_add_subscriber(&topics, "stocks", &sub1);
+    messages = topic_find(&topics, "stocks")->messages;
 
     // send first message
-    ret = topic_add_message(&topics, &messages, "stocks", "price: 33");
+    ret = topic_add_message(&topics, "stocks", NULL, 0,
+        "price: 33", 9);
     CU_ASSERT_EQUAL_FATAL(0, ret);
-    CU_ASSERT_EQUAL_FATAL(1, list_len(&messages));
-
-    // first msg: only sub1
-    msg = message_find_by_content(&messages, "price: 33");
-    CU_ASSERT_PTR_NOT_NULL_FATAL(msg);
-    CU_ASSERT_STRING_EQUAL_FATAL("stocks", msg->topicname);
-    stats = msg->stats;
-    CU_ASSERT_EQUAL_FATAL(1, list_len(stats));
-    msgstats = stats->root->entry;
-    CU_ASSERT_EQUAL_FATAL(0, msgstats->last_fail);
-    CU_ASSERT_EQUAL_FATAL(0, msgstats->nattempts);
-    CU_ASSERT_EQUAL_FATAL(&sub1, msgstats->subscriber);
+    CU_ASSERT_EQUAL_FATAL(1, list_len(messages));
 
     // snd msg: both
     topic_add_subscriber(&topics, "stocks", &sub2);
-    ret = topic_add_message(&topics, &messages, "stocks", "price: 34");
+    ret = topic_add_message(&topics, "stocks", NULL, 0,
+        "price: 34", 9);
     CU_ASSERT_EQUAL_FATAL(0, ret);
-    CU_ASSERT_EQUAL_FATAL(2, list_len(&messages));
-    // first still only has one sub
-    msg = message_find_by_content(&messages, "price: 33");
+    CU_ASSERT_EQUAL_FATAL(2, list_len(messages));
+    msg = message_find_by_content(messages, "price: 34");
     CU_ASSERT_PTR_NOT_NULL_FATAL(msg);
-    CU_ASSERT_STRING_EQUAL_FATAL("stocks", msg->topicname);
-    stats = msg->stats;
-    CU_ASSERT_EQUAL_FATAL(1, list_len(stats));
-    msgstats = stats->root->entry;
-    CU_ASSERT_EQUAL_FATAL(0, msgstats->last_fail);
-    CU_ASSERT_EQUAL_FATAL(0, msgstats->nattempts);
-    CU_ASSERT_EQUAL_FATAL(&sub1, msgstats->subscriber);
-    // second has two subs
-    msg = message_find_by_content(&messages, "price: 34");
-    CU_ASSERT_PTR_NOT_NULL_FATAL(msg);
-    CU_ASSERT_STRING_EQUAL_FATAL("stocks", msg->topicname);
-    stats = msg->stats;
-    CU_ASSERT_EQUAL_FATAL(2, list_len(stats));
-    msgstats = stats->root->entry;
-    CU_ASSERT_EQUAL_FATAL(0, msgstats->last_fail);
-    CU_ASSERT_EQUAL_FATAL(0, msgstats->nattempts);
-    CU_ASSERT_EQUAL_FATAL(&sub1, msgstats->subscriber);
-    msgstats = stats->root->next->entry;
-    CU_ASSERT_EQUAL_FATAL(0, msgstats->last_fail);
-    CU_ASSERT_EQUAL_FATAL(0, msgstats->nattempts);
-    CU_ASSERT_EQUAL_FATAL(&sub2, msgstats->subscriber);
+    CU_ASSERT_EQUAL_FATAL(1, msg->offset);
+
+    // sub1 is to receive both, sub2 starts after the first
+    CU_ASSERT_EQUAL_FATAL(0,
+        subscription_of(&topics, "stocks", &sub1)->cursor);
+    CU_ASSERT_EQUAL_FATAL(1,
+        subscription_of(&topics, "stocks", &sub2)->cursor);
     topic_after_test();
 }
 
 void test_add_message_dead_subscriber() {
     topic_before_test();
     int ret;
-    struct list topics;
-    struct list messages;
+    struct topic_table topics;
     struct subscriber sub1 = {&c1, "hans"};
-    list_init(&topics);
-    list_init(&messages);
+    topic_table_init(&topics);
 
     topic_add_subscriber(&topics, "stocks", &sub1);
 
-    // set client 1 to dead, should not be copied to
-    // statistics for message anymore
+    // set client 1 to dead, no message
+    // is to be delivered to it anymore
     c1.dead = 1;
 
-    ret = topic_add_message(&topics, &messages, "stocks", "price: 33");
+    ret = topic_add_message(&topics, "stocks", NULL, 0,
+        "price: 33", 9);
     CU_ASSERT_EQUAL_FATAL(TOPIC_NO_SUBSCRIBERS, ret);
     topic_after_test();
 }
@@ -359,145 +400,188 @@ void test_add_message_dead_subscriber() {
 void test_add_message_dead_subscriber_2() {
     topic_before_test();
     int ret;
-    struct list topics;
-    struct list messages;
+    struct topic_table topics;
+    struct list *messages;
     struct message *msg;
-    struct msg_statistics *msgstats;
     struct subscriber sub1 = {&c1, "hans"};
     struct subscriber sub2 = {&c2, "jakob"};
-    list_init(&topics);
-    list_init(&messages);
+    topic_table_init(&topics);
 
     topic_add_subscriber(&topics, "stocks", &sub1);
+    messages = topic_find(&topics, "stocks")->messages;
     topic_add_subscriber(&topics, "stocks", &sub2);
 
-    // set client 1 to dead, should not be copied to
-    // statistics for message anymore
+    // set client 1 to dead, the message
+    // is still sent for client 2
     c1.dead = 1;
 
-    ret = topic_add_message(&topics, &messages, "stocks", "price: 33");
+    ret = topic_add_message(&topics, "stocks", NULL, 0,
+        "price: 33", 9);
     assert(ret == 0);
-    msg = messages.root->entry;
-    CU_ASSERT_EQUAL_FATAL(1, list_len(msg->stats));
-    msgstats = msg->stats->root->entry;
-    CU_ASSERT_EQUAL_FATAL(&sub2, msgstats->subscriber);
+    CU_ASSERT_EQUAL_FATAL(1, list_len(messages));
+    msg = messages->root->entry;
+    CU_ASSERT_EQUAL_FATAL(0, msg->offset);
     topic_after_test();
 }
 
 
 void test_add_message_5() {
     int ret;
-    struct list topics;
-    struct list messages;
-    list_init(&topics);
-    list_init(&messages);
+    struct topic_table topics;
+    topic_table_init(&topics);
     // inexistent topic
-    ret = topic_add_message(&topics, &messages, "foo", "price: 33");
+    ret = topic_add_message(&topics, "foo", NULL, 0, "price: 33", 9);
     CU_ASSERT_EQUAL_FATAL(TOPIC_NOT_FOUND, ret);
 }
 
-void test_add_message_no_subscriber() {
-    int ret;
-    struct list topics;
-    struct list messages;
-    struct subscriber sub1 = {&c1, "hans"};
-    list_init(&topics);
-    list_init(&messages);
-    // add and remove sub to create topic
-    topic_add_subscriber(&topics, "stocks", &sub1);
-    topic_remove_subscriber(&topics, &sub1);
-
-    ret = topic_add_message(&topics, &messages, "stocks", "price: 33");
-    CU_ASSERT_EQUAL_FATAL(TOPIC_NO_SUBSCRIBERS, ret);
-}
-
-void test_msg_remove_subscriber_first() {
+void test_add_messages() {
     topic_before_test();
     int ret;
-    struct list topics;
-    struct list messages;
+    struct topic_table topics;
+    struct list *messages;
     struct subscriber sub1 = {&c1, "hans"};
     struct subscriber sub2 = {&c2, "jakob"};
-    struct message *msg;
-    struct msg_statistics *stat;
-    list_init(&topics);
-    list_init(&messages);
+    struct stomp_header hdr = {"x-app", "ticker"};
+    struct iovec bodies[3] = {{"a", 1}, {"b\0c", 3}, {"d", 1}};
+    struct message *msgs[3];
+    struct node *cur;
+    int i;
+    topic_table_init(&topics);
     topic_add_subscriber(&topics, "stocks", &sub1);
+    messages = topic_find(&topics, "stocks")->messages;
     topic_add_subscriber(&topics, "stocks", &sub2);
-    topic_add_message(&topics, &messages, "stocks", "price: 33");
 
-    ret = message_remove_subscriber(&messages, &sub1);
+    ret = topic_add_messages(&topics, "stocks", &hdr, 1,
+        bodies, 3);
     CU_ASSERT_EQUAL_FATAL(0, ret);
-    msg = message_find_by_content(&messages, "price: 33");
-    CU_ASSERT_EQUAL_FATAL(1, list_len(msg->stats));
-    stat = msg->stats->root->entry;
-    CU_ASSERT_EQUAL_FATAL(&sub2, stat->subscriber);
+    CU_ASSERT_EQUAL_FATAL(3, list_len(messages));
+
+    // each one on its own and in order
+    for (i = 0, cur = messages->root; cur != NULL; i++, cur = cur->next)
+        msgs[i] = cur->entry;
+    for (i = 0; i < 3; i++) {
+        CU_ASSERT_EQUAL_FATAL(bodies[i].iov_len, msgs[i]->contentlen);
+        CU_ASSERT_EQUAL_FATAL(0, memcmp(bodies[i].iov_base,
+            msgs[i]->content, bodies[i].iov_len));
+        CU_ASSERT_EQUAL_FATAL(i, msgs[i]->offset);
+        CU_ASSERT_EQUAL_FATAL(1, msgs[i]->nheaders);
+        CU_ASSERT_STRING_EQUAL_FATAL("ticker", msgs[i]->headers[0].val);
+
+        // the frame starts the same for all of them
+        CU_ASSERT_EQUAL_FATAL(strlen("MESSAGE\ndestination:stocks\n"),
+            msgs[i]->prefixlen);
+        CU_ASSERT_EQUAL_FATAL(0, memcmp("MESSAGE\ndestination:stocks\n",
+            msgs[i]->prefix, msgs[i]->prefixlen));
+    }
+    CU_ASSERT_PTR_EQUAL_FATAL(msgs[0]->prefix, msgs[2]->prefix);
+    CU_ASSERT_EQUAL_FATAL(msgs[0]->id + 1, msgs[1]->id);
+    CU_ASSERT_EQUAL_FATAL(msgs[1]->id + 1, msgs[2]->id);
+
+    // none of them without a topic
+    ret = topic_add_messages(&topics, "bonds", NULL, 0,
+        bodies, 3);
+    CU_ASSERT_EQUAL_FATAL(TOPIC_NOT_FOUND, ret);
+    CU_ASSERT_EQUAL_FATAL(3, list_len(messages));
     topic_after_test();
 }
 
-void test_msg_remove_subscriber_second() {
-    topic_before_test();
+void test_add_message_no_subscriber() {
     int ret;
-    struct list topics;
-    struct list messages;
+    struct topic_table topics;
     struct subscriber sub1 = {&c1, "hans"};
-    struct subscriber sub2 = {&c2, "jakob"};
-    struct message *msg;
-    struct msg_statistics *stat;
-    list_init(&topics);
-    list_init(&messages);
+    topic_table_init(&topics);
+    // add and remove sub to create topic
     topic_add_subscriber(&topics, "stocks", &sub1);
-    topic_add_subscriber(&topics, "stocks", &sub2);
-    topic_add_message(&topics, &messages, "stocks", "price: 33");
+    topic_remove_subscriber(&topics, &sub1);
 
-    ret = message_remove_subscriber(&messages, &sub2);
-    CU_ASSERT_EQUAL_FATAL(0, ret);
-    msg = message_find_by_content(&messages, "price: 33");
-    CU_ASSERT_EQUAL_FATAL(1, list_len(msg->stats));
-    stat = msg->stats->root->entry;
-    CU_ASSERT_EQUAL_FATAL(&sub1, stat->subscriber);
-    topic_after_test();
+    ret = topic_add_message(&topics, "stocks", NULL, 0,
+        "price: 33", 9);
+    CU_ASSERT_EQUAL_FATAL(TOPIC_NO_SUBSCRIBERS, ret);
 }
 
-void test_msg_remove_subscriber_last() {
+static void count_topic_messages(struct topic *topic, void *arg) {
+    *(int *) arg += list_len(topic->messages);
+}
+
+void test_add_message_own_queue() {
     topic_before_test();
-    int ret;
-    struct list topics;
-    struct list messages;
+    int ret, nmsgs = 0;
+    struct topic_table topics;
+    struct topic *stocks, *bonds;
+    struct message *msg;
     struct subscriber sub1 = {&c1, "hans"};
+    struct subscriber sub2 = {&c2, "peter"};
+    topic_table_init(&topics);
 
-    // one message
-    list_init(&topics);
-    list_init(&messages);
     topic_add_subscriber(&topics, "stocks", &sub1);
-    topic_add_message(&topics, &messages, "stocks", "price: 33");
-    ret = message_remove_subscriber(&messages, &sub1);
-    CU_ASSERT_EQUAL_FATAL(0, ret);
+    topic_add_subscriber(&topics, "bonds", &sub2);
+    stocks = topic_find(&topics, "stocks");
+    bonds = topic_find(&topics, "bonds");
 
-    // two messages
-    list_init(&topics);
-    list_init(&messages);
-    topic_add_subscriber(&topics, "stocks", &sub1);
-    topic_add_message(&topics, &messages, "stocks", "price: 33");
-    topic_add_message(&topics, &messages, "stocks", "price: 34");
-    ret = message_remove_subscriber(&messages, &sub1);
+    ret = topic_add_message(&topics, "stocks", NULL, 0, "price: 33", 9);
+    CU_ASSERT_EQUAL_FATAL(0, ret);
+    ret = topic_add_message(&topics, "bonds", NULL, 0, "yield: 2", 8);
+    CU_ASSERT_EQUAL_FATAL(0, ret);
+    ret = topic_add_message(&topics, "stocks", NULL, 0, "price: 34", 9);
     CU_ASSERT_EQUAL_FATAL(0, ret);
+
+    // each topic only holds its own messages, in order
+    CU_ASSERT_EQUAL_FATAL(2, list_len(stocks->messages));
+    msg = stocks->messages->root->entry;
+    CU_ASSERT_STRING_EQUAL_FATAL("price: 33", msg->content);
+    msg = stocks->messages->root->next->entry;
+    CU_ASSERT_STRING_EQUAL_FATAL("price: 34", msg->content);
+    CU_ASSERT_EQUAL_FATAL(1, list_len(bonds->messages));
+    msg = bonds->messages->root->entry;
+    CU_ASSERT_STRING_EQUAL_FATAL("yield: 2", msg->content);
+    CU_ASSERT_STRING_EQUAL_FATAL("bonds", msg->topicname);
+
+    // every topic is visited once
+    CU_ASSERT_EQUAL_FATAL(2,
+        topic_foreach(&topics, count_topic_messages, &nmsgs));
+    CU_ASSERT_EQUAL_FATAL(3, nmsgs);
+
     topic_after_test();
 }
 
-void test_msg_remove_subscriber_not_subscribed() {
+void test_subscription_retry() {
+    struct subscription sub;
+
+    subscription_init(&sub);
+    sub.cursor = 10;
+    CU_ASSERT_EQUAL_FATAL(10, subscription_oldest(&sub));
+
+    // the failed delivery is needed until it is retried
+    subscription_set_retry(&sub, 7, 100);
+    CU_ASSERT_EQUAL_FATAL(1, sub.retrying);
+    CU_ASSERT_EQUAL_FATAL(7, subscription_oldest(&sub));
+    CU_ASSERT_EQUAL_FATAL(7, sub.retry.offset);
+    CU_ASSERT_EQUAL_FATAL(1, sub.retry.nattempts);
+    CU_ASSERT_EQUAL_FATAL(100, sub.retry.last_fail);
+
+    subscription_clear_retry(&sub);
+    CU_ASSERT_EQUAL_FATAL(0, sub.retrying);
+    CU_ASSERT_EQUAL_FATAL(10, subscription_oldest(&sub));
+
+    // another one once the cursor has moved on
+    sub.cursor = 12;
+    subscription_set_retry(&sub, 11, 101);
+    CU_ASSERT_EQUAL_FATAL(11, subscription_oldest(&sub));
+    CU_ASSERT_EQUAL_FATAL(101, sub.retry.last_fail);
+
+    subscription_destroy(&sub);
+    CU_ASSERT_PTR_NULL_FATAL(sub.rwlock);
+    CU_ASSERT_EQUAL_FATAL(0, sub.retrying);
+}
+
+void test_subscriber_is_dead() {
     topic_before_test();
-    struct list topics;
-    struct list messages;
     struct subscriber sub1 = {&c1, "hans"};
-    struct subscriber sub2 = {&c2, "jakob"};
-    list_init(&topics);
-    list_init(&messages);
-    topic_add_subscriber(&topics, "stocks", &sub1);
-    topic_add_message(&topics, &messages, "stocks", "price: 33");
 
-    int ret = message_remove_subscriber(&messages, &sub2);
-    CU_ASSERT_EQUAL_FATAL(0, ret);
+    CU_ASSERT_FALSE_FATAL(subscriber_is_dead(&sub1));
+    c1.dead = 1;
+    CU_ASSERT_TRUE_FATAL(subscriber_is_dead(&sub1));
+    c1.dead = 0;
     topic_after_test();
 }
 
@@ -526,22 +610,24 @@ void topic_add_topic_suite() {
     CU_add_test(topicSuite, "test_add_message_late_subscriber",
         test_add_message_late_subscriber);
     CU_add_test(topicSuite, "test_add_message_5", test_add_message_5);
+    CU_add_test(topicSuite, "test_add_messages", test_add_messages);
+    CU_add_test(topicSuite, "test_add_message_own_queue",
+        test_add_message_own_queue);
     CU_add_test(topicSuite, "test_add_message_no_subscriber",
         test_add_message_no_subscriber);
     CU_add_test(topicSuite, "test_add_message_dead_subscriber",
         test_add_message_dead_subscriber);
     CU_add_test(topicSuite, "test_add_message_dead_subscriber_2",
         test_add_message_dead_subscriber_2);
-    CU_add_test(topicSuite, "test_msg_remove_subscriber_first",
-        test_msg_remove_subscriber_first);
-    CU_add_test(topicSuite, "test_msg_remove_subscriber_second",
-        test_msg_remove_subscriber_second);
-    CU_add_test(topicSuite, "test_msg_remove_subscriber_last",
-        test_msg_remove_subscriber_last);
-    CU_add_test(topicSuite, "test_msg_remove_subscriber_not_subscribed",
-        test_msg_remove_subscriber_not_subscribed);
+    CU_add_test(topicSuite, "test_subscription_retry",
+        test_subscription_retry);
+    CU_add_test(topicSuite, "test_topic_table", test_topic_table);
     CU_add_test(topicSuite, "test_topic_init_and_destroy",
         test_topic_init_and_destroy);
+    CU_add_test(topicSuite, "test_topic_destroy_messages",
+        test_topic_destroy_messages);
+    CU_add_test(topicSuite, "test_subscriber_is_dead",
+        test_subscriber_is_dead);
     CU_add_test(topicSuite, "test_topic_strerror",
         test_topic_strerror);
 }
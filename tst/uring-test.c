@@ -0,0 +1,116 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <assert.h>
+#include <sys/socket.h>
+
+#include <CUnit/CUnit.h>
+#include <CUnit/Basic.h>
+
+#include "../src/uring.h"
+
+void test_uring_nop() {
+    int ret;
+    struct uring ring;
+    struct io_uring_sqe *sqe;
+    struct io_uring_cqe *cqe;
+
+    ret = uring_init(&ring, 4);
+    if (ret == URING_UNSUPPORTED) return;
+    CU_ASSERT_EQUAL_FATAL(0, ret);
+
+    sqe = uring_get_sqe(&ring);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(sqe);
+    sqe->opcode = IORING_OP_NOP;
+    sqe->user_data = 1;
+    sqe = uring_get_sqe(&ring);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(sqe);
+    sqe->opcode = IORING_OP_NOP;
+    sqe->user_data = 2;
+
+    // nothing has been submitted yet
+    CU_ASSERT_PTR_NULL_FATAL(uring_peek_cqe(&ring));
+
+    // both with a single syscall
+    CU_ASSERT_EQUAL_FATAL(0, uring_enter(&ring, 2, -1));
+
+    cqe = uring_peek_cqe(&ring);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(cqe);
+    CU_ASSERT_EQUAL_FATAL(1, cqe->user_data);
+    uring_cqe_seen(&ring);
+
+    cqe = uring_peek_cqe(&ring);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(cqe);
+    CU_ASSERT_EQUAL_FATAL(2, cqe->user_data);
+    uring_cqe_seen(&ring);
+
+    CU_ASSERT_PTR_NULL_FATAL(uring_peek_cqe(&ring));
+
+    uring_destroy(&ring);
+}
+
+void test_uring_full() {
+    int i, ret;
+    struct uring ring;
+    struct io_uring_sqe *sqe;
+
+    ret = uring_init(&ring, 2);
+    if (ret == URING_UNSUPPORTED) return;
+    CU_ASSERT_EQUAL_FATAL(0, ret);
+
+    // more entries than fit into the ring
+    for (i = 0; i < 3; i++) {
+        sqe = uring_get_sqe(&ring);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(sqe);
+        sqe->opcode = IORING_OP_NOP;
+    }
+    CU_ASSERT_EQUAL_FATAL(0, uring_enter(&ring, 3, 1000));
+
+    for (i = 0; i < 3; i++) {
+        CU_ASSERT_PTR_NOT_NULL_FATAL(uring_peek_cqe(&ring));
+        uring_cqe_seen(&ring);
+    }
+
+    uring_destroy(&ring);
+}
+
+void test_uring_timeout() {
+    int ret;
+    int fds[2];
+    char buf[8];
+    struct uring ring;
+    struct io_uring_sqe *sqe;
+
+    ret = uring_init(&ring, 4);
+    if (ret == URING_UNSUPPORTED) return;
+    CU_ASSERT_EQUAL_FATAL(0, ret);
+    assert(0 == socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+
+    // nothing to receive
+    sqe = uring_get_sqe(&ring);
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fds[0];
+    sqe->addr = (uint64_t) (uintptr_t) buf;
+    sqe->len = sizeof(buf);
+
+    CU_ASSERT_EQUAL_FATAL(0, uring_enter(&ring, 1, 10));
+    CU_ASSERT_PTR_NULL_FATAL(uring_peek_cqe(&ring));
+
+    // completes the receive
+    close(fds[1]);
+    CU_ASSERT_EQUAL_FATAL(0, uring_enter(&ring, 1, 1000));
+    CU_ASSERT_PTR_NOT_NULL_FATAL(uring_peek_cqe(&ring));
+    CU_ASSERT_EQUAL_FATAL(0, uring_peek_cqe(&ring)->res);
+    uring_cqe_seen(&ring);
+
+    close(fds[0]);
+    uring_destroy(&ring);
+}
+
+void uring_test_suite() {
+    CU_pSuite uringSuite = CU_add_suite("uring", NULL, NULL);
+    CU_add_test(uringSuite, "test_uring_nop", test_uring_nop);
+    CU_add_test(uringSuite, "test_uring_full", test_uring_full);
+    CU_add_test(uringSuite, "test_uring_timeout", test_uring_timeout);
+}
@@ -0,0 +1,241 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "../src/stomp.h"
+#include "../src/binary.h"
+
+/* compares the text framing with the binary one (see
+ * binary.h) by the bytes per frame and the time it takes
+ * to parse a SEND, with the topic named or referred to by
+ * its id, and to encode a MESSAGE, as a whole or after the
+ * part all MESSAGEs of a topic start with. the frames have
+ * a few headers and a content of the size asked for.
+ *
+ * the parsers terminate the parts of the frame in place,
+ * so each round parses a fresh copy. the time it takes to
+ * copy it is measured on its own and taken off.
+ */
+
+#define DEFAULT_ROUNDS 1000000
+#define DEFAULT_CONTENT 64
+
+#define TOPIC "market.stocks.nasdaq"
+#define TOPIC_ID 42
+
+static double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* returns the nanoseconds per round to copy the frame
+ * and, if parse is set, to parse it */
+static double measure_parse(const char *frame, char *work, size_t len,
+        long rounds, int (*parse)(char *, size_t, struct stomp_command *)) {
+    long i;
+    double start;
+    struct stomp_command cmd;
+
+    start = now_ns();
+    for (i = 0; i < rounds; i++) {
+        memcpy(work, frame, len);
+        if (parse != NULL && parse(work, len, &cmd) != 0) {
+            fprintf(stderr, "Failed to parse\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    return (now_ns() - start) / rounds;
+}
+
+/* returns the nanoseconds per round to encode the command */
+static double measure_create(const struct stomp_command *cmd, long rounds,
+        int (*create)(const struct stomp_command *, char **, size_t *)) {
+    long i;
+    double start;
+    char *str;
+    size_t len;
+
+    start = now_ns();
+    for (i = 0; i < rounds; i++) {
+        if (create(cmd, &str, &len) != 0) {
+            fprintf(stderr, "Failed to encode\n");
+            exit(EXIT_FAILURE);
+        }
+        free(str);
+    }
+
+    return (now_ns() - start) / rounds;
+}
+
+/* the same for a frame that starts with the prefix */
+static double measure_create_prefixed(const struct stomp_command *cmd,
+        const char *prefix, size_t prefixlen, long rounds) {
+    long i;
+    double start;
+    char *str;
+    size_t len;
+
+    start = now_ns();
+    for (i = 0; i < rounds; i++) {
+        if (create_command_prefixed(cmd, prefix, prefixlen, &str,
+                &len) != 0) {
+            fprintf(stderr, "Failed to encode\n");
+            exit(EXIT_FAILURE);
+        }
+        free(str);
+    }
+
+    return (now_ns() - start) / rounds;
+}
+
+static void report(const char *what, size_t len, double ns) {
+    printf("%-26s %6zu bytes %8.1fns/frame\n", what, len, ns);
+}
+
+static void run_send(char *content, size_t contentlen, long rounds) {
+    struct stomp_header headers[4] = {
+        { "topic", TOPIC }, { "content-type", "application/json" },
+        { "receipt", "1234" }, { "x-trace", "5f1c9a2e" }
+    };
+    struct stomp_command cmd;
+    char *text, *bin, *work;
+    size_t textlen, binlen;
+    double copy;
+
+    // SEND, as the broker gets it
+    text = malloc(contentlen + 256);
+    work = malloc(contentlen + 256);
+    if (text == NULL || work == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    textlen = sprintf(text, "SEND\ntopic:%s\ncontent-type:%s\n"
+        "receipt:%s\nx-trace:%s\ncontent-length:%zu\n\n", TOPIC,
+        headers[1].val, headers[2].val, headers[3].val, contentlen);
+    memcpy(text + textlen, content, contentlen);
+    textlen += contentlen;
+    text[textlen++] = '\0';
+
+    copy = measure_parse(text, work, textlen, rounds, NULL);
+    measure_parse(text, work, textlen, rounds / 10, parse_frame);
+    report("SEND text", textlen,
+        measure_parse(text, work, textlen, rounds, parse_frame) - copy);
+
+    cmd.name = "SEND";
+    cmd.headers = headers;
+    cmd.nheaders = 4;
+    cmd.content = content;
+    cmd.contentlen = contentlen;
+    cmd.topicid = 0;
+
+    if (binary_create(&cmd, &bin, &binlen) != 0) exit(EXIT_FAILURE);
+    copy = measure_parse(bin, work, binlen, rounds, NULL);
+    measure_parse(bin, work, binlen, rounds / 10, binary_parse);
+    report("SEND binary, topic name", binlen,
+        measure_parse(bin, work, binlen, rounds, binary_parse) - copy);
+    free(bin);
+
+    cmd.topicid = TOPIC_ID;
+    if (binary_create(&cmd, &bin, &binlen) != 0) exit(EXIT_FAILURE);
+    copy = measure_parse(bin, work, binlen, rounds, NULL);
+    measure_parse(bin, work, binlen, rounds / 10, binary_parse);
+    report("SEND binary, topic id", binlen,
+        measure_parse(bin, work, binlen, rounds, binary_parse) - copy);
+    free(bin);
+
+    free(text);
+    free(work);
+}
+
+static void run_message(char *content, size_t contentlen, long rounds) {
+    struct stomp_header headers[4] = {
+        { "destination", TOPIC }, { "message-id", "1234567" },
+        { "content-type", "application/json" }, { "x-trace", "5f1c9a2e" }
+    };
+    struct stomp_command cmd;
+    char *str, *prefix;
+    size_t len, prefixlen;
+
+    cmd.name = "MESSAGE";
+    cmd.headers = headers;
+    cmd.nheaders = 4;
+    cmd.content = content;
+    cmd.contentlen = contentlen;
+    cmd.topicid = TOPIC_ID;
+
+    if (create_command(&cmd, &str, &len) != 0) exit(EXIT_FAILURE);
+    free(str);
+    measure_create(&cmd, rounds / 10, create_command);
+    report("MESSAGE text", len,
+        measure_create(&cmd, rounds, create_command));
+
+    // the destination is encoded once per topic
+    cmd.nheaders = 1;
+    if (stomp_create_prefix(&cmd, &prefix, &prefixlen) != 0)
+        exit(EXIT_FAILURE);
+    cmd.headers++;
+    cmd.nheaders = 3;
+    measure_create_prefixed(&cmd, prefix, prefixlen, rounds / 10);
+    report("MESSAGE text, prefixed", len,
+        measure_create_prefixed(&cmd, prefix, prefixlen, rounds));
+    cmd.headers--;
+    cmd.nheaders = 4;
+    free(prefix);
+
+    if (binary_create(&cmd, &str, &len) != 0) exit(EXIT_FAILURE);
+    free(str);
+    measure_create(&cmd, rounds / 10, binary_create);
+    report("MESSAGE binary", len,
+        measure_create(&cmd, rounds, binary_create));
+}
+
+static void usage(char *prog) {
+    fprintf(stderr, "usage: %s [-n rounds] [-c bytes]\n", prog);
+    fprintf(stderr, "\trounds: frames per measurement (default %d)\n",
+        DEFAULT_ROUNDS);
+    fprintf(stderr, "\tbytes: content per frame (default %d)\n",
+        DEFAULT_CONTENT);
+}
+
+int main(int argc, char **argv) {
+    int opt;
+    long rounds = DEFAULT_ROUNDS;
+    long contentlen = DEFAULT_CONTENT;
+    char *content;
+
+    while ((opt = getopt(argc, argv, "n:c:h")) != -1) {
+        switch (opt) {
+            case 'n':
+                rounds = atol(optarg);
+                break;
+            case 'c':
+                contentlen = atol(optarg);
+                break;
+            default:
+                usage(argv[0]);
+                exit(opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+    }
+
+    if (rounds < 10 || contentlen < 1) {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    content = malloc(contentlen);
+    if (content == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    memset(content, 'c', contentlen);
+
+    run_send(content, contentlen, rounds);
+    run_message(content, contentlen, rounds);
+
+    free(content);
+    return EXIT_SUCCESS;
+}